@@ -46,6 +46,8 @@ namespace Config {
             void SetFitExt(double fit_ext);
             void ToggleScaleMapFit(bool scale_map_fit);
             void SetMapFitScale(double map_fit_scale);
+            void ToggleMapFitPlanar(bool map_fit_planar);
+            void SetMapFitPlanarTolerance(double map_fit_planar_tolerance);
             void SetHeadingGroups(uint32_t heading_groups);
             void SetMinEdgeTripPoints(uint32_t min_edge_trip_points);
             void SetTAMaxQSize(uint32_t ta_max_q_size);
@@ -64,7 +66,10 @@ namespace Config {
             void SetRandDirectDistance(double rand_direct_distance);
             void SetRandManhattanDistance(double rand_manhattan_distance);
             void SetRandOutDegree(double rand_out_degree);
+            void SetRandSeed(uint64_t rand_seed);
             void TogglePlotKML(bool plot_kml);
+            void SetECSampleSize(uint32_t ec_sample_size);
+            void ToggleECSlidingWindow(bool ec_sliding_window);
             double GetQuadSWLat(void) const;
             double GetQuadSWLng(void) const;
             double GetQuadNELat(void) const;
@@ -78,6 +83,8 @@ namespace Config {
             double GetFitExt(void) const;
             bool IsScaleMapFit(void) const;
             double GetMapFitScale(void) const;
+            bool IsMapFitPlanar(void) const;
+            double GetMapFitPlanarTolerance(void) const;
             uint32_t GetHeadingGroups(void) const;
             uint32_t GetMinEdgeTripPoints(void) const;
             uint32_t GetTAMaxQSize(void) const;
@@ -96,7 +103,11 @@ namespace Config {
             double GetRandDirectDistance(void) const;
             double GetRandManhattanDistance(void) const;
             double GetRandOutDegree(void) const;
+            uint64_t GetRandSeed(void) const;
+            bool IsRandSeedSet(void) const;
             bool IsPlotKML(void) const;
+            uint32_t GetECSampleSize(void) const;
+            bool IsECSlidingWindow(void) const;
 
             /**
              * \brief Print out the current configuration values to an output stream.
@@ -130,6 +141,16 @@ namespace Config {
              * \return a shared pointer to the configuration instance.
              */
             static DIConfig::Ptr ConfigFromStream(std::istream& stream);
+
+            /**
+             * \brief Overwrite the configuration values given in the specified input stream; the parameters that are not
+             * in the stream keep their current values (e.g., to apply the overrides of one job to a base configuration).
+             *
+             * The stream has the format read by ConfigFromStream.
+             *
+             * \param stream an input stream containing key value pairs of parameters.
+             */
+            void Update(std::istream& stream);
             
         private:
             // These settings are based on Ann Arbor Safety Pilot data headers.
@@ -150,6 +171,8 @@ namespace Config {
             double fit_ext_                     = 5.0;          // meters.
             bool scale_map_fit_                 = false;        // do not scale boxes based on road type.
             double map_fit_scale_               = 1;
+            bool map_fit_planar_                = false;        // test fit areas in lat/lon by default.
+            double map_fit_planar_tolerance_    = 0.0;          // meters.
             uint32_t n_heading_groups_          = 36;           // 10 degree sectors.
             uint32_t min_edge_trip_points_      = 50;
 
@@ -173,6 +196,11 @@ namespace Config {
             double rand_direct_distance_        = 0.0;
             double rand_manhattan_distance_     = 0.0;
             double rand_out_degree_             = 0.0;
+            uint64_t rand_seed_                 = 0;            // combined with each trip UID to seed its thresholds.
+            bool rand_seed_set_                 = false;        // a random run seed is drawn unless rand_seed is set.
+
+            uint32_t ec_sample_size_            = 50;           // points examined by the error corrector.
+            bool ec_sliding_window_             = false;        // only examine the ends of the trip by default.
     };
 }
 
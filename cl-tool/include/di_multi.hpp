@@ -3,11 +3,88 @@
 
 #include "config.hpp"
 #include "cvlib.hpp"
+#include "journal.hpp"
+#include "manifest.hpp"
 #include "multi_thread.hpp"
 
+#include <deque>
+
 namespace DIMulti {
     using IFSTPtr = std::shared_ptr<std::ifstream>;
 
+    const std::size_t kDefaultTileMemory = std::size_t(256) << 20;    ///< the bytes of map tiles kept loaded by default.
+
+    /**
+     * \brief Load the road network and compile its quad tree.
+     *
+     * A binary map snapshot is read directly. Otherwise, the file is parsed as a CSV shape file and the quad tree is
+     * built using the bounds in the configuration.
+     *
+     * \param quad_file_path the CSV shape file or binary map snapshot.
+     * \param config the configuration providing the quad tree bounds.
+     * \param edges filled with the edges of the road network.
+     * \param quad_ptr set to the compiled quad tree.
+     *
+     * \throws invalid_argument if the file cannot be read.
+     */
+    void LoadMap(const std::string& quad_file_path, const Config::DIConfig& config, std::vector<geo::EdgeCPtr>& edges, FlatQuad::CPtr& quad_ptr);
+
+    /**
+     * \brief The road network used to de-identify trips: a compiled quad tree with its fit areas, or a tiled map. It is
+     * loaded once and can be shared by many runs, e.g., the jobs of a Service.
+     */
+    class ResidentMap {
+        public:
+            using CPtr = std::shared_ptr<const ResidentMap>;
+
+            /**
+             * \brief Load a map (see LoadMap); a tiled map directory is opened instead and its tiles load on demand.
+             *
+             * \param quad_file_path the CSV shape file, binary map snapshot or tiled map directory.
+             * \param config the configuration providing the quad tree bounds and the fit area parameters.
+             * \param tile_memory the bytes of map tiles kept loaded.
+             *
+             * \throws invalid_argument if the map cannot be read.
+             */
+            ResidentMap(const std::string& quad_file_path, const Config::DIConfig& config, std::size_t tile_memory=kDefaultTileMemory);
+
+            /**
+             * \brief Load the regional maps of a comma separated list of map paths, e.g., one snapshot per region.
+             *
+             * \throws invalid_argument if the list is empty or a map cannot be read.
+             */
+            static std::vector<CPtr> LoadAll(const std::string& quad_file_paths, const Config::DIConfig& config, std::size_t tile_memory=kDefaultTileMemory);
+
+            /**
+             * \brief Load one copy of the maps (see LoadAll) for each NUMA node the first n_threads pinned threads run
+             * on. Each copy is loaded by a thread pinned to its node, so its pages are first touched, and placed, there;
+             * the copies are loaded in parallel. Every copy of a tiled map keeps tile_memory bytes of tiles.
+             *
+             * \return the maps of each node, indexed by node; empty for the nodes no thread runs on.
+             * \throws invalid_argument if a map cannot be read.
+             */
+            static std::vector<std::vector<CPtr>> LoadReplicas(const std::string& quad_file_paths, const Config::DIConfig& config, std::size_t tile_memory, const MultiThread::Topology& topology, unsigned n_threads);
+
+            /**
+             * \brief Return the maps of the lowest node that has a copy (see LoadReplicas), e.g., to serve as the shared
+             * maps of a run.
+             *
+             * \throws invalid_argument if no node has a copy.
+             */
+            static const std::vector<CPtr>& FirstReplica(const std::vector<std::vector<CPtr>>& node_maps);
+
+            /**
+             * \brief Return the map context for the given fit area parameters; the fit areas (or the tiled map) are only
+             * built again when the parameters differ from those of the loading configuration.
+             */
+            MapContext::CPtr GetContext(double fit_width_scaling, double fit_extension) const;
+
+        private:
+            std::string quad_file_path_;
+            std::size_t tile_memory_;
+            MapContext::CPtr context_;                          ///< the context of the loading configuration.
+    };
+
     /**
      * \brief An abstract base class containing information about a file containing one or more trips.
      */
@@ -39,6 +116,26 @@ namespace DIMulti {
             uint64_t size_;
     };
 
+    /**
+     * \brief A class representing one trip in a file containing many trips: the byte range of its records in the
+     * mapped file. Size is used to distribute work across threads.
+     */
+    class TripRangeInfo : public FileInfo {
+        public:
+            using Ptr = std::shared_ptr<TripRangeInfo>;
+
+            TripRangeInfo(const std::string& file_path, const MappedFile::CPtr& file, const trip_index::TripRange& range);
+
+            const std::string GetFilePath(void) const;
+            uint64_t GetSize(void) const;
+            const MappedFile::CPtr& GetFile(void) const;
+            const trip_index::TripRange& GetRange(void) const;
+        private:
+            std::string file_path_;
+            MappedFile::CPtr file_;
+            trip_index::TripRange range_;
+    };
+
     /**
      * \brief A class that processes files containing trips in parallel.
      */
@@ -86,26 +183,238 @@ namespace DIMulti {
         public:
             SingleBatchCSV(const std::string& file_path);
             virtual void Thread(unsigned thread_num, MultiThread::SharedQueue<FileInfo::Ptr>* q) = 0;
+            void Init(unsigned n_used_threads);
+
+            /**
+             * \brief Treat every listed file as a CSV file holding many trips. Each file is mapped and its trip
+             * boundaries are found in parallel; the trips are then handed out as TripRangeInfo items. The boundaries
+             * are saved beside each file (see trip_index::write_index) and reused while the file is unchanged.
+             *
+             * \param uid_fields the delimiter separated names of the fields that make up a trip UID.
+             * \param lat_field the name of the latitude field, used for the saved trip bounding boxes.
+             * \param lon_field the name of the longitude field, used for the saved trip bounding boxes.
+             */
+            void SetMultiTrip(const std::string& uid_fields, const std::string& lat_field, const std::string& lon_field);
+
+            /**
+             * \brief Only hand out the work items of one node of several; each item is assigned by the hash of its key
+             * (see ItemKey), so every node finds the same partition of the batch file.
+             *
+             * \param node_index the node of this run, less than n_nodes.
+             * \param n_nodes the number of nodes sharing the batch file.
+             *
+             * \throws invalid_argument if node_index is not less than n_nodes.
+             */
+            void SetPartition(unsigned node_index, unsigned n_nodes);
+
+            /**
+             * \brief Skip the work items already recorded in a completion journal.
+             */
+            void SetJournal(const Journal::Ptr& journal);
+
+            /**
+             * \brief Open the listed trip files for their sizes on several threads (see ManifestScanner) while the items
+             * are handed out, instead of one after another on the thread that hands them out. The items keep the order
+             * of the batch file. The files of a multi-trip batch are not scanned.
+             *
+             * \param n_scan_threads the scan threads; 1 scans each file when its item is needed.
+             *
+             * \throws invalid_argument if n_scan_threads is 0.
+             */
+            void SetScanThreads(unsigned n_scan_threads);
+
+            /**
+             * \brief Write a copy of the batch file with the size of each trip file (see ManifestEntry); a run on the
+             * copy does not open the files for their sizes. Every line of the batch file is written, whether or not
+             * its item belongs to this run.
+             *
+             * \param size_cache_path the copy to write.
+             *
+             * \throws invalid_argument if the copy cannot be opened.
+             */
+            void SetSizeCache(const std::string& size_cache_path);
+
+            /**
+             * \brief Return the key of a work item: the trip file path, or path:UID for a trip of a multi-trip file.
+             */
+            static std::string ItemKey(const FileInfo& item);
             FileInfo::Ptr NextItem(void);
+
+            /**
+             * \brief Close the batch file and the size cache.
+             */
+            void Close(void);
+        protected:
+            const Journal::Ptr& GetJournal(void) const;
+        private:
+            bool multi_trip_;
+            std::string uid_fields_;
+            std::string lat_field_;
+            std::string lon_field_;
+            unsigned n_index_threads_;                          ///< the threads that index a multi-trip file.
+            std::deque<FileInfo::Ptr> pending_;                 ///< the indexed trips not yet handed out.
+            unsigned node_index_;
+            unsigned n_nodes_;                                  ///< the nodes sharing the batch file; 1 for all items.
+            Journal::Ptr journal_;                              ///< the finished items to skip; nullptr for none.
+            unsigned n_scan_threads_;                           ///< the threads that scan the trip files for their sizes.
+            std::unique_ptr<ManifestScanner> scanner_;          ///< the scan of the batch file; nullptr when not started.
+            std::shared_ptr<std::ofstream> size_cache_;         ///< the batch file copy with sizes; nullptr for none.
+
+            /**
+             * \brief Return the next work item of the batch file, whether or not it belongs to this run.
+             */
+            FileInfo::Ptr NextCandidate(void);
+
+            /**
+             * \brief Read the next entry of the batch file; the trip file is scanned unless this is a multi-trip batch.
+             *
+             * \return false when the batch file has no more entries.
+             */
+            bool NextEntry(ManifestEntry& entry);
+
+            /**
+             * \brief Map a multi-trip file and queue its trips in pending_, reading them from the saved trip index when
+             * it is still valid and saving a new one otherwise.
+             *
+             * \throws invalid_argument if the file cannot be read, has no header or lacks the UID fields.
+             */
+            void IndexFile(const std::string& file_path);
     };
 
     class DICSV : public SingleBatchCSV
     {
         public:
-            DICSV(const std::string& file_path, const std::string& quad_file_path, const std::string& out_dir_path, const std::string& config_file_path, const std::string& kml_dir_path, bool count_points=false);
+            DICSV(const std::string& file_path, const std::string& quad_file_path, const std::string& out_dir_path, const std::string& config_file_path, const std::string& kml_dir_path, bool count_points=false, bool mapped_input=false, bool time_stages=false, bool staged=false, bool async_write=false, unsigned n_shards=0, bool multi_trip=false, std::size_t tile_memory=kDefaultTileMemory);
+
+            /**
+             * \brief Construct a run over already loaded maps and configuration.
+             *
+             * \param maps the road networks of the regions; each trip is de-identified against the one its bounding box
+             * falls in (see MapContext::route). The quad bounds of config_ptr are not used.
+             * \param config_ptr the configuration of this run.
+             */
+            DICSV(const std::string& file_path, const std::vector<ResidentMap::CPtr>& maps, const std::string& out_dir_path, const Config::DIConfig::Ptr& config_ptr, const std::string& kml_dir_path, bool count_points=false, bool mapped_input=false, bool time_stages=false, bool staged=false, bool async_write=false, unsigned n_shards=0, bool multi_trip=false);
+
+            /**
+             * \brief Write the de-identified trips as columnar files (see columnar.hpp) instead of CSV files.
+             */
+            void SetColumnarOutput(bool columnar_output);
+
+            /**
+             * \brief Compress the de-identified CSV trip files; the file names end with the extension of the format.
+             *
+             * \throws invalid_argument if the format is not supported by this build.
+             */
+            void SetOutputCompression(compression::Format format);
+
+            /**
+             * \brief Let each thread de-identify its trips against the copy of the maps on its NUMA node (see
+             * ResidentMap::LoadReplicas and Parallel::SetPlacement) instead of the shared maps.
+             *
+             * \param node_maps the maps of each node, in the order of the shared maps; a node without maps uses the
+             * shared maps.
+             * \throws invalid_argument if a node has a different number of maps than the shared maps.
+             */
+            void SetMapReplicas(const std::vector<std::vector<ResidentMap::CPtr>>& node_maps);
+
+            /**
+             * \brief Record a timeline of each thread (a span per trip, per pipeline stage and per wait for a trip) and
+             * write it at Close as a Chrome trace-event JSON file.
+             *
+             * \param trace_path the trace file; empty for no trace.
+             */
+            void SetTracePath(const std::string& trace_path);
+
+            /**
+             * \brief Map fit each long trip in segments of at least segment_points points on as many threads as the
+             * host has CPUs (see PointPipeline::run); the result is the same as fitting the trip in one pass. Trips
+             * are fit in one pass when KML output is on.
+             *
+             * \param segment_points the fewest points of a segment; 0 never splits a trip.
+             */
+            void SetTripSegments(std::size_t segment_points);
+
+            /**
+             * \brief Suppress the points of every trip that fall in a suppression zone (see geofence::ZoneIndex); the
+             * runs of points in a zone are critical intervals, so the privacy intervals are found around them.
+             *
+             * \param zones the zones, shared by all the threads; nullptr for none.
+             */
+            void SetGeofence(const geofence::ZoneIndex::CPtr& zones);
             void Init(unsigned n_used_threads);
             void Close(void);
             void Thread(unsigned thread_num, MultiThread::SharedQueue<FileInfo::Ptr>* q);
         private:
             Config::DIConfig::Ptr config_ptr_;
+            uint64_t run_seed_;                                 ///< combined with each trip UID to seed its privacy thresholds.
             std::string out_dir_path_;
             std::string kml_dir_path_;
             bool count_points_;
-            Quad::Ptr quad_ptr_;
+            bool mapped_input_;                                 ///< read trip files through a memory mapping.
+            std::vector<ResidentMap::CPtr> maps_;
+            std::vector<MapContext::CPtr> contexts_;            ///< the map contexts of this configuration, one per map.
+            std::vector<std::vector<MapContext::CPtr>> node_contexts_;  ///< the map contexts of each NUMA node's replica.
             std::vector<std::shared_ptr<instrument::PointCounter>> counters_;
+            std::vector<std::vector<Journal::Entry>> unjournaled_;  ///< per thread, the finished trips still in the async writer.
+            bool time_stages_;                                  ///< collect and print per-stage timing.
+            std::vector<std::shared_ptr<instrument::StageTimer>> timers_;
+            bool staged_;                                       ///< run the point-local stages as separate passes.
+            bool async_write_;                                  ///< write the output in blocks on an I/O thread.
+            unsigned n_shards_;                                 ///< the number of output shard files; 0 for a file per trip.
+            output::AsyncWriter::Ptr async_writer_;
+            bool columnar_output_;                              ///< write columnar trip files instead of CSV files.
+            compression::Format output_compression_;            ///< the format the CSV trip files are compressed in.
+            std::string trace_path_;                            ///< the trace file; empty for no trace.
+            std::vector<instrument::TraceBuffer::Ptr> traces_;  ///< the timeline of each thread when tracing.
+            std::size_t segment_points_;                        ///< the fewest points of a map fit segment; 0 for none.
+            geofence::ZoneIndex::CPtr zones_;                   ///< the suppression zones; nullptr for none.
+
+            /**
+             * \brief Print the configuration and take the map contexts this configuration uses.
+             */
+            void SetUp(bool multi_trip);
+
+            /**
+             * \brief Return the map contexts a thread uses: those of its node's replica, or the shared ones.
+             */
+            const std::vector<MapContext::CPtr>& ThreadContexts(unsigned thread_num) const;
+
+            /**
+             * \brief Return the map context, one of contexts, a trip is de-identified against.
+             */
+            const MapContext& RouteTrip(const trajectory::Trajectory& traj, const std::vector<MapContext::CPtr>& contexts) const;
+
+            /**
+             * \brief Make the map fitter of a trip for the quad tree or the tiled map of its map context.
+             */
+            MapFitter MakeMapFitter(const MapContext& context) const;
+
+            /**
+             * \brief Return the number of segments a trip of n_points points is map fit in; 1 for a single pass.
+             */
+            unsigned SegmentCount(std::size_t n_points) const;
+
+            void AnalyzePoints(trajectory::Trajectory& traj, MapFitter& mf, ImplicitMapFitter& imf, IntersectionCounter& ic, Detector::TurnAround& tad, Detector::Stop& stop_detector, instrument::StageClock& stage_clock) const;
 
-            trajectory::Trajectory DeIdentify(trajectory::Trajectory& traj, const std::string& uid) const;
-            trajectory::Trajectory DeIdentify(trajectory::Trajectory& traj, const std::string& uid, instrument::PointCounter& point_counter) const;
+            /**
+             * \brief Parse the trip of a work item: a trip file or a range of a multi-trip file.
+             *
+             * \param uid set to the trip UID.
+             * \param point_counter counts the points: a PointCounter, or a NullCounter when they are not counted.
+             */
+            template <typename Counter>
+            trajectory::Trajectory MakeTrajectory(const FileInfo& item, std::string& uid, Counter& point_counter) const;
+
+            template <typename Counter>
+            void DeIdentify(trajectory::Trajectory& traj, const std::string& uid, const std::vector<MapContext::CPtr>& contexts, trajectory::PointSinkFactory& traj_writer, PrivacyIntervalFinder::RandomEngine& rand_engine, Counter& point_counter, instrument::StageClock& stage_clock) const;
+
+            /**
+             * \brief Parse and de-identify the trip of a work item; the one code path of counted and uncounted runs.
+             *
+             * \throws the exceptions of MakeTrajectory and DeIdentify.
+             */
+            template <typename Counter>
+            void ProcessTrip(const FileInfo& item, std::string& uid, trajectory::Trajectory& traj, const std::vector<MapContext::CPtr>& contexts, trajectory::PointSinkFactory& traj_writer, PrivacyIntervalFinder::RandomEngine& rand_engine, Counter& point_counter, instrument::StageClock& stage_clock) const;
     };
 }
 
@@ -0,0 +1,118 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include "cvlib.hpp"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace DIMulti {
+    /**
+     * \brief Return the 64-bit FNV-1a hash of a key; it is the same on every node and every run.
+     */
+    uint64_t HashKey(const std::string& key);
+
+    /**
+     * \brief Return true if the work item with this key belongs to node node_index of n_nodes.
+     */
+    bool InPartition(const std::string& key, unsigned node_index, unsigned n_nodes);
+
+    /**
+     * \brief An append-only record of the trips a node has finished, used to skip them when the node is restarted.
+     *
+     * Each line holds the fields of one entry separated by tabs: the work item key, the trip UID, the output path and
+     * the point counts (as printed for the point summary). A line is appended and flushed as soon as its trip is done,
+     * so a node that is stopped loses at most the line being written; a partial last line is cut off when the journal
+     * is opened again.
+     */
+    class Journal {
+        public:
+            using Ptr = std::shared_ptr<Journal>;
+
+            struct Entry {
+                std::string key;                                ///< the work item: the trip file path, or path:UID for a trip of a multi-trip file.
+                std::string uid;                                ///< the trip UID.
+                std::string out_path;                           ///< the file the de-identified trip was written to.
+                instrument::PointCounter counter;               ///< the point counts of the trip.
+            };
+
+            /**
+             * \brief Open a journal, reading the entries of earlier runs; the file is created when it does not exist.
+             *
+             * \throws invalid_argument if the file cannot be opened for appending.
+             */
+            Journal(const std::string& file_path);
+
+            /**
+             * \brief Return true if the work item was finished by this or an earlier run.
+             */
+            bool IsDone(const std::string& key) const;
+
+            /**
+             * \brief Append an entry and flush it to the file; safe to call from the work threads.
+             *
+             * \throws invalid_argument if the entry cannot be written.
+             */
+            void Record(const Entry& entry);
+
+            /**
+             * \brief Return the number of entries read when the journal was opened.
+             */
+            std::size_t GetResumedCount(void) const;
+
+            /**
+             * \brief Return the number of entries recorded since the journal was opened.
+             */
+            std::size_t GetRecordedCount(void) const;
+
+            /**
+             * \brief Parse a journal line.
+             *
+             * \return false if the line is not a complete entry.
+             */
+            static bool ParseEntry(const std::string& line, Entry& entry);
+
+            /**
+             * \brief Sum the point counts of the entries in the journals of several nodes. An item found in more than
+             * one journal (e.g., after re-running with a different node count) is counted once.
+             *
+             * \param journal_paths the journal files.
+             * \param n_trips set to the number of distinct items.
+             *
+             * \throws invalid_argument if a journal cannot be read.
+             */
+            static instrument::PointCounter Merge(const std::vector<std::string>& journal_paths, std::size_t& n_trips);
+
+        private:
+            std::ofstream file_;
+            mutable std::mutex mutex_;
+            std::unordered_set<std::string> done_;
+            std::size_t n_resumed_;
+            std::size_t n_recorded_;
+    };
+}
+
+#endif
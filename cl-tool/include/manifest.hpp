@@ -0,0 +1,119 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef MANIFEST_HPP
+#define MANIFEST_HPP
+
+#include "cvlib.hpp"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace DIMulti {
+    /**
+     * \brief One line of a batch file: the trip file path, optionally followed by a ':' and the auxiliary data of the
+     * trip and by another ':' and the size hint of the file (see compression::size_hint), e.g., trip.csv::20480 for a
+     * trip without auxiliary data. A given size is trusted, so the file is not opened until a thread reads the trip.
+     */
+    struct ManifestEntry {
+        std::string file_path;
+        std::string aux_data;
+        bool has_aux = false;                                   ///< the line has an auxiliary data field, maybe empty.
+        bool has_size = false;                                  ///< the size was given in the line or found by a scan.
+        uint64_t size = 0;                                      ///< the size hint used to balance the threads.
+        std::string error;                                      ///< why the file could not be scanned; empty on success.
+    };
+
+    /**
+     * \brief Parse a batch file line into an entry; a size field that is not a number is ignored.
+     *
+     * \return false if the line holds no trip file path.
+     */
+    bool ParseManifestLine(const std::string& line, ManifestEntry& entry);
+
+    /**
+     * \brief Open the trip file of an entry without a size and read its size hint; sets the error of the entry when the
+     * file cannot be opened.
+     */
+    void ScanManifestEntry(ManifestEntry& entry);
+
+    /**
+     * \brief Return the batch file line of an entry with its size, so a later run does not open the file; an entry
+     * without a size (e.g., its file could not be opened) is written as it was read.
+     */
+    std::string FormatManifestLine(const ManifestEntry& entry);
+
+    /**
+     * \brief Scan the trip files of a batch file on several threads ahead of the reader. The lines are read in order by
+     * whichever thread is free, each thread opens its own files (on a network file system the time of a scan is mostly
+     * the latency of opening the file), and Next returns the entries in the order of the batch file as soon as each
+     * one and those before it are scanned. At most read_ahead entries are scanned beyond the last one returned.
+     */
+    class ManifestScanner {
+        public:
+            static const std::size_t kDefaultReadAhead = 4096;  ///< the entries scanned ahead of the reader by default.
+
+            /**
+             * \brief Start scanning the rest of a batch file.
+             *
+             * \param file the batch file; it is read only by the scan threads until the scan is done.
+             * \param n_threads the scan threads.
+             * \param read_ahead the most entries scanned and not yet returned.
+             *
+             * \throws invalid_argument if n_threads or read_ahead is 0.
+             */
+            ManifestScanner(const IFSPtr& file, unsigned n_threads, std::size_t read_ahead=kDefaultReadAhead);
+
+            /**
+             * \brief Stop scanning and wait for the scan threads.
+             */
+            ~ManifestScanner(void);
+
+            ManifestScanner(const ManifestScanner&) = delete;
+            ManifestScanner& operator=(const ManifestScanner&) = delete;
+
+            /**
+             * \brief Wait for the next entry of the batch file; the lines without a trip file are skipped.
+             *
+             * \return false when the batch file has no more entries.
+             */
+            bool Next(ManifestEntry& entry);
+
+        private:
+            IFSPtr file_;
+            std::size_t read_ahead_;
+            std::mutex mutex_;
+            std::condition_variable scanned_cond_;              ///< an entry was scanned or the batch file ended.
+            std::condition_variable space_cond_;                ///< an entry was returned or the scan was stopped.
+            std::map<uint64_t, ManifestEntry> scanned_;         ///< the scanned lines not yet returned, by line number; an empty path for a line without a trip file.
+            uint64_t n_read_;                                   ///< the lines taken by the scan threads.
+            uint64_t n_returned_;                               ///< the lines returned or skipped by Next.
+            bool end_;                                          ///< the batch file has no more lines.
+            bool stop_;
+            std::vector<std::thread> threads_;
+
+            void Scan(void);
+    };
+}
+
+#endif
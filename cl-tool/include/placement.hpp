@@ -0,0 +1,92 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MultiThread {
+    /**
+     * \brief The CPUs of each NUMA node this process may run on.
+     *
+     * On Linux the nodes are read from /sys/devices/system/node and limited to the CPU affinity of the process (e.g.,
+     * set by taskset or a container); elsewhere, or when the nodes cannot be read, there is one node holding every CPU.
+     * Worker threads are spread over the nodes round robin: thread i runs on node i % NodeCount().
+     */
+    class Topology {
+        public:
+            using CPtr = std::shared_ptr<const Topology>;
+
+            /**
+             * \brief Read the topology of this host.
+             */
+            static CPtr Detect(void);
+
+            /**
+             * \brief Construct a topology from the CPUs of each node; nodes without CPUs are dropped.
+             *
+             * \throws invalid_argument if no node has a CPU.
+             */
+            explicit Topology(const std::vector<std::vector<unsigned>>& node_cpus);
+
+            unsigned NodeCount(void) const;
+
+            /**
+             * \brief Return the CPUs of a node.
+             */
+            const std::vector<unsigned>& NodeCpus(unsigned node) const;
+
+            /**
+             * \brief Return the node a worker thread runs on.
+             */
+            unsigned ThreadNode(unsigned thread_number) const;
+
+            /**
+             * \brief Return the CPU a worker thread is pinned to: the threads of a node take its CPUs in turn.
+             */
+            unsigned ThreadCpu(unsigned thread_number) const;
+
+            /**
+             * \brief Return the nodes the first n_threads worker threads run on, in increasing order.
+             */
+            std::vector<unsigned> UsedNodes(unsigned n_threads) const;
+
+        private:
+            std::vector<std::vector<unsigned>> node_cpus_;
+    };
+
+    /**
+     * \brief Parse a Linux CPU list, e.g., 0-3,8,10-11.
+     *
+     * \throws invalid_argument if the list is malformed.
+     */
+    std::vector<unsigned> ParseCpuList(const std::string& cpu_list);
+
+    /**
+     * \brief Restrict the calling thread to a set of CPUs; threads it starts afterwards inherit the set on Linux.
+     *
+     * \return false if the platform does not support it or the call fails; the thread then runs anywhere.
+     */
+    bool PinCurrentThread(const std::vector<unsigned>& cpus);
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef SERVICE_HPP
+#define SERVICE_HPP
+
+#include "config.hpp"
+#include "di_multi.hpp"
+#include "multi_thread.hpp"
+
+#include <iostream>
+#include <string>
+
+namespace DIMulti {
+    /**
+     * \brief The command line settings every job of a Service runs with.
+     */
+    struct RunOptions {
+        unsigned n_threads = 1;
+        bool autotune = false;                                                  ///< tune the number of active threads.
+        MultiThread::Schedule schedule = MultiThread::Schedule::kLeastLoaded;
+        MultiThread::QueueBackend backend = MultiThread::QueueBackend::kLocked;
+        std::size_t high_water_mark = 0;
+        std::string kml_dir_path;
+        bool count_points = false;
+        bool mapped_input = false;
+        bool time_stages = false;
+        std::string trace_path;                                                 ///< the trace of job n is written to <trace_path>.<n>; empty for none.
+        bool staged = false;
+        std::size_t segment_points = 0;                                         ///< the fewest points of a map fit segment; 0 for none.
+        geofence::ZoneIndex::CPtr zones;                                        ///< the suppression zones, loaded once for all jobs; nullptr for none.
+        unsigned n_scan_threads = 1;                                            ///< the threads that open the trip files for their sizes.
+        std::string size_cache_path;                                            ///< the batch file of job n is copied with sizes to <size_cache_path>.<n>; empty for none.
+        bool async_write = false;
+        unsigned n_shards = 0;
+        bool multi_trip = false;
+        bool columnar_output = false;
+        compression::Format output_compression = compression::Format::kNone;
+        MultiThread::Topology::CPtr placement;                                  ///< where the threads are pinned; nullptr for anywhere.
+    };
+
+    /**
+     * \brief Run de-identification jobs one after another against maps that are loaded once; with several regional maps
+     * each trip is de-identified against the map its bounding box falls in (see MapContext::route).
+     *
+     * The requests are text lines whose fields are separated by tabs:
+     *
+     * - run <batch file> <out dir> [<configuration line>]... : de-identify the trips listed in the batch file (as the
+     *   SOURCE of cv_di) into the out dir. The configuration lines (e.g., max_direct_distance:3000) override the base
+     *   configuration for this job only; the quad bounds of the loaded map cannot be changed.
+     * - quit : stop the service.
+     *
+     * Every run request is answered when the job is done with one line: ok<TAB><batch file> or error<TAB><message>.
+     * Empty lines are ignored.
+     */
+    class Service {
+        public:
+            /**
+             * \brief Construct a service.
+             *
+             * \param maps the loaded road networks.
+             * \param config the base configuration of the jobs.
+             * \param options the settings of every job.
+             */
+            Service(const std::vector<ResidentMap::CPtr>& maps, const Config::DIConfig& config, const RunOptions& options);
+
+            /**
+             * \brief Let the threads of every job use the copy of the maps on their NUMA node (see DICSV::SetMapReplicas).
+             */
+            void SetMapReplicas(const std::vector<std::vector<ResidentMap::CPtr>>& node_maps);
+
+            /**
+             * \brief Handle one request line.
+             *
+             * \param request the request.
+             * \param reply receives the answer of a run request.
+             * \return false when the request is quit.
+             */
+            bool HandleRequest(const std::string& request, std::ostream& reply);
+
+            /**
+             * \brief Handle the requests of a stream until quit or the end of the stream (e.g., standard input).
+             *
+             * \param in the requests.
+             * \param out the replies; flushed after each one.
+             */
+            void Serve(std::istream& in, std::ostream& out);
+
+            /**
+             * \brief Listen on a local (UNIX domain) socket and handle the requests of one connection at a time until a
+             * quit request. The socket file is created, replacing a stale one, and removed when the service stops.
+             *
+             * \param socket_path the path of the socket file.
+             * \throws invalid_argument if the socket cannot be created.
+             */
+            void ServeSocket(const std::string& socket_path);
+
+            /**
+             * \brief Return the number of jobs run so far, including the failed ones.
+             */
+            uint64_t GetJobCount(void) const;
+
+        private:
+            std::vector<ResidentMap::CPtr> maps_;
+            std::vector<std::vector<ResidentMap::CPtr>> node_maps_;            ///< the maps of each NUMA node; empty for none.
+            Config::DIConfig config_;
+            RunOptions options_;
+            uint64_t n_jobs_;
+
+            /**
+             * \brief Run one job.
+             *
+             * \throws invalid_argument if the batch file cannot be read.
+             */
+            void RunJob(const std::string& batch_file_path, const std::string& out_dir_path, const std::string& overrides);
+    };
+}
+
+#endif
@@ -19,6 +19,7 @@
  *******************************************************************************/
 #include "config.hpp"
 #include <algorithm>
+#include <stdexcept>
 
 namespace Config {
     DIConfig::DIConfig() {}
@@ -75,6 +76,14 @@ namespace Config {
         map_fit_scale_ = map_fit_scale;
     }
 
+    void DIConfig::ToggleMapFitPlanar(bool map_fit_planar) {
+        map_fit_planar_ = map_fit_planar;
+    }
+
+    void DIConfig::SetMapFitPlanarTolerance(double map_fit_planar_tolerance) {
+        map_fit_planar_tolerance_ = map_fit_planar_tolerance;
+    }
+
     void DIConfig::SetHeadingGroups(uint32_t n_heading_groups) {
         n_heading_groups_ = n_heading_groups;
     }
@@ -146,11 +155,28 @@ namespace Config {
     void DIConfig::SetRandOutDegree(double rand_out_degree) {
         rand_out_degree_ = rand_out_degree;
     }
+
+    void DIConfig::SetRandSeed(uint64_t rand_seed) {
+        rand_seed_ = rand_seed;
+        rand_seed_set_ = true;
+    }
             
     void DIConfig::TogglePlotKML(bool plot_kml) {
         plot_kml_ = plot_kml;
     }
 
+    void DIConfig::SetECSampleSize(uint32_t ec_sample_size) {
+        if (ec_sample_size == 0) {
+            throw std::invalid_argument("The error corrector sample size must be positive.");
+        }
+
+        ec_sample_size_ = ec_sample_size;
+    }
+
+    void DIConfig::ToggleECSlidingWindow(bool ec_sliding_window) {
+        ec_sliding_window_ = ec_sliding_window;
+    }
+
     const std::string& DIConfig::GetLatField(void) const {
         return lat_field_;
     }
@@ -203,6 +229,14 @@ namespace Config {
         return map_fit_scale_;
     }
 
+    bool DIConfig::IsMapFitPlanar(void) const {
+        return map_fit_planar_;
+    }
+
+    double DIConfig::GetMapFitPlanarTolerance(void) const {
+        return map_fit_planar_tolerance_;
+    }
+
     uint32_t DIConfig::GetHeadingGroups(void) const {
         return n_heading_groups_;
     }
@@ -274,11 +308,27 @@ namespace Config {
     double DIConfig::GetRandOutDegree(void) const {
         return rand_out_degree_;
     }
+
+    uint64_t DIConfig::GetRandSeed(void) const {
+        return rand_seed_;
+    }
+
+    bool DIConfig::IsRandSeedSet(void) const {
+        return rand_seed_set_;
+    }
     
     bool DIConfig::IsPlotKML(void) const {
         return plot_kml_;
     }
 
+    uint32_t DIConfig::GetECSampleSize(void) const {
+        return ec_sample_size_;
+    }
+
+    bool DIConfig::IsECSlidingWindow(void) const {
+        return ec_sliding_window_;
+    }
+
     DIConfig::Ptr DIConfig::ConfigFromFile(const std::string& config_file_path) {
         std::ifstream file(config_file_path);
         DIConfig::Ptr config_ptr;
@@ -295,9 +345,15 @@ namespace Config {
     }
 
     DIConfig::Ptr DIConfig::ConfigFromStream(std::istream& stream) {
+        DIConfig::Ptr config_ptr = std::make_shared<DIConfig>();
+        config_ptr->Update(stream);
+
+        return config_ptr;
+    }
+
+    void DIConfig::Update(std::istream& stream) {
         std::string line;                 
         StrVector parts;
-        DIConfig::Ptr config_ptr = std::make_shared<DIConfig>();
     
         while (std::getline(stream, line)) {
             line.erase(std::remove(line.begin(), line.end(), '\n'), line.end());
@@ -305,57 +361,69 @@ namespace Config {
             
             try {
                 if (parts[0] == "mf_fit_ext") {
-                    config_ptr->SetFitExt(std::stod(parts[1]));
+                    SetFitExt(std::stod(parts[1]));
                 } else if (parts[0] == "mf_toggle_scale") {
-                    config_ptr->ToggleScaleMapFit(!!std::stoi(parts[1]));
+                    ToggleScaleMapFit(!!std::stoi(parts[1]));
                 } else if (parts[0] == "mf_scale") {
-                    config_ptr->SetFitExt(std::stod(parts[1]));
+                    SetFitExt(std::stod(parts[1]));
+                } else if (parts[0] == "mf_planar") {
+                    ToggleMapFitPlanar(!!std::stoi(parts[1]));
+                } else if (parts[0] == "mf_planar_tolerance") {
+                    SetMapFitPlanarTolerance(std::stod(parts[1]));
                 } else if (parts[0] == "n_heading_groups") {
-                    config_ptr->SetHeadingGroups(std::stoul(parts[1]));
+                    SetHeadingGroups(std::stoul(parts[1]));
                 } else if (parts[0] == "min_edge_trip_pts") {
-                    config_ptr->SetMinEdgeTripPoints(std::stoul(parts[1]));
+                    SetMinEdgeTripPoints(std::stoul(parts[1]));
                 } else if (parts[0] == "ta_max_q_size") {
-                    config_ptr->SetTAMaxQSize(std::stoul(parts[1]));
+                    SetTAMaxQSize(std::stoul(parts[1]));
                 } else if (parts[0] == "ta_area_width") {
-                    config_ptr->SetTAAreaWidth(std::stod(parts[1]));
+                    SetTAAreaWidth(std::stod(parts[1]));
                 } else if (parts[0] == "ta_heading_delta") {
-                    config_ptr->SetTAAreaWidth(std::stod(parts[1]));
+                    SetTAAreaWidth(std::stod(parts[1]));
                 } else if (parts[0] == "ta_max_speed") {
-                    config_ptr->SetTAMaxSpeed(std::stod(parts[1]));
+                    SetTAMaxSpeed(std::stod(parts[1]));
                 } else if (parts[0] == "stop_min_distance") {
-                    config_ptr->SetStopMinDistance(std::stod(parts[1]));
+                    SetStopMinDistance(std::stod(parts[1]));
                 } else if (parts[0] == "stop_max_time") {
-                    config_ptr->SetStopMaxTime(std::stod(parts[1]));
+                    SetStopMaxTime(std::stod(parts[1]));
                 } else if (parts[0] == "stop_max_speed") {
-                    config_ptr->SetStopMaxSpeed(std::stod(parts[1]));
+                    SetStopMaxSpeed(std::stod(parts[1]));
                 } else if (parts[0] == "min_direct_distance") {
-                    config_ptr->SetMinDirectDistance(std::stod(parts[1]));
+                    SetMinDirectDistance(std::stod(parts[1]));
                 } else if (parts[0] == "min_manhattan_distance") {
-                    config_ptr->SetMinManhattanDistance(std::stod(parts[1]));
+                    SetMinManhattanDistance(std::stod(parts[1]));
                 } else if (parts[0] == "min_out_degree") {
-                    config_ptr->SetMinOutDegree(std::stoul(parts[1]));
+                    SetMinOutDegree(std::stoul(parts[1]));
                 } else if (parts[0] == "max_direct_distance") {
-                    config_ptr->SetMaxDirectDistance(std::stod(parts[1]));
+                    SetMaxDirectDistance(std::stod(parts[1]));
                 } else if (parts[0] == "max_manhattan_distance") {
-                    config_ptr->SetMaxManhattanDistance(std::stod(parts[1]));
+                    SetMaxManhattanDistance(std::stod(parts[1]));
                 } else if (parts[0] == "max_out_degree") {
-                    config_ptr->SetMaxOutDegree(std::stoul(parts[1]));
+                    SetMaxOutDegree(std::stoul(parts[1]));
                 } else if (parts[0] == "rand_direct_distance") {
-                    config_ptr->SetRandDirectDistance(std::stod(parts[1]));
+                    SetRandDirectDistance(std::stod(parts[1]));
                 } else if (parts[0] == "rand_manhattan_distance") {
-                    config_ptr->SetRandManhattanDistance(std::stod(parts[1]));
+                    SetRandManhattanDistance(std::stod(parts[1]));
                 } else if (parts[0] == "rand_out_degree") {
-                    config_ptr->SetRandOutDegree(std::stod(parts[1]));
+                    SetRandOutDegree(std::stod(parts[1]));
+                } else if (parts[0] == "rand_seed") {
+                    SetRandSeed(std::stoull(parts[1]));
                 } else if (parts[0] == "quad_sw_lat") {
-                    config_ptr->SetQuadSWLat(std::stod(parts[1]));
+                    SetQuadSWLat(std::stod(parts[1]));
                 } else if (parts[0] == "quad_sw_lng") {
-                    config_ptr->SetQuadSWLng(std::stod(parts[1]));
+                    SetQuadSWLng(std::stod(parts[1]));
                 } else if (parts[0] == "quad_ne_lat") {
-                    config_ptr->SetQuadNELat(std::stod(parts[1]));
+                    SetQuadNELat(std::stod(parts[1]));
                 } else if (parts[0] == "quad_ne_lng") {
-                    config_ptr->SetQuadNELng(std::stod(parts[1]));
+                    SetQuadNELng(std::stod(parts[1]));
                 } else if (parts[0] == "plot_kml") {
-                    config_ptr->TogglePlotKML(!!std::stoi(parts[1]));
+                    TogglePlotKML(!!std::stoi(parts[1]));
+                } else if (parts[0] == "ec_sample_size") {
+                    SetECSampleSize(std::stoul(parts[1]));
+                } else if (parts[0] == "ec_sliding_window") {
+                    ToggleECSlidingWindow(!!std::stoi(parts[1]));
+                } else if (parts[0] == "uid_fields") {
+                    SetUIDFields(parts.at(1));
                 } else {
                     std::cerr << "Ignoring configuration line: " + line << std::endl;
                 }
@@ -365,8 +433,6 @@ namespace Config {
                 continue;
             }
         } 
-
-        return config_ptr;
     }
 
     void DIConfig::PrintConfig(std::ostream& stream) const {
@@ -377,6 +443,8 @@ namespace Config {
         stream << "Quad NE longitude: " << quad_ne_lng_ << std::endl;
         stream << "Fit extension: " << fit_ext_  << std::endl;
         stream << "Scale map fit: " << scale_map_fit_  << std::endl;
+        stream << "Planar map fit: " << map_fit_planar_ << std::endl;
+        stream << "Planar map fit tolerance: " << map_fit_planar_tolerance_ << std::endl;
         stream << "N Heading groups: " << n_heading_groups_ << std::endl;
         stream << "Min edge trip points: " << min_edge_trip_points_ << std::endl;
         stream << "TA max queue size: " << ta_max_q_size_ << std::endl;
@@ -394,7 +462,11 @@ namespace Config {
         stream << "Rand direct distance: " << rand_direct_distance_ << std::endl; 
         stream << "Rand manhattan distance: " << rand_manhattan_distance_ << std::endl; 
         stream << "Rand out degree: " << rand_out_degree_ << std::endl; 
+        stream << "Rand seed: " << (rand_seed_set_ ? "set" : "random") << std::endl;
         stream << "Plot KML: " << plot_kml_ << std::endl;
+        stream << "EC sample size: " << ec_sample_size_ << std::endl;
+        stream << "EC sliding window: " << ec_sliding_window_ << std::endl;
+        stream << "UID fields: " << uid_fields_ << std::endl;
         stream << "*****************************************************************************************" << std::endl;
     }
 }
@@ -20,26 +20,154 @@
 #include "cvlib.hpp"
 #include "tool.hpp"
 #include "di_multi.hpp"
+#include "service.hpp"
 
 int main( int argc, char **argv ) {
     // Set up the tool.
     tool::Tool tool("cv_di", "De-identify BSMP1 CSV data.");
     tool.AddOption(tool::Option('h', "help", "Print this message."));
-    tool.AddOption(tool::Option('t', "thread", "The number of threads to use (default: 1 thread).", "1"));
+    tool.AddOption(tool::Option('t', "thread", "The number of threads to use, or auto to tune the number of active threads toward the highest throughput (default: 1 thread).", "1"));
     tool.AddOption(tool::Option('o', "out_dir", "The output directory (default: working directory).", ""));
     tool.AddOption(tool::Option('k', "kml_dir", "The KML output directory (default: working directory).", ""));
-    tool.AddOption(tool::Option('q', "quad", "The file .quad file containing the circles defining the regions.", ""));
+    tool.AddOption(tool::Option('q', "quad", "The file .quad file containing the circles defining the regions; regional maps may be given as a comma separated list.", ""));
     tool.AddOption(tool::Option('c', "config", "A configuration file for de-identification.", ""));
     tool.AddOption(tool::Option('n', "count_pts", "Print summary of the points after de-identification to standard error."));
+    tool.AddOption(tool::Option('b', "max_queued", "The maximum number of trips read ahead of the threads (default: 0, unbounded).", "0"));
+    tool.AddOption(tool::Option('w', "work_steal", "Let idle threads take waiting trips from busy threads."));
+    tool.AddOption(tool::Option('l', "lock_free", "Hand trips to the threads through lock-free ring buffers."));
+    tool.AddOption(tool::Option('r', "mmap_read", "Read trip files through a memory mapping instead of a stream."));
+    tool.AddOption(tool::Option('p', "profile", "Print the time spent in each de-identification stage to standard error."));
+    tool.AddOption(tool::Option('e', "trace", "Write a Chrome trace-event JSON file of each thread's trips, stages and waits for trips to this path; with daemon, job <n> writes <path>.<n>.", ""));
+    tool.AddOption(tool::Option('S', "split_trips", "Map fit each trip in segments of at least this many points on parallel threads (default: 0, trips are not split).", "0"));
+    tool.AddOption(tool::Option('F', "scan_threads", "Open the listed trip files for their sizes on this many threads ahead of the threads that de-identify them (default: 1).", "1"));
+    tool.AddOption(tool::Option('W', "write_sizes", "Write a copy of the batch file with the size of each trip file to this path, for later runs; with daemon, job <n> writes <path>.<n>.", ""));
+    tool.AddOption(tool::Option('G', "geofence", "A shape file of circle and grid suppression zones; the trip points in a zone are suppressed.", ""));
+    tool.AddOption(tool::Option('x', "staged", "Run each point analysis stage as a separate pass over the trip (e.g., to profile them)."));
+    tool.AddOption(tool::Option('a', "async_write", "Collect the output in large blocks and write them on a separate I/O thread."));
+    tool.AddOption(tool::Option('s', "shards", "Write all trips into this many shard files with a trip index (default: 0, one file per trip).", "0"));
+    tool.AddOption(tool::Option('C', "columnar", "Write the de-identified trips as columnar (.cvcol) files instead of CSV files."));
+    tool.AddOption(tool::Option('Z', "compress", "Compress the de-identified CSV trips with gzip or zstd (default: none).", "none"));
+    tool.AddOption(tool::Option('u', "multi_trip", "Each listed file holds many trips; find the trips by their UID fields in parallel."));
+    tool.AddOption(tool::Option('m', "map_snapshot", "Write a binary map snapshot of the source shape file with the -c quad bounds to this path and exit.", ""));
+    tool.AddOption(tool::Option('T', "map_tiles", "Write a tiled map of the source shape file inside the -c quad bounds to this existing directory and exit.", ""));
+    tool.AddOption(tool::Option('g', "tile_degrees", "The width and height in degrees of the tiles written with map_tiles (default: 0.05).", "0.05"));
+    tool.AddOption(tool::Option('M', "tile_memory", "The megabytes of map tiles kept loaded when the quad is a tiled map directory (default: 256).", "256"));
+    tool.AddOption(tool::Option('N', "node", "Process only the trips of node <index>/<count>; the trips are assigned to nodes by a hash of their path and UID (default: 0/1, all trips).", "0/1"));
+    tool.AddOption(tool::Option('J', "journal", "Append each finished trip to this journal file and skip the trips it already holds.", ""));
+    tool.AddOption(tool::Option('R', "merge_journals", "Print the merged point summary of the journal files listed in the source and exit."));
+    tool.AddOption(tool::Option('A', "pin_threads", "Pin each thread to a CPU, spreading the threads over the NUMA nodes."));
+    tool.AddOption(tool::Option('L', "local_maps", "Load a copy of the map on each NUMA node for the threads pinned there (implies pin_threads)."));
+    tool.AddOption(tool::Option('D', "daemon", "Load the maps in the source (comma separated) once and run the jobs requested on this local socket path, or on standard input for -.", ""));
     
     if (!tool.ParseArgs(std::vector<std::string>{argv + 1, argv + argc})) {
         exit(1);
     }
 
+    if (!tool.GetStringVal("map_snapshot").empty()) {
+        // Snapshot generation mode: the source is the CSV shape file.
+        try {
+            if (tool.GetStringVal("config").empty()) {
+                throw std::invalid_argument("A configuration file (-c) with the quad bounds is required to write a map snapshot.");
+            }
+
+            Config::DIConfig::Ptr config_ptr = Config::DIConfig::ConfigFromFile(tool.GetStringVal("config"));
+
+            if (config_ptr->GetQuadSWLat() >= config_ptr->GetQuadNELat() || config_ptr->GetQuadSWLng() >= config_ptr->GetQuadNELng()) {
+                throw std::invalid_argument("The configured quad bounds are empty; no map snapshot written.");
+            }
+
+            std::vector<geo::EdgeCPtr> edges;
+            FlatQuad::CPtr quad_ptr;
+
+            DIMulti::LoadMap(tool.GetSource(), *config_ptr, edges, quad_ptr);
+            snapshot::MapWriter(edges, *quad_ptr).write(tool.GetStringVal("map_snapshot"));
+            std::cerr << "Wrote map snapshot: " << edges.size() << " edges, " << quad_ptr->node_count() << " quad nodes." << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl; 
+            exit(1);
+        }
+
+        return 0;
+    }
+
+    if (!tool.GetStringVal("map_tiles").empty()) {
+        // Tiled map generation mode: the source is the CSV shape file; the configuration bounds are tiled.
+        try {
+            if (tool.GetStringVal("config").empty()) {
+                throw std::invalid_argument("A configuration file (-c) with the quad bounds is required to write a tiled map.");
+            }
+
+            Config::DIConfig::Ptr config_ptr = Config::DIConfig::ConfigFromFile(tool.GetStringVal("config"));
+
+            if (config_ptr->GetQuadSWLat() >= config_ptr->GetQuadNELat() || config_ptr->GetQuadSWLng() >= config_ptr->GetQuadNELng()) {
+                throw std::invalid_argument("The configured quad bounds are empty; no map tiles written.");
+            }
+
+            shapes::CSVInputFactory shape_factory(tool.GetSource());
+            shape_factory.make_shapes();
+
+            geo::Point sw{ config_ptr->GetQuadSWLat(), config_ptr->GetQuadSWLng() };
+            geo::Point ne{ config_ptr->GetQuadNELat(), config_ptr->GetQuadNELng() };
+            std::size_t n_tiles = tiles::write_tiles(shape_factory.get_edges(), sw, ne, tool.GetDoubleVal("tile_degrees"), 0.0, tool.GetStringVal("map_tiles"));
+
+            if (n_tiles == 0) {
+                throw std::invalid_argument("No roads of the source are inside the configured quad bounds; no map tiles written.");
+            }
+
+            std::cerr << "Wrote map tiles: " << shape_factory.get_edges().size() << " edges, " << n_tiles << " tiles." << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl; 
+            exit(1);
+        }
+
+        return 0;
+    }
+
+    if (tool.GetBoolVal("merge_journals")) {
+        // Report mode: the source lists the journals of the nodes, one per line.
+        try {
+            std::ifstream list_file(tool.GetSource());
+
+            if (!list_file) {
+                throw std::invalid_argument("Could not read journal list: " + tool.GetSource());
+            }
+
+            std::vector<std::string> journal_paths;
+            std::string line;
+
+            while (std::getline(list_file, line)) {
+                if (!line.empty()) {
+                    journal_paths.push_back(line);
+                }
+            }
+
+            std::size_t n_trips = 0;
+            instrument::PointCounter summary = DIMulti::Journal::Merge(journal_paths, n_trips);
+
+            std::cerr << "********************************** Point Summary ****************************************" << std::endl;
+            std::cerr << "total,invalid_fields,invalid_GPS,invalid_heading,error,critical_interval,privacy_interval" << std::endl;
+            std::cerr << summary << std::endl;
+            std::cerr << "trips: " << n_trips << ", journals: " << journal_paths.size() << std::endl;
+            std::cerr << "*****************************************************************************************" << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl; 
+            exit(1);
+        }
+
+        return 0;
+    }
+
     unsigned n_threads = 0;
+    bool autotune = tool.GetStringVal("thread") == "auto";
 
     try {
-        n_threads = static_cast<unsigned>(tool.GetIntVal("thread"));    
+        if (autotune) {
+            // the most threads Parallel runs; the tuner decides how many of them are active.
+            unsigned n_cpus = std::max(1u, std::thread::hardware_concurrency());
+            n_threads = n_cpus + n_cpus / 2;
+        } else {
+            n_threads = static_cast<unsigned>(tool.GetIntVal("thread"));    
+        }
     } catch (std::out_of_range&) {
         std::cerr << "Invalid value for \"thread\"!" << std::endl;
         exit(1);
@@ -49,10 +177,227 @@ int main( int argc, char **argv ) {
         std::cerr << "Number of threads must be greater than 1." << std::endl;
         exit(1);
     }
+
+    int max_queued = 0;
+
+    try {
+        max_queued = tool.GetIntVal("max_queued");
+    } catch (std::out_of_range&) {
+        std::cerr << "Invalid value for \"max_queued\"!" << std::endl;
+        exit(1);
+    }
+
+    if (max_queued < 0) {
+        std::cerr << "The maximum number of queued trips must not be negative." << std::endl;
+        exit(1);
+    }
     
+    int segment_points = 0;
+
+    try {
+        segment_points = tool.GetIntVal("split_trips");
+    } catch (std::out_of_range&) {
+        std::cerr << "Invalid value for \"split_trips\"!" << std::endl;
+        exit(1);
+    }
+
+    if (segment_points < 0) {
+        std::cerr << "The number of points of a trip segment must not be negative." << std::endl;
+        exit(1);
+    }
+
+    int n_scan_threads = 1;
+
+    try {
+        n_scan_threads = tool.GetIntVal("scan_threads");
+    } catch (std::out_of_range&) {
+        std::cerr << "Invalid value for \"scan_threads\"!" << std::endl;
+        exit(1);
+    }
+
+    if (n_scan_threads < 1) {
+        std::cerr << "The number of scan threads must be at least 1." << std::endl;
+        exit(1);
+    }
+
+    int n_shards = 0;
+
+    try {
+        n_shards = tool.GetIntVal("shards");
+    } catch (std::out_of_range&) {
+        std::cerr << "Invalid value for \"shards\"!" << std::endl;
+        exit(1);
+    }
+
+    if (n_shards < 0) {
+        std::cerr << "The number of shards must not be negative." << std::endl;
+        exit(1);
+    }
+
+    int tile_memory = 0;
+
     try {
-        DIMulti::DICSV parallel_csv(tool.GetSource(), tool.GetStringVal("quad"), tool.GetStringVal("out_dir"), tool.GetStringVal("config"), tool.GetStringVal("kml_dir"), tool.GetBoolVal("count_pts"));
-        parallel_csv.Start(n_threads);
+        tile_memory = tool.GetIntVal("tile_memory");
+    } catch (std::out_of_range&) {
+        std::cerr << "Invalid value for \"tile_memory\"!" << std::endl;
+        exit(1);
+    }
+
+    if (tile_memory < 0) {
+        std::cerr << "The map tile memory must not be negative." << std::endl;
+        exit(1);
+    }
+
+    unsigned node_index = 0;
+    unsigned n_nodes = 1;
+
+    try {
+        StrVector node_items = string_utilities::split(tool.GetStringVal("node"), '/');
+
+        if (node_items.size() != 2) {
+            throw std::invalid_argument("node");
+        }
+
+        int index = std::stoi(node_items[0]);
+        int count = std::stoi(node_items[1]);
+
+        if (index < 0 || count < 1 || index >= count) {
+            throw std::invalid_argument("node");
+        }
+
+        node_index = static_cast<unsigned>(index);
+        n_nodes = static_cast<unsigned>(count);
+    } catch (std::logic_error&) {
+        std::cerr << "Invalid value for \"node\"; expected <index>/<count> with index less than count!" << std::endl;
+        exit(1);
+    }
+
+    compression::Format output_compression = compression::Format::kNone;
+
+    try {
+        output_compression = compression::parse_format(tool.GetStringVal("compress"));
+    } catch (std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    }
+
+    if (!compression::is_supported(output_compression)) {
+        std::cerr << "This build cannot write " << tool.GetStringVal("compress") << " files." << std::endl;
+        exit(1);
+    }
+
+    geofence::ZoneIndex::CPtr zones = nullptr;
+
+    if (!tool.GetStringVal("geofence").empty()) {
+        try {
+            zones = geofence::ZoneIndex::load(tool.GetStringVal("geofence"));
+            std::cerr << "Loaded " << zones->size() << " suppression zone(s) into " << zones->cell_count() << " cells of " << zones->get_cell_degrees() << " degrees." << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+    }
+
+    bool local_maps = tool.GetBoolVal("local_maps");
+    MultiThread::Topology::CPtr placement = nullptr;
+
+    if (local_maps || tool.GetBoolVal("pin_threads")) {
+        placement = MultiThread::Topology::Detect();
+        std::cerr << "Pinning the threads over " << placement->NodeCount() << " NUMA node(s)." << std::endl;
+    }
+
+    if (!tool.GetStringVal("daemon").empty()) {
+        // Service mode: the source is the map; every job brings its own batch file and out dir.
+        try {
+            Config::DIConfig::Ptr config_ptr = tool.GetStringVal("config").empty() ? std::make_shared<Config::DIConfig>() : Config::DIConfig::ConfigFromFile(tool.GetStringVal("config"));
+            std::vector<std::vector<DIMulti::ResidentMap::CPtr>> node_maps;
+            std::vector<DIMulti::ResidentMap::CPtr> maps;
+
+            if (local_maps) {
+                node_maps = DIMulti::ResidentMap::LoadReplicas(tool.GetSource(), *config_ptr, static_cast<std::size_t>(tile_memory) << 20, *placement, n_threads);
+                maps = DIMulti::ResidentMap::FirstReplica(node_maps);
+            } else {
+                maps = DIMulti::ResidentMap::LoadAll(tool.GetSource(), *config_ptr, static_cast<std::size_t>(tile_memory) << 20);
+            }
+
+            DIMulti::RunOptions options;
+            options.n_threads = n_threads;
+            options.autotune = autotune;
+            options.schedule = tool.GetBoolVal("work_steal") ? MultiThread::Schedule::kWorkStealing : MultiThread::Schedule::kLeastLoaded;
+            options.backend = tool.GetBoolVal("lock_free") ? MultiThread::QueueBackend::kRing : MultiThread::QueueBackend::kLocked;
+            options.high_water_mark = static_cast<std::size_t>(max_queued);
+            options.kml_dir_path = tool.GetStringVal("kml_dir");
+            options.count_points = tool.GetBoolVal("count_pts");
+            options.mapped_input = tool.GetBoolVal("mmap_read");
+            options.time_stages = tool.GetBoolVal("profile");
+            options.trace_path = tool.GetStringVal("trace");
+            options.segment_points = static_cast<std::size_t>(segment_points);
+            options.n_scan_threads = static_cast<unsigned>(n_scan_threads);
+            options.zones = zones;
+            options.size_cache_path = tool.GetStringVal("write_sizes");
+            options.staged = tool.GetBoolVal("staged");
+            options.async_write = tool.GetBoolVal("async_write");
+            options.n_shards = static_cast<unsigned>(n_shards);
+            options.multi_trip = tool.GetBoolVal("multi_trip");
+            options.columnar_output = tool.GetBoolVal("columnar");
+            options.output_compression = output_compression;
+            options.placement = placement;
+
+            DIMulti::Service service(maps, *config_ptr, options);
+            service.SetMapReplicas(node_maps);
+            std::cerr << maps.size() << " map(s) loaded; waiting for jobs." << std::endl;
+
+            if (tool.GetStringVal("daemon") == "-") {
+                service.Serve(std::cin, std::cout);
+            } else {
+                service.ServeSocket(tool.GetStringVal("daemon"));
+            }
+
+            std::cerr << "Service stopped after " << service.GetJobCount() << " jobs." << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl; 
+            exit(1);
+        }
+
+        return 0;
+    }
+
+    try {
+        std::unique_ptr<DIMulti::DICSV> parallel_csv_ptr;
+
+        if (local_maps) {
+            // Every node gets its own copy of the maps; the first also serves the threads of nodes without one.
+            Config::DIConfig::Ptr config_ptr = tool.GetStringVal("config").empty() ? std::make_shared<Config::DIConfig>() : Config::DIConfig::ConfigFromFile(tool.GetStringVal("config"));
+            std::vector<std::vector<DIMulti::ResidentMap::CPtr>> node_maps = DIMulti::ResidentMap::LoadReplicas(tool.GetStringVal("quad"), *config_ptr, static_cast<std::size_t>(tile_memory) << 20, *placement, n_threads);
+            parallel_csv_ptr.reset(new DIMulti::DICSV(tool.GetSource(), DIMulti::ResidentMap::FirstReplica(node_maps), tool.GetStringVal("out_dir"), config_ptr, tool.GetStringVal("kml_dir"), tool.GetBoolVal("count_pts"), tool.GetBoolVal("mmap_read"), tool.GetBoolVal("profile"), tool.GetBoolVal("staged"), tool.GetBoolVal("async_write"), static_cast<unsigned>(n_shards), tool.GetBoolVal("multi_trip")));
+            parallel_csv_ptr->SetMapReplicas(node_maps);
+        } else {
+            parallel_csv_ptr.reset(new DIMulti::DICSV(tool.GetSource(), tool.GetStringVal("quad"), tool.GetStringVal("out_dir"), tool.GetStringVal("config"), tool.GetStringVal("kml_dir"), tool.GetBoolVal("count_pts"), tool.GetBoolVal("mmap_read"), tool.GetBoolVal("profile"), tool.GetBoolVal("staged"), tool.GetBoolVal("async_write"), static_cast<unsigned>(n_shards), tool.GetBoolVal("multi_trip"), static_cast<std::size_t>(tile_memory) << 20));
+        }
+
+        DIMulti::DICSV& parallel_csv = *parallel_csv_ptr;
+        parallel_csv.SetPlacement(placement);
+        parallel_csv.SetPartition(node_index, n_nodes);
+        parallel_csv.SetColumnarOutput(tool.GetBoolVal("columnar"));
+        parallel_csv.SetOutputCompression(output_compression);
+
+        if (!tool.GetStringVal("journal").empty()) {
+            parallel_csv.SetJournal(std::make_shared<DIMulti::Journal>(tool.GetStringVal("journal")));
+        }
+
+        parallel_csv.SetHighWaterMark(static_cast<std::size_t>(max_queued));
+        parallel_csv.SetAutotune(autotune);
+        parallel_csv.SetTracePath(tool.GetStringVal("trace"));
+        parallel_csv.SetTripSegments(static_cast<std::size_t>(segment_points));
+        parallel_csv.SetScanThreads(static_cast<unsigned>(n_scan_threads));
+        parallel_csv.SetGeofence(zones);
+
+        if (!tool.GetStringVal("write_sizes").empty()) {
+            parallel_csv.SetSizeCache(tool.GetStringVal("write_sizes"));
+        }
+
+        parallel_csv.SetQueueBackend(tool.GetBoolVal("lock_free") ? MultiThread::QueueBackend::kRing : MultiThread::QueueBackend::kLocked);
+        parallel_csv.Start(n_threads, tool.GetBoolVal("work_steal") ? MultiThread::Schedule::kWorkStealing : MultiThread::Schedule::kLeastLoaded);
     } catch (std::invalid_argument& e) {    
         std::cerr << e.what() << std::endl; 
     }
@@ -1,11 +1,131 @@
 #include "di_multi.hpp"
 #include "config.hpp"
 
+#include <algorithm>
 #include <iomanip>
 #include <chrono>
 #include <ctime>
+#include <exception>
+#include <thread>
 
 namespace DIMulti {
+    void LoadMap(const std::string& quad_file_path, const Config::DIConfig& config, std::vector<geo::EdgeCPtr>& edges, FlatQuad::CPtr& quad_ptr) {
+        if (snapshot::MapReader::is_snapshot(quad_file_path)) {
+            snapshot::MapReader map_reader(quad_file_path);
+            edges = map_reader.get_edges();
+            quad_ptr = map_reader.get_quad();
+
+            return;
+        }
+
+        geo::Point sw{ config.GetQuadSWLat(), config.GetQuadSWLng() };
+        geo::Point ne{ config.GetQuadNELat(), config.GetQuadNELng() };
+
+        Quad::Ptr tree_ptr = std::make_shared<Quad>(sw, ne);
+        shapes::CSVInputFactory shape_factory(quad_file_path);
+        shape_factory.make_shapes();
+
+        // Partition the whole edge list at once and build the subtrees on all the cores.
+        geo::Entity::PtrList entities{ shape_factory.get_edges().begin(), shape_factory.get_edges().end() };
+        Quad::bulk_insert(tree_ptr, entities, std::max(1u, std::thread::hardware_concurrency()));
+
+        // The tree is never modified after loading; compile it for the lookups and let the tree go.
+        edges = shape_factory.get_edges();
+        quad_ptr = tree_ptr->freeze();
+    }
+
+    // ResidentMap
+    ResidentMap::ResidentMap(const std::string& quad_file_path, const Config::DIConfig& config, std::size_t tile_memory) :
+        quad_file_path_(quad_file_path),
+        tile_memory_(tile_memory)
+    {
+        if (tiles::TiledMap::is_tiled(quad_file_path)) {
+            // Only the tiles the trips touch are loaded; each tile brings its own fit areas.
+            tiles::TiledMap::CPtr tiled_map = std::make_shared<const tiles::TiledMap>(quad_file_path, tile_memory, config.GetMapFitScale(), config.GetFitExt());
+            context_ = std::make_shared<const MapContext>(tiled_map, config.GetMapFitScale(), config.GetFitExt());
+
+            return;
+        }
+
+        std::vector<geo::EdgeCPtr> edges;
+        FlatQuad::CPtr quad_ptr;
+        LoadMap(quad_file_path, config, edges, quad_ptr);
+
+        // The fit areas depend only on the map and configuration; build them once for all the threads.
+        context_ = std::make_shared<const MapContext>(edges, quad_ptr, config.GetMapFitScale(), config.GetFitExt());
+    }
+
+    std::vector<ResidentMap::CPtr> ResidentMap::LoadAll(const std::string& quad_file_paths, const Config::DIConfig& config, std::size_t tile_memory) {
+        std::vector<CPtr> maps;
+
+        for (auto& quad_file_path : string_utilities::split(quad_file_paths, ',')) {
+            if (!quad_file_path.empty()) {
+                maps.push_back(std::make_shared<const ResidentMap>(quad_file_path, config, tile_memory));
+            }
+        }
+
+        if (maps.empty()) {
+            throw std::invalid_argument("No map file was given.");
+        }
+
+        return maps;
+    }
+
+    std::vector<std::vector<ResidentMap::CPtr>> ResidentMap::LoadReplicas(const std::string& quad_file_paths, const Config::DIConfig& config, std::size_t tile_memory, const MultiThread::Topology& topology, unsigned n_threads) {
+        std::vector<std::vector<CPtr>> node_maps(topology.NodeCount());
+        std::vector<std::exception_ptr> errors(topology.NodeCount());
+        std::vector<std::thread> loaders;
+
+        for (unsigned node : topology.UsedNodes(n_threads)) {
+            loaders.push_back(std::thread([&, node]() {
+                // the threads that build a quad tree inherit the node's CPUs.
+                MultiThread::PinCurrentThread(topology.NodeCpus(node));
+
+                try {
+                    node_maps[node] = LoadAll(quad_file_paths, config, tile_memory);
+                } catch (...) {
+                    errors[node] = std::current_exception();
+                }
+            }));
+        }
+
+        for (auto& loader : loaders) {
+            loader.join();
+        }
+
+        for (auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        return node_maps;
+    }
+
+    const std::vector<ResidentMap::CPtr>& ResidentMap::FirstReplica(const std::vector<std::vector<CPtr>>& node_maps) {
+        for (auto& maps : node_maps) {
+            if (!maps.empty()) {
+                return maps;
+            }
+        }
+
+        throw std::invalid_argument("No NUMA node holds a copy of the maps.");
+    }
+
+    MapContext::CPtr ResidentMap::GetContext(double fit_width_scaling, double fit_extension) const {
+        if (context_->matches(fit_width_scaling, fit_extension)) {
+            return context_;
+        }
+
+        if (context_->get_tiled_map()) {
+            tiles::TiledMap::CPtr tiled_map = std::make_shared<const tiles::TiledMap>(quad_file_path_, tile_memory_, fit_width_scaling, fit_extension);
+
+            return std::make_shared<const MapContext>(tiled_map, fit_width_scaling, fit_extension, context_->get_stop_excluded_highways());
+        }
+
+        return std::make_shared<const MapContext>(context_->get_edges(), context_->get_quad(), fit_width_scaling, fit_extension, nullptr, context_->get_stop_excluded_highways());
+    }
+
     // FileInfo
     SingleFileInfo::SingleFileInfo(const std::string& file_path, uint64_t size) :
         file_path_(file_path),
@@ -30,6 +150,28 @@ namespace DIMulti {
         return file_path_;
     }
 
+    TripRangeInfo::TripRangeInfo(const std::string& file_path, const MappedFile::CPtr& file, const trip_index::TripRange& range) :
+        file_path_(file_path),
+        file_(file),
+        range_(range)
+        {}
+
+    const std::string TripRangeInfo::GetFilePath() const {
+        return file_path_;
+    }
+
+    uint64_t TripRangeInfo::GetSize() const {
+        return range_.end - range_.begin;
+    }
+
+    const MappedFile::CPtr& TripRangeInfo::GetFile() const {
+        return file_;
+    }
+
+    const trip_index::TripRange& TripRangeInfo::GetRange() const {
+        return range_;
+    }
+
     // BatchCSV
 
     BatchCSV::BatchCSV(const std::string& file_path) :
@@ -67,55 +209,223 @@ namespace DIMulti {
     // SingleBatchCSV
       
     SingleBatchCSV::SingleBatchCSV(const std::string& file_path) :
-        BatchCSV(file_path)
+        BatchCSV(file_path),
+        multi_trip_(false),
+        n_index_threads_(1),
+        node_index_(0),
+        n_nodes_(1),
+        n_scan_threads_(1)
         {}
 
+    void SingleBatchCSV::Init(unsigned n_used_threads) {
+        if (size_cache_ && multi_trip_) {
+            throw std::invalid_argument("File sizes cannot be written for a multi-trip batch.");
+        }
+
+        BatchCSV::Init(n_used_threads);
+        n_index_threads_ = n_used_threads;
+    }
+
+    void SingleBatchCSV::SetMultiTrip(const std::string& uid_fields, const std::string& lat_field, const std::string& lon_field) {
+        multi_trip_ = true;
+        uid_fields_ = uid_fields;
+        lat_field_ = lat_field;
+        lon_field_ = lon_field;
+    }
+
+    void SingleBatchCSV::SetPartition(unsigned node_index, unsigned n_nodes) {
+        if (node_index >= n_nodes) {
+            throw std::invalid_argument("The node index must be less than the number of nodes.");
+        }
+
+        node_index_ = node_index;
+        n_nodes_ = n_nodes;
+    }
+
+    void SingleBatchCSV::SetScanThreads(unsigned n_scan_threads) {
+        if (n_scan_threads == 0) {
+            throw std::invalid_argument("The number of scan threads must be at least 1.");
+        }
+
+        n_scan_threads_ = n_scan_threads;
+    }
+
+    void SingleBatchCSV::SetSizeCache(const std::string& size_cache_path) {
+        size_cache_ = std::make_shared<std::ofstream>(size_cache_path, std::ofstream::trunc);
+
+        if (size_cache_->fail()) {
+            size_cache_ = nullptr;
+            throw std::invalid_argument("Could not open the size cache file: " + size_cache_path);
+        }
+    }
+
+    void SingleBatchCSV::Close() {
+        scanner_.reset();
+
+        if (size_cache_) {
+            size_cache_->close();
+        }
+
+        BatchCSV::Close();
+    }
+
+    void SingleBatchCSV::SetJournal(const Journal::Ptr& journal) {
+        journal_ = journal;
+    }
+
+    const Journal::Ptr& SingleBatchCSV::GetJournal(void) const {
+        return journal_;
+    }
+
+    std::string SingleBatchCSV::ItemKey(const FileInfo& item) {
+        const TripRangeInfo* range_info = dynamic_cast<const TripRangeInfo*>(&item);
+
+        if (range_info) {
+            return item.GetFilePath() + ":" + range_info->GetRange().uid;
+        }
+
+        return item.GetFilePath();
+    }
+
+    void SingleBatchCSV::IndexFile(const std::string& file_path) {
+        MappedFile::CPtr file = std::make_shared<const MappedFile>(file_path);
+        const char* data = file->data();
+        const char* eol = std::find(data, data + file->size(), '\n');
+
+        if (eol == data + file->size()) {
+            throw std::invalid_argument("Multi-trip file has no header or records: " + file_path);
+        }
+
+        trip_index::TripRangeList ranges;
+
+        // reuse the index of an earlier run when the file has not changed since.
+        if (!trip_index::read_index(file_path, uid_fields_, ranges)) {
+            std::string header(data, eol);
+            trip_index::UIDExtractor extractor(header, uid_fields_);
+            trip_index::LocationExtractor locator(header, lat_field_, lon_field_);
+            std::size_t begin = static_cast<std::size_t>(eol - data) + 1;
+
+            ranges = trip_index::index_trips(data, file->size(), begin, extractor, locator, n_index_threads_);
+
+            try {
+                trip_index::write_index(file_path, uid_fields_, ranges);
+            } catch (std::exception& e) {
+                std::cerr << "Trip index not saved: " << e.what() << std::endl;
+            }
+        }
+
+        for (auto& range : ranges) {
+            pending_.push_back(std::make_shared<TripRangeInfo>(file_path, file, range));
+        }
+    }
+
     FileInfo::Ptr SingleBatchCSV::NextItem() {
+        FileInfo::Ptr item_ptr;
+
+        while ((item_ptr = NextCandidate()) != nullptr) {
+            if (n_nodes_ <= 1 && !journal_) {
+                return item_ptr;
+            }
+
+            std::string key = ItemKey(*item_ptr);
+
+            if (InPartition(key, node_index_, n_nodes_) && !(journal_ && journal_->IsDone(key))) {
+                return item_ptr;
+            }
+        }
+
+        return nullptr;
+    }
+
+    bool SingleBatchCSV::NextEntry(ManifestEntry& entry) {
+        if (!multi_trip_ && n_scan_threads_ > 1) {
+            if (!scanner_) {
+                scanner_.reset(new ManifestScanner(GetFilePtr(), n_scan_threads_));
+            }
+
+            return scanner_->Next(entry);
+        }
+
         std::string line;
 
         while (std::getline(*(GetFilePtr()), line)) {
-            line.erase(std::remove(line.begin(), line.end(), '\n'), line.end());
-            StrVector items = string_utilities::split(line, ':');
-
-            if (items.size() < 1) {
+            if (!ParseManifestLine(line, entry)) {
                 continue;
             }
 
-            std::string file_path = items[0];
-            std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+            if (!multi_trip_) {
+                ScanManifestEntry(entry);
+            }
 
-            if (file.fail()) {  
-                std::cerr << "Could not open file: " << file_path << std::endl; 
+            return true;
+        }
 
-                continue;
+        return false;
+    }
+
+    FileInfo::Ptr SingleBatchCSV::NextCandidate() {
+        if (!pending_.empty()) {
+            FileInfo::Ptr item_ptr = pending_.front();
+            pending_.pop_front();
+
+            return item_ptr;
+        }
+
+        ManifestEntry entry;
+
+        while (NextEntry(entry)) {
+            if (multi_trip_) {
+                try {
+                    IndexFile(entry.file_path);
+                } catch (std::exception& e) {
+                    std::cerr << e.what() << std::endl;
+
+                    continue;
+                }
+
+                if (pending_.empty()) {
+                    continue;
+                }
+
+                FileInfo::Ptr item_ptr = pending_.front();
+                pending_.pop_front();
+
+                return item_ptr;
             }
-        
-            uint64_t size = file.tellg();
-        
-            file.close();
 
-            StrVector path_items = string_utilities::split(file_path, '/');
+            if (size_cache_) {
+                *size_cache_ << FormatManifestLine(entry) << '\n';
+            }
+
+            if (!entry.error.empty()) {
+                std::cerr << entry.error << std::endl;
 
-            if (path_items.size() < 1) {
                 continue;
             }
 
-            if (items.size() > 1) {
-                return std::make_shared<SingleFileInfo>(file_path, items[1], size);
+            if (entry.has_aux) {
+                return std::make_shared<SingleFileInfo>(entry.file_path, entry.aux_data, entry.size);
             } else {
-                return std::make_shared<SingleFileInfo>(file_path, size);
+                return std::make_shared<SingleFileInfo>(entry.file_path, entry.size);
             }
-    
         }
 
         return nullptr;
     }
 
-    DICSV::DICSV(const std::string& file_path, const std::string& quad_file_path, const std::string& out_dir_path, const std::string& config_file_path, const std::string& kml_dir_path, bool count_points) :
+    DICSV::DICSV(const std::string& file_path, const std::string& quad_file_path, const std::string& out_dir_path, const std::string& config_file_path, const std::string& kml_dir_path, bool count_points, bool mapped_input, bool time_stages, bool staged, bool async_write, unsigned n_shards, bool multi_trip, std::size_t tile_memory) :
         SingleBatchCSV(file_path),
         out_dir_path_(out_dir_path),
         kml_dir_path_(kml_dir_path), 
-        count_points_(count_points)
+        count_points_(count_points),
+        mapped_input_(mapped_input),
+        time_stages_(time_stages),
+        staged_(staged),
+        async_write_(async_write || n_shards > 0),
+        n_shards_(n_shards),
+        columnar_output_(false),
+        output_compression_(compression::Format::kNone),
+        segment_points_(0)
         {
             if (!config_file_path.empty()) {
                 config_ptr_ = Config::DIConfig::ConfigFromFile(config_file_path);
@@ -123,21 +433,138 @@ namespace DIMulti {
                 config_ptr_ = std::make_shared<Config::DIConfig>();
             }
 
-            config_ptr_->PrintConfig(std::cerr);
-            geo::Point sw{ config_ptr_->GetQuadSWLat(), config_ptr_->GetQuadSWLng() };
-            geo::Point ne{ config_ptr_->GetQuadNELat(), config_ptr_->GetQuadNELng() };
+            maps_ = ResidentMap::LoadAll(quad_file_path, *config_ptr_, tile_memory);
+            SetUp(multi_trip);
+        }
+
+    DICSV::DICSV(const std::string& file_path, const std::vector<ResidentMap::CPtr>& maps, const std::string& out_dir_path, const Config::DIConfig::Ptr& config_ptr, const std::string& kml_dir_path, bool count_points, bool mapped_input, bool time_stages, bool staged, bool async_write, unsigned n_shards, bool multi_trip) :
+        SingleBatchCSV(file_path),
+        config_ptr_(config_ptr),
+        out_dir_path_(out_dir_path),
+        kml_dir_path_(kml_dir_path), 
+        count_points_(count_points),
+        mapped_input_(mapped_input),
+        maps_(maps),
+        time_stages_(time_stages),
+        staged_(staged),
+        async_write_(async_write || n_shards > 0),
+        n_shards_(n_shards),
+        columnar_output_(false),
+        output_compression_(compression::Format::kNone),
+        segment_points_(0)
+        {
+            SetUp(multi_trip);
+        }
 
-            quad_ptr_ = std::make_shared<Quad>(sw, ne);
-            shapes::CSVInputFactory shape_factory(quad_file_path);
-            shape_factory.make_shapes();
+    void DICSV::SetUp(bool multi_trip) {
+        config_ptr_->PrintConfig(std::cerr);
 
-            for (auto& edge_ptr : shape_factory.get_edges()) {
-                Quad::insert(quad_ptr_, std::dynamic_pointer_cast<const geo::Entity>(edge_ptr)); 
-            }
+        // Without a configured seed every run draws its own, so the thresholds cannot be recomputed from the UIDs.
+        run_seed_ = config_ptr_->IsRandSeedSet() ? config_ptr_->GetRandSeed() : PrivacyIntervalFinder::random_seed();
+
+        if (multi_trip) {
+            SetMultiTrip(config_ptr_->GetUIDFields(), config_ptr_->GetLatField(), config_ptr_->GetLonField());
+        }
+
+        if (maps_.empty()) {
+            throw std::invalid_argument("A de-identification run needs a map.");
         }
+
+        contexts_.clear();
+
+        for (auto& map_ptr : maps_) {
+            contexts_.push_back(map_ptr->GetContext(config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()));
+        }
+    }
     
+    void DICSV::SetColumnarOutput(bool columnar_output) {
+        columnar_output_ = columnar_output;
+    }
+
+    void DICSV::SetTracePath(const std::string& trace_path) {
+        trace_path_ = trace_path;
+    }
+
+    void DICSV::SetGeofence(const geofence::ZoneIndex::CPtr& zones) {
+        zones_ = zones;
+    }
+
+    void DICSV::SetTripSegments(std::size_t segment_points) {
+        segment_points_ = segment_points;
+    }
+
+    unsigned DICSV::SegmentCount(std::size_t n_points) const {
+        if (segment_points_ == 0 || n_points < 2 * segment_points_) {
+            return 1;
+        }
+
+        std::size_t n_cpus = std::max(1u, std::thread::hardware_concurrency());
+
+        return static_cast<unsigned>(std::min(n_cpus, n_points / segment_points_));
+    }
+
+    void DICSV::SetOutputCompression(compression::Format format) {
+        if (!compression::is_supported(format)) {
+            throw std::invalid_argument("The requested output compression is not supported by this build.");
+        }
+
+        output_compression_ = format;
+    }
+
+    void DICSV::SetMapReplicas(const std::vector<std::vector<ResidentMap::CPtr>>& node_maps) {
+        node_contexts_.assign(node_maps.size(), std::vector<MapContext::CPtr>());
+
+        for (std::size_t node = 0; node < node_maps.size(); ++node) {
+            if (node_maps[node].empty()) {
+                continue;
+            }
+
+            if (node_maps[node].size() != maps_.size()) {
+                throw std::invalid_argument("Every map replica must hold the same maps as the shared maps.");
+            }
+
+            // fit areas built again for other fit parameters are placed by this thread, not on the node.
+            for (auto& map_ptr : node_maps[node]) {
+                node_contexts_[node].push_back(map_ptr->GetContext(config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()));
+            }
+        }
+    }
+
     void DICSV::Init(unsigned n_used_threads) {
+        if (GetJournal() && n_shards_ > 0) {
+            // a restarted run writes the shard files anew, losing the trips it skips.
+            throw std::invalid_argument("A completion journal cannot be used with sharded output.");
+        }
+
+        if (columnar_output_ && async_write_) {
+            // the async writer collects CSV text.
+            throw std::invalid_argument("Columnar output cannot be used with async or sharded output.");
+        }
+
+        if (output_compression_ != compression::Format::kNone && (columnar_output_ || async_write_)) {
+            throw std::invalid_argument("Compressed output can only be used with CSV trip files.");
+        }
+
         SingleBatchCSV::Init(n_used_threads);
+        unjournaled_.assign(n_used_threads, std::vector<Journal::Entry>());
+
+        if (async_write_) {
+            async_writer_ = std::make_shared<output::AsyncWriter>(out_dir_path_, BSMP1::kCSVHeader, n_shards_);
+        }
+
+        if (time_stages_) {
+            for (unsigned i = 0; i < n_used_threads; ++i) {
+                timers_.push_back(std::make_shared<instrument::StageTimer>());
+            }
+        }
+
+        traces_.clear();
+
+        if (!trace_path_.empty()) {
+            for (unsigned i = 0; i < n_used_threads; ++i) {
+                traces_.push_back(std::make_shared<instrument::TraceBuffer>(i));
+            }
+        }
 
         if (!count_points_) {
             return;
@@ -148,115 +575,127 @@ namespace DIMulti {
         }
     }
 
-    trajectory::Trajectory DICSV::DeIdentify(trajectory::Trajectory& traj, const std::string& uid) const {
-        bool plot_kml = config_ptr_->IsPlotKML();
-        std::string shape_in_file_path, shape_out_file_path;
-    
-        ErrorCorrector ec(50);
-        ec.correct_error(traj, uid);
+    void DICSV::AnalyzePoints(trajectory::Trajectory& traj, MapFitter& mf, ImplicitMapFitter& imf, IntersectionCounter& ic, Detector::TurnAround& tad, Detector::Stop& stop_detector, instrument::StageClock& stage_clock) const {
+        if (!staged_) {
+            // One pass over the trip for all the point-local stages.
+            PointPipeline pipeline{mf, imf, ic, tad, stop_detector};
+            pipeline.run(traj, SegmentCount(traj.size()));
+            stage_clock.lap(instrument::Stage::kPointAnalysis, traj.size());
+
+            return;
+        }
 
-        MapFitter mf{quad_ptr_, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()};
-        mf.fit(traj);
+        mf.fit(traj, SegmentCount(traj.size()));
+        stage_clock.lap(instrument::Stage::kMapFit, traj.size());
 
-        ImplicitMapFitter imf{config_ptr_->GetHeadingGroups(), config_ptr_->GetMinEdgeTripPoints()};
         imf.fit(traj);
+        stage_clock.lap(instrument::Stage::kImplicitMapFit, traj.size());
 
-        IntersectionCounter ic{};
         ic.count_intersections(traj);
+        stage_clock.lap(instrument::Stage::kIntersectionCount, traj.size());
 
-        Detector::TurnAround tad{config_ptr_->GetTAMaxQSize(), config_ptr_->GetTAAreaWidth(), config_ptr_->GetTAMaxSpeed(), config_ptr_->GetTAHeadingDelta()};
-        trajectory::Interval::PtrList ta_critical_intervals = tad.find_turn_arounds(traj);
+        tad.find_turn_arounds(traj);
+        stage_clock.lap(instrument::Stage::kTurnAround, traj.size());
 
-        Detector::Stop stop_detector{config_ptr_->GetStopMaxTime(), config_ptr_->GetStopMinDistance(), config_ptr_->GetStopMaxSpeed()};
-        trajectory::Interval::PtrList stop_critical_intervals = stop_detector.find_stops( traj );
+        stop_detector.find_stops( traj );
+        stage_clock.lap(instrument::Stage::kStop, traj.size());
+    }
 
-        StartEndIntervals sei;
+    template <typename Counter>
+    trajectory::Trajectory DICSV::MakeTrajectory(const FileInfo& item, std::string& uid, Counter& point_counter) const {
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory traj;
+        const TripRangeInfo* range_info = dynamic_cast<const TripRangeInfo*>(&item);
 
-        IntervalMarker im( { ta_critical_intervals, stop_critical_intervals, sei.get_start_end_intervals( traj ) } );
-        im.mark_trajectory( traj );
+        if (range_info) {
+            // the trip is named by the UID fields that delimit it in the file.
+            const trip_index::TripRange& range = range_info->GetRange();
+            traj = factory.make_mapped_trajectory(range_info->GetFile(), range.begin, range.end, point_counter);
+            uid = range.uid;
 
-        trajectory::Interval::PtrList priv_intervals;
+            return traj;
+        }
 
-        PrivacyIntervalFinder pif(config_ptr_->GetMinDirectDistance(), 
-                                  config_ptr_->GetMinManhattanDistance(), 
-                                  config_ptr_->GetMinOutDegree(), 
-                                  config_ptr_->GetMaxDirectDistance(), 
-                                  config_ptr_->GetMaxManhattanDistance(), 
-                                  config_ptr_->GetMaxOutDegree(), 
-                                  config_ptr_->GetRandDirectDistance(), 
-                                  config_ptr_->GetRandManhattanDistance(), 
-                                  config_ptr_->GetRandOutDegree());
-        priv_intervals = pif.find_intervals( traj );
+        if (columnar::is_columnar_path(item.GetFilePath())) {
+            BSMP1::BSMP1ColumnarTrajectoryFactory columnar_factory;
+            traj = columnar_factory.make_trajectory(item.GetFilePath(), point_counter);
+            uid = columnar_factory.get_uid();
 
-        PrivacyIntervalMarker pim({ priv_intervals });
-        pim.mark_trajectory(traj);
+            return traj;
+        }
 
-        if (plot_kml) {
-            std::string kml_path;
-    
-            if (kml_dir_path_.empty()) {
-                kml_path = uid + ".di.kml";
-            } else {
-                kml_path = kml_dir_path_ + "/" + uid + ".di.kml";
-            }
-    
-            std::ofstream out_file(kml_path, std::ofstream::trunc);
-    
-            if (out_file.fail()) {
-                throw std::invalid_argument("Could not open kml output file: " + kml_path);
-            }
-    
-            KML::File kml_file(out_file, uid);
-    
-            kml_file.write_poly_style( "explicit_boxes", 0xff990000, 1 );
-            kml_file.write_poly_style( "implicit_boxes", 0xff0033ff, 1 );
-            kml_file.write_line_style( "ci_intervals", 0xffff00ff, 7 );
-            kml_file.write_line_style( "priv_intervals", 0xffffff00, 5 );
-            kml_file.write_trajectory( traj, true );
-            kml_file.write_areas(mf.area_set, "explicit_boxes");
-            kml_file.write_areas(imf.area_set, "implicit_boxes");
-            kml_file.write_intervals( stop_critical_intervals, traj, "ci_intervals", "stop_marker_style" );
-            kml_file.write_intervals( ta_critical_intervals, traj, "ci_intervals", "turnaround_marker_style" );
-            kml_file.write_intervals( priv_intervals, traj, "priv_intervals" );
-            kml_file.finish();
-    
-            out_file.close();
+        if (mapped_input_) {
+            traj = factory.make_mapped_trajectory(item.GetFilePath(), point_counter);
+        } else {
+            traj = factory.make_trajectory(item.GetFilePath(), point_counter);
         }
 
-        DeIdentifier di;
+        uid = factory.get_uid();
 
-        return di.de_identify(traj);
+        return traj;
     }
 
-    trajectory::Trajectory DICSV::DeIdentify(trajectory::Trajectory& traj, const std::string& uid, instrument::PointCounter& point_counter) const {
+    const std::vector<MapContext::CPtr>& DICSV::ThreadContexts(unsigned thread_num) const {
+        unsigned node = ThreadNode(thread_num);
+
+        if (node < node_contexts_.size() && !node_contexts_[node].empty()) {
+            return node_contexts_[node];
+        }
+
+        return contexts_;
+    }
+
+    const MapContext& DICSV::RouteTrip(const trajectory::Trajectory& traj, const std::vector<MapContext::CPtr>& contexts) const {
+        // A single map needs no bounding box.
+        if (contexts.size() == 1 || traj.empty()) {
+            return *contexts.front();
+        }
+
+        return *MapContext::route(contexts, MapContext::trip_bounds(traj));
+    }
+
+    MapFitter DICSV::MakeMapFitter(const MapContext& context) const {
+        // The areas are only collected to plot them.
+        return MapFitter{context, config_ptr_->IsPlotKML(), config_ptr_->IsMapFitPlanar(), config_ptr_->GetMapFitPlanarTolerance()};
+    }
+
+    template <typename Counter>
+    void DICSV::DeIdentify(trajectory::Trajectory& traj, const std::string& uid, const std::vector<MapContext::CPtr>& contexts, trajectory::PointSinkFactory& traj_writer, PrivacyIntervalFinder::RandomEngine& rand_engine, Counter& point_counter, instrument::StageClock& stage_clock) const {
         bool plot_kml = config_ptr_->IsPlotKML();
         std::string shape_in_file_path, shape_out_file_path;
     
-        ErrorCorrector ec(50);
+        ErrorCorrector ec(config_ptr_->GetECSampleSize(), config_ptr_->IsECSlidingWindow());
         ec.correct_error(traj, uid, point_counter);
+        stage_clock.lap(instrument::Stage::kErrorCorrect, traj.size());
 
-        MapFitter mf{quad_ptr_, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()};
-        mf.fit(traj);
-
-        ImplicitMapFitter imf{config_ptr_->GetHeadingGroups(), config_ptr_->GetMinEdgeTripPoints()};
-        imf.fit(traj);
-
+        const MapContext& context = RouteTrip(traj, contexts);
+        MapFitter mf = MakeMapFitter(context);
+        ImplicitMapFitter imf{config_ptr_->GetHeadingGroups(), config_ptr_->GetMinEdgeTripPoints(), plot_kml};
         IntersectionCounter ic{};
-        ic.count_intersections(traj);
+        Detector::TurnAround tad{config_ptr_->GetTAMaxQSize(), config_ptr_->GetTAAreaWidth(), config_ptr_->GetTAMaxSpeed(), config_ptr_->GetTAHeadingDelta(), plot_kml};
+        Detector::Stop stop_detector{config_ptr_->GetStopMaxTime(), config_ptr_->GetStopMinDistance(), config_ptr_->GetStopMaxSpeed(), context.get_stop_excluded_highways()};
 
-        Detector::TurnAround tad{config_ptr_->GetTAMaxQSize(), config_ptr_->GetTAAreaWidth(), config_ptr_->GetTAMaxSpeed(), config_ptr_->GetTAHeadingDelta()};
-        trajectory::Interval::PtrList ta_critical_intervals = tad.find_turn_arounds(traj);
+        AnalyzePoints(traj, mf, imf, ic, tad, stop_detector, stage_clock);
 
-        Detector::Stop stop_detector{config_ptr_->GetStopMaxTime(), config_ptr_->GetStopMinDistance(), config_ptr_->GetStopMaxSpeed()};
-        trajectory::Interval::PtrList stop_critical_intervals = stop_detector.find_stops( traj );
+        trajectory::Interval::PtrList ta_critical_intervals = tad.get_turn_arounds();
+        trajectory::Interval::PtrList stop_critical_intervals = stop_detector.get_stops();
+        trajectory::Interval::PtrList geofence_intervals;
+
+        if (zones_) {
+            geofence_intervals = zones_->find_intervals(traj);
+            stage_clock.lap(instrument::Stage::kGeofence, traj.size());
+        }
 
         StartEndIntervals sei;
 
-        IntervalMarker im( { ta_critical_intervals, stop_critical_intervals, sei.get_start_end_intervals( traj ) } );
+        IntervalMarker im( { ta_critical_intervals, stop_critical_intervals, geofence_intervals, sei.get_start_end_intervals( traj ) } );
         im.mark_trajectory( traj );
+        stage_clock.lap(instrument::Stage::kIntervalMark, traj.size());
 
         trajectory::Interval::PtrList priv_intervals;
 
+        // Seed from the UID so the thresholds of a trip do not depend on the thread or the order of the trips.
+        rand_engine.seed(PrivacyIntervalFinder::trip_seed(run_seed_, uid));
         PrivacyIntervalFinder pif(config_ptr_->GetMinDirectDistance(), 
                                   config_ptr_->GetMinManhattanDistance(), 
                                   config_ptr_->GetMinOutDegree(), 
@@ -265,11 +704,14 @@ namespace DIMulti {
                                   config_ptr_->GetMaxOutDegree(), 
                                   config_ptr_->GetRandDirectDistance(), 
                                   config_ptr_->GetRandManhattanDistance(), 
-                                  config_ptr_->GetRandOutDegree());
+                                  config_ptr_->GetRandOutDegree(),
+                                  &rand_engine);
         priv_intervals = pif.find_intervals( traj );
+        stage_clock.lap(instrument::Stage::kPrivacyInterval, traj.size());
 
         PrivacyIntervalMarker pim({ priv_intervals });
         pim.mark_trajectory(traj);
+        stage_clock.lap(instrument::Stage::kIntervalMark, traj.size());
 
         if (plot_kml) {
             std::string kml_path;
@@ -297,51 +739,183 @@ namespace DIMulti {
             kml_file.write_areas(imf.area_set, "implicit_boxes");
             kml_file.write_intervals( stop_critical_intervals, traj, "ci_intervals", "stop_marker_style" );
             kml_file.write_intervals( ta_critical_intervals, traj, "ci_intervals", "turnaround_marker_style" );
+            kml_file.write_intervals( geofence_intervals, traj, "ci_intervals" );
             kml_file.write_intervals( priv_intervals, traj, "priv_intervals" );
             kml_file.finish();
     
             out_file.close();
+            stage_clock.lap(instrument::Stage::kKML, traj.size());
         }
 
+        // the retained points go straight to the output file; the filter is timed with the write.
+        std::unique_ptr<trajectory::PointSink> sink = traj_writer.open_trajectory(uid, true);
         DeIdentifier di;
+        uint64_t n_written = di.de_identify(traj, *sink, point_counter);
+        sink->close();
+        stage_clock.lap(instrument::Stage::kWrite, n_written);
+    }
 
-        return di.de_identify(traj, point_counter);
+    template <typename Counter>
+    void DICSV::ProcessTrip(const FileInfo& item, std::string& uid, trajectory::Trajectory& traj, const std::vector<MapContext::CPtr>& contexts, trajectory::PointSinkFactory& traj_writer, PrivacyIntervalFinder::RandomEngine& rand_engine, Counter& point_counter, instrument::StageClock& stage_clock) const {
+        traj = MakeTrajectory(item, uid, point_counter);
+        stage_clock.lap(instrument::Stage::kParse, traj.size());
+
+        DeIdentify(traj, uid, contexts, traj_writer, rand_engine, point_counter, stage_clock);
     }
 
     void DICSV::Thread(unsigned thread_num, MultiThread::SharedQueue<FileInfo::Ptr>* q) {
-        SingleFileInfo::Ptr trip_file_ptr;
+        // The points, intervals and areas of a trip come from this thread's arena; declared first so it outlives them.
+        memory::Arena arena;
+        memory::Arena::Scope arena_scope(arena);
+        FileInfo::Ptr trip_file_ptr;
         trajectory::Trajectory traj;
-        BSMP1::BSMP1CSVTrajectoryWriter traj_writer(out_dir_path_);
+        std::string uid;
+        BSMP1::BSMP1CSVTrajectoryWriter file_writer(out_dir_path_, output_compression_);
+        BSMP1::BSMP1ColumnarTrajectoryWriter columnar_writer(out_dir_path_);
+        std::unique_ptr<output::BufferedTrajectoryWriter> buffered_writer;
 
-        while ((trip_file_ptr = std::dynamic_pointer_cast<SingleFileInfo>(q->pop())) != nullptr) {
-            if (count_points_) {
-                try {
-                    BSMP1::BSMP1CSVTrajectoryFactory factory;
-                    std::shared_ptr<instrument::PointCounter> point_counter_ptr = counters_[thread_num];
-                    traj = factory.make_trajectory(trip_file_ptr->GetFilePath(), *point_counter_ptr);
-                    traj_writer.write_trajectory(DeIdentify(traj, factory.get_uid(), *point_counter_ptr), factory.get_uid(), true);
-                } catch (std::exception& e) {
-                    std::cerr << "DeIdentification error: " << e.what() << std::endl;
-    
-                    continue;
+        if (async_write_) {
+            buffered_writer.reset(new output::BufferedTrajectoryWriter(*async_writer_));
+        }
+
+        PrivacyIntervalFinder::RandomEngine rand_engine;
+        trajectory::PointSinkFactory& traj_writer = buffered_writer ? static_cast<trajectory::PointSinkFactory&>(*buffered_writer) : columnar_output_ ? static_cast<trajectory::PointSinkFactory&>(columnar_writer) : file_writer;
+        instrument::StageTimer* stage_timer = time_stages_ ? timers_[thread_num].get() : nullptr;
+        instrument::TraceBuffer* trace = trace_path_.empty() ? nullptr : traces_[thread_num].get();
+        instrument::StageClock stage_clock(stage_timer, trace);
+        const Journal::Ptr& journal = GetJournal();
+        const std::vector<MapContext::CPtr>& contexts = ThreadContexts(thread_num);
+
+        while (true) {
+            {
+                instrument::TraceScope wait_span(trace, "queue_wait", "queue");
+                trip_file_ptr = q->pop();
+            }
+
+            if (trip_file_ptr == nullptr) {
+                break;
+            }
+
+            instrument::TraceScope trip_span(trace, "trip", "trip");
+
+            if (trace) {
+                trip_span.set_detail(ItemKey(*trip_file_ptr));
+            }
+
+            // release the previous trip so its arena memory is reused.
+            traj.clear();
+            arena.reset();
+            stage_clock.reset();
+
+            // the trip is counted on its own so that its journal entry holds its counts.
+            instrument::PointCounter trip_counter;
+            instrument::NullCounter null_counter;
+            bool done = true;
+
+            try {
+                if (count_points_ || journal) {
+                    ProcessTrip(*trip_file_ptr, uid, traj, contexts, traj_writer, rand_engine, trip_counter, stage_clock);
+                } else {
+                    ProcessTrip(*trip_file_ptr, uid, traj, contexts, traj_writer, rand_engine, null_counter, stage_clock);
                 }
-            } else {
+            } catch (std::exception& e) {
+                std::cerr << "DeIdentification error: " << e.what() << std::endl;
+                done = false;
+            }
+
+            if (count_points_) {
+                // the points of a failed trip are still counted.
+                *counters_[thread_num] = *counters_[thread_num] + trip_counter;
+            }
+
+            if (done && journal) {
+                Journal::Entry entry{ItemKey(*trip_file_ptr), uid, columnar_output_ ? columnar_writer.output_path(uid) : file_writer.output_path(uid), trip_counter};
+
                 try {
-                    BSMP1::BSMP1CSVTrajectoryFactory factory;
-                    traj = factory.make_trajectory(trip_file_ptr->GetFilePath());
-                    traj_writer.write_trajectory(DeIdentify(traj, factory.get_uid()), factory.get_uid(), true);
+                    if (async_write_) {
+                        // only journaled once the writer has closed the file.
+                        unjournaled_[thread_num].push_back(entry);
+                    } else {
+                        journal->Record(entry);
+                    }
                 } catch (std::exception& e) {
-                    std::cerr << "DeIdentification error: " << e.what() << std::endl;
-    
-                    continue;
+                    std::cerr << "Journal error: " << e.what() << std::endl;
                 }
             }
         }
+
+        if (buffered_writer) {
+            try {
+                buffered_writer->flush();
+            } catch (std::exception& e) {
+                std::cerr << "DeIdentification error: " << e.what() << std::endl;
+            }
+        }
     }
 
     void DICSV::Close(void) {
         SingleBatchCSV::Close();
 
+        if (async_writer_) {
+            try {
+                async_writer_->close();
+
+                for (auto& entries : unjournaled_) {
+                    for (auto& entry : entries) {
+                        GetJournal()->Record(entry);
+                    }
+                }
+            } catch (std::exception& e) {
+                std::cerr << "Output error: " << e.what() << std::endl;
+            }
+        }
+
+        unjournaled_.clear();
+
+        if (!traces_.empty()) {
+            // the output is complete either way; a trace that cannot be written is only reported.
+            std::ofstream trace_file(trace_path_, std::ofstream::trunc);
+
+            if (trace_file.fail()) {
+                std::cerr << "Could not open the trace file: " << trace_path_ << std::endl;
+            } else {
+                instrument::TraceBuffer::write_chrome_trace(trace_file, traces_, "cv_di");
+                std::cerr << "Trace written to: " << trace_path_ << std::endl;
+            }
+
+            traces_.clear();
+        }
+
+        if (GetJournal()) {
+            std::cerr << "Journal: " << GetJournal()->GetResumedCount() << " trips done before this run, " << GetJournal()->GetRecordedCount() << " trips recorded." << std::endl;
+        }
+
+        if (time_stages_) {
+            instrument::StageTimer stage_summary;
+
+            for (auto& stage_timer_ptr : timers_) {
+                stage_summary = stage_summary + *stage_timer_ptr;
+            }
+
+            std::cerr << "********************************** Stage Summary ****************************************" << std::endl;
+            std::cerr << "stage,calls,points,wall_seconds,cpu_seconds" << std::endl;
+            std::cerr << stage_summary;
+
+            std::vector<MapContext::CPtr> all_contexts = contexts_;
+
+            for (auto& contexts : node_contexts_) {
+                all_contexts.insert(all_contexts.end(), contexts.begin(), contexts.end());
+            }
+
+            for (auto& context : all_contexts) {
+                if (context->get_tiled_map()) {
+                    std::cerr << "map tile loads: " << context->get_tiled_map()->load_count() << ", resident bytes: " << context->get_tiled_map()->resident_size() << std::endl;
+                }
+            }
+
+            std::cerr << "*****************************************************************************************" << std::endl;
+        }
+
         if (!count_points_) {
             return;
         }
@@ -0,0 +1,185 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "journal.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace DIMulti {
+    uint64_t HashKey(const std::string& key) {
+        uint64_t hash = 14695981039346656037ULL;
+
+        for (unsigned char c : key) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+
+        return hash;
+    }
+
+    bool InPartition(const std::string& key, unsigned node_index, unsigned n_nodes) {
+        return n_nodes <= 1 || HashKey(key) % n_nodes == node_index;
+    }
+
+    Journal::Journal(const std::string& file_path) :
+        n_resumed_(0),
+        n_recorded_(0)
+    {
+        std::string content;
+        std::ifstream in(file_path, std::ios::binary);
+
+        if (in) {
+            std::ostringstream buffer;
+            buffer << in.rdbuf();
+            content = buffer.str();
+            in.close();
+        }
+
+        // only whole lines were completed; cut off the tail a stopped run may have left.
+        std::size_t valid_size = content.rfind('\n');
+        valid_size = valid_size == std::string::npos ? 0 : valid_size + 1;
+
+        if (valid_size < content.size()) {
+            if (::truncate(file_path.c_str(), static_cast<off_t>(valid_size)) != 0) {
+                throw std::invalid_argument("Could not repair journal: " + file_path);
+            }
+
+            content.resize(valid_size);
+        }
+
+        std::istringstream lines(content);
+        std::string line;
+        Entry entry;
+
+        while (std::getline(lines, line)) {
+            if (ParseEntry(line, entry) && done_.insert(entry.key).second) {
+                ++n_resumed_;
+            }
+        }
+
+        file_.open(file_path, std::ios::binary | std::ios::app);
+
+        if (!file_) {
+            throw std::invalid_argument("Could not open journal: " + file_path);
+        }
+    }
+
+    bool Journal::IsDone(const std::string& key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return done_.count(key) > 0;
+    }
+
+    void Journal::Record(const Entry& entry) {
+        std::ostringstream line;
+        line << entry.key << '\t' << entry.uid << '\t' << entry.out_path << '\t' << entry.counter << '\n';
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        file_ << line.str();
+        file_.flush();
+
+        if (!file_) {
+            throw std::invalid_argument("Could not write journal entry: " + entry.key);
+        }
+
+        done_.insert(entry.key);
+        ++n_recorded_;
+    }
+
+    std::size_t Journal::GetResumedCount(void) const {
+        return n_resumed_;
+    }
+
+    std::size_t Journal::GetRecordedCount(void) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return n_recorded_;
+    }
+
+    bool Journal::ParseEntry(const std::string& line, Entry& entry) {
+        StrVector fields = string_utilities::split(line, '\t');
+
+        if (fields.size() != 4 || fields[0].empty()) {
+            return false;
+        }
+
+        StrVector counts = string_utilities::split(fields[3], ',');
+
+        if (counts.size() != 7) {
+            return false;
+        }
+
+        uint64_t values[7];
+
+        try {
+            for (std::size_t i = 0; i < counts.size(); ++i) {
+                std::size_t n_used = 0;
+                values[i] = std::stoull(counts[i], &n_used);
+
+                if (n_used != counts[i].size()) {
+                    return false;
+                }
+            }
+        } catch (std::logic_error&) {
+            return false;
+        }
+
+        entry.key = fields[0];
+        entry.uid = fields[1];
+        entry.out_path = fields[2];
+        entry.counter = instrument::PointCounter(values[0], values[1], values[2], values[3], values[4], values[5], values[6]);
+
+        return true;
+    }
+
+    instrument::PointCounter Journal::Merge(const std::vector<std::string>& journal_paths, std::size_t& n_trips) {
+        instrument::PointCounter summary;
+        std::unordered_set<std::string> seen;
+
+        for (const std::string& journal_path : journal_paths) {
+            std::ifstream in(journal_path);
+
+            if (!in) {
+                throw std::invalid_argument("Could not read journal: " + journal_path);
+            }
+
+            std::string line;
+            Entry entry;
+
+            // a partial last line fails to parse or, lacking its newline, is skipped.
+            while (std::getline(in, line)) {
+                if (in.eof()) {
+                    break;
+                }
+
+                if (ParseEntry(line, entry) && seen.insert(entry.key).second) {
+                    summary = summary + entry.counter;
+                }
+            }
+        }
+
+        n_trips = seen.size();
+
+        return summary;
+    }
+}
@@ -0,0 +1,180 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "manifest.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+
+namespace DIMulti {
+    bool ParseManifestLine(const std::string& line, ManifestEntry& entry) {
+        StrVector items = string_utilities::split(line, ':');
+
+        entry = ManifestEntry();
+
+        if (items.size() < 1 || items[0].empty()) {
+            return false;
+        }
+
+        entry.file_path = items[0];
+
+        if (items.size() > 1) {
+            entry.has_aux = true;
+            entry.aux_data = items[1];
+        }
+
+        if (items.size() > 2 && !items[2].empty() && std::all_of(items[2].begin(), items[2].end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; })) {
+            try {
+                entry.size = std::stoull(items[2]);
+                entry.has_size = true;
+            } catch (std::out_of_range&) {
+                // too large to be a size; the file is scanned.
+            }
+        }
+
+        return true;
+    }
+
+    void ScanManifestEntry(ManifestEntry& entry) {
+        if (entry.has_size) {
+            return;
+        }
+
+        std::ifstream file(entry.file_path, std::ios::binary);
+
+        if (file.fail()) {
+            entry.error = "Could not open file: " + entry.file_path;
+
+            return;
+        }
+
+        // the threads are balanced by the decompressed size of a compressed trip.
+        entry.size = compression::size_hint(file);
+        entry.has_size = true;
+    }
+
+    std::string FormatManifestLine(const ManifestEntry& entry) {
+        if (!entry.has_size) {
+            return entry.has_aux ? entry.file_path + ":" + entry.aux_data : entry.file_path;
+        }
+
+        return entry.file_path + ":" + entry.aux_data + ":" + std::to_string(entry.size);
+    }
+
+    // ManifestScanner
+    ManifestScanner::ManifestScanner(const IFSPtr& file, unsigned n_threads, std::size_t read_ahead) :
+        file_(file),
+        read_ahead_(read_ahead),
+        n_read_(0),
+        n_returned_(0),
+        end_(false),
+        stop_(false)
+    {
+        if (n_threads == 0 || read_ahead == 0) {
+            throw std::invalid_argument("A manifest scan needs at least one thread and one entry of read ahead.");
+        }
+
+        for (unsigned i = 0; i < n_threads; ++i) {
+            threads_.push_back(std::thread(&ManifestScanner::Scan, this));
+        }
+    }
+
+    ManifestScanner::~ManifestScanner() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+
+        space_cond_.notify_all();
+
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    bool ManifestScanner::Next(ManifestEntry& entry) {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (true) {
+            scanned_cond_.wait(lock, [this]() { return scanned_.count(n_returned_) > 0 || (end_ && n_returned_ == n_read_); });
+
+            auto it = scanned_.find(n_returned_);
+
+            if (it == scanned_.end()) {
+                return false;
+            }
+
+            ++n_returned_;
+            space_cond_.notify_one();
+
+            if (it->second.file_path.empty()) {
+                scanned_.erase(it);
+
+                continue;
+            }
+
+            entry = std::move(it->second);
+            scanned_.erase(it);
+
+            return true;
+        }
+    }
+
+    void ManifestScanner::Scan() {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (true) {
+            space_cond_.wait(lock, [this]() { return stop_ || end_ || n_read_ < n_returned_ + read_ahead_; });
+
+            if (stop_ || end_) {
+                return;
+            }
+
+            // the batch file is read under the lock, so the line numbers follow the file.
+            std::string line;
+
+            if (!std::getline(*file_, line)) {
+                end_ = true;
+                scanned_cond_.notify_all();
+                space_cond_.notify_all();
+
+                return;
+            }
+
+            uint64_t line_number = n_read_++;
+            lock.unlock();
+
+            ManifestEntry entry;
+
+            if (ParseManifestLine(line, entry)) {
+                try {
+                    ScanManifestEntry(entry);
+                } catch (std::exception& e) {
+                    entry.error = e.what();
+                }
+            }
+
+            lock.lock();
+            scanned_[line_number] = std::move(entry);
+            scanned_cond_.notify_all();
+        }
+    }
+}
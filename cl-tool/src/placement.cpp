@@ -0,0 +1,232 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "placement.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+namespace MultiThread {
+    namespace {
+        const std::string kNodeDir = "/sys/devices/system/node";
+
+        /**
+         * \brief Return the CPUs the process may run on, or an empty list when they cannot be read.
+         */
+        std::vector<unsigned> AllowedCpus(void) {
+            std::vector<unsigned> cpus;
+
+#ifdef __linux__
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+
+            if (::sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+                for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &cpu_set)) {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+#endif
+
+            return cpus;
+        }
+
+        /**
+         * \brief Return the CPUs of each node in /sys, or an empty list when the directory cannot be read.
+         */
+        std::vector<std::vector<unsigned>> NodeCpuLists(void) {
+            std::vector<std::vector<unsigned>> node_cpus;
+
+#ifdef __linux__
+            DIR* dir = ::opendir(kNodeDir.c_str());
+
+            if (dir == nullptr) {
+                return node_cpus;
+            }
+
+            std::vector<unsigned> nodes;
+
+            for (dirent* entry = ::readdir(dir); entry != nullptr; entry = ::readdir(dir)) {
+                std::string name = entry->d_name;
+
+                if (name.size() > 4 && name.compare(0, 4, "node") == 0 && name.find_first_not_of("0123456789", 4) == std::string::npos) {
+                    nodes.push_back(static_cast<unsigned>(std::stoul(name.substr(4))));
+                }
+            }
+
+            ::closedir(dir);
+            std::sort(nodes.begin(), nodes.end());
+
+            for (unsigned node : nodes) {
+                std::ifstream file(kNodeDir + "/node" + std::to_string(node) + "/cpulist");
+                std::string cpu_list;
+
+                if (!std::getline(file, cpu_list)) {
+                    continue;
+                }
+
+                try {
+                    node_cpus.push_back(ParseCpuList(cpu_list));
+                } catch (std::invalid_argument&) {
+                    return std::vector<std::vector<unsigned>>();
+                }
+            }
+#endif
+
+            return node_cpus;
+        }
+    }
+
+    std::vector<unsigned> ParseCpuList(const std::string& cpu_list) {
+        std::vector<unsigned> cpus;
+        std::istringstream list_stream(cpu_list);
+        std::string range;
+
+        while (std::getline(list_stream, range, ',')) {
+            range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+
+            if (range.empty()) {
+                continue;
+            }
+
+            std::size_t dash = range.find('-');
+
+            try {
+                std::size_t n_parsed = 0;
+                unsigned first = static_cast<unsigned>(std::stoul(range.substr(0, dash), &n_parsed));
+                unsigned last = first;
+
+                if (n_parsed != range.substr(0, dash).size()) {
+                    throw std::invalid_argument(range);
+                }
+
+                if (dash != std::string::npos) {
+                    last = static_cast<unsigned>(std::stoul(range.substr(dash + 1), &n_parsed));
+
+                    if (n_parsed != range.size() - dash - 1 || last < first) {
+                        throw std::invalid_argument(range);
+                    }
+                }
+
+                for (unsigned cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            } catch (std::logic_error&) {
+                throw std::invalid_argument("Malformed CPU list: " + cpu_list);
+            }
+        }
+
+        return cpus;
+    }
+
+    bool PinCurrentThread(const std::vector<unsigned>& cpus) {
+#ifdef __linux__
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+
+        for (unsigned cpu : cpus) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &cpu_set);
+            }
+        }
+
+        return CPU_COUNT(&cpu_set) > 0 && ::sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
+#else
+        (void) cpus;
+        return false;
+#endif
+    }
+
+    Topology::CPtr Topology::Detect() {
+        std::vector<unsigned> allowed = AllowedCpus();
+        std::vector<std::vector<unsigned>> node_cpus = NodeCpuLists();
+
+        if (!allowed.empty()) {
+            // Only the CPUs this process may use count.
+            for (auto& cpus : node_cpus) {
+                cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&allowed](unsigned cpu) { return !std::binary_search(allowed.begin(), allowed.end(), cpu); }), cpus.end());
+            }
+        }
+
+        bool has_cpu = std::any_of(node_cpus.begin(), node_cpus.end(), [](const std::vector<unsigned>& cpus) { return !cpus.empty(); });
+
+        if (!has_cpu) {
+            // One node holding every CPU.
+            if (allowed.empty()) {
+                for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+                    allowed.push_back(cpu);
+                }
+            }
+
+            node_cpus.assign(1, allowed);
+        }
+
+        return std::make_shared<const Topology>(node_cpus);
+    }
+
+    Topology::Topology(const std::vector<std::vector<unsigned>>& node_cpus) {
+        for (auto& cpus : node_cpus) {
+            if (!cpus.empty()) {
+                node_cpus_.push_back(cpus);
+            }
+        }
+
+        if (node_cpus_.empty()) {
+            throw std::invalid_argument("A topology needs at least one CPU.");
+        }
+    }
+
+    unsigned Topology::NodeCount() const {
+        return static_cast<unsigned>(node_cpus_.size());
+    }
+
+    const std::vector<unsigned>& Topology::NodeCpus(unsigned node) const {
+        return node_cpus_.at(node);
+    }
+
+    unsigned Topology::ThreadNode(unsigned thread_number) const {
+        return thread_number % NodeCount();
+    }
+
+    unsigned Topology::ThreadCpu(unsigned thread_number) const {
+        const std::vector<unsigned>& cpus = node_cpus_[ThreadNode(thread_number)];
+
+        return cpus[(thread_number / NodeCount()) % cpus.size()];
+    }
+
+    std::vector<unsigned> Topology::UsedNodes(unsigned n_threads) const {
+        std::vector<unsigned> nodes;
+
+        for (unsigned node = 0; node < std::min(n_threads, NodeCount()); ++node) {
+            nodes.push_back(node);
+        }
+
+        return nodes;
+    }
+}
@@ -0,0 +1,194 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "service.hpp"
+
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace DIMulti {
+    Service::Service(const std::vector<ResidentMap::CPtr>& maps, const Config::DIConfig& config, const RunOptions& options) :
+        maps_(maps),
+        config_(config),
+        options_(options),
+        n_jobs_(0)
+    {}
+
+    void Service::SetMapReplicas(const std::vector<std::vector<ResidentMap::CPtr>>& node_maps) {
+        node_maps_ = node_maps;
+    }
+
+    uint64_t Service::GetJobCount() const {
+        return n_jobs_;
+    }
+
+    void Service::RunJob(const std::string& batch_file_path, const std::string& out_dir_path, const std::string& overrides) {
+        // Each job starts from the base configuration; the maps and their fit areas are shared.
+        Config::DIConfig::Ptr config_ptr = std::make_shared<Config::DIConfig>(config_);
+        std::istringstream override_stream(overrides);
+        config_ptr->Update(override_stream);
+
+        DICSV job(batch_file_path, maps_, out_dir_path, config_ptr, options_.kml_dir_path, options_.count_points, options_.mapped_input, options_.time_stages, options_.staged, options_.async_write, options_.n_shards, options_.multi_trip);
+        job.SetColumnarOutput(options_.columnar_output);
+        job.SetOutputCompression(options_.output_compression);
+        job.SetPlacement(options_.placement);
+
+        if (!node_maps_.empty()) {
+            job.SetMapReplicas(node_maps_);
+        }
+
+        job.SetHighWaterMark(options_.high_water_mark);
+        job.SetAutotune(options_.autotune);
+        job.SetTripSegments(options_.segment_points);
+        job.SetGeofence(options_.zones);
+        job.SetScanThreads(options_.n_scan_threads);
+
+        if (!options_.size_cache_path.empty()) {
+            job.SetSizeCache(options_.size_cache_path + "." + std::to_string(n_jobs_));
+        }
+
+        if (!options_.trace_path.empty()) {
+            job.SetTracePath(options_.trace_path + "." + std::to_string(n_jobs_));
+        }
+        job.SetQueueBackend(options_.backend);
+        job.Start(options_.n_threads, options_.schedule);
+    }
+
+    bool Service::HandleRequest(const std::string& request, std::ostream& reply) {
+        std::string line = request;
+
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        if (line.empty()) {
+            return true;
+        }
+
+        if (line == "quit") {
+            return false;
+        }
+
+        StrVector fields = string_utilities::split(line, '\t');
+
+        if (fields[0] != "run" || fields.size() < 3) {
+            reply << "error\tUnknown request: " << line << std::endl;
+
+            return true;
+        }
+
+        std::string overrides;
+
+        for (std::size_t i = 3; i < fields.size(); ++i) {
+            overrides += fields[i] + "\n";
+        }
+
+        ++n_jobs_;
+
+        try {
+            RunJob(fields[1], fields[2], overrides);
+            reply << "ok\t" << fields[1] << std::endl;
+        } catch (std::exception& e) {
+            reply << "error\t" << e.what() << std::endl;
+        }
+
+        return true;
+    }
+
+    void Service::Serve(std::istream& in, std::ostream& out) {
+        std::string line;
+
+        while (std::getline(in, line)) {
+            if (!HandleRequest(line, out)) {
+                return;
+            }
+
+            out.flush();
+        }
+    }
+
+    void Service::ServeSocket(const std::string& socket_path) {
+        sockaddr_un address;
+
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument("Socket path is too long: " + socket_path);
+        }
+
+        int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (listen_fd < 0) {
+            throw std::invalid_argument("Could not create socket: " + socket_path);
+        }
+
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+        ::unlink(socket_path.c_str());
+
+        if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listen_fd, 16) < 0) {
+            ::close(listen_fd);
+            throw std::invalid_argument("Could not listen on socket: " + socket_path);
+        }
+
+        // A client that hangs up before its reply must not stop the service.
+        std::signal(SIGPIPE, SIG_IGN);
+
+        bool running = true;
+
+        while (running) {
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+
+            if (fd < 0) {
+                continue;
+            }
+
+            std::string pending;
+            char buffer[4096];
+            ssize_t n_read;
+
+            while (running && (n_read = ::read(fd, buffer, sizeof(buffer))) > 0) {
+                pending.append(buffer, static_cast<std::size_t>(n_read));
+                std::size_t line_end;
+
+                while (running && (line_end = pending.find('\n')) != std::string::npos) {
+                    std::ostringstream reply;
+                    running = HandleRequest(pending.substr(0, line_end), reply);
+                    pending.erase(0, line_end + 1);
+
+                    std::string reply_str = reply.str();
+
+                    if (!reply_str.empty() && ::write(fd, reply_str.data(), reply_str.size()) < 0) {
+                        break;
+                    }
+                }
+            }
+
+            ::close(fd);
+        }
+
+        ::close(listen_fd);
+        ::unlink(socket_path.c_str());
+    }
+}
@@ -307,6 +307,7 @@ class DIConfig {
         void SetRandDirectDistance(double rand_direct_distance);
         void SetRandManhattanDistance(double rand_manhattan_distance);
         void SetRandOutDegree(double rand_out_degree);
+        void SetRandSeed(uint64_t rand_seed);
         void TogglePlotKML(bool plot_kml);
         const std::string& GetLatField(void) const;
         void SetQuadSWLat(double quad_sw_lat);
@@ -340,6 +341,8 @@ class DIConfig {
         double GetRandDirectDistance(void) const;
         double GetRandManhattanDistance(void) const;
         double GetRandOutDegree(void) const;
+        uint64_t GetRandSeed(void) const;
+        bool IsRandSeedSet(void) const;
         double GetQuadSWLat(void) const;
         double GetQuadSWLon(void) const;
         double GetQuadNELat(void) const;
@@ -396,6 +399,8 @@ class DIConfig {
         double rand_direct_distance_    = 0.0;
         double rand_manhattan_distance_ = 0.0;
         double rand_out_degree_         = 0.0;
+        uint64_t rand_seed_             = 0;        // combined with each trip UID to seed its thresholds.
+        bool rand_seed_set_             = false;    // a random run seed is drawn unless rand_seed is set.
 };
 
 /**
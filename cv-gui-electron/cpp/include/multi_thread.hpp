@@ -21,66 +21,553 @@
 #define MULTI_THREAD_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <deque>
 #include <thread>
+#include <vector>
+
+#include "instrument.hpp"
+#include "ring_queue.hpp"
 
 namespace MultiThread {
 
     /**
-     * \brief Implementation of a threadsafe queue.
+     * \brief How Parallel hands items to its threads.
      */
-    template <typename T>
-    class SharedQueue
+    enum class Schedule {
+        kLeastLoaded,               ///< each item goes up front to the thread with the least total item size.
+        kWorkStealing               ///< as kLeastLoaded, but idle threads take waiting items from busy threads.
+    };
+
+    /**
+     * \brief How a SharedQueue stores its items.
+     */
+    enum class QueueBackend {
+        kLocked,                    ///< a deque guarded by a mutex and condition variables.
+        kRing                       ///< a bounded lock-free ring buffer (RingQueue).
+    };
+
+    /**
+     * \brief Moves the number of active threads of a Parallel run toward the highest throughput.
+     *
+     * Threads [0, active) take items; the others park before their next item. Every window the tuner measures the items
+     * finished per second and, over the active threads, the fraction of their time spent waiting for an item (idle) and
+     * the fraction of their busy time not spent on a CPU (e.g., waiting for I/O). It then hill climbs:
+     *
+     * - the active count moves on in the same direction while the throughput rises and turns back when it falls;
+     * - it shrinks when the threads mostly wait for items, since the items are not read fast enough for them;
+     * - it does not grow past the CPUs while the busy threads are CPU bound, only I/O waits are hidden by more threads.
+     */
+    class Autotuner
     {
         public:
+            /**
+             * \brief Construct a tuner.
+             *
+             * \param n_threads the number of threads; the active count stays in [1, n_threads].
+             * \param n_active the active count to start with.
+             * \param n_cpus the CPUs the threads share.
+             */
+            Autotuner(unsigned n_threads, unsigned n_active, unsigned n_cpus) :
+                slots_(new Slot[std::max(1u, n_threads)]),
+                n_threads_(std::max(1u, n_threads)),
+                n_cpus_(std::max(1u, n_cpus)),
+                active_(std::min(std::max(1u, n_active), std::max(1u, n_threads))),
+                released_(false),
+                direction_(1),
+                last_throughput_(-1.0),
+                peak_throughput_(0.0),
+                peak_active_(active_),
+                window_start_(std::chrono::steady_clock::now())
+            {}
 
-            T pop() {
+            Autotuner(const Autotuner&) = delete;
+            Autotuner& operator=(const Autotuner&) = delete;
+
+            /**
+             * \brief Return the number of active threads.
+             */
+            unsigned active() const {
+                return active_.load();
+            }
+
+            /**
+             * \brief Return the highest throughput (items per second) of a window and the active count it was reached
+             * with.
+             */
+            double peak_throughput(unsigned& n_active) const {
                 std::unique_lock<std::mutex> mlock(mutex_);
-                
-                while (queue_.empty()) {
-                    cond_.wait(mlock);
+                n_active = peak_active_;
+                return peak_throughput_;
+            }
+
+            /**
+             * \brief Called by a thread before it waits for its next item: ends the item it was busy with, if any, and
+             * blocks while the thread is parked.
+             */
+            void finish_item(unsigned index) {
+                Slot& slot = slots_[index];
+
+                if (slot.busy) {
+                    slot.busy_ns += elapsed_ns(slot.wall_mark);
+                    slot.cpu_ns += static_cast<uint64_t>((instrument::StageTimer::thread_cpu_seconds() - slot.cpu_mark) * 1e9);
+                    ++slot.items;
+                    slot.busy = false;
                 }
-                
-                auto val = queue_.front();
-                queue_.pop();
-                return val;
+
+                if (index >= active_.load() && !released_.load()) {
+                    std::unique_lock<std::mutex> mlock(mutex_);
+
+                    while (index >= active_.load() && !released_.load()) {
+                        cond_.wait(mlock);
+                    }
+                }
+
+                // parked time is not idle time.
+                slot.wall_mark = std::chrono::steady_clock::now();
             }
-    
-            void pop(T& item) {
+
+            /**
+             * \brief Called by a thread once it has its next item: ends its wait and starts its busy time.
+             */
+            void start_item(unsigned index) {
+                Slot& slot = slots_[index];
+
+                slot.idle_ns += elapsed_ns(slot.wall_mark);
+                slot.wall_mark = std::chrono::steady_clock::now();
+                slot.cpu_mark = instrument::StageTimer::thread_cpu_seconds();
+                slot.busy = true;
+            }
+
+            /**
+             * \brief Measure the window since the last adjustment and move the active count. A window in which fewer
+             * items than active threads finished is extended instead.
+             *
+             * \return the active count.
+             */
+            unsigned adjust() {
+                uint64_t items = 0, busy_ns = 0, cpu_ns = 0, idle_ns = 0;
+
+                for (unsigned i = 0; i < n_threads_; ++i) {
+                    items += slots_[i].items.load();
+                    busy_ns += slots_[i].busy_ns.load();
+                    cpu_ns += slots_[i].cpu_ns.load();
+                    idle_ns += slots_[i].idle_ns.load();
+                }
+
                 std::unique_lock<std::mutex> mlock(mutex_);
-                
-                while (queue_.empty()) {
+                unsigned n_active = active_.load();
+
+                if (items - window_.items < n_active || released_.load()) {
+                    return n_active;
+                }
+
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - window_start_).count();
+                double throughput = static_cast<double>(items - window_.items) / std::max(seconds, 1e-9);
+                double busy = static_cast<double>(busy_ns - window_.busy_ns);
+                double idle = static_cast<double>(idle_ns - window_.idle_ns);
+                double idle_fraction = busy + idle > 0.0 ? idle / (busy + idle) : 0.0;
+                double cpu_fraction = busy > 0.0 ? static_cast<double>(cpu_ns - window_.cpu_ns) / busy : 1.0;
+
+                window_.items = items;
+                window_.busy_ns = busy_ns;
+                window_.cpu_ns = cpu_ns;
+                window_.idle_ns = idle_ns;
+                window_start_ = std::chrono::steady_clock::now();
+
+                if (throughput > peak_throughput_) {
+                    peak_throughput_ = throughput;
+                    peak_active_ = n_active;
+                }
+
+                if (last_throughput_ >= 0.0 && throughput < last_throughput_ * (1.0 - kTolerance)) {
+                    direction_ = -direction_;                   // the last move hurt.
+                }
+
+                if (idle_fraction > kStarvedFraction) {
+                    direction_ = -1;                            // the threads outrun the items.
+                } else if (direction_ > 0 && n_active >= n_cpus_ && cpu_fraction > kCpuBoundFraction) {
+                    direction_ = -1;                            // more threads only compete for the CPUs.
+                }
+
+                last_throughput_ = throughput;
+
+                unsigned step = std::max(1u, n_active / 4);
+                unsigned target = direction_ > 0 ? std::min(n_threads_, n_active + step) : (n_active > step ? n_active - step : 1);
+
+                active_.store(target);
+                mlock.unlock();
+                cond_.notify_all();
+
+                return target;
+            }
+
+            /**
+             * \brief Let every thread run from now on, e.g., to finish the queued items.
+             */
+            void release() {
+                std::unique_lock<std::mutex> mlock(mutex_);
+                released_.store(true);
+                mlock.unlock();
+                cond_.notify_all();
+            }
+
+        private:
+            static constexpr double kTolerance = 0.05;          ///< throughput changes below this fraction are noise.
+            static constexpr double kStarvedFraction = 0.5;     ///< idle fraction above which the threads wait for items.
+            static constexpr double kCpuBoundFraction = 0.9;    ///< CPU fraction of busy time above which work is CPU bound.
+
+            /**
+             * \brief The counters of one thread; only the thread writes them, the tuner reads the atomic ones.
+             */
+            struct Slot {
+                std::atomic<uint64_t> items{0};
+                std::atomic<uint64_t> busy_ns{0};
+                std::atomic<uint64_t> cpu_ns{0};
+                std::atomic<uint64_t> idle_ns{0};
+                std::chrono::steady_clock::time_point wall_mark = std::chrono::steady_clock::now();
+                double cpu_mark = 0.0;
+                bool busy = false;
+            };
+
+            /**
+             * \brief The counter totals at the start of the window.
+             */
+            struct Totals {
+                uint64_t items = 0;
+                uint64_t busy_ns = 0;
+                uint64_t cpu_ns = 0;
+                uint64_t idle_ns = 0;
+            };
+
+            std::unique_ptr<Slot[]> slots_;
+            unsigned n_threads_;
+            unsigned n_cpus_;
+            std::atomic<unsigned> active_;
+            std::atomic<bool> released_;
+            mutable std::mutex mutex_;                         ///< guards the members below and parking.
+            std::condition_variable cond_;
+            int direction_;                                     ///< +1 to grow, -1 to shrink on the next move.
+            double last_throughput_;                            ///< items per second of the last window; < 0 for none.
+            double peak_throughput_;
+            unsigned peak_active_;
+            Totals window_;
+            std::chrono::steady_clock::time_point window_start_;
+
+            static uint64_t elapsed_ns(const std::chrono::steady_clock::time_point& since) {
+                return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count());
+            }
+    };
+
+    template <typename T>
+    class SharedQueue;
+
+    /**
+     * \brief The state shared by a set of queues whose threads steal work from each other.
+     *
+     * A thread serves its own queue from the front; when it runs dry it takes items from the back of the other queues
+     * and only blocks when every queue is empty.
+     */
+    template <typename T>
+    class StealGroup
+    {
+        public:
+            StealGroup() : n_pending_(0), closed_(false) {}
+            StealGroup(const StealGroup&) = delete;             // disable copying
+            StealGroup& operator=(const StealGroup&) = delete;  // disable assignment
+
+            /**
+             * \brief Tell the threads that no more items will be pushed; they finish once all queues are empty.
+             */
+            void close() {
+                std::unique_lock<std::mutex> mlock(mutex_);
+                closed_ = true;
+                mlock.unlock();
+                cond_.notify_all();
+            }
+
+            std::vector<SharedQueue<T>*> queues;                ///< the queues in the group, indexed by thread.
+
+        private:
+            friend class SharedQueue<T>;
+
+            std::mutex mutex_;
+            std::condition_variable cond_;
+            uint64_t n_pending_;                                ///< items pushed to any queue and not yet popped.
+            bool closed_;
+
+            void add_pending() {
+                std::unique_lock<std::mutex> mlock(mutex_);
+                ++n_pending_;
+                mlock.unlock();
+                cond_.notify_all();
+            }
+
+            void remove_pending() {
+                std::unique_lock<std::mutex> mlock(mutex_);
+                --n_pending_;
+            }
+
+            /**
+             * \brief Block until an item is pending somewhere in the group or the group is closed.
+             *
+             * \return false when the group is closed and all items have been popped.
+             */
+            bool wait() {
+                std::unique_lock<std::mutex> mlock(mutex_);
+
+                while (n_pending_ == 0 && !closed_) {
                     cond_.wait(mlock);
                 }
-    
-                item = queue_.front();
-                queue_.pop();
+
+                return n_pending_ > 0;
+            }
+    };
+
+    /**
+     * \brief Implementation of a threadsafe queue.
+     */
+    template <typename T>
+    class SharedQueue
+    {
+        public:
+            T pop() {
+                if (tuner_ == nullptr) {
+                    return take();
+                }
+
+                tuner_->finish_item(index_);
+                T item = take();
+                tuner_->start_item(index_);
+
+                return item;
+            }
+
+            void pop(T& item) {
+                item = pop();
             }
     
+            /**
+             * \brief Add an item to the back of the queue; when the queue is bounded, block while it is full.
+             */
             void push(const T& item) {
+                push(T(item));
+            }
+
+            /**
+             * \brief Move an item to the back of the queue; when the queue is bounded, block while it is full.
+             */
+            void push(T&& item) {
+                if (ring_) {
+                    ring_->push(std::move(item));
+
+                    if (group_ != nullptr) {
+                        group_->add_pending();
+                    }
+
+                    return;
+                }
+
+                std::unique_lock<std::mutex> mlock(mutex_);
+
+                while (capacity_ > 0 && queue_.size() >= capacity_) {
+                    not_full_.wait(mlock);
+                }
+
+                queue_.push_back(std::move(item));
+                mlock.unlock();
+
+                if (group_ != nullptr) {
+                    group_->add_pending();
+                } else {
+                    cond_.notify_one();
+                }
+            }
+
+            /**
+             * \brief Make this queue a member of a work stealing group; this must happen before any item is pushed.
+             *
+             * \param group the group; it must outlive this queue's use.
+             * \param index the position of this queue in the group's queue list.
+             */
+            void join(StealGroup<T>* group, unsigned index) {
+                group_ = group;
+                index_ = index;
+            }
+
+            /**
+             * \brief Report the items of this queue's thread to a tuner, which parks the thread while it is not active.
+             *
+             * \param tuner the tuner; it must outlive this queue's use.
+             * \param index the thread of this queue.
+             */
+            void tune(Autotuner* tuner, unsigned index) {
+                tuner_ = tuner;
+                index_ = index;
+            }
+      
+            /**
+             * \brief Bound the number of items held by the queue so producers wait for the consumer; 0 is unbounded.
+             *
+             * \param capacity the maximum number of items in the queue.
+             */
+            void set_capacity(std::size_t capacity) {
                 std::unique_lock<std::mutex> mlock(mutex_);
-                queue_.push(item);
+                capacity_ = capacity;
                 mlock.unlock();
-                cond_.notify_one();
+                not_full_.notify_all();
+            }
+
+            /**
+             * \brief Store the items in a lock-free ring buffer instead of the locked deque; this must happen before any
+             * item is pushed.  The ring is always bounded.
+             *
+             * \param capacity the minimum number of items the ring holds.
+             */
+            void use_ring(std::size_t capacity) {
+                ring_.reset(new RingQueue<T>(capacity));
             }
 
-            SharedQueue()=default;
+            SharedQueue() : group_(nullptr), tuner_(nullptr), index_(0), capacity_(0) {}
             SharedQueue(const SharedQueue&) = delete;            // disable copying
             SharedQueue& operator=(const SharedQueue&) = delete; // disable assignment
       
         private:
-            std::queue<T> queue_;
+            std::deque<T> queue_;
             std::mutex mutex_;
             std::condition_variable cond_;
+            StealGroup<T>* group_;                              ///< the work stealing group; nullptr when not stealing.
+            Autotuner* tuner_;                                  ///< the tuner of the threads; nullptr when not tuned.
+            unsigned index_;
+            std::size_t capacity_;                              ///< the maximum number of items held; 0 is unbounded.
+            std::condition_variable not_full_;
+            std::unique_ptr<RingQueue<T>> ring_;                ///< the ring buffer backend; nullptr for the deque.
+
+            /**
+             * \brief Return the next item of this queue, or of the group when stealing; blocks until there is one.
+             */
+            T take() {
+                if (group_ != nullptr) {
+                    return steal_pop();
+                }
+
+                if (ring_) {
+                    return ring_->pop();
+                }
+
+                std::unique_lock<std::mutex> mlock(mutex_);
+                
+                while (queue_.empty()) {
+                    cond_.wait(mlock);
+                }
+                
+                auto val = std::move(queue_.front());
+                
+                queue_.pop_front();
+                mlock.unlock();
+                not_full_.notify_one();
+                
+                return val;
+            }
+
+            bool try_take(T& item, bool front) {
+                if (ring_) {
+                    // The ring only pops from the front; thieves take the oldest item instead of the newest.
+                    return ring_->try_pop(item);
+                }
+
+                std::unique_lock<std::mutex> mlock(mutex_);
+
+                if (queue_.empty()) {
+                    return false;
+                }
+
+                if (front) {
+                    item = std::move(queue_.front());
+                    queue_.pop_front();
+                } else {
+                    item = std::move(queue_.back());
+                    queue_.pop_back();
+                }
+
+                mlock.unlock();
+                not_full_.notify_one();
+
+                return true;
+            }
+
+            /**
+             * \brief Pop from this queue's front, otherwise steal from the back of the other queues in the group.
+             *
+             * \return the item, or nullptr when the group is closed and empty.
+             */
+            T steal_pop() {
+                T item;
+                std::size_t n_queues = group_->queues.size();
+
+                for (;;) {
+                    if (try_take(item, true)) {
+                        group_->remove_pending();
+                        return item;
+                    }
+
+                    for (std::size_t i = 1; i < n_queues; ++i) {
+                        if (group_->queues[(index_ + i) % n_queues]->try_take(item, false)) {
+                            group_->remove_pending();
+                            return item;
+                        }
+                    }
+
+                    if (!group_->wait()) {
+                        return T();
+                    }
+                }
+            }
     };
 
     template <typename T>
     class Parallel
     {
         public:
-            void Start(unsigned n_threads) {
+            Parallel() : high_water_mark_(0), backend_(QueueBackend::kLocked), autotune_(false) {}
+
+            /**
+             * \brief Select how the thread queues store items.  The ring backend holds high water mark / threads items per
+             * thread, or kDefaultRingCapacity when no mark is set.
+             *
+             * \param backend the queue backend.
+             */
+            void SetQueueBackend(QueueBackend backend) {
+                backend_ = backend;
+            }
+
+            /**
+             * \brief Bound the number of items read ahead of the threads.  NextItem is not called while this many items
+             * are waiting, so memory stays flat regardless of the number of items.
+             *
+             * \param high_water_mark the maximum number of waiting items across all threads; 0 is unbounded.
+             */
+            void SetHighWaterMark(std::size_t high_water_mark) {
+                high_water_mark_ = high_water_mark;
+            }
+
+            /**
+             * \brief Tune the number of active threads while the items are handed out (see Autotuner). The threads of
+             * Start are then the most that run; it starts with half of them (at most half the CPUs), uses work stealing
+             * so the items of parked threads are taken by the active ones, and reads kAutotuneReadAhead items per thread
+             * ahead when no high water mark is set.
+             *
+             * \param autotune true to tune the thread count.
+             */
+            void SetAutotune(bool autotune) {
+                autotune_ = autotune;
+            }
+
+            void Start(unsigned n_threads, Schedule schedule = Schedule::kLeastLoaded) {
                 // Call the initialize routine for the subclass.
                 // Can be used to prevent furhter exectuion.
                 if (!Init()) {
@@ -95,14 +582,66 @@ namespace MultiThread {
                 std::vector<SharedQueue<std::shared_ptr<T>>*> q_list(n_used_threads);   // list of shared queues.
                 std::vector<uint64_t> load(n_used_threads);                             // load of each queue
 
-                // For each thread, zero the load of thread, initialize 
-                // the thread's queue, and start each thread.
+                StealGroup<std::shared_ptr<T>> group;
+                std::unique_ptr<Autotuner> tuner;
+
+                if (autotune_) {
+                    unsigned n_cpus = std::max(1u, std::thread::hardware_concurrency());
+                    tuner.reset(new Autotuner(n_used_threads, std::min(n_used_threads, n_cpus) / 2, n_cpus));
+                    schedule = Schedule::kWorkStealing;
+                }
+
+                // For each thread, zero the load of thread and initialize the thread's queue.  All queues must exist
+                // before any thread starts since a stealing thread visits them all.
                 for (unsigned i = 0; i < n_used_threads; ++i)
                 {
                     load[i] = 0;
-                    SharedQueue<std::shared_ptr<T>> *q = new SharedQueue<std::shared_ptr<T>>;
-                    threads[i] = std::thread(&Parallel::Thread, this, i, q);
-                    q_list[i] = q;
+                    q_list[i] = new SharedQueue<std::shared_ptr<T>>;
+
+                    // Share the mark between the threads; each queue holds at least one item.
+                    std::size_t capacity = (high_water_mark_ + n_used_threads - 1) / n_used_threads;
+
+                    if (tuner && capacity == 0) {
+                        capacity = kAutotuneReadAhead;
+                    }
+
+                    if (backend_ == QueueBackend::kRing) {
+                        q_list[i]->use_ring(capacity > 0 ? capacity : kDefaultRingCapacity);
+                    } else if (capacity > 0) {
+                        q_list[i]->set_capacity(capacity);
+                    }
+
+                    if (schedule == Schedule::kWorkStealing) {
+                        q_list[i]->join(&group, i);
+                    }
+
+                    if (tuner) {
+                        q_list[i]->tune(tuner.get(), i);
+                    }
+                }
+
+                group.queues = q_list;
+
+                // Start each thread.
+                for (unsigned i = 0; i < n_used_threads; ++i)
+                {
+                    threads[i] = std::thread(&Parallel::Thread, this, i, q_list[i]);
+                }
+
+                // The tuner moves the active count once per window while the items are handed out.
+                std::mutex monitor_mutex;
+                std::condition_variable monitor_cond;
+                bool dispatched = false;
+                std::thread monitor;
+
+                if (tuner) {
+                    monitor = std::thread([&]() {
+                        std::unique_lock<std::mutex> mlock(monitor_mutex);
+
+                        while (!monitor_cond.wait_for(mlock, std::chrono::milliseconds(static_cast<int64_t>(kAutotuneWindowMs)), [&dispatched]() { return dispatched; })) {
+                            tuner->adjust();
+                        }
+                    });
                 }
 
                 std::shared_ptr<T> item_ptr = nullptr;
@@ -114,18 +653,47 @@ namespace MultiThread {
 
                     // Identify the queue that has the least amount of work and then add this item to that queue /
                     // threads work.
-                    int64_t index = min_element(load.begin(), load.end()) - load.begin();
-                    q_list[index]->push(item_ptr);
+                    unsigned n_active = tuner ? tuner->active() : n_used_threads;
+                    int64_t index = min_element(load.begin(), load.begin() + n_active) - load.begin();
+                    q_list[index]->push(std::move(item_ptr));
                     load[index] += size;
                 } 
 
+                if (tuner) {
+                    {
+                        std::lock_guard<std::mutex> mlock(monitor_mutex);
+                        dispatched = true;
+                    }
+
+                    monitor_cond.notify_all();
+                    monitor.join();
+
+                    unsigned n_peak_active = 0;
+                    double peak_throughput = tuner->peak_throughput(n_peak_active);
+                    std::cerr << "Autotune: " << tuner->active() << " of " << n_used_threads << " threads active at the end; peak of " << peak_throughput << " items/s with " << n_peak_active << " threads." << std::endl;
+
+                    // the queued items are finished by all the threads.
+                    tuner->release();
+                }
+
                 // Join all the threads.
-                // Pass a null pointer to tell the threads not to expect 
-                // anymore items.
-                // Clean up the queue memory.
+                // Pass a null pointer (or close the stealing group) to tell
+                // the threads not to expect anymore items.
+                if (schedule == Schedule::kWorkStealing) {
+                    group.close();
+                } else {
+                    for (unsigned i = 0; i < n_used_threads; ++i) {
+                        q_list[i]->push(nullptr);
+                    }
+                }
+
                 for (unsigned i = 0; i < n_used_threads; ++i) {
-                    q_list[i]->push(nullptr);
                     threads[i].join();  
+                }
+
+                // Clean up the queue memory; only after every thread is done
+                // since a stealing thread may visit any queue.
+                for (unsigned i = 0; i < n_used_threads; ++i) {
                     delete q_list[i]; 
                 }
 
@@ -138,6 +706,15 @@ namespace MultiThread {
             virtual void Close(void) = 0;
             virtual std::shared_ptr<T> NextItem(void) = 0;
             virtual uint64_t ItemSize(T &item) = 0;
+
+        private:
+            static const std::size_t kDefaultRingCapacity = 1024;
+            static const std::size_t kAutotuneReadAhead = 4;   ///< the items queued per thread when tuning without a mark.
+            static const unsigned kAutotuneWindowMs = 1000;     ///< the length of a tuning window.
+
+            std::size_t high_water_mark_;                       ///< the maximum number of waiting items; 0 is unbounded.
+            QueueBackend backend_;
+            bool autotune_;                                     ///< tune the number of active threads.
     };
 }
 
@@ -19,8 +19,16 @@
  *******************************************************************************/
 #include <nan.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <time.h>
 #include <vector>
 #include <uv.h>
@@ -28,11 +36,6 @@
 #include "cvdi.hpp"
 #include "multi_thread.hpp"
 
-#ifndef _WIN32
-#include <unistd.h>
-#define Sleep(x) usleep((x)*1000)
-#endif
-
 using std::string;
 
 using Nan::AsyncWorker;  
@@ -560,6 +563,11 @@ void DIConfig::SetRandOutDegree(double rand_out_degree) {
     rand_out_degree_ = rand_out_degree;
 }
 
+void DIConfig::SetRandSeed(uint64_t rand_seed) {
+    rand_seed_ = rand_seed;
+    rand_seed_set_ = true;
+}
+
 void DIConfig::SetQuadSWLat(double quad_sw_lat) {
     quad_sw_lat_ = quad_sw_lat;
 }
@@ -692,6 +700,14 @@ double DIConfig::GetRandOutDegree(void) const {
     return rand_out_degree_;
 }
 
+uint64_t DIConfig::GetRandSeed(void) const {
+    return rand_seed_;
+}
+
+bool DIConfig::IsRandSeedSet(void) const {
+    return rand_seed_set_;
+}
+
 double DIConfig::GetQuadSWLat(void) const {
     return quad_sw_lat_;
 }
@@ -729,6 +745,7 @@ void DIConfig::PrintConfig(std::ostream& stream) const {
     stream << "Rand direct distance: " << rand_direct_distance_ << std::endl; 
     stream << "Rand manhattan distance: " << rand_manhattan_distance_ << std::endl; 
     stream << "Rand out degree: " << rand_out_degree_ << std::endl; 
+    stream << "Rand seed: " << (rand_seed_set_ ? "set" : "random") << std::endl;
     stream << "Quad SW Lat: " << quad_sw_lat_ << std::endl; 
     stream << "Quad SW Lon: " << quad_sw_lon_ << std::endl; 
     stream << "Quad NE Lat: " << quad_ne_lat_ << std::endl; 
@@ -810,7 +827,11 @@ bool GetBoolVal(v8::Isolate* isolate, v8::Handle<v8::Object> object, const char*
     return local->BooleanValue();
 }
 
-void GetConfiguration(v8::Isolate* isolate, v8::Handle<v8::Object> object, DIConfig::Ptr config) {
+/**
+ * Set the configuration from the config field of the object; return false, with a JS exception thrown, when the
+ * rand-seed field is not empty or a non-negative integer.
+ */
+bool GetConfiguration(v8::Isolate* isolate, v8::Handle<v8::Object> object, DIConfig::Ptr config) {
     v8::Handle<v8::Object> config_object = v8::Handle<v8::Object>::Cast(object->Get(v8::String::NewFromUtf8(isolate, "config", v8::String::NewStringType::kNormalString)));
 
     config->TogglePlotKML(GetBoolVal(isolate, config_object, "kml-output")); 
@@ -845,6 +866,27 @@ void GetConfiguration(v8::Isolate* isolate, v8::Handle<v8::Object> object, DICon
     config->SetQuadSWLon(GetDoubleVal(isolate, config_object, "sw-lng"));
     config->SetQuadNELat(GetDoubleVal(isolate, config_object, "ne-lat"));
     config->SetQuadNELon(GetDoubleVal(isolate, config_object, "ne-lng"));
+
+    // An empty or missing seed leaves the worker to draw a new one for the run.
+    v8::Handle<v8::Value> rand_seed = config_object->Get(v8::String::NewFromUtf8(isolate, "rand-seed", v8::String::NewStringType::kNormalString));
+    std::string rand_seed_str = rand_seed->IsUndefined() || rand_seed->IsNull() ? "" : ToString(rand_seed);
+
+    if (!rand_seed_str.empty()) {
+        std::size_t n_parsed = 0;
+
+        try {
+            config->SetRandSeed(std::stoull(rand_seed_str, &n_parsed));
+        } catch (std::exception&) {
+            n_parsed = 0;
+        }
+
+        if (n_parsed != rand_seed_str.size() || rand_seed_str[0] == '-') {
+            isolate->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(isolate, "Module error: rand-seed must be empty or a non-negative integer.")));
+            return false;
+        }
+    }
+
+    return true;
 }
 
 /**
@@ -871,11 +913,9 @@ uint64_t GetFiles(v8::Isolate* isolate, v8::Handle<v8::Object> object, std::vect
     return total_size;
 }
 
+// A progress tick; the messages and statistics it reports are taken from the worker when the tick is handled.
 struct data_t {
-    // 0 = progress; 1 = message; 2 = thread message?
-    unsigned type;
     double progress;
-    unsigned thread_index;
 };
 
 struct thread_message {
@@ -883,6 +923,20 @@ struct thread_message {
     std::string message;
 };
 
+/**
+ * The progress of one de-identification thread. The thread adds to it after each trip and the JS thread reads it when
+ * it handles a progress tick; the counts are atomic and the stage times are guarded by a lock of their own, so neither
+ * thread waits on the other for more than a copy.
+ */
+struct ThreadProgress {
+    std::atomic<uint64_t> work;                     // the bytes of the trips done.
+    std::atomic<uint64_t> n_trips;                  // the trips done.
+    std::mutex stage_mutex;
+    instrument::StageTimer stages;                  // the time of each stage over the trips done.
+
+    ThreadProgress() : work(0), n_trips(0) {}
+};
+
 class TrajectoryFactory {
     public:
         using Ptr = std::shared_ptr<TrajectoryFactory>;
@@ -935,6 +989,7 @@ class TrajectoryFactory {
 };
 
 Quad::Ptr qptr_ = nullptr;                          // Global quad ptr persists through the life of the module.
+MapContext::CPtr map_context_ = nullptr;            // Global compiled version of qptr_ and its fit areas used for map matching; rebuilt with the quad or when fit parameters change.
 
 /**
  * AsyncProgressWorkerBase provides progress reporting callback support for asynchronous communication with the GUI. An
@@ -947,10 +1002,11 @@ Quad::Ptr qptr_ = nullptr;                          // Global quad ptr persists
 class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Parallel<TrajectoryFactory>  {
     public:
 
-        CVDI(Callback *callback, Callback *progress, DIConfig::Ptr config_ptr, const std::string& output_dir_path, const std::string& quad_path, bool build_quad, const std::string& log_path, const std::vector<FileInfo::Ptr>& files, uint64_t total_size, unsigned n_threads): 
+        CVDI(Callback *callback, Callback *progress, DIConfig::Ptr config_ptr, const std::string& output_dir_path, const std::string& quad_path, bool build_quad, const std::string& log_path, const std::vector<FileInfo::Ptr>& files, uint64_t total_size, unsigned n_threads, MultiThread::Schedule schedule, std::size_t max_queued, MultiThread::QueueBackend backend, bool columnar_output, bool autotune, const std::string& trace_path): 
             Nan::AsyncProgressWorkerBase<data_t>(callback),
             progress(progress),
             config_ptr_(config_ptr),
+            run_seed_(config_ptr->IsRandSeedSet() ? config_ptr->GetRandSeed() : PrivacyIntervalFinder::random_seed()),
             output_dir_path_(output_dir_path),
             quad_path_(quad_path),
             build_quad_(build_quad),
@@ -958,49 +1014,62 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
             files_(files),
             total_size_(total_size),
             n_threads_(n_threads),
+            schedule_(schedule),
             curr_index_(0),
-            splitter_ptr_(nullptr),
-            multi_file_ptr_(nullptr),
             log_file_ptr_(nullptr),
-            curr_file_(nullptr)
-        {}
+            curr_file_(nullptr),
+            columnar_output_(columnar_output),
+            trace_path_(trace_path),
+            ticker_done_(false)
+        {
+            // Keep the trips split from large files from piling up ahead of the threads.
+            SetHighWaterMark(max_queued);
+            SetQueueBackend(backend);
+            SetAutotune(autotune);
+        }
 
         ~CVDI() {}
 
         /**
          * Deidentifies a single trajectory
          */
-        void DeIdentify(TrajectoryFactory::Ptr traj_factory_ptr) {
+        void DeIdentify(TrajectoryFactory::Ptr traj_factory_ptr, PrivacyIntervalFinder::RandomEngine& rand_engine, instrument::StageTimer* stage_timer, instrument::TraceBuffer* trace) {
             std::string uid = traj_factory_ptr->GetUID();
             std::string header = traj_factory_ptr->GetHeader();
             trajectory::Trajectory traj;
+            instrument::StageClock stage_clock(stage_timer, trace);
             
             // Opens trajectory CSV file uses configuration to determine fields.
             traj_factory_ptr->GetTrajectory(config_ptr_, traj);
+            stage_clock.lap(instrument::Stage::kParse, traj.size());
 
             ErrorCorrector ec(50);
             ec.correct_error(traj, uid);
+            stage_clock.lap(instrument::Stage::kErrorCorrect, traj.size());
         
-            MapFitter mf{qptr_, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()};
-            mf.fit(traj);
-
-            ImplicitMapFitter imf{config_ptr_->GetHeadingGroups(), config_ptr_->GetMinEdgeTripPoints()};
-            imf.fit(traj);
-            
+            // The areas are only collected to plot them.
+            MapFitter mf{*map_context_, config_ptr_->IsPlotKML()};
+            ImplicitMapFitter imf{config_ptr_->GetHeadingGroups(), config_ptr_->GetMinEdgeTripPoints(), config_ptr_->IsPlotKML()};
             IntersectionCounter ic{};
-            ic.count_intersections(traj);
+            Detector::TurnAround tad{config_ptr_->GetTAMaxQSize(), config_ptr_->GetTAAreaWidth(), config_ptr_->GetTAMaxSpeed(), config_ptr_->GetTAHeadingDelta(), config_ptr_->IsPlotKML()};
+            Detector::Stop stop_detector{config_ptr_->GetStopMaxTime(), config_ptr_->GetStopMinDistance(), config_ptr_->GetStopMaxSpeed(), map_context_->get_stop_excluded_highways()};
 
-            Detector::TurnAround tad{config_ptr_->GetTAMaxQSize(), config_ptr_->GetTAAreaWidth(), config_ptr_->GetTAMaxSpeed(), config_ptr_->GetTAHeadingDelta()};
-            trajectory::Interval::PtrList ta_critical_intervals = tad.find_turn_arounds(traj);
+            // Fit, count intersections and detect turnarounds and stops in one pass over the trip.
+            PointPipeline pipeline{mf, imf, ic, tad, stop_detector};
+            pipeline.run(traj);
+            stage_clock.lap(instrument::Stage::kPointAnalysis, traj.size());
 
-            Detector::Stop stop_detector{config_ptr_->GetStopMaxTime(), config_ptr_->GetStopMinDistance(), config_ptr_->GetStopMaxSpeed()};
-            trajectory::Interval::PtrList stop_critical_intervals = stop_detector.find_stops( traj );
+            trajectory::Interval::PtrList ta_critical_intervals = tad.get_turn_arounds();
+            trajectory::Interval::PtrList stop_critical_intervals = stop_detector.get_stops();
 
             StartEndIntervals sei;
 
             IntervalMarker im( { ta_critical_intervals, stop_critical_intervals, sei.get_start_end_intervals( traj ) } );
             im.mark_trajectory( traj );
+            stage_clock.lap(instrument::Stage::kIntervalMark, traj.size());
 
+            // Seed from the UID so the thresholds of a trip do not depend on the thread or the order of the trips.
+            rand_engine.seed(PrivacyIntervalFinder::trip_seed(run_seed_, uid));
             PrivacyIntervalFinder pif(config_ptr_->GetMinDirectDistance(), 
                                       config_ptr_->GetMinManhattanDistance(), 
                                       config_ptr_->GetMinOutDegree(), 
@@ -1009,26 +1078,38 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
                                       config_ptr_->GetMaxOutDegree(), 
                                       config_ptr_->GetRandDirectDistance(), 
                                       config_ptr_->GetRandManhattanDistance(), 
-                                      config_ptr_->GetRandOutDegree());
+                                      config_ptr_->GetRandOutDegree(),
+                                      &rand_engine);
             trajectory::Interval::PtrList priv_intervals =  pif.find_intervals( traj );
+            stage_clock.lap(instrument::Stage::kPrivacyInterval, traj.size());
 
             PrivacyIntervalMarker pim({ priv_intervals });
             pim.mark_trajectory(traj);
+            stage_clock.lap(instrument::Stage::kIntervalMark, traj.size());
 
-            DeIdentifier di;
-
-            trajectory::Trajectory di_traj = di.de_identify(traj);
-
-            // Write de-identified trajectory to file.
-            std::string out_file_path = output_dir_path_ + "/di_out/" + uid + ".di.csv";
-            std::ofstream os(out_file_path, std::ofstream::trunc);
+            // Write the de-identified points straight to file.
+            std::string out_file_path = output_dir_path_ + "/di_out/" + uid + (columnar_output_ ? ".di" + columnar::kFileExtension : ".di.csv");
+            std::ofstream os(out_file_path, std::ofstream::trunc | std::ofstream::binary);
 
             if (os.fail()) {
                 throw std::invalid_argument("Could not open output file: " + out_file_path);
             }
 
-            CSVFactory::write_trajectory(os, header, di_traj);
+            DeIdentifier di;
+
+            if (columnar_output_) {
+                columnar::Writer sink(os, columnar::column_names(header), false);
+                di.de_identify(traj, sink);
+                sink.close();
+            } else {
+                os << header << std::endl;
+
+                trajectory::StreamPointSink sink(os, false);
+                di.de_identify(traj, sink);
+            }
+
             os.close();
+            stage_clock.lap(instrument::Stage::kWrite, traj.size());
             
             if (!config_ptr_->IsPlotKML()) {
                 return;
@@ -1055,85 +1136,105 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
             kml_file.write_intervals( priv_intervals, traj, "priv_intervals" );
             kml_file.finish();
             kml_os.close();
+            stage_clock.lap(instrument::Stage::kKML, traj.size());
         }
 
-        void SendProgress(int thread_num) {
-            thread_data_[thread_num]->type = 0; // progress 
-            thread_data_[thread_num]->progress = GetProgress();
-            progress_->Send(thread_data_[thread_num], sizeof((*thread_data_[thread_num])));
-            Sleep(5);
-        }
-
-        void ProgressDone() {
-            message_data_.type = 0;
-            message_data_.progress = 1.0;
-            progress_->Send(&message_data_, sizeof(message_data_));
-            Sleep(5);
+        /**
+         * Queue a message for the next progress tick; the worker threads never wait on the JS thread.
+         */
+        void QueueMessage(int severity, const std::string& message) {
+            std::lock_guard<std::mutex> lock(outbox_mutex_);
+            outbox_.push_back(thread_message{ static_cast<unsigned>(severity), message });
         }
 
-        void SendMessage(int severity, const std::string& message) {
-            message_data_.type = 1;
-            message_.message = message;
-            message_.type = severity;
-            progress_->Send(&message_data_, sizeof(message_data_));
-            Sleep(5);
-        }
+        /**
+         * Tick the JS thread every kProgressTickMs until the run is done. Ticks that arrive before the last one is
+         * handled are merged into one, and each handled tick reports everything queued since the previous one.
+         */
+        void RunTicker() {
+            std::unique_lock<std::mutex> lock(ticker_mutex_);
 
-        void SendThreadMessage(int thread_num, int severity, const std::string& message) {
-            thread_data_[thread_num]->type = 02; // thread message
-            thread_data_[thread_num]->thread_index = thread_num;
-            messages_[thread_num]->type = severity;
-            messages_[thread_num]->message = message;
-            progress_->Send(thread_data_[thread_num], sizeof((*thread_data_[thread_num])));
-            Sleep(5);
+            while (!ticker_cond_.wait_for(lock, std::chrono::milliseconds(static_cast<int64_t>(kProgressTickMs)), [this]() { return ticker_done_; })) {
+                data_t tick{ GetProgress() };
+                progress_->Send(&tick, 1);
+            }
         }
 
         void ReportLog(const std::string& message) {
-            SendMessage(0, "[DI Log] " + message); 
+            QueueMessage(0, "[DI Log] " + message); 
         }
 
         void ReportWarning(const std::string& message) {
-            SendMessage(1, "[DI Warning] " + message); 
+            QueueMessage(1, "[DI Warning] " + message); 
         }
 
         void ReportError(const std::string& message) {
-            SendMessage(2, "[DI Error] " + message); 
+            QueueMessage(2, "[DI Error] " + message); 
         }
 
         void ReportDebug(const std::string& message) {
-            SendMessage(3, "[DI Debug] " + message); 
+            QueueMessage(3, "[DI Debug] " + message); 
         }
 
         void ReportThreadLog(int thread_num, const std::string& message) {
-            SendThreadMessage(thread_num, 0, "[DI] " + message); 
+            QueueMessage(0, "[DI] " + message); 
         }
 
         void ReportThreadWarning(int thread_num, const std::string& message) {
-            SendThreadMessage(thread_num, 1, "[DI Warning] " + message); 
+            QueueMessage(1, "[DI Warning] " + message); 
         }
 
         void ReportThreadError(int thread_num, const std::string& message) {
-            SendThreadMessage(thread_num, 2, "[DI Error] " + message); 
+            QueueMessage(2, "[DI Error] " + message); 
         }
 
         void ReportThreadDebug(int thread_num, const std::string& message) {
-            SendThreadMessage(thread_num, 3, "[DI Debug] " + message); 
+            QueueMessage(3, "[DI Debug] " + message); 
         }
 
         void Thread(int thread_num, MultiThread::SharedQueue<TrajectoryFactory::Ptr>* q) 
         {
+            // The points, intervals and areas of a trip come from this thread's arena.
+            memory::Arena arena;
+            memory::Arena::Scope arena_scope(arena);
+            PrivacyIntervalFinder::RandomEngine rand_engine;
             TrajectoryFactory::Ptr traj_factory_ptr;
+            instrument::TraceBuffer* trace = traces_.empty() ? nullptr : traces_[thread_num].get();
+            ThreadProgress& thread_progress = *thread_progress_[thread_num];
+
+            while (true) {
+                {
+                    instrument::TraceScope wait_span(trace, "queue_wait", "queue");
+                    traj_factory_ptr = q->pop();
+                }
+
+                if (traj_factory_ptr == nullptr) {
+                    break;
+                }
+
+                instrument::TraceScope trip_span(trace, "trip", "trip");
+
+                if (trace) {
+                    trip_span.set_detail(traj_factory_ptr->GetFilePath() + ":" + traj_factory_ptr->GetUID());
+                }
+
+                // the previous trip has been released; reuse its arena memory.
+                arena.reset();
 
-            while ((traj_factory_ptr = q->pop()) != nullptr) {
                 try {
+                    instrument::StageTimer trip_stages;
+
                     // DeIdentify
-                    DeIdentify(traj_factory_ptr);
+                    DeIdentify(traj_factory_ptr, rand_engine, &trip_stages, trace);
     
-                    // Update the progress for this thread.
-                    // unique to this thread.
-                    work_[thread_num] += traj_factory_ptr->GetSize();
+                    // Update the progress for this thread; the next tick reports it.
+                    thread_progress.work += traj_factory_ptr->GetSize();
+                    ++thread_progress.n_trips;
 
-                    SendProgress(thread_num);
+                    {
+                        std::lock_guard<std::mutex> lock(thread_progress.stage_mutex);
+                        thread_progress.stages = thread_progress.stages + trip_stages;
+                    }
 
                     ReportThreadLog(thread_num, "De-identified trip: " + traj_factory_ptr->GetUID() + " from file: " + traj_factory_ptr->GetFilePath());
 
@@ -1148,8 +1249,6 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
         }
 
         bool Init(void) {
-            log_file_ptr_ = std::make_shared<std::ofstream>(log_path_, std::ofstream::trunc);
-
             if (log_file_ptr_->fail()) {
                 ReportError("Could not open the log file: " + log_path_);
                 return false;
@@ -1175,50 +1274,86 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
                     return false;
                 }
 
-                for (auto& edge_ptr : shape_factory.get_edges()) {
-                    Quad::insert(qptr_, std::dynamic_pointer_cast<const geo::Entity>(edge_ptr)); 
-                }
+                geo::Entity::PtrList entities{ shape_factory.get_edges().begin(), shape_factory.get_edges().end() };
+                Quad::bulk_insert(qptr_, entities, n_threads_);
+
+                map_context_ = std::make_shared<const MapContext>(shape_factory.get_edges(), qptr_->freeze(), config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt());
 
             } else {
                 ReportLog("Reusing quad from file: " + quad_path_);
+
+                if (!map_context_->matches(config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt())) {
+                    // The fit parameters changed; rebuild the areas from the edges already in the quad.
+                    map_context_ = std::make_shared<const MapContext>(map_context_->get_edges(), map_context_->get_quad(), config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt(), nullptr, map_context_->get_stop_excluded_highways());
+                }
             }
 
             return true;
         }
 
         void Close(void) {
-            if (log_file_ptr_) {
-                log_file_ptr_->close();
+            if (!traces_.empty()) {
+                std::ofstream trace_file(trace_path_, std::ofstream::trunc);
+
+                if (trace_file.fail()) {
+                    ReportWarning("Could not open the trace file: " + trace_path_);
+                } else {
+                    instrument::TraceBuffer::write_chrome_trace(trace_file, traces_, "cvdi_nm");
+                    ReportLog("Trace written to: " + trace_path_);
+                }
+
+                traces_.clear();
             }
+
+            // the log file is written by the JS thread; it is closed after the last report.
         }
                 
         uint64_t ItemSize(TrajectoryFactory& traj_factory) {
             return traj_factory.GetSize();
         }
 
-        TrajectoryFactory::Ptr NextMultiItem(void) {
-            CSVSplitter::TripLocationPtr locptr = splitter_ptr_->next_trajectory();
-            
-            if (locptr) {
-                std::shared_ptr<TrajectoryFactory> ret = std::make_shared<TrajectoryFactory>(curr_file_->GetPath(), splitter_ptr_->get_header(), std::get<0>(*locptr), std::get<1>(*locptr), std::get<2>(*locptr));
+        /**
+         * Find the trips in a file that holds one or more of them. The trip boundaries saved by an earlier run are
+         * reused while the file is unchanged; otherwise the file is mapped, indexed in parallel and the index saved.
+         */
+        void IndexFile(const std::string& file_path) {
+            MappedFile::CPtr file = std::make_shared<const MappedFile>(file_path);
+            const char* data = file->data();
+            const char* eol = std::find(data, data + file->size(), '\n');
 
-                return std::static_pointer_cast<TrajectoryFactory>(ret);
-            } else {
-                return nullptr;
+            if (eol == data + file->size()) {
+                throw std::invalid_argument("File has no header or records: " + file_path);
+            }
+
+            curr_header_ = std::string(data, eol);
+            pending_.clear();
+
+            trip_index::TripRangeList ranges;
+
+            if (!trip_index::read_index(file_path, config_ptr_->GetUIDFields(), ranges)) {
+                trip_index::UIDExtractor extractor(curr_header_, config_ptr_->GetUIDFields());
+                trip_index::LocationExtractor locator(curr_header_, config_ptr_->GetLatField(), config_ptr_->GetLonField());
+                std::size_t begin = static_cast<std::size_t>(eol - data) + 1;
+
+                ranges = trip_index::index_trips(data, file->size(), begin, extractor, locator, n_threads_);
+
+                try {
+                    trip_index::write_index(file_path, config_ptr_->GetUIDFields(), ranges);
+                } catch (std::exception& e) {
+                    ReportLog(std::string("Trip index not saved: ") + e.what());
+                }
             }
+
+            pending_.assign(ranges.begin(), ranges.end());
         }
 
         TrajectoryFactory::Ptr NextItem(void) {
             while (true) {
-                if (splitter_ptr_) {
-                    TrajectoryFactory::Ptr ret = NextMultiItem();
-
-                    if (ret) {
-                        return ret;
-                    } else {
-                        splitter_ptr_ = nullptr;
-                        multi_file_ptr_->close();
-                    }
+                if (!pending_.empty()) {
+                    trip_index::TripRange range = pending_.front();
+                    pending_.pop_front();
+
+                    return std::make_shared<TrajectoryFactory>(curr_file_->GetPath(), curr_header_, range.uid, range.begin, range.end);
                 }
                 
                 if (curr_index_ >= files_.size()) {
@@ -1227,35 +1362,11 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
 
                 curr_file_ = files_[curr_index_];
                 curr_index_++;
-                
-                std::ifstream file(curr_file_->GetPath(), std::ios::binary | std::ios::ate);
-                
-                if (file.fail()) {  
-                    ReportError("Could not open file: " + curr_file_->GetPath()); 
-                
-                    continue;
-                }
 
-                uint64_t size = file.tellg();
-                file.close();
-
-                multi_file_ptr_ = std::make_shared<std::ifstream>(curr_file_->GetPath());
-                
-                if (multi_file_ptr_->fail()) {  
-                    ReportError("Could not open file: " + curr_file_->GetPath()); 
-
-                    continue;
-                }
-
-                splitter_ptr_ = std::make_shared<CSVSplitter>(*multi_file_ptr_, size, config_ptr_->GetUIDFields(), true);
-
-                TrajectoryFactory::Ptr ret = NextMultiItem();
-
-                if (ret) {
-                    return ret;
-                } else {
-                    splitter_ptr_ = nullptr;
-                    multi_file_ptr_->close();
+                try {
+                    IndexFile(curr_file_->GetPath());
+                } catch (std::exception& e) {
+                    ReportError(e.what());
                 }
             }
                 
@@ -1268,8 +1379,8 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
         double GetProgress() {
             uint64_t total_work = 0;
 
-            for (unsigned i = 0; i < n_threads_; ++i) {
-                total_work += work_[i];
+            for (auto& thread_progress : thread_progress_) {
+                total_work += thread_progress->work.load();
             }
 
             return static_cast<double>(total_work) / static_cast<double>(total_size_);
@@ -1280,26 +1391,37 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
          */
         void Execute(const typename Nan::AsyncProgressWorkerBase<data_t>::ExecutionProgress& progress) {
 
-            // Set up a vector of output queues to store the messages from each thread.
+            // Set up the progress of each thread.
             for (unsigned i = 0; i < n_threads_; ++i) {
-                work_.push_back(0);
-                messages_.push_back(new thread_message);
-                thread_data_.push_back(new data_t);
+                thread_progress_.emplace_back(new ThreadProgress);
             }
 
             progress_ = &progress;
+            ticker_done_ = false;
 
-            // Start all the de-identification threads; this blocks until complete.
-            Start(n_threads_);
+            // opened before the first tick since each tick writes the queued messages to it.
+            log_file_ptr_ = std::make_shared<std::ofstream>(log_path_, std::ofstream::trunc);
 
-            // Make the progress bar full.
-            ProgressDone();
+            std::thread ticker(&CVDI::RunTicker, this);
 
-            // All threads will be finished at this point.
-            for (unsigned i = 0; i < n_threads_; ++i) {
-                delete messages_[i];
-                delete thread_data_[i];
+            if (!trace_path_.empty()) {
+                for (unsigned i = 0; i < n_threads_; ++i) {
+                    traces_.push_back(std::make_shared<instrument::TraceBuffer>(i));
+                }
+            }
+
+            // Start all the de-identification threads; this blocks until complete.
+            Start(n_threads_, schedule_);
+
+            {
+                std::lock_guard<std::mutex> lock(ticker_mutex_);
+                ticker_done_ = true;
             }
+
+            ticker_cond_.notify_all();
+            ticker.join();
+
+            // A tick may still be pending; HandleOKCallback reports what is left.
         }
 
         /**
@@ -1307,70 +1429,86 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
          */
         void HandleProgressCallback(const data_t *data, size_t size) {
             HandleScope scope;
-            v8::Local<v8::Object> obj = Nan::New<v8::Object>();
-            unsigned thread_num, type;
+            Report(data->progress, false);
+        }
 
-            switch (data->type) {           
-                case 0:         // progress
-                    Nan::Set(obj, Nan::New("type").ToLocalChecked(), New<v8::String>("progress").ToLocalChecked());
-                    Nan::Set(obj, Nan::New("progress").ToLocalChecked(), New<v8::Number>(data->progress));
+        /**
+         * Report the messages queued since the last report before the run's callback; the last tick may not have been
+         * handled.
+         */
+        void HandleOKCallback() {
+            HandleScope scope;
+            Report(1.0, true);
+            log_file_ptr_->close();
+            callback->Call(0, nullptr);
+        }
 
-                    break;
+        /**
+         * Send one progress event to JS: the progress, the trips done, the warnings, errors and debug messages queued
+         * since the last event (logs only go to the log file) and the throughput of each stage so far.
+         */
+        void Report(double progress_value, bool done) {
+            std::vector<thread_message> messages;
 
-                case 1:         // message or thread message
-                    type = message_.type;
+            {
+                std::lock_guard<std::mutex> lock(outbox_mutex_);
+                messages.swap(outbox_);
+            }
 
-                    if (type == 0) {
-                        // Log only goes to file.
-                        *log_file_ptr_ << message_.message << std::endl;
-                        return;
+            v8::Local<v8::Array> message_array = Nan::New<v8::Array>();
+            uint32_t n_messages = 0;
 
-                    } else if (type == 1) {
-                        Nan::Set(obj, Nan::New("type").ToLocalChecked(), New<v8::String>("warning").ToLocalChecked());
-                        *log_file_ptr_ << message_.message << std::endl;
+            for (auto& message : messages) {
+                *log_file_ptr_ << message.message << std::endl;
 
-                    } else if (type == 2) {
-                        Nan::Set(obj, Nan::New("type").ToLocalChecked(), New<v8::String>("error").ToLocalChecked());
-                        *log_file_ptr_ << message_.message << std::endl;
+                if (message.type == 0 || message.type > 3) {
+                    continue;
+                }
 
-                    } else if (type == 3) {
-                        Nan::Set(obj, Nan::New("type").ToLocalChecked(), New<v8::String>("debug").ToLocalChecked());
-                        *log_file_ptr_ << message_.message << std::endl;
+                static const char* const kTypeNames[] = { "log", "warning", "error", "debug" };
+                v8::Local<v8::Object> message_obj = Nan::New<v8::Object>();
+                Nan::Set(message_obj, Nan::New("type").ToLocalChecked(), New<v8::String>(kTypeNames[message.type]).ToLocalChecked());
+                Nan::Set(message_obj, Nan::New("message").ToLocalChecked(), New<v8::String>(message.message).ToLocalChecked());
+                Nan::Set(message_array, n_messages++, message_obj);
+            }
 
-                    }
-                   
-                    Nan::Set(obj, Nan::New("message").ToLocalChecked(), New<v8::String>(message_.message).ToLocalChecked());
-                    break;
+            uint64_t n_trips = 0;
+            instrument::StageTimer stages;
 
-                case 2:         // thread message.
-                    thread_num = data->thread_index;
-                    type = messages_[thread_num]->type;
+            for (auto& thread_progress : thread_progress_) {
+                n_trips += thread_progress->n_trips.load();
 
-                    if (type == 0) {
-                        // Log only goes to file.
-                        *log_file_ptr_ << messages_[thread_num]->message << std::endl;
-                        return;
+                std::lock_guard<std::mutex> lock(thread_progress->stage_mutex);
+                stages = stages + thread_progress->stages;
+            }
 
-                    } else if (type == 1) {
-                        Nan::Set(obj, Nan::New("type").ToLocalChecked(), New<v8::String>("warning").ToLocalChecked());
-                        *log_file_ptr_ << messages_[thread_num]->message << std::endl;
+            v8::Local<v8::Array> stage_array = Nan::New<v8::Array>();
+            uint32_t n_stages = 0;
 
-                    } else if (type == 2) {
-                        Nan::Set(obj, Nan::New("type").ToLocalChecked(), New<v8::String>("error").ToLocalChecked());
-                        *log_file_ptr_ << messages_[thread_num]->message << std::endl;
+            for (std::size_t i = 0; i < static_cast<std::size_t>(instrument::Stage::kNStages); ++i) {
+                instrument::Stage stage = static_cast<instrument::Stage>(i);
+                const instrument::StageTimer::Totals& totals = stages.get(stage);
 
-                    } else if (type == 3) {
-                        Nan::Set(obj, Nan::New("type").ToLocalChecked(), New<v8::String>("debug").ToLocalChecked());
-                        *log_file_ptr_ << messages_[thread_num]->message << std::endl;
-                    }
-                   
-                    Nan::Set(obj, Nan::New("message").ToLocalChecked(), New<v8::String>(messages_[thread_num]->message).ToLocalChecked());
-                    break;
+                if (totals.n_calls == 0) {
+                    continue;
+                }
 
-                default:
-                    break;
+                v8::Local<v8::Object> stage_obj = Nan::New<v8::Object>();
+                Nan::Set(stage_obj, Nan::New("name").ToLocalChecked(), New<v8::String>(instrument::StageTimer::stage_name(stage)).ToLocalChecked());
+                Nan::Set(stage_obj, Nan::New("points").ToLocalChecked(), New<v8::Number>(static_cast<double>(totals.n_points)));
+                Nan::Set(stage_obj, Nan::New("seconds").ToLocalChecked(), New<v8::Number>(totals.wall_seconds));
+                Nan::Set(stage_obj, Nan::New("pointsPerSecond").ToLocalChecked(), New<v8::Number>(totals.wall_seconds > 0.0 ? totals.n_points / totals.wall_seconds : 0.0));
+                Nan::Set(stage_array, n_stages++, stage_obj);
             }
 
+            v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+            Nan::Set(obj, Nan::New("type").ToLocalChecked(), New<v8::String>("progress").ToLocalChecked());
+            Nan::Set(obj, Nan::New("progress").ToLocalChecked(), New<v8::Number>(progress_value));
+            Nan::Set(obj, Nan::New("done").ToLocalChecked(), Nan::New<v8::Boolean>(done));
+            Nan::Set(obj, Nan::New("trips").ToLocalChecked(), New<v8::Number>(static_cast<double>(n_trips)));
+            Nan::Set(obj, Nan::New("messages").ToLocalChecked(), message_array);
+            Nan::Set(obj, Nan::New("stages").ToLocalChecked(), stage_array);
+
             v8::Local<v8::Value> argv[] = { obj };
             progress->Call(1, argv);
         }
@@ -1379,6 +1517,7 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
         std::string config_str_;
         std::string debug_str_;
         DIConfig::Ptr config_ptr_;
+        uint64_t run_seed_;                                 // combined with each trip UID to seed its privacy thresholds.
         std::string output_dir_path_;
         std::string quad_path_;
         bool build_quad_;
@@ -1386,17 +1525,23 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
         std::vector<FileInfo::Ptr> files_;
         uint64_t total_size_;
         unsigned n_threads_;
+        MultiThread::Schedule schedule_;
         uint32_t curr_index_;
-        CSVSplitter::Ptr splitter_ptr_;
-        std::shared_ptr<std::ifstream> multi_file_ptr_;
+        std::deque<trip_index::TripRange> pending_;         // the trips of curr_file_ not yet handed out.
+        std::string curr_header_;
         std::shared_ptr<std::ofstream> log_file_ptr_;
         FileInfo::Ptr curr_file_;
-        std::vector<uint64_t> work_; 
-
-        std::vector<thread_message*> messages_;
-        std::vector<data_t*> thread_data_;
-        thread_message message_;
-        data_t message_data_;
+        bool columnar_output_;                              // write the trips as columnar files instead of CSV files.
+        std::string trace_path_;                            // the Chrome trace-event file; empty for no trace.
+        std::vector<instrument::TraceBuffer::Ptr> traces_;  // the timeline of each thread when tracing.
+        std::vector<std::unique_ptr<ThreadProgress>> thread_progress_;   // the progress of each thread.
+
+        static const unsigned kProgressTickMs = 100;        // the time between progress reports.
+        std::mutex outbox_mutex_;
+        std::vector<thread_message> outbox_;                // the messages not yet reported.
+        std::mutex ticker_mutex_;
+        std::condition_variable ticker_cond_;
+        bool ticker_done_;                                  // the run is done; stop ticking.
 
         const typename Nan::AsyncProgressWorkerBase<data_t>::ExecutionProgress *progress_;
 };
@@ -1416,11 +1561,20 @@ NAN_METHOD(DeIdentify) {
     // Get the first argument from: cvdiModule.deIdentify(diObject, diCallback, function () {});
     v8::Handle<Object> di_object = v8::Handle<Object>::Cast(info[0]);
 
-    GetConfiguration(isolate, di_object, config);
+    if (!GetConfiguration(isolate, di_object, config)) {
+        return;
+    }
+
     std::string quad_path = GetStringVal(isolate, di_object, "quadFile");
     std::string log_path = GetStringVal(isolate, di_object, "logFile");
     std::string output_dir_path = GetStringVal(isolate, di_object, "outputDir");
     bool build_quad = GetBoolVal(isolate, di_object, "buildQuad");
+    std::size_t max_queued = GetUInt32Val(isolate, di_object, "maxQueued");
+    MultiThread::QueueBackend backend = GetBoolVal(isolate, di_object, "lockFreeQueue") ? MultiThread::QueueBackend::kRing : MultiThread::QueueBackend::kLocked;
+    MultiThread::Schedule schedule = GetBoolVal(isolate, di_object, "workStealing") ? MultiThread::Schedule::kWorkStealing : MultiThread::Schedule::kLeastLoaded;
+    bool columnar_output = GetBoolVal(isolate, di_object, "columnarOutput");
+    bool autotune = GetBoolVal(isolate, di_object, "autotuneThreads");
+    std::string trace_path = GetStringVal(isolate, di_object, "traceFile");
     total_size = GetFiles(isolate, di_object, files);
 
     // Get the second argument from: cvdiModule.deIdentify(diObject, diCallback, function () {});
@@ -1432,7 +1586,11 @@ NAN_METHOD(DeIdentify) {
 
     // Create a worker with the JS callback.
     // Run the execute routine async.
-    AsyncQueueWorker(new CVDI(callback, progress, config, output_dir_path, quad_path, build_quad, log_path, files, total_size, std::thread::hardware_concurrency()));
+    // When tuning, start the most threads Parallel runs and let the tuner decide how many are active.
+    unsigned n_cpus = std::max(1u, std::thread::hardware_concurrency());
+    unsigned n_threads = autotune ? n_cpus + n_cpus / 2 : n_cpus;
+
+    AsyncQueueWorker(new CVDI(callback, progress, config, output_dir_path, quad_path, build_quad, log_path, files, total_size, n_threads, schedule, max_queued, backend, columnar_output, autotune, trace_path));
 }
 
 // Defines the entry point function to a Node add-on.
@@ -87,6 +87,8 @@ var DIModule = (function() {
      */
     var config = {
         'kml-output':                true,
+        'columnar-output':           false,
+        'trace-output':              false,
         'lat-field':                 'Latitude',
         'lng-field':                 'Longitude',
         'heading-field':             'Heading',
@@ -114,6 +116,7 @@ var DIModule = (function() {
         'rand-direct-distance':      0.0,
         'rand-manhattan-distance':   0.0,
         'rand-out-degree':           0.0,
+        'rand-seed':                 '',
         'sw-lat':                    35.946920,
         'sw-lng':                    -83.938486,
         'ne-lat':                    35.955526,
@@ -135,6 +138,8 @@ var DIModule = (function() {
     function getConfigMetaObject(configIn) {
         return {
             'kml-output': {type: 'boolean'},
+            'columnar-output': {type: 'boolean'},
+            'trace-output': {type: 'boolean'},
             'lat-field': {type: 'string'},
             'lng-field': {type: 'string'},
             'heading-field': {type: 'string'},
@@ -162,6 +167,7 @@ var DIModule = (function() {
             'rand-direct-distance': {type: 'float', min: 0.0, max: 1.0, step: 0.01},
             'rand-manhattan-distance': {type: 'float', min: 0.0, max: 1.0, step: 0.01},
             'rand-out-degree': {type: 'float', min: 0.0, max: 1.0, step: 0.01},
+            'rand-seed': {type: 'seed-string'},
             'sw-lat': {type: 'float', min: -84.0, max: configIn['ne-lat'], step: 0.01, maxProp: 'ne-lat'},
             'sw-lng': {type: 'float', min: -180.0, max: configIn['ne-lng'], step: 0.01, maxProp: 'ne-lng'},
             'ne-lat': {type: 'float', min: configIn['sw-lat'], max: 84.0, step: 0.01, minProp: 'sw-lat'},
@@ -177,6 +183,15 @@ var DIModule = (function() {
     function diCallback(evt) {
         if (evt.type === 'progress') {
             GUI.updateProgress(evt.progress * 100); 
+
+            // The warnings and errors since the last progress event come with it.
+            evt.messages.forEach(diCallback);
+
+            if (evt.done && evt.stages.length > 0) {
+                GUI.log('[DI] ' + evt.trips + ' trips; points per second by stage: ' + evt.stages.map(function (stage) {
+                    return stage.name + ' ' + Math.round(stage.pointsPerSecond);
+                }).join(', '));
+            }
         } else if (evt.type === 'message') {
             GUI.log(evt.message);
         } else if (evt.type === 'warning') {
@@ -268,6 +283,12 @@ var DIModule = (function() {
             outputDir: outputDir,
             quadFile: quadFile,
             buildQuad: reBuildQuad,
+            workStealing: true,
+            maxQueued: 256,
+            lockFreeQueue: true,
+            autotuneThreads: true,
+            columnarOutput: config['columnar-output'],
+            traceFile: config['trace-output'] ? path.join(outputDir, 'trace.json') : '',
             logFile: logFile,
             files: inputFiles
         };
@@ -479,6 +500,14 @@ var DIModule = (function() {
     
                         return;
                     } 
+                } else if (meta.type == 'seed-string') {
+                    newVal = String(newVal).trim();
+
+                    if (newVal.length > 0 && !/^[0-9]{1,19}$/.test(newVal)) {
+                        callback(prop + ': ' + 'value must be empty or a non-negative integer of at most 19 digits'); 
+
+                        return;
+                    }
                 } else if (meta.type == 'integer') {
                     newVal = Number(newVal);
     
@@ -625,6 +654,14 @@ var DIModule = (function() {
                 return;
             } 
 
+        } else if (meta.type == 'seed-string') {
+            newVal = String(val).trim();
+
+            if (newVal.length > 0 && !/^[0-9]{1,19}$/.test(newVal)) {
+                callback(config[prop], prop + ': value must be empty or a non-negative integer of at most 19 digits'); 
+
+                return;
+            }
         } else if (meta.type == 'integer') {
             newVal = Number(val);
 
@@ -0,0 +1,563 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+
+/**
+ * Throughput benchmarks for the library.
+ *
+ * The micro-benchmarks time the spatial lookups, distance functions, fit area construction and record parsing; the
+ * macro-benchmark runs the de-identification chain used by cv_di over synthetic trips on a synthetic road grid.
+ *
+ * usage: cvlib_bench [trip points (default: 2000)] [trips (default: 20)] [grid size (default: 20)]
+ *
+ * Results are written to standard output as CSV: benchmark,ops,ns_per_op,points_per_sec
+ */
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cvlib.hpp"
+
+namespace {
+
+    const double kGridLat = 35.90;          ///< the south west corner of the grid.
+    const double kGridLon = -83.95;
+    const double kGridStep = 0.001;         ///< the distance between grid vertices in degrees (about 100 m).
+    const double kTripSpeed = 10.0;         ///< speed of the synthetic trips in meters / second.
+    const uint64_t kTripPeriod = 100000;    ///< time between trip points in microseconds.
+
+    volatile double sink;                   ///< keeps the optimizer from dropping benchmarked work.
+
+    /**
+     * A square grid of residential roads.
+     */
+    struct Grid {
+        std::vector<geo::EdgeCPtr> edges;
+        geo::Point sw;
+        geo::Point ne;
+        Quad::Ptr quad_ptr;
+        FlatQuad::CPtr flat_quad_ptr;
+
+        explicit Grid(unsigned size) :
+            sw{ kGridLat - kGridStep, kGridLon - kGridStep },
+            ne{ kGridLat + size * kGridStep, kGridLon + size * kGridStep }
+        {
+            std::vector<geo::Vertex::Ptr> vertices;
+            uint64_t id = 1;
+
+            for (unsigned row = 0; row < size; ++row) {
+                for (unsigned col = 0; col < size; ++col) {
+                    vertices.push_back(std::make_shared<geo::Vertex>(kGridLat + row * kGridStep, kGridLon + col * kGridStep, id++));
+                }
+            }
+
+            for (unsigned row = 0; row < size; ++row) {
+                for (unsigned col = 0; col < size; ++col) {
+                    geo::Vertex::Ptr& v = vertices[row * size + col];
+
+                    if (col + 1 < size) {
+                        add_edge(v, vertices[row * size + col + 1], id++);
+                    }
+
+                    if (row + 1 < size) {
+                        add_edge(v, vertices[(row + 1) * size + col], id++);
+                    }
+                }
+            }
+
+            quad_ptr = std::make_shared<Quad>(sw, ne);
+
+            for (auto& edge_ptr : edges) {
+                Quad::insert(quad_ptr, std::dynamic_pointer_cast<const geo::Entity>(edge_ptr));
+            }
+
+            flat_quad_ptr = quad_ptr->freeze();
+        }
+
+        void add_edge(geo::Vertex::Ptr& v1, geo::Vertex::Ptr& v2, uint64_t id) {
+            geo::EdgePtr edge_ptr = std::make_shared<geo::Edge>(v1, v2, osm::Highway::RESIDENTIAL, id);
+            v1->add_edge(edge_ptr);
+            v2->add_edge(edge_ptr);
+            edges.push_back(edge_ptr);
+        }
+    };
+
+    /**
+     * A trip that snakes along the grid rows at a constant speed with a little GPS noise.
+     */
+    trajectory::Trajectory make_trip(unsigned size, std::size_t n_points, unsigned seed) {
+        std::mt19937 gen(seed);
+        std::normal_distribution<double> noise(0.0, 0.000005);
+        trajectory::Trajectory traj;
+
+        double step = kTripSpeed * kTripPeriod / 1000000.0;
+        double row_length = geo::Location::distance(kGridLat, kGridLon, kGridLat, kGridLon + (size - 1) * kGridStep);
+        double row_gap = geo::Location::distance(kGridLat, kGridLon, kGridLat + kGridStep, kGridLon);
+        double lat = kGridLat;
+        double lon = kGridLon;
+        double heading = 90.0;
+        double travelled = 0.0;
+        unsigned row = 0;
+
+        for (std::size_t i = 0; i < n_points; ++i) {
+            traj.push_back(memory::make_shared<trajectory::Point>("", (i + 1) * kTripPeriod, lat + noise(gen), lon + noise(gen), heading, kTripSpeed, i));
+
+            geo::Location next = geo::Location::project_position(lat, lon, heading, step);
+            lat = next.lat;
+            lon = next.lon;
+            travelled += step;
+
+            if (heading != 0.0 && travelled >= row_length) {
+                // Turn north to the next row.
+                heading = 0.0;
+                travelled = 0.0;
+            } else if (heading == 0.0 && travelled >= row_gap) {
+                row++;
+                heading = row % 2 == 0 ? 90.0 : 270.0;
+                travelled = 0.0;
+                lat = kGridLat + (row % size) * kGridStep;
+            }
+        }
+
+        return traj;
+    }
+
+    /**
+     * Write a trip as a BSMP1 CSV file.
+     */
+    void write_trip(const std::string& path, const trajectory::Trajectory& traj) {
+        std::ofstream os(path, std::ofstream::trunc);
+
+        if (os.fail()) {
+            throw std::invalid_argument("Could not open benchmark trip file: " + path);
+        }
+
+        os << "RxDevice,FileId,TxDevice,Gentime,TxRandom,MsgCount,DSecond,Latitude,Longitude,Elevation,Speed,Heading,Ax,Ay,Az,Yawrate,PathCount,RadiusOfCurve,Confidence" << std::endl;
+        os.precision(10);
+
+        for (auto& tp : traj) {
+            os << "1,1,1," << tp->get_time() << ",0,0,0," << tp->lat << "," << tp->lon << ",0," << tp->get_speed() << "," << tp->get_heading() << ",0,0,0,0,0,0,0" << std::endl;
+        }
+    }
+
+    void report(const std::string& name, uint64_t n_ops, double ns, uint64_t n_points = 0) {
+        std::cout << name << "," << n_ops << "," << ns / n_ops << ",";
+
+        if (n_points > 0) {
+            std::cout << n_points / (ns * 1e-9);
+        }
+
+        std::cout << std::endl;
+    }
+
+    template <typename F>
+    double time_ns(F f) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::vector<geo::Point> random_points(const Grid& grid, std::size_t n) {
+        std::mt19937 gen(7);
+        std::uniform_real_distribution<double> lat(grid.sw.lat, grid.ne.lat);
+        std::uniform_real_distribution<double> lon(grid.sw.lon, grid.ne.lon);
+        std::vector<geo::Point> points;
+
+        for (std::size_t i = 0; i < n; ++i) {
+            points.push_back(geo::Point{ lat(gen), lon(gen) });
+        }
+
+        return points;
+    }
+
+    void bench_quad(const Grid& grid) {
+        const std::size_t n = 200000;
+        std::vector<geo::Point> points = random_points(grid, n);
+
+        double ns = time_ns([&]() {
+            std::size_t found = 0;
+
+            for (auto& pt : points) {
+                found += grid.quad_ptr->retrieve_elements(pt).size();
+            }
+
+            sink = static_cast<double>(found);
+        });
+
+        report("quad_retrieve_elements", n, ns);
+
+        ns = time_ns([&]() {
+            std::size_t found = 0;
+
+            for (auto& pt : points) {
+                FlatQuad::EntityRange range = grid.flat_quad_ptr->retrieve_elements(pt);
+                found += range.second - range.first;
+            }
+
+            sink = static_cast<double>(found);
+        });
+
+        report("flat_quad_retrieve_elements", n, ns);
+
+        // building the tree one edge at a time against partitioning the whole edge list.
+        geo::Entity::PtrList entities{ grid.edges.begin(), grid.edges.end() };
+
+        ns = time_ns([&]() {
+            Quad::Ptr quad_ptr = std::make_shared<Quad>(grid.sw, grid.ne);
+
+            for (auto& entity_ptr : entities) {
+                Quad::insert(quad_ptr, entity_ptr);
+            }
+        });
+
+        report("quad_insert", entities.size(), ns);
+
+        for (unsigned n_threads : { 1u, 4u }) {
+            ns = time_ns([&]() {
+                Quad::Ptr quad_ptr = std::make_shared<Quad>(grid.sw, grid.ne);
+                Quad::bulk_insert(quad_ptr, entities, n_threads);
+            });
+
+            report("quad_bulk_insert_" + std::to_string(n_threads), entities.size(), ns);
+        }
+    }
+
+    void bench_distance(const Grid& grid) {
+        const std::size_t n = 1000000;
+        std::vector<geo::Point> points = random_points(grid, n + 1);
+        std::vector<geo::Location> locations;
+
+        for (auto& pt : points) {
+            locations.push_back(geo::Location{ pt.lat, pt.lon });
+        }
+
+        double ns = time_ns([&]() {
+            double total = 0.0;
+
+            for (std::size_t i = 0; i < n; ++i) {
+                total += geo::Location::distance(locations[i], locations[i + 1]);
+            }
+
+            sink = total;
+        });
+
+        report("location_distance", n, ns);
+
+        ns = time_ns([&]() {
+            double total = 0.0;
+
+            for (std::size_t i = 0; i < n; ++i) {
+                total += geo::Location::distance_haversine(locations[i], locations[i + 1]);
+            }
+
+            sink = total;
+        });
+
+        report("location_distance_haversine", n, ns);
+
+        std::vector<double> latrs;
+        std::vector<double> lonrs;
+        std::vector<double> out(n + 1);
+
+        for (auto& loc : locations) {
+            latrs.push_back(loc.latr);
+            lonrs.push_back(loc.lonr);
+        }
+
+        ns = time_ns([&]() {
+            geo::kernels::consecutive_distances(latrs.data(), lonrs.data(), n + 1, out.data());
+            sink = out[n];
+        });
+
+        report("kernel_consecutive_distances", n, ns);
+
+        ns = time_ns([&]() {
+            double total = 0.0;
+
+            for (std::size_t i = 0; i < n; ++i) {
+                total += geo::Location::bearing(locations[i], locations[i + 1]);
+            }
+
+            sink = total;
+        });
+
+        report("location_bearing", n, ns);
+
+        ns = time_ns([&]() {
+            geo::kernels::consecutive_bearings(latrs.data(), lonrs.data(), n + 1, out.data());
+            sink = out[n];
+        });
+
+        report("kernel_consecutive_bearings", n, ns);
+    }
+
+    void bench_to_area(const Grid& grid) {
+        const unsigned n_rounds = 20;
+
+        double ns = time_ns([&]() {
+            std::size_t n_areas = 0;
+
+            for (unsigned r = 0; r < n_rounds; ++r) {
+                for (auto& eptr : grid.edges) {
+                    n_areas += eptr->to_area(eptr->get_way_width(), 5.0) ? 1 : 0;
+                }
+            }
+
+            sink = static_cast<double>(n_areas);
+        });
+
+        report("edge_to_area", n_rounds * grid.edges.size(), ns);
+
+        // containment of points near each area, as the map fitter tests them.
+        const std::size_t n_points = 16;
+        std::vector<geo::AreaCPtr> areas;
+        std::vector<geo::Point> points;
+
+        for (auto& eptr : grid.edges) {
+            areas.push_back(eptr->to_area(eptr->get_way_width(), 5.0));
+
+            for (std::size_t i = 0; i < n_points; ++i) {
+                double t = static_cast<double>(i) / n_points;
+                points.push_back(geo::Point{ eptr->v1->lat + t * (eptr->v2->lat - eptr->v1->lat) + 0.00003, eptr->v1->lon + t * (eptr->v2->lon - eptr->v1->lon) });
+            }
+        }
+
+        ns = time_ns([&]() {
+            std::size_t n_contained = 0;
+
+            for (unsigned r = 0; r < n_rounds; ++r) {
+                for (std::size_t i = 0; i < points.size(); ++i) {
+                    n_contained += areas[i / n_points]->contains(points[i]) ? 1 : 0;
+                }
+            }
+
+            sink = static_cast<double>(n_contained);
+        });
+
+        report("area_contains", n_rounds * points.size(), ns);
+
+        ns = time_ns([&]() {
+            std::size_t n_contained = 0;
+
+            for (unsigned r = 0; r < n_rounds; ++r) {
+                for (std::size_t i = 0; i < points.size(); ++i) {
+                    n_contained += areas[i / n_points]->contains_planar(points[i]) ? 1 : 0;
+                }
+            }
+
+            sink = static_cast<double>(n_contained);
+        });
+
+        report("area_contains_planar", n_rounds * points.size(), ns);
+    }
+
+    void bench_error_correct(unsigned size, std::size_t n_points, uint64_t sample_size, bool sliding_window) {
+        const unsigned n_rounds = 20;
+        trajectory::Trajectory trip = make_trip(size, n_points, 1);
+        uint64_t n_total = 0;
+        double ns = 0.0;
+
+        for (unsigned r = 0; r < n_rounds; ++r) {
+            trajectory::Trajectory traj{ trip };
+            n_total += traj.size();
+
+            ns += time_ns([&]() {
+                ErrorCorrector ec(sample_size, sliding_window);
+                ec.correct_error(traj, "bench");
+                sink = static_cast<double>(traj.size());
+            });
+        }
+
+        report((sliding_window ? "error_correct_sliding_" : "error_correct_") + std::to_string(sample_size), n_rounds, ns, n_total);
+    }
+
+    void bench_parse(unsigned size, std::size_t n_points) {
+        const std::string path = "cvlib_bench_trip.csv";
+        const unsigned n_rounds = 20;
+
+        write_trip(path, make_trip(size, n_points, 1));
+
+        uint64_t n_parsed = 0;
+
+        double ns = time_ns([&]() {
+            for (unsigned r = 0; r < n_rounds; ++r) {
+                BSMP1::BSMP1CSVTrajectoryFactory factory;
+                n_parsed += factory.make_trajectory(path).size();
+            }
+        });
+
+        report("bsmp1_make_point", n_parsed, ns, n_parsed);
+
+        n_parsed = 0;
+
+        ns = time_ns([&]() {
+            for (unsigned r = 0; r < n_rounds; ++r) {
+                BSMP1::BSMP1CSVTrajectoryFactory factory;
+                n_parsed += factory.make_mapped_trajectory(path).size();
+            }
+        });
+
+        report("bsmp1_make_point_mapped", n_parsed, ns, n_parsed);
+
+        n_parsed = 0;
+
+        ns = time_ns([&]() {
+            for (unsigned r = 0; r < n_rounds; ++r) {
+                BSMP1::BSMP1CSVTrajectoryFactory factory;
+                n_parsed += factory.make_columns(path).size();
+            }
+        });
+
+        report("bsmp1_make_columns", n_parsed, ns, n_parsed);
+
+        n_parsed = 0;
+
+        ns = time_ns([&]() {
+            for (unsigned r = 0; r < n_rounds; ++r) {
+                BSMP1::BSMP1CSVTrajectoryFactory factory;
+                n_parsed += factory.make_mapped_columns(path).size();
+            }
+        });
+
+        report("bsmp1_make_columns_mapped", n_parsed, ns, n_parsed);
+
+        std::remove(path.c_str());
+    }
+
+    /**
+     * The de-identification chain of DICSV::DeIdentify (without KML output) using the utk.config parameters.
+     */
+    trajectory::Trajectory de_identify(trajectory::Trajectory& traj, const Grid& grid, const EdgeAreaCache::CPtr& area_cache_ptr, bool staged) {
+        ErrorCorrector ec(50);
+        ec.correct_error(traj, "bench");
+
+        MapFitter mf{grid.flat_quad_ptr, 1.0, 0.5, area_cache_ptr, false};
+        ImplicitMapFitter imf{36, 10, false};
+        IntersectionCounter ic{};
+        Detector::TurnAround tad{20, 30.0, 100.0, 90.0, false};
+        Detector::Stop stop_detector{1.0, 50.0, 2.5};
+
+        if (staged) {
+            mf.fit(traj);
+            imf.fit(traj);
+            ic.count_intersections(traj);
+            tad.find_turn_arounds(traj);
+            stop_detector.find_stops(traj);
+        } else {
+            PointPipeline pipeline{mf, imf, ic, tad, stop_detector};
+            pipeline.run(traj);
+        }
+
+        trajectory::Interval::PtrList ta_critical_intervals = tad.get_turn_arounds();
+        trajectory::Interval::PtrList stop_critical_intervals = stop_detector.get_stops();
+
+        StartEndIntervals sei;
+
+        IntervalMarker im({ ta_critical_intervals, stop_critical_intervals, sei.get_start_end_intervals(traj) });
+        im.mark_trajectory(traj);
+
+        PrivacyIntervalFinder pif(10.0, 10.0, 0, 10000.0, 10000.0, 0, 0.0, 0.0, 0.0);
+        trajectory::Interval::PtrList priv_intervals = pif.find_intervals(traj);
+
+        PrivacyIntervalMarker pim({ priv_intervals });
+        pim.mark_trajectory(traj);
+
+        DeIdentifier di;
+
+        return di.de_identify(traj);
+    }
+
+    void bench_pipeline(const Grid& grid, unsigned size, std::size_t n_points, unsigned n_trips, bool staged, memory::Arena* arena) {
+        EdgeAreaCache::CPtr area_cache_ptr = std::make_shared<const EdgeAreaCache>(grid.edges, 1.0, 0.5);
+        std::unique_ptr<memory::Arena::Scope> arena_scope;
+        uint64_t n_total = 0;
+        double ns = 0.0;
+
+        if (arena) {
+            arena_scope.reset(new memory::Arena::Scope(*arena));
+        }
+
+        for (unsigned i = 0; i < n_trips; ++i) {
+            if (arena) {
+                arena->reset();
+            }
+
+            trajectory::Trajectory traj = make_trip(size, n_points, i + 1);
+            n_total += traj.size();
+
+            ns += time_ns([&]() {
+                sink = static_cast<double>(de_identify(traj, grid, area_cache_ptr, staged).size());
+            });
+        }
+
+        report(staged ? "de_identify_pipeline_staged" : (arena ? "de_identify_pipeline_arena" : "de_identify_pipeline"), n_trips, ns, n_total);
+    }
+}
+
+int main(int argc, char** argv) {
+    std::size_t n_points = 2000;
+    unsigned n_trips = 20;
+    unsigned size = 20;
+
+    try {
+        if (argc > 1) {
+            n_points = std::stoul(argv[1]);
+        }
+
+        if (argc > 2) {
+            n_trips = static_cast<unsigned>(std::stoul(argv[2]));
+        }
+
+        if (argc > 3) {
+            size = static_cast<unsigned>(std::stoul(argv[3]));
+        }
+    } catch (std::exception&) {
+        std::cerr << "usage: " << argv[0] << " [trip points] [trips] [grid size]" << std::endl;
+        return 1;
+    }
+
+    if (n_points < 2 || n_trips < 1 || size < 2) {
+        std::cerr << "Trips need at least 2 points and the grid at least 2 vertices per side." << std::endl;
+        return 1;
+    }
+
+    Grid grid(size);
+
+    std::cout << "benchmark,ops,ns_per_op,points_per_sec" << std::endl;
+
+    bench_quad(grid);
+    bench_distance(grid);
+    bench_to_area(grid);
+    bench_parse(size, n_points);
+    bench_error_correct(size, n_points, 50, false);
+    bench_error_correct(size, n_points, 500, false);
+    bench_error_correct(size, n_points, 50, true);
+    memory::Arena arena;
+
+    bench_pipeline(grid, size, n_points, n_trips, true, nullptr);
+    bench_pipeline(grid, size, n_points, n_trips, false, nullptr);
+    bench_pipeline(grid, size, n_points, n_trips, false, &arena);
+
+    return 0;
+}
@@ -36,9 +36,18 @@
 #include <fstream>
 #include <string>
 #include <vector>
-// #include <iterator>
-// #include <algorithm>
+#include <map>
+#include <set>
+#include <iterator>
+#include <algorithm>
 #include <regex>
+#include <cstring>
+#include <cstdlib>
+#include <iomanip>
+#include <thread>
+#include <random>
+
+#include <sys/stat.h>
 
 #include "cvlib.hpp"
 
@@ -304,19 +313,1017 @@ TEST_CASE( "Parse Shape File Data", "[quad][shapefile]" ) {
     CHECK_THROWS_AS(output_factory_1.write_shapes(), std::invalid_argument);
     shapes::CSVOutputFactory output_factory("unit-test-data/lib-test-data/test.shapes.out");
 
-    for ( auto& eptr : input_factory.get_edges() ) {
-        output_factory.add_edge(eptr);
+    for ( auto& eptr : input_factory.get_edges() ) {
+        output_factory.add_edge(eptr);
+    }
+
+    for ( auto& gptr : input_factory.get_grids() ) {
+        output_factory.add_grid(gptr);
+    }
+
+    for ( auto& cptr : input_factory.get_circles() ) {
+        output_factory.add_circle(cptr);
+    }
+
+    CHECK_NOTHROW(output_factory.write_shapes());
+}
+
+TEST_CASE("Span Parsing", "[utilities]") {
+    SECTION("Split") {
+        std::vector<std::string> lines { "", "a", "a,b", "a,,b", "a,b,", ",a", ",", "a,b,,," };
+
+        // Field counts and contents must agree with the std::string split.
+        for (auto& line : lines) {
+            StrVector parts = string_utilities::split(line, ',');
+            string_utilities::CharSpan spans[8];
+            std::size_t n = string_utilities::split(line.data(), line.data() + line.size(), ',', spans, 8);
+
+            REQUIRE(n == parts.size());
+
+            for (std::size_t i = 0; i < n; ++i) {
+                CHECK(spans[i].str() == parts[i]);
+            }
+        }
+
+        std::string line = "1,2,3,4";
+        string_utilities::CharSpan spans[2];
+        CHECK(string_utilities::split(line.data(), line.data() + line.size(), ',', spans, 2) == 4);
+        CHECK(spans[1].str() == "2");
+    }
+
+    SECTION("Numbers") {
+        std::vector<std::string> doubles { "0", "-0.0", "42.283135", "-83.735670", " 12.5", "+7", ".5", "5.", "359.9999",
+            "1e3", "1.5E-2", "0x1A", "inf", "12abc", "0.1234567890123456789", "123456789012345678901234567890",
+            "35.95552600000000000000001" };
+
+        for (auto& d : doubles) {
+            string_utilities::CharSpan span{ d.data(), d.data() + d.size() };
+            double expected = std::stod(d);
+            double value = string_utilities::to_double(span);
+            // bitwise equality with stod.
+            CHECK(std::memcmp(&expected, &value, sizeof(double)) == 0);
+        }
+
+        std::srand(1);
+
+        for (int i = 0; i < 10000; ++i) {
+            std::ostringstream ss;
+            ss << std::fixed << std::setprecision(i % 12) << (std::rand() / static_cast<double>(RAND_MAX) - 0.5) * 360.0;
+            std::string d = ss.str();
+            CHECK(string_utilities::to_double(string_utilities::CharSpan{ d.data(), d.data() + d.size() }) == std::stod(d));
+        }
+
+        std::vector<std::string> bad_doubles { "", "-", ".", "abc", " " };
+
+        for (auto& d : bad_doubles) {
+            CHECK_THROWS_AS(string_utilities::to_double(string_utilities::CharSpan{ d.data(), d.data() + d.size() }), std::invalid_argument);
+        }
+
+        std::string big = "1e400";
+        CHECK_THROWS_AS(string_utilities::to_double(string_utilities::CharSpan{ big.data(), big.data() + big.size() }), std::out_of_range);
+
+        std::vector<std::string> ints { "0", "1493131804281", " 18446744073709551615", "12x", "+5" };
+
+        for (auto& u : ints) {
+            CHECK(string_utilities::to_uint64(string_utilities::CharSpan{ u.data(), u.data() + u.size() }) == std::stoull(u));
+        }
+
+        std::string overflow = "18446744073709551616";
+        CHECK_THROWS_AS(string_utilities::to_uint64(string_utilities::CharSpan{ overflow.data(), overflow.data() + overflow.size() }), std::out_of_range);
+        std::string no_digits = "x";
+        CHECK_THROWS_AS(string_utilities::to_uint64(string_utilities::CharSpan{ no_digits.data(), no_digits.data() + no_digits.size() }), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Mapped Trajectory", "[trajectory][bsmp1]") {
+    std::vector<std::string> inputs{ "unit-test-data/lib-test-data/utk_test.csv", "unit-test-data/lib-test-data/utk_err_test.csv" };
+
+    for (auto& input : inputs) {
+        BSMP1::BSMP1CSVTrajectoryFactory stream_factory;
+        BSMP1::BSMP1CSVTrajectoryFactory mapped_factory;
+        instrument::PointCounter stream_counter;
+        instrument::PointCounter mapped_counter;
+
+        trajectory::Trajectory stream_traj = stream_factory.make_trajectory(input, stream_counter);
+        trajectory::Trajectory mapped_traj = mapped_factory.make_mapped_trajectory(input, mapped_counter);
+
+        CHECK(stream_factory.get_uid() == mapped_factory.get_uid());
+        REQUIRE(stream_traj.size() == mapped_traj.size());
+
+        for (std::size_t i = 0; i < stream_traj.size(); ++i) {
+            CHECK(stream_traj[i]->get_index() == mapped_traj[i]->get_index());
+            CHECK(stream_traj[i]->get_time() == mapped_traj[i]->get_time());
+            CHECK(stream_traj[i]->lat == mapped_traj[i]->lat);
+            CHECK(stream_traj[i]->lon == mapped_traj[i]->lon);
+            CHECK(stream_traj[i]->get_heading() == mapped_traj[i]->get_heading());
+            CHECK(stream_traj[i]->get_speed() == mapped_traj[i]->get_speed());
+            CHECK(stream_traj[i]->get_data() == mapped_traj[i]->get_data());
+        }
+
+        CHECK(stream_counter.n_points == mapped_counter.n_points);
+        CHECK(stream_counter.n_invalid_field_points == mapped_counter.n_invalid_field_points);
+        CHECK(stream_counter.n_invalid_geo_points == mapped_counter.n_invalid_geo_points);
+        CHECK(stream_counter.n_invalid_heading_points == mapped_counter.n_invalid_heading_points);
+    }
+
+    BSMP1::BSMP1CSVTrajectoryFactory factory;
+    CHECK_THROWS_AS(factory.make_mapped_trajectory("unit-test-data/lib-test-data/does_not_exist.csv"), std::invalid_argument);
+}
+
+TEST_CASE("Trajectory Columns", "[trajectory][bsmp1]") {
+    std::string input = "unit-test-data/lib-test-data/utk_err_test.csv";
+
+    BSMP1::BSMP1CSVTrajectoryFactory point_factory;
+    BSMP1::BSMP1CSVTrajectoryFactory column_factory;
+    BSMP1::BSMP1CSVTrajectoryFactory mapped_factory;
+
+    trajectory::Trajectory traj = point_factory.make_trajectory(input);
+    trajectory::Columns cols = column_factory.make_columns(input);
+    trajectory::Columns mapped_cols = mapped_factory.make_mapped_columns(input);
+
+    CHECK(column_factory.get_uid() == point_factory.get_uid());
+    REQUIRE(cols.size() == traj.size());
+    REQUIRE(mapped_cols.size() == traj.size());
+
+    SECTION("Factory") {
+        for (trajectory::Index i = 0; i < traj.size(); ++i) {
+            CHECK(cols.indexes()[i] == traj[i]->get_index());
+            CHECK(cols.times()[i] == traj[i]->get_time());
+            CHECK(cols.lats()[i] == traj[i]->lat);
+            CHECK(cols.lons()[i] == traj[i]->lon);
+            CHECK(cols.headings()[i] == traj[i]->get_heading());
+            CHECK(cols.speeds()[i] == traj[i]->get_speed());
+            CHECK(cols.record(i).str() == traj[i]->get_data());
+            CHECK(mapped_cols.record(i).str() == traj[i]->get_data());
+            CHECK_FALSE(cols.has_edge(i));
+            CHECK_FALSE(cols.is_critical(i));
+            CHECK_FALSE(cols.is_private(i));
+        }
+    }
+
+    SECTION("Adapter") {
+        geo::Vertex::Ptr v1 = std::make_shared<geo::Vertex>(35.95, -83.93, 1);
+        geo::Vertex::Ptr v2 = std::make_shared<geo::Vertex>(35.96, -83.92, 2);
+        geo::EdgeCPtr edge = std::make_shared<const geo::Edge>(v1, v2, 1);
+        trajectory::IntervalCPtr interval = std::make_shared<const trajectory::Interval>(1, 3, "stop");
+
+        for (trajectory::Index i = 0; i < 4; ++i) {
+            traj[i]->set_fit_edge(edge);
+        }
+
+        traj[1]->set_critical_interval(interval);
+        traj[2]->set_critical_interval(interval);
+        traj[5]->set_private();
+        traj[6]->set_out_degree(3);
+
+        trajectory::Columns converted{ traj };
+        trajectory::Trajectory round_trip = converted.to_trajectory();
+
+        CHECK(converted.get_fit_edge(3) == edge);
+        CHECK_FALSE(converted.has_edge(4));
+        CHECK(converted.get_critical_interval(2) == interval);
+        CHECK(converted.is_private(5));
+        CHECK(converted.out_degrees()[6] == 3);
+
+        REQUIRE(round_trip.size() == traj.size());
+
+        for (trajectory::Index i = 0; i < traj.size(); ++i) {
+            CHECK(round_trip[i]->get_index() == traj[i]->get_index());
+            CHECK(round_trip[i]->get_time() == traj[i]->get_time());
+            CHECK(round_trip[i]->lat == traj[i]->lat);
+            CHECK(round_trip[i]->lon == traj[i]->lon);
+            CHECK(round_trip[i]->get_data() == traj[i]->get_data());
+            CHECK(round_trip[i]->get_fit_edge() == traj[i]->get_fit_edge());
+            CHECK(round_trip[i]->get_critical_interval() == traj[i]->get_critical_interval());
+            CHECK(round_trip[i]->is_private() == traj[i]->is_private());
+            CHECK(round_trip[i]->get_out_degree() == traj[i]->get_out_degree());
+        }
+    }
+
+    SECTION("De-Identify") {
+        trajectory::Interval::PtrList critical{ std::make_shared<const trajectory::Interval>(2, 5, "stop") };
+        trajectory::Interval::PtrList privacy{ std::make_shared<const trajectory::Interval>(0, 2, "privacy"), std::make_shared<const trajectory::Interval>(5, 9, "privacy") };
+
+        IntervalMarker im_traj({ critical });
+        IntervalMarker im_cols({ critical });
+        IntervalMarker im_mapped({ critical });
+        im_traj.mark_trajectory(traj);
+        im_cols.mark_trajectory(cols);
+        im_mapped.mark_trajectory(mapped_cols);
+
+        PrivacyIntervalMarker pim_traj({ privacy });
+        PrivacyIntervalMarker pim_cols({ privacy });
+        PrivacyIntervalMarker pim_mapped({ privacy });
+        pim_traj.mark_trajectory(traj);
+        pim_cols.mark_trajectory(cols);
+        pim_mapped.mark_trajectory(mapped_cols);
+
+        DeIdentifier di_traj;
+        DeIdentifier di_cols;
+        DeIdentifier di_mapped;
+        const trajectory::Trajectory& di_traj_result = di_traj.de_identify(traj);
+        const trajectory::Columns& di_cols_result = di_cols.de_identify(cols);
+        const trajectory::Columns& di_mapped_result = di_mapped.de_identify(mapped_cols);
+
+        REQUIRE(di_traj_result.size() == traj.size() - 9);
+        REQUIRE(di_cols_result.size() == di_traj_result.size());
+        REQUIRE(di_mapped_result.size() == di_traj_result.size());
+
+        for (trajectory::Index i = 0; i < di_traj_result.size(); ++i) {
+            CHECK(di_cols_result.indexes()[i] == di_traj_result[i]->get_index());
+            CHECK(di_cols_result.record(i).str() == di_traj_result[i]->get_data());
+            CHECK(di_mapped_result.record(i).str() == di_traj_result[i]->get_data());
+        }
+
+        std::ostringstream expected;
+
+        for (auto& tp : di_traj_result) {
+            expected << tp->get_data() << std::endl;
+        }
+
+        std::ostringstream streamed;
+        trajectory::StreamPointSink sink{ streamed, true };
+        DeIdentifier di_sink;
+        CHECK(di_sink.de_identify(traj, sink) == di_traj_result.size());
+        CHECK(streamed.str() == expected.str());
+
+        std::ostringstream counted;
+        trajectory::StreamPointSink counted_sink{ counted, true };
+        instrument::PointCounter point_counter;
+        CHECK(di_sink.de_identify(traj, counted_sink, point_counter) == di_traj_result.size());
+        CHECK(counted.str() == expected.str());
+        CHECK(point_counter.n_ci_points == 3);
+        CHECK(point_counter.n_pi_points == 6);
+    }
+
+    CHECK_THROWS_AS(trajectory::Columns{ mapped_cols }.push_back(*traj[0]), std::invalid_argument);
+}
+
+TEST_CASE("Columnar Trajectory", "[trajectory][bsmp1]") {
+    SECTION("Round Trip") {
+        std::vector<std::string> records{ "1,0.50,-3,x,", "2,0.05,-12,y,a", "02,-1.25,7.5,y,a", "-0,-0.0,-8,,a" };
+        std::stringstream ss;
+        // Two rows per group so a group has a column of each encoding.
+        columnar::Writer writer{ ss, columnar::column_names("a,b,c,d,e\r"), true, 2 };
+
+        for (auto& record : records) {
+            writer.write_record(string_utilities::CharSpan{ record.data(), record.data() + record.size() });
+        }
+
+        std::string bad = "1,2";
+        CHECK_THROWS_AS(writer.write_record(string_utilities::CharSpan{ bad.data(), bad.data() + bad.size() }), std::invalid_argument);
+        writer.close();
+
+        columnar::Reader reader{ ss };
+        CHECK(reader.get_column_names() == std::vector<std::string>({ "a", "b", "c", "d", "e" }));
+        REQUIRE(reader.next_group());
+        CHECK(reader.group_size() == 2);
+        CHECK(reader.get_column(0).encoding == columnar::Encoding::kInteger);
+        CHECK(reader.get_column(1).encoding == columnar::Encoding::kDecimal);
+        CHECK(reader.get_column(2).encoding == columnar::Encoding::kInteger);
+        CHECK(reader.get_column(3).encoding == columnar::Encoding::kString);
+        CHECK(reader.get_column(1).to_double(1) == 0.05);
+
+        std::vector<std::string> restored;
+
+        do {
+            for (std::size_t row = 0; row < reader.group_size(); ++row) {
+                restored.push_back("");
+                reader.append_record(row, restored.back());
+            }
+
+            CHECK(reader.get_column(4).size() == reader.group_size());
+        } while (reader.next_group());
+
+        CHECK(restored == records);
+        CHECK_FALSE(reader.next_group());
+
+        std::stringstream not_columnar("RxDevice,FileId");
+        CHECK_THROWS_AS(columnar::Reader{ not_columnar }, std::invalid_argument);
+    }
+
+    SECTION("Factory") {
+        BSMP1::BSMP1CSVTrajectoryFactory csv_factory;
+        BSMP1::BSMP1ColumnarTrajectoryFactory columnar_factory;
+        trajectory::Trajectory traj = csv_factory.make_trajectory("unit-test-data/lib-test-data/utk_err_test.csv");
+
+        BSMP1::BSMP1ColumnarTrajectoryWriter writer{ "" };
+        writer.write_trajectory(traj, "columnar_test", true);
+        REQUIRE(columnar::is_columnar_path(writer.output_path("columnar_test")));
+
+        instrument::PointCounter point_counter;
+        trajectory::Trajectory restored = columnar_factory.make_trajectory(writer.output_path("columnar_test"), point_counter);
+
+        CHECK(columnar_factory.get_uid() == csv_factory.get_uid());
+        CHECK(point_counter.n_points == traj.size());
+        REQUIRE(restored.size() == traj.size());
+
+        for (std::size_t i = 0; i < traj.size(); ++i) {
+            CHECK(restored[i]->get_time() == traj[i]->get_time());
+            CHECK(restored[i]->lat == traj[i]->lat);
+            CHECK(restored[i]->lon == traj[i]->lon);
+            CHECK(restored[i]->get_data() == traj[i]->get_data());
+        }
+
+        // The BSMP1 columns are typed.
+        std::ifstream file(writer.output_path("columnar_test"), std::ios::binary);
+        columnar::Reader reader{ file };
+        REQUIRE(reader.next_group());
+        CHECK(reader.get_column(3).encoding == columnar::Encoding::kInteger);
+        CHECK(reader.get_column(7).encoding == columnar::Encoding::kDecimal);
+        file.close();
+
+        std::remove(writer.output_path("columnar_test").c_str());
+        CHECK_THROWS_AS(columnar_factory.make_trajectory("unit-test-data/lib-test-data/utk_err_test.csv"), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Compressed Streams", "[compression][bsmp1]") {
+    CHECK(compression::parse_format("gzip") == compression::Format::kGzip);
+    CHECK(compression::parse_format("zst") == compression::Format::kZstd);
+    CHECK(compression::parse_format("none") == compression::Format::kNone);
+    CHECK_THROWS_AS(compression::parse_format("bzip2"), std::invalid_argument);
+    CHECK(compression::file_extension(compression::Format::kNone).empty());
+
+    for (compression::Format format : { compression::Format::kGzip, compression::Format::kZstd }) {
+        if (!compression::is_supported(format)) {
+            CHECK_THROWS_AS(compression::OutputFile("compression_test", format), std::invalid_argument);
+
+            continue;
+        }
+
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_err_test.csv");
+        BSMP1::BSMP1CSVTrajectoryWriter writer{ "", format };
+        std::string path = writer.output_path("compression_test");
+        REQUIRE(path == "compression_test.csv" + compression::file_extension(format));
+        writer.write_trajectory(traj, "compression_test", true);
+
+        BSMP1::BSMP1CSVTrajectoryWriter plain_writer{ "" };
+        plain_writer.write_trajectory(traj, "compression_test", true);
+        std::ifstream plain(plain_writer.output_path("compression_test"), std::ios::binary);
+        std::string expected;
+        compression::read_all(plain, expected);
+        plain.close();
+        std::remove(plain_writer.output_path("compression_test").c_str());
+
+        compression::InputFile file(path);
+        REQUIRE_FALSE(file.fail());
+        CHECK(file.get_format() == format);
+        std::string contents;
+        compression::read_all(file, contents);
+        file.close();
+        CHECK(contents == expected);
+
+        std::ifstream compressed(path, std::ios::binary);
+        CHECK(compression::detect_format(compressed) == format);
+        CHECK(compression::size_hint(compressed) >= contents.size());
+        compressed.close();
+
+        MappedFile mapped(path);
+        CHECK(std::string(mapped.data(), mapped.size()) == contents);
+
+        BSMP1::BSMP1CSVTrajectoryFactory compressed_factory;
+        trajectory::Trajectory restored = compressed_factory.make_trajectory(path);
+        REQUIRE(restored.size() == traj.size());
+        CHECK(compressed_factory.get_uid() == factory.get_uid());
+
+        for (std::size_t i = 0; i < traj.size(); ++i) {
+            CHECK(restored[i]->get_data() == traj[i]->get_data());
+        }
+
+        // A truncated file is an error rather than a short trip.
+        std::ifstream whole(path, std::ios::binary);
+        std::string bytes;
+        compression::read_all(whole, bytes);
+        whole.close();
+        std::ofstream truncated(path, std::ios::binary | std::ios::trunc);
+        truncated.write(bytes.data(), bytes.size() / 2);
+        truncated.close();
+        CHECK_THROWS_AS(compressed_factory.make_trajectory(path), std::invalid_argument);
+
+        std::remove(path.c_str());
+    }
+
+    std::stringstream gzip_magic("\x1f\x8b\x08");
+    CHECK(compression::detect_format(gzip_magic) == compression::Format::kGzip);
+    std::stringstream text("RxDevice,FileId");
+    CHECK(compression::detect_format(text) == compression::Format::kNone);
+    CHECK(compression::size_hint(text) == 15);
+    CHECK(text.tellg() == 0);
+}
+
+TEST_CASE("Async Writer", "[output]") {
+    BSMP1::BSMP1CSVTrajectoryFactory factory;
+    trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_err_test.csv");
+
+    std::string records;
+
+    for (auto& tp : traj) {
+        records += tp->get_data() + "\n";
+    }
+
+    std::vector<std::string> uids{ "trip_a", "trip_b", "trip_c", "trip_d", "trip_e" };
+
+    {
+        output::AsyncWriter writer{ "", BSMP1::kCSVHeader, 2, 2 };
+        // A small block size so the trips span several blocks.
+        output::BufferedTrajectoryWriter buffered{ writer, 1024 };
+
+        for (auto& uid : uids) {
+            std::unique_ptr<trajectory::PointSink> sink = buffered.open_trajectory(uid, true);
+
+            for (auto& tp : traj) {
+                sink->write_point(*tp);
+            }
+
+            sink->close();
+
+            // An abandoned trip leaves no records behind.
+            std::unique_ptr<trajectory::PointSink> abandoned = buffered.open_trajectory(uid + "_x", true);
+            abandoned->write_point(*traj[0]);
+        }
+
+        buffered.flush();
+        writer.close();
+        CHECK(writer.shard_of("trip_a") == writer.shard_of("trip_a"));
+    }
+
+    std::vector<std::string> found;
+
+    for (unsigned shard = 0; shard < 2; ++shard) {
+        std::string name = "trips_" + std::to_string(shard);
+        std::ifstream data_file(name + ".csv", std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(data_file)), std::istreambuf_iterator<char>());
+        std::ifstream index_file(name + ".idx");
+        std::string line;
+        uint64_t n_bytes = BSMP1::kCSVHeader.size() + 1;
+
+        REQUIRE(std::getline(index_file, line));
+        CHECK(line == "uid,offset,bytes,records");
+        CHECK(data.compare(0, n_bytes, BSMP1::kCSVHeader + "\n") == 0);
+
+        while (std::getline(index_file, line)) {
+            StrVector fields = string_utilities::split(line, ',');
+            REQUIRE(fields.size() == 4);
+
+            uint64_t offset = std::stoull(fields[1]);
+            uint64_t size = std::stoull(fields[2]);
+
+            CHECK(data.substr(offset, size) == records);
+            CHECK(std::stoull(fields[3]) == traj.size());
+            found.push_back(fields[0]);
+            n_bytes += size;
+        }
+
+        CHECK(data.size() == n_bytes);
+
+        data_file.close();
+        index_file.close();
+        std::remove((name + ".csv").c_str());
+        std::remove((name + ".idx").c_str());
+    }
+
+    std::sort(found.begin(), found.end());
+    CHECK(found == uids);
+}
+
+TEST_CASE("Trip Index", "[trajectory][bsmp1]") {
+    BSMP1::BSMP1CSVTrajectoryFactory factory;
+    trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+
+    // a file of trips with the device and file ids of each trip; file 2 appears twice, so it makes two trips.
+    std::vector<std::pair<std::string, std::string>> ids{ { "7", "1" }, { "7", "2" }, { "8", "2" }, { "7", "2" }, { "9", "10" } };
+    std::string contents = BSMP1::kCSVHeader + "\r\n";
+    std::vector<uint64_t> offsets;
+
+    for (auto& id : ids) {
+        offsets.push_back(contents.size());
+
+        for (uint64_t i = 0; i < traj.size(); ++i) {
+            std::string record = traj[i]->get_data();
+            contents += id.first + "," + id.second + record.substr(record.find(',', record.find(',') + 1)) + "\r\n";
+
+            if (i == 5 && id.second == "10") {
+                contents += "\n";
+            }
+        }
+    }
+
+    offsets.push_back(contents.size());
+
+    std::string header = BSMP1::kCSVHeader + "\r";
+    trip_index::UIDExtractor extractor(header, "RxDevice,FileId");
+    string_utilities::CharSpan record{ contents.data() + offsets[4], contents.data() + offsets[4] + 4 };
+    CHECK(extractor.uid(record) == "9_10");
+    CHECK(trip_index::UIDExtractor(header, "FileId,Confidence").uid(record) == "10_");
+    CHECK_THROWS_AS(trip_index::UIDExtractor(header, "FileId,RxDevice"), std::invalid_argument);
+    CHECK_THROWS_AS(trip_index::UIDExtractor(header, "Nothing"), std::invalid_argument);
+
+    std::size_t begin = BSMP1::kCSVHeader.size() + 2;
+
+    // small chunks so the trips cross the chunk edges; every split gives the same trips.
+    for (unsigned n_threads : { 1, 2, 3, 7, 64 }) {
+        trip_index::TripRangeList trips = trip_index::index_trips(contents.data(), contents.size(), begin, extractor, n_threads, 64);
+        REQUIRE(trips.size() == ids.size());
+
+        for (std::size_t i = 0; i < ids.size(); ++i) {
+            CHECK(trips[i].uid == ids[i].first + "_" + ids[i].second);
+            CHECK(trips[i].begin == offsets[i]);
+            CHECK(trips[i].end == offsets[i + 1]);
+        }
+    }
+
+    CHECK(trip_index::index_trips(contents.data(), contents.size(), contents.size(), extractor, 4).empty());
+
+    std::ofstream out("multi_trip_test.csv", std::ios::binary);
+    out << contents;
+    out.close();
+
+    {
+        MappedFile::CPtr file = std::make_shared<const MappedFile>("multi_trip_test.csv");
+        trip_index::TripRangeList trips = trip_index::index_trips(file->data(), file->size(), begin, extractor, 4, 64);
+        REQUIRE(trips.size() == ids.size());
+
+        instrument::PointCounter point_counter;
+        trajectory::Trajectory ranged = factory.make_mapped_trajectory(file, trips[4].begin, trips[4].end, point_counter);
+        CHECK(factory.get_uid() == "9_10");
+        REQUIRE(ranged.size() == traj.size());
+        CHECK(point_counter.n_points == traj.size() + 1);
+
+        for (uint64_t i = 0; i < traj.size(); ++i) {
+            CHECK(ranged[i]->lat == traj[i]->lat);
+            CHECK(ranged[i]->get_time() == traj[i]->get_time());
+        }
+
+        ranged = factory.make_mapped_trajectory(file, trips[1].begin, trips[1].end);
+        CHECK(factory.get_uid() == "7_2");
+        CHECK(ranged.size() == traj.size());
+
+        CHECK_THROWS_AS(factory.make_mapped_trajectory(file, trips[1].begin, trips[1].begin), std::invalid_argument);
+        CHECK_THROWS_AS(factory.make_mapped_trajectory(file, 0, file->size() + 1), std::invalid_argument);
+    }
+
+    double min_lat = traj[0]->lat, max_lat = traj[0]->lat, min_lon = traj[0]->lon, max_lon = traj[0]->lon;
+
+    for (auto& pt : traj) {
+        min_lat = std::min(min_lat, pt->lat);
+        max_lat = std::max(max_lat, pt->lat);
+        min_lon = std::min(min_lon, pt->lon);
+        max_lon = std::max(max_lon, pt->lon);
+    }
+
+    trip_index::LocationExtractor locator(header, "Latitude", "Longitude");
+    CHECK_THROWS_AS(trip_index::LocationExtractor(header, "Latitude", "Nothing"), std::invalid_argument);
+
+    for (unsigned n_threads : { 1, 3, 64 }) {
+        trip_index::TripRangeList trips = trip_index::index_trips(contents.data(), contents.size(), begin, extractor, locator, n_threads, 64);
+        REQUIRE(trips.size() == ids.size());
+
+        for (auto& trip : trips) {
+            CHECK(trip.n_records == traj.size());
+            REQUIRE(trip.has_bounds());
+            CHECK(trip.min_lat == min_lat);
+            CHECK(trip.max_lat == max_lat);
+            CHECK(trip.min_lon == min_lon);
+            CHECK(trip.max_lon == max_lon);
+        }
+    }
+
+    SECTION("Saved Index") {
+        trip_index::TripRangeList trips = trip_index::index_trips(contents.data(), contents.size(), begin, extractor, locator, 4, 64);
+        trip_index::TripRangeList saved;
+        CHECK(trip_index::index_path("multi_trip_test.csv") == "multi_trip_test.csv.tripidx");
+        CHECK_FALSE(trip_index::read_index("multi_trip_test.csv", "RxDevice,FileId", saved));
+
+        trip_index::write_index("multi_trip_test.csv", "RxDevice,FileId", trips);
+        REQUIRE(trip_index::read_index("multi_trip_test.csv", "RxDevice,FileId", saved));
+        REQUIRE(saved.size() == trips.size());
+
+        for (std::size_t i = 0; i < trips.size(); ++i) {
+            CHECK(saved[i].uid == trips[i].uid);
+            CHECK(saved[i].begin == trips[i].begin);
+            CHECK(saved[i].end == trips[i].end);
+            CHECK(saved[i].n_records == trips[i].n_records);
+            CHECK(saved[i].min_lat == trips[i].min_lat);
+            CHECK(saved[i].max_lon == trips[i].max_lon);
+        }
+
+        // an index built with other UID fields or for other contents is not reused.
+        CHECK_FALSE(trip_index::read_index("multi_trip_test.csv", "RxDevice", saved));
+
+        std::ofstream append("multi_trip_test.csv", std::ios::binary | std::ios::app);
+        append << "\n";
+        append.close();
+        CHECK_FALSE(trip_index::read_index("multi_trip_test.csv", "RxDevice,FileId", saved));
+
+        CHECK_THROWS_AS(trip_index::write_index("no_such_file.csv", "RxDevice,FileId", trips), std::invalid_argument);
+        std::remove(trip_index::index_path("multi_trip_test.csv").c_str());
+    }
+
+    std::remove("multi_trip_test.csv");
+}
+
+TEST_CASE("Arena", "[memory]") {
+    memory::Arena arena{ 4096 };
+
+    SECTION("Scope") {
+        CHECK(memory::Arena::current() == nullptr);
+
+        {
+            memory::Arena::Scope scope{ arena };
+            CHECK(memory::Arena::current() == &arena);
+
+            {
+                // a null scope suspends the arena, e.g., for objects that outlive the trip.
+                memory::Arena::Scope heap_scope{ nullptr };
+                CHECK(memory::Arena::current() == nullptr);
+                std::shared_ptr<trajectory::Interval> iptr = memory::make_shared<trajectory::Interval>(0, 1, "heap");
+                CHECK(arena.n_live() == 0);
+            }
+
+            CHECK(memory::Arena::current() == &arena);
+        }
+
+        CHECK(memory::Arena::current() == nullptr);
+
+        // without a scope objects come from the global allocator.
+        std::shared_ptr<trajectory::Interval> iptr = memory::make_shared<trajectory::Interval>(0, 1, "heap");
+        CHECK(arena.n_live() == 0);
+    }
+
+    SECTION("Reset") {
+        memory::Arena::Scope scope{ arena };
+        std::vector<trajectory::Point::Ptr> points;
+
+        for (uint64_t i = 0; i < 100; ++i) {
+            points.push_back(memory::make_shared<trajectory::Point>("record", i, 35.9, -83.9, 90.0, 10.0, i));
+            CHECK(reinterpret_cast<std::uintptr_t>(points.back().get()) % alignof(trajectory::Point) == 0);
+        }
+
+        CHECK(points[99]->get_index() == 99);
+        CHECK(points[99]->get_data() == "record");
+        CHECK(arena.n_live() == 100);
+
+        std::size_t capacity = arena.capacity();
+        CHECK(capacity > 4096);
+
+        // the objects are alive so the arena must not rewind.
+        CHECK_FALSE(arena.reset());
+
+        points.clear();
+        CHECK(arena.n_live() == 0);
+        CHECK(arena.reset());
+
+        // the blocks are reused for the next trip.
+        for (uint64_t i = 0; i < 100; ++i) {
+            points.push_back(memory::make_shared<trajectory::Point>("record", i, 35.9, -83.9, 90.0, 10.0, i));
+        }
+
+        CHECK(arena.capacity() == capacity);
+    }
+
+    SECTION("Large") {
+        void* p = arena.allocate(10000, alignof(std::max_align_t));
+        CHECK(p != nullptr);
+        CHECK(arena.capacity() == 10000);
+        arena.deallocate(p, 10000);
+        CHECK(arena.reset());
+        CHECK(arena.capacity() == 0);
+    }
+}
+
+namespace {
+    // The original sort-and-erase correction, kept as a reference for the linear-time implementation.
+    uint64_t reference_remove_points(trajectory::Trajectory& traj, uint64_t start, uint64_t end, uint64_t sample_size) {
+        std::vector<double> lats;
+        std::vector<double> lons;
+        uint64_t n_removed = 0;
+
+        for (uint64_t i = start; i < traj.size() && i < end; ++i) {
+            lats.push_back(traj[i]->lat);
+            lons.push_back(traj[i]->lon);
+        }
+
+        std::sort(lats.begin(), lats.end());
+        std::sort(lons.begin(), lons.end());
+
+        double med_lat = lats[sample_size / 2];
+        double med_lon = lons[sample_size / 2];
+        double time_est = (static_cast<double>(lats.size()) / 2.0) * 0.1;
+
+        for (uint64_t i = start; i < traj.size() && i < end;) {
+            if (geo::Location::distance(traj[i]->lat, traj[i]->lon, med_lat, med_lon) / time_est > 44.7) {
+                traj.erase(traj.begin() + i);
+                ++n_removed;
+            } else {
+                ++i;
+            }
+        }
+
+        return n_removed;
+    }
+
+    trajectory::Trajectory make_line_trip(uint64_t n_points, const std::vector<uint64_t>& outliers) {
+        trajectory::Trajectory traj;
+
+        for (uint64_t i = 0; i < n_points; ++i) {
+            double lat = 35.95 + 1e-5 * static_cast<double>(i);
+
+            if (std::find(outliers.begin(), outliers.end(), i) != outliers.end()) {
+                lat += 0.01;
+            }
+
+            traj.push_back(std::make_shared<trajectory::Point>(std::to_string(i), i * 100000, lat, -83.93, 0.0, 11.0, i));
+        }
+
+        return traj;
+    }
+}
+
+TEST_CASE("Distance Kernels", "[quad][entity]") {
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> lat_dist(35.0, 36.0);
+    std::uniform_real_distribution<double> lon_dist(-84.0, -83.0);
+    const std::size_t n = 37;
+
+    std::vector<geo::Location> locations;
+    std::vector<double> lats;
+    std::vector<double> lons;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        locations.push_back(geo::Location{ lat_dist(gen), lon_dist(gen) });
+        lats.push_back(locations.back().lat);
+        lons.push_back(locations.back().lon);
+    }
+
+    std::vector<double> latrs(n);
+    std::vector<double> lonrs(n);
+    std::vector<double> out(n);
+    geo::kernels::to_radians(lats.data(), n, latrs.data());
+    geo::kernels::to_radians(lons.data(), n, lonrs.data());
+
+    for (std::size_t i = 0; i < n; ++i) {
+        CHECK(latrs[i] == locations[i].latr);
+        CHECK(lonrs[i] == locations[i].lonr);
+    }
+
+    // every kernel gives exactly the values of the scalar functions.
+    geo::kernels::distances_from(latrs[0], lonrs[0], latrs.data(), lonrs.data(), n, out.data());
+
+    for (std::size_t i = 0; i < n; ++i) {
+        CHECK(out[i] == geo::Location::distance(locations[0], locations[i]));
+    }
+
+    geo::kernels::pairwise_distances(latrs.data(), lonrs.data(), latrs.data() + 1, lonrs.data() + 1, n - 1, out.data());
+
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+        CHECK(out[i] == geo::Location::distance(locations[i], locations[i + 1]));
+        CHECK(out[i] == geo::Location::distance(locations[i + 1], locations[i]));
+    }
+
+    geo::kernels::consecutive_distances(latrs.data(), lonrs.data(), n, out.data());
+    CHECK(out[0] == 0.0);
+
+    for (std::size_t i = 1; i < n; ++i) {
+        CHECK(out[i] == geo::Location::distance(locations[i - 1], locations[i]));
+    }
+
+    double total = 0.0;
+    geo::kernels::cumulative_distances(latrs.data(), lonrs.data(), n, out.data());
+
+    for (std::size_t i = 1; i < n; ++i) {
+        total += geo::Location::distance(locations[i - 1], locations[i]);
+        CHECK(out[i] == total);
+    }
+
+    geo::kernels::consecutive_bearings(latrs.data(), lonrs.data(), n, out.data());
+    CHECK(out[0] == 0.0);
+
+    for (std::size_t i = 1; i < n; ++i) {
+        CHECK(out[i] == geo::Location::bearing(locations[i - 1], locations[i]));
+    }
+
+    trajectory::Trajectory traj;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        traj.push_back(std::make_shared<trajectory::Point>("a", i * 100000, lats[i], lons[i], 0.0, 0.0, i));
+    }
+
+    std::vector<double> traj_latrs;
+    std::vector<double> traj_lonrs;
+    geo::kernels::gather_radians(traj, traj_latrs, traj_lonrs);
+    CHECK(traj_latrs == latrs);
+    CHECK(traj_lonrs == lonrs);
+
+    // empty inputs are allowed.
+    geo::kernels::consecutive_distances(latrs.data(), lonrs.data(), 0, out.data());
+    geo::kernels::consecutive_bearings(latrs.data(), lonrs.data(), 0, out.data());
+}
+
+TEST_CASE("Error Corrector", "[error]") {
+    CHECK_THROWS_AS(ErrorCorrector(0), std::invalid_argument);
+
+    SECTION("Ends") {
+        std::vector<trajectory::Trajectory> trips;
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trips.push_back(factory.make_trajectory("unit-test-data/lib-test-data/utk_err_test.csv"));
+        trips.push_back(make_line_trip(400, { 0, 1, 2, 3, 10, 40, 41, 42, 200, 390, 399 }));
+
+        for (auto& trip : trips) {
+            for (uint64_t sample_size : { 5, 10, 50, 60 }) {
+                if (trip.size() < sample_size) {
+                    continue;
+                }
+
+                trajectory::Trajectory expected{ trip };
+                trajectory::Trajectory actual{ trip };
+                instrument::PointCounter counter;
+
+                uint64_t n_expected = reference_remove_points(expected, 0, sample_size, sample_size);
+
+                if (expected.size() > sample_size) {
+                    n_expected += reference_remove_points(expected, expected.size() - sample_size, expected.size(), sample_size);
+                }
+
+                ErrorCorrector ec{ sample_size };
+                ec.correct_error(actual, "test", counter);
+
+                CHECK(counter.n_error_points == n_expected);
+                REQUIRE(actual.size() == expected.size());
+
+                for (trajectory::Index i = 0; i < actual.size(); ++i) {
+                    CHECK(actual[i] == expected[i]);
+                    CHECK(actual[i]->get_index() == i);
+                }
+            }
+        }
+    }
+
+    SECTION("Sliding Window") {
+        trajectory::Trajectory ends_traj = make_line_trip(400, { 0, 200, 201, 399 });
+        trajectory::Trajectory sliding_traj{ ends_traj };
+        instrument::PointCounter ends_counter;
+        instrument::PointCounter sliding_counter;
+
+        ErrorCorrector ends_ec{ 50 };
+        ends_ec.correct_error(ends_traj, "test", ends_counter);
+
+        ErrorCorrector sliding_ec{ 50, true };
+        sliding_ec.correct_error(sliding_traj, "test", sliding_counter);
+
+        // only the sliding window reaches the middle of the trip.
+        CHECK(ends_counter.n_error_points == 2);
+        CHECK(sliding_counter.n_error_points == 4);
+        REQUIRE(sliding_traj.size() == 396);
+
+        for (trajectory::Index i = 0; i < sliding_traj.size(); ++i) {
+            CHECK(sliding_traj[i]->get_index() == i);
+            CHECK(sliding_traj[i]->get_data() != "200");
+            CHECK(sliding_traj[i]->get_data() != "201");
+        }
+
+        // a window larger than the trip uses the whole trip.
+        trajectory::Trajectory short_traj = make_line_trip(20, { 5 });
+        ErrorCorrector short_ec{ 50, true };
+        short_ec.correct_error(short_traj, "test");
+        CHECK(short_traj.size() == 19);
+    }
+}
+
+TEST_CASE("Stage Timer", "[instrument]") {
+    instrument::StageTimer timer_1;
+    instrument::StageTimer timer_2;
+
+    timer_1.add(instrument::Stage::kMapFit, 10, 0.5, 0.25);
+    timer_1.add(instrument::Stage::kMapFit, 20, 0.5, 0.25);
+    timer_2.add(instrument::Stage::kMapFit, 5, 1.0, 1.0);
+    timer_2.add(instrument::Stage::kWrite, 7, 2.0, 0.0);
+
+    instrument::StageTimer summary = timer_1 + timer_2;
+
+    CHECK(summary.get(instrument::Stage::kMapFit).n_calls == 3);
+    CHECK(summary.get(instrument::Stage::kMapFit).n_points == 35);
+    CHECK(summary.get(instrument::Stage::kMapFit).wall_seconds == Approx(2.0));
+    CHECK(summary.get(instrument::Stage::kMapFit).cpu_seconds == Approx(1.5));
+    CHECK(summary.get(instrument::Stage::kWrite).n_calls == 1);
+    CHECK(summary.get(instrument::Stage::kParse).n_calls == 0);
+
+    std::stringstream ss;
+    ss << summary;
+
+    std::string line;
+    std::vector<std::string> lines;
+
+    while (std::getline(ss, line)) {
+        lines.push_back(line);
+    }
+
+    REQUIRE(lines.size() == static_cast<std::size_t>(instrument::Stage::kNStages));
+    CHECK(lines[static_cast<std::size_t>(instrument::Stage::kMapFit)] == "map_fit,3,35,2.000000,1.500000");
+
+    instrument::StageClock clock{&timer_1};
+    clock.lap(instrument::Stage::kParse, 4);
+    CHECK(timer_1.get(instrument::Stage::kParse).n_calls == 1);
+    CHECK(timer_1.get(instrument::Stage::kParse).n_points == 4);
+    CHECK(timer_1.get(instrument::Stage::kParse).wall_seconds >= 0.0);
+
+    // An untimed clock does nothing.
+    instrument::StageClock untimed{nullptr};
+    untimed.lap(instrument::Stage::kParse, 4);
+}
+
+TEST_CASE("Trace Buffer", "[instrument]") {
+    instrument::TraceBuffer::Ptr trace = std::make_shared<instrument::TraceBuffer>(3);
+    instrument::TraceBuffer::Clock::time_point start = instrument::TraceBuffer::Clock::now();
+
+    trace->span("queue_wait", "queue", start, start + std::chrono::microseconds(250));
+
+    {
+        instrument::TraceScope trip_span(trace.get(), "trip", "trip");
+        trip_span.set_detail("a\"b.csv");
+
+        // A traced clock adds a span per lap; there is no timer to charge.
+        instrument::StageClock clock{nullptr, trace.get()};
+        clock.lap(instrument::Stage::kParse, 4);
+        clock.lap(instrument::Stage::kWrite, 4);
+    }
+
+    REQUIRE(trace->events().size() == 4);
+    CHECK(trace->thread_id() == 3);
+    CHECK(trace->events()[0].duration_us == 250);
+    CHECK(trace->events()[0].start_us >= 0);
+    CHECK(std::string(trace->events()[1].name) == "parse");
+    CHECK(std::string(trace->events()[2].name) == "write");
+    CHECK(std::string(trace->events()[3].name) == "trip");
+    CHECK(trace->events()[3].detail == "a\"b.csv");
+    CHECK(trace->events()[3].start_us <= trace->events()[1].start_us);
+
+    // An untraced scope adds nothing.
+    {
+        instrument::TraceScope untraced(nullptr, "trip", "trip");
     }
 
-    for ( auto& gptr : input_factory.get_grids() ) {
-        output_factory.add_grid(gptr);
+    std::stringstream ss;
+    instrument::TraceBuffer::write_chrome_trace(ss, { trace, nullptr }, "test");
+
+    std::string json = ss.str();
+    CHECK(json.find("\"traceEvents\":[") != std::string::npos);
+    CHECK(json.find("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"thread 3\"}}") != std::string::npos);
+    CHECK(json.find("{\"name\":\"queue_wait\",\"cat\":\"queue\",\"ph\":\"X\",\"pid\":1,\"tid\":3,\"ts\":") != std::string::npos);
+    CHECK(json.find("\"args\":{\"detail\":\"a\\\"b.csv\"}") != std::string::npos);
+    CHECK(json.substr(json.size() - 4) == "\n]}\n");
+}
+
+TEST_CASE("Ring Queue", "[thread]") {
+    SECTION("Capacity") {
+        MultiThread::RingQueue<int> q1{1};
+        MultiThread::RingQueue<int> q5{5};
+        MultiThread::RingQueue<int> q8{8};
+
+        CHECK(q1.capacity() == 2);
+        CHECK(q5.capacity() == 8);
+        CHECK(q8.capacity() == 8);
+        CHECK_THROWS_AS(MultiThread::RingQueue<int>{0}, std::invalid_argument);
     }
 
-    for ( auto& cptr : input_factory.get_circles() ) {
-        output_factory.add_circle(cptr);
+    SECTION("Order") {
+        MultiThread::RingQueue<int> q{4};
+        int item;
+
+        CHECK(!q.try_pop(item));
+
+        // Wrap around the ring a few times.
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 4; ++i) {
+                item = round * 4 + i;
+                CHECK(q.try_push(item));
+            }
+
+            item = -1;
+            CHECK(!q.try_push(item));
+            CHECK(item == -1);
+
+            for (int i = 0; i < 4; ++i) {
+                CHECK(q.try_pop(item));
+                CHECK(item == round * 4 + i);
+            }
+
+            CHECK(!q.try_pop(item));
+        }
     }
 
-    CHECK_NOTHROW(output_factory.write_shapes());
+    SECTION("Move Only") {
+        MultiThread::RingQueue<std::unique_ptr<int>> q{2};
+
+        q.push(std::unique_ptr<int>(new int(7)));
+        q.push(nullptr);
+
+        std::unique_ptr<int> item = q.pop();
+        REQUIRE(item != nullptr);
+        CHECK(*item == 7);
+        CHECK(q.pop() == nullptr);
+    }
 }
 
 TEST_CASE("Entity", "[quad][entity]") {
@@ -544,6 +1551,33 @@ TEST_CASE("Entity", "[quad][entity]") {
         CHECK_FALSE(phss_area->contains(outside_2));
         CHECK(phss_area_long->contains(outside_2));
         CHECK(phss_area_wide_long->contains(inside));
+        // The planar tests agree with the lat/lon tests.
+        CHECK(phss_area->contains_planar(midsum));
+        CHECK_FALSE(phss_area->contains_planar(loc_a));
+        CHECK(phss_area->contains_planar(inside));
+        CHECK_FALSE(phss_area->contains_planar(outside_1));
+        CHECK_FALSE(phss_area->contains_planar(outside_2));
+        CHECK(phss_area_long->contains_planar(outside_2));
+        CHECK_FALSE(phss_area->outside_edge_planar(-1, inside));
+        CHECK_FALSE(phss_area->outside_edge_planar(20, inside));
+
+        for (int edge = 0; edge < 4; ++edge) {
+            CHECK(phss_area->outside_edge_planar(edge, outside_1) == phss_area->outside_edge(edge, outside_1));
+            CHECK(phss_area->outside_edge_planar(edge, inside) == phss_area->outside_edge(edge, inside));
+        }
+
+        // Points within the tolerance of an edge are contained.
+        double outside_1_gap = -1.0;
+
+        for (double tolerance = 0.0; tolerance < 1000.0; tolerance += 0.5) {
+            if (phss_area->contains_planar(outside_1, tolerance)) {
+                outside_1_gap = tolerance;
+                break;
+            }
+        }
+
+        CHECK(outside_1_gap > 0.0);
+        CHECK_FALSE(phss_area->contains_planar(outside_1, outside_1_gap - 0.5));
         // Check the corners.
         std::vector<geo::Point> corners = phss_area->get_corners();
         geo::Area copy(corners[0], corners[1], corners[2], corners[3]);
@@ -561,6 +1595,15 @@ TEST_CASE("Entity", "[quad][entity]") {
         CHECK(geo::Location::distance_haversine(corners[0].lat, corners[0].lon, corners[3].lat, corners[3].lon) == Approx(17.0));
         CHECK(geo::Location::distance_haversine(corners[1].lat, corners[1].lon, corners[2].lat, corners[2].lon) == Approx(17.0));
         CHECK(phss_area->get_poly_string() == "-83.93236639,35.95255325,0 -83.9280134,35.94893125,0 -83.9281486,35.94882475,0 -83.93250161,35.95244675,0 -83.93236639,35.95255325,0");
+        // The corners are computed without building the area.
+        geo::Point wide_long_corners[4];
+        phss->area_corners(80.0, 10.0, wide_long_corners);
+
+        for (int i = 0; i < 4; ++i) {
+            CHECK(wide_long_corners[i] == phss_area_wide_long->get_corners()[i]);
+        }
+
+        CHECK_THROWS(phss->area_corners(0.0, 10.0, wide_long_corners));
     }
 
     geo::Circle c1(cage, 10.0);
@@ -833,6 +1876,464 @@ TEST_CASE("Quad Tree", "[quad]") {
 
 }
 
+TEST_CASE("Bulk Quad Tree", "[quad]") {
+    Quad::Ptr qptr = buildTestQuadTree();
+    geo::Entity::PtrList entities = Quad::retrieve_all_entities(qptr);
+    std::vector<geo::Bounds::Ptr> leaves = Quad::retrieve_all_bounds(qptr, true);
+
+    shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+    shape_factory.make_shapes();
+    geo::Entity::PtrList edges{ shape_factory.get_edges().begin(), shape_factory.get_edges().end() };
+
+    for (unsigned n_threads : { 1, 3, 8 }) {
+        Quad::Ptr bulk_ptr = std::make_shared<Quad>(geo::Point{ 35.946920, -83.938486 }, geo::Point{ 35.955526, -83.926738 });
+        CHECK(Quad::bulk_insert(bulk_ptr, edges, n_threads) <= edges.size());
+
+        std::vector<geo::Bounds::Ptr> bulk_leaves = Quad::retrieve_all_bounds(bulk_ptr, true);
+        REQUIRE(bulk_leaves.size() == leaves.size());
+
+        for (std::size_t i = 0; i < leaves.size(); ++i) {
+            CHECK(bulk_leaves[i]->sw.lat == leaves[i]->sw.lat);
+            CHECK(bulk_leaves[i]->ne.lon == leaves[i]->ne.lon);
+        }
+
+        // the leaves hold the same edges in the same order; the edges were recreated, so compare their ids.
+        geo::Entity::PtrList bulk_entities = Quad::retrieve_all_entities(bulk_ptr);
+        REQUIRE(bulk_entities.size() == entities.size());
+
+        for (std::size_t i = 0; i < entities.size(); ++i) {
+            CHECK(std::static_pointer_cast<const geo::Edge>(bulk_entities[i])->get_uid() == std::static_pointer_cast<const geo::Edge>(entities[i])->get_uid());
+        }
+    }
+
+    // a leaf that cannot be split keeps everything, just as with insert.
+    geo::Point sw(35.948378, -83.936072);
+    geo::Point ne(35.953811, -83.928997);
+    Quad::Ptr quad_ptr = std::make_shared<Quad>(sw, ne);
+    Quad::Ptr bulk_ptr = std::make_shared<Quad>(sw, ne);
+    geo::Entity::PtrList locations;
+
+    for (int i = 0; i < 3 * Quad::MAX_ELEMENTS; ++i) {
+        locations.push_back(std::make_shared<geo::Location>(35.951959, -83.931815, i));
+        Quad::insert(quad_ptr, locations.back());
+    }
+
+    locations.push_back(std::make_shared<geo::Location>(0.0, 0.0, 1000));
+    CHECK(Quad::bulk_insert(bulk_ptr, locations, 4) == locations.size() - 1);
+    CHECK(Quad::retrieve_all_bounds(bulk_ptr).size() == Quad::retrieve_all_bounds(quad_ptr).size());
+    CHECK(bulk_ptr->retrieve_elements(geo::Point{ 35.951959, -83.931815 }) == quad_ptr->retrieve_elements(geo::Point{ 35.951959, -83.931815 }));
+
+    CHECK_THROWS_AS(Quad::bulk_insert(bulk_ptr, locations), std::invalid_argument);
+}
+
+TEST_CASE("Flat Quad Tree", "[quad]") {
+    Quad::Ptr qptr = buildTestQuadTree();
+    FlatQuad::CPtr flat_qptr = qptr->freeze();
+
+    CHECK(flat_qptr->node_count() == Quad::retrieve_all_bounds(qptr).size());
+    CHECK(flat_qptr->element_count() == Quad::retrieve_all_entities(qptr).size());
+
+    std::vector<geo::Point> test_points {
+        geo::Point(35.951959, -83.931815),
+        geo::Point(35.949098, -83.935403),
+        geo::Point(35.946920, -83.938486),
+        geo::Point(35.955526, -83.926738),
+        geo::Point(35.950000, -83.930000),
+        geo::Point(90.0, 180.0)
+    };
+
+    // The compiled tree must return the same elements in the same order.
+    for (auto& pt : test_points) {
+        const geo::Entity::PtrList& tree_elements = qptr->retrieve_elements(pt);
+        FlatQuad::EntityRange flat_elements = flat_qptr->retrieve_elements(pt);
+
+        REQUIRE(static_cast<std::size_t>(std::distance(flat_elements.first, flat_elements.second)) == tree_elements.size());
+        CHECK(std::equal(tree_elements.begin(), tree_elements.end(), flat_elements.first));
+    }
+
+    BSMP1::BSMP1CSVTrajectoryFactory factory;
+    trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+    trajectory::Trajectory flat_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+
+    MapFitter mf(qptr, 1.0, .5);
+    mf.fit(traj);
+    MapFitter flat_mf(flat_qptr, 1.0, .5);
+    flat_mf.fit(flat_traj);
+
+    REQUIRE(traj.size() == flat_traj.size());
+
+    for (uint64_t i = 0; i < traj.size(); ++i) {
+        CHECK(traj[i]->has_edge() == flat_traj[i]->has_edge());
+
+        if (traj[i]->has_edge() && flat_traj[i]->has_edge()) {
+            CHECK(traj[i]->get_fit_edge()->get_uid() == flat_traj[i]->get_fit_edge()->get_uid());
+        }
+    }
+}
+
+TEST_CASE("Map Snapshot", "[quad][snapshot]") {
+    shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+    shape_factory.make_shapes(); 
+
+    geo::Point sw{ 35.946920, -83.938486 };
+    geo::Point ne{ 35.955526, -83.926738 };
+    Quad::Ptr qptr = std::make_shared<Quad>(sw, ne);
+
+    for (auto& edge_ptr : shape_factory.get_edges()) {
+        Quad::insert(qptr, std::dynamic_pointer_cast<const geo::Entity>(edge_ptr)); 
+    }
+
+    FlatQuad::CPtr flat_qptr = qptr->freeze();
+
+    std::stringstream ss;
+    snapshot::MapWriter(shape_factory.get_edges(), *flat_qptr).write(ss);
+    snapshot::MapReader reader(ss);
+
+    const std::vector<geo::EdgeCPtr>& edges = shape_factory.get_edges();
+    const std::vector<geo::EdgeCPtr>& snap_edges = reader.get_edges();
+
+    REQUIRE(snap_edges.size() == edges.size());
+    CHECK(reader.get_quad()->node_count() == flat_qptr->node_count());
+    CHECK(reader.get_quad()->element_count() == flat_qptr->element_count());
+
+    for (std::size_t i = 0; i < edges.size(); ++i) {
+        CHECK(snap_edges[i]->get_uid() == edges[i]->get_uid());
+        CHECK(snap_edges[i]->get_way_type() == edges[i]->get_way_type());
+        CHECK(snap_edges[i]->get_way_width() == edges[i]->get_way_width());
+        CHECK(snap_edges[i]->v1->uid == edges[i]->v1->uid);
+        CHECK(snap_edges[i]->v2->lat == edges[i]->v2->lat);
+        CHECK(snap_edges[i]->v2->lon == edges[i]->v2->lon);
+        CHECK(snap_edges[i]->v1->get_incident_edges().size() == edges[i]->v1->get_incident_edges().size());
+        CHECK(snap_edges[i]->end_outdegree(0) == edges[i]->v1->outdegree());
+        CHECK(snap_edges[i]->end_outdegree(1) == edges[i]->v2->outdegree());
+    }
+
+    // The out-degrees of the complete network are kept when only some of its edges are written, e.g., a map tile.
+    auto intersection = std::find_if(edges.begin(), edges.end(), [](const geo::EdgeCPtr& eptr) { return eptr->v1->outdegree() > 0; });
+    REQUIRE(intersection != edges.end());
+    std::vector<geo::EdgeCPtr> tile_edges{ *intersection };
+    Quad::Ptr tile_qptr = std::make_shared<Quad>(sw, ne);
+    Quad::insert(tile_qptr, std::dynamic_pointer_cast<const geo::Entity>(*intersection));
+    std::stringstream tile_ss;
+    snapshot::MapWriter(tile_edges, *tile_qptr->freeze()).write(tile_ss);
+    snapshot::MapReader tile_reader(tile_ss);
+    REQUIRE(tile_reader.get_edges().size() == 1);
+    CHECK(tile_reader.get_edges()[0]->v1->outdegree() == 0);
+    CHECK(tile_reader.get_edges()[0]->end_outdegree(0) == (*intersection)->v1->outdegree());
+
+    geo::Point test_point(35.951959, -83.931815);
+    FlatQuad::EntityRange flat_elements = flat_qptr->retrieve_elements(test_point);
+    FlatQuad::EntityRange snap_elements = reader.get_quad()->retrieve_elements(test_point);
+
+    REQUIRE(std::distance(flat_elements.first, flat_elements.second) == std::distance(snap_elements.first, snap_elements.second));
+
+    for (; flat_elements.first != flat_elements.second; ++flat_elements.first, ++snap_elements.first) {
+        CHECK(std::static_pointer_cast<const geo::Edge>(*flat_elements.first)->get_uid() == std::static_pointer_cast<const geo::Edge>(*snap_elements.first)->get_uid());
+    }
+
+    // Not a snapshot.
+    std::stringstream bad_ss("edge,1,2;35.0;-83.0:3;35.1;-83.1,way_type=secondary:way_id=1");
+    CHECK_THROWS_AS(snapshot::MapReader{bad_ss}, std::invalid_argument);
+    CHECK_FALSE(snapshot::MapReader::is_snapshot("unit-test-data/lib-test-data/utk.quad"));
+
+    // Truncated snapshot.
+    std::string truncated = ss.str();
+    std::stringstream truncated_ss(truncated.substr(0, truncated.size() / 2));
+    CHECK_THROWS_AS(snapshot::MapReader{truncated_ss}, std::invalid_argument);
+}
+
+TEST_CASE("Tiled Map", "[quad][snapshot][map match]") {
+    // a grid of roads 100 m apart cut into 400 m tiles.
+    const unsigned size = 24;
+    const double step = 0.001;
+    geo::Point sw{ 35.90 - step, -83.95 - step };
+    geo::Point ne{ 35.90 + size * step, -83.95 + size * step };
+    std::vector<geo::Vertex::Ptr> vertices;
+    std::vector<geo::EdgeCPtr> edges;
+    uint64_t id = 1;
+
+    for (unsigned row = 0; row < size; ++row) {
+        for (unsigned col = 0; col < size; ++col) {
+            vertices.push_back(std::make_shared<geo::Vertex>(35.90 + row * step, -83.95 + col * step, id++));
+        }
+    }
+
+    auto add_edge = [&](geo::Vertex::Ptr& v1, geo::Vertex::Ptr& v2) {
+        geo::EdgePtr edge_ptr = std::make_shared<geo::Edge>(v1, v2, osm::Highway::RESIDENTIAL, id++);
+        v1->add_edge(edge_ptr);
+        v2->add_edge(edge_ptr);
+        edges.push_back(edge_ptr);
+    };
+
+    for (unsigned row = 0; row < size; ++row) {
+        for (unsigned col = 0; col < size; ++col) {
+            if (col + 1 < size) add_edge(vertices[row * size + col], vertices[row * size + col + 1]);
+            if (row + 1 < size) add_edge(vertices[row * size + col], vertices[(row + 1) * size + col]);
+        }
+    }
+
+    ::mkdir("tiled_map_test", 0755);
+    std::size_t n_tiles = tiles::write_tiles(edges, sw, ne, 0.004, 0.0, "tiled_map_test");
+    CHECK(n_tiles == 49);
+    CHECK(tiles::TiledMap::is_tiled("tiled_map_test"));
+    CHECK_FALSE(tiles::TiledMap::is_tiled("unit-test-data"));
+    CHECK_THROWS_AS(tiles::write_tiles(edges, sw, ne, 0.0, 0.0, "tiled_map_test"), std::invalid_argument);
+    CHECK_THROWS_AS(tiles::TiledMap("unit-test-data", 0), std::invalid_argument);
+
+    Quad::Ptr quad_ptr = std::make_shared<Quad>(sw, ne);
+    Quad::bulk_insert(quad_ptr, geo::Entity::PtrList{ edges.begin(), edges.end() });
+    FlatQuad::CPtr flat_quad_ptr = quad_ptr->freeze();
+
+    // east along a road, north along another and back west; the trip crosses many tiles.
+    auto make_trip = [&]() {
+        trajectory::Trajectory traj;
+        uint64_t i = 0;
+
+        auto leg = [&](double lat0, double lon0, double dlat, double dlon, double heading, unsigned n) {
+            for (unsigned k = 0; k < n; ++k, ++i) {
+                traj.push_back(std::make_shared<trajectory::Point>(std::to_string(i), i * 1000000, lat0 + k * dlat + 0.00001, lon0 + k * dlon, heading, 10.0, i));
+            }
+        };
+
+        leg(35.90 + 3 * step, -83.95, 0.0, 0.0001, 90.0, 200);
+        leg(35.90 + 3 * step, -83.95 + 20 * step, 0.0001, 0.0, 0.0, 120);
+        leg(35.90 + 15 * step, -83.95 + 20 * step, 0.0, -0.0001, 270.0, 180);
+        return traj;
+    };
+
+    trajectory::Trajectory expected = make_trip();
+    MapFitter mf{ flat_quad_ptr };
+    IntersectionCounter ic{};
+
+    for (auto& tp : expected) {
+        mf.fit(*tp);
+        ic.count_intersections(*tp);
+    }
+
+    for (std::size_t budget : { std::size_t(1) << 30, std::size_t(1) }) {
+        tiles::TiledMap::CPtr tiled_map = std::make_shared<const tiles::TiledMap>("tiled_map_test", budget);
+        CHECK(tiled_map->load_count() == 0);
+        CHECK(tiled_map->tile(geo::Point{ 0.0, 0.0 }) == nullptr);
+
+        trajectory::Trajectory traj = make_trip();
+        MapFitter tiled_mf{ tiled_map };
+        IntersectionCounter tiled_ic{};
+        std::size_t n_fit = 0;
+
+        for (auto& tp : traj) {
+            tiled_mf.fit(*tp);
+            tiled_ic.count_intersections(*tp);
+        }
+
+        for (std::size_t i = 0; i < traj.size(); ++i) {
+            REQUIRE(traj[i]->is_explicitly_fit() == expected[i]->is_explicitly_fit());
+
+            if (traj[i]->is_explicitly_fit()) {
+                CHECK(traj[i]->get_fit_edge()->get_uid() == expected[i]->get_fit_edge()->get_uid());
+                ++n_fit;
+            }
+
+            CHECK(traj[i]->get_out_degree() == expected[i]->get_out_degree());
+        }
+
+        CHECK(n_fit == traj.size());
+        CHECK(tiled_map->load_count() > 1);
+
+        if (budget == 1) {
+            // only the last tile stays loaded; revisiting a tile loads it again.
+            tiles::Tile::CPtr tile = tiled_map->tile(*traj.front());
+            REQUIRE(tile);
+            CHECK(tiled_map->resident_size() == tile->size());
+            uint64_t n_loads = tiled_map->load_count();
+            tiled_map->tile(*traj.back());
+            CHECK(tiled_map->load_count() == n_loads + 1);
+            CHECK(tile->bounds().contains(*traj.front()));
+            CHECK(tile->find_vertex(vertices[3 * size]->uid));
+        }
+    }
+
+    {
+        // a tile loaded by a thread with an arena installed outlives the arena.
+        tiles::TiledMap::CPtr tiled_map = std::make_shared<const tiles::TiledMap>("tiled_map_test", std::size_t(1) << 30);
+        tiles::Tile::CPtr tile;
+        std::unique_ptr<memory::Arena> arena(new memory::Arena);
+
+        {
+            memory::Arena::Scope scope(*arena);
+            tile = tiled_map->tile(*expected.front());
+            REQUIRE(tile);
+        }
+
+        CHECK(arena->n_live() == 0);
+        CHECK(arena->reset());
+        arena.reset();
+
+        geo::AreaCPtr aptr;
+        REQUIRE(tile->area_cache()->find(expected.front()->get_fit_edge(), aptr));
+        CHECK(aptr->contains(*expected.front()));
+        CHECK(tiled_map->tile(*expected.front()) == tile);
+    }
+
+    CHECK_THROWS_AS(MapFitter(std::make_shared<const tiles::TiledMap>("tiled_map_test", 0, 1.5), 1.0), std::invalid_argument);
+
+    std::remove(("tiled_map_test/" + tiles::kManifestName).c_str());
+
+    for (unsigned row = 0; row < 7; ++row) {
+        for (unsigned col = 0; col < 7; ++col) {
+            std::remove(("tiled_map_test/tile_" + std::to_string(row) + "_" + std::to_string(col) + ".snap").c_str());
+        }
+    }
+
+    std::remove("tiled_map_test");
+}
+
+TEST_CASE("Map Context", "[quad][map match]") {
+    shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+    shape_factory.make_shapes();
+    const std::vector<geo::EdgeCPtr>& edges = shape_factory.get_edges();
+
+    geo::Point sw{ 35.946920, -83.938486 };
+    geo::Point ne{ 35.955526, -83.926738 };
+    Quad::Ptr qptr = std::make_shared<Quad>(sw, ne);
+    Quad::bulk_insert(qptr, geo::Entity::PtrList{ edges.begin(), edges.end() });
+    FlatQuad::CPtr flat_qptr = qptr->freeze();
+
+    MapContext::CPtr context = std::make_shared<const MapContext>(edges, flat_qptr, 1.0, 5.0);
+    CHECK(context->get_bounds().sw == sw);
+    CHECK(context->get_bounds().ne == ne);
+    CHECK(context->matches(1.0, 5.0));
+    CHECK_FALSE(context->matches(1.5, 5.0));
+    CHECK(context->get_stop_excluded_highways() == Detector::Stop::default_excluded_highways());
+    CHECK(context->find_vertex(edges.front()->v1->uid) == edges.front()->v1);
+    CHECK(context->find_vertex(std::numeric_limits<uint64_t>::max()) == nullptr);
+    CHECK(context->vertex_count() > 0);
+
+    // The context fitter matches the points as the quad tree fitter does.
+    BSMP1::BSMP1CSVTrajectoryFactory factory;
+    trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+    trajectory::Trajectory context_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+    MapFitter mf{ flat_qptr, 1.0, 5.0, context->get_area_cache() };
+    mf.fit(traj);
+    MapFitter context_mf{ *context };
+    context_mf.fit(context_traj);
+
+    REQUIRE(traj.size() == context_traj.size());
+
+    for (std::size_t i = 0; i < traj.size(); ++i) {
+        REQUIRE(traj[i]->has_edge() == context_traj[i]->has_edge());
+
+        if (traj[i]->has_edge()) {
+            CHECK(traj[i]->get_fit_edge()->get_uid() == context_traj[i]->get_fit_edge()->get_uid());
+        }
+    }
+
+    // A second region that shares no roads with the first; it holds its own highway policy.
+    osm::HighwaySet no_excludes;
+    Quad::Ptr other_qptr = std::make_shared<Quad>(geo::Point{ 36.0, -84.0 }, geo::Point{ 36.1, -83.9 });
+    MapContext::CPtr other_context = std::make_shared<const MapContext>(std::vector<geo::EdgeCPtr>{}, other_qptr->freeze(), 1.0, 5.0, nullptr, no_excludes);
+    CHECK(other_context->get_stop_excluded_highways().empty());
+    CHECK(other_context->vertex_count() == 0);
+
+    geo::Bounds trip_bounds = MapContext::trip_bounds(traj);
+    CHECK(context->get_bounds().contains(trip_bounds.sw));
+    CHECK(context->get_bounds().contains(trip_bounds.ne));
+    CHECK(MapContext::route({ other_context, context }, trip_bounds) == context);
+    CHECK(MapContext::route({ context, other_context }, geo::Bounds{ geo::Point{ 36.05, -83.95 }, geo::Point{ 36.2, -83.8 } }) == other_context);
+    CHECK(MapContext::route({ other_context, context }, geo::Bounds{ geo::Point{ 35.95, -83.93 }, geo::Point{ 35.99, -83.92 } }) == context);
+    CHECK(MapContext::route({ other_context, context }, geo::Bounds{ geo::Point{ 10.0, 10.0 }, geo::Point{ 11.0, 11.0 } }) == other_context);
+    CHECK_THROWS_AS(MapContext::route({}, trip_bounds), std::invalid_argument);
+    CHECK_THROWS_AS(MapContext::trip_bounds(trajectory::Trajectory{}), std::invalid_argument);
+
+    // The stop detectors of the two regions disagree about a point fit to a motorway.
+    trajectory::Point::Ptr tp = std::make_shared<trajectory::Point>("0", 0, 35.95, -83.93, 0.0, 1.0, 0);
+    geo::Vertex::Ptr v1 = std::make_shared<geo::Vertex>(35.95, -83.93, 1);
+    geo::Vertex::Ptr v2 = std::make_shared<geo::Vertex>(35.96, -83.93, 2);
+    tp->set_fit_edge(std::make_shared<geo::Edge>(v1, v2, osm::Highway::MOTORWAY, 3));
+    Detector::Stop stop_detector{ 1.0, 50.0, 2.5, context->get_stop_excluded_highways() };
+    Detector::Stop other_stop_detector{ 1.0, 50.0, 2.5, other_context->get_stop_excluded_highways() };
+    CHECK_FALSE(stop_detector.valid_highway(tp));
+    CHECK(other_stop_detector.valid_highway(tp));
+
+    CHECK_THROWS_AS(MapContext(edges, nullptr), std::invalid_argument);
+    CHECK_THROWS_AS(MapContext(edges, flat_qptr, 1.5, 5.0, context->get_area_cache()), std::invalid_argument);
+    CHECK_THROWS_AS(MapContext(tiles::TiledMap::CPtr{}), std::invalid_argument);
+}
+
+TEST_CASE("Geofence Zones", "[entity][critical interval]") {
+    std::vector<geo::Circle::CPtr> circles;
+    std::vector<geo::Grid::CPtr> grids;
+
+    // zones over two regions far apart; homes of 50 to 250 m and a few depot squares.
+    for (int i = 0; i < 2000; ++i) {
+        double base_lat = (i % 2 == 0) ? 35.9 : 47.6;
+        double base_lon = (i % 2 == 0) ? -83.9 : -122.3;
+        circles.push_back(std::make_shared<geo::Circle>(base_lat + 0.0007 * (i % 97), base_lon + 0.0009 * (i % 89), static_cast<uint64_t>(i), 50.0 + (i % 5) * 50.0));
+    }
+
+    for (uint32_t i = 0; i < 20; ++i) {
+        grids.push_back(std::make_shared<geo::Grid>(geo::Point{ 35.8 + 0.01 * i, -84.0 }, geo::Point{ 35.803 + 0.01 * i, -83.997 }, i, 0));
+    }
+
+    // a county-sized zone is tested apart from the cells.
+    grids.push_back(std::make_shared<geo::Grid>(geo::Point{ 40.0, -100.0 }, geo::Point{ 41.0, -99.0 }, 0, 1));
+
+    geofence::ZoneIndex zones(circles, grids);
+    CHECK(zones.size() == circles.size() + grids.size());
+    CHECK(zones.cell_count() > 0);
+    CHECK(zones.get_cell_degrees() >= geofence::ZoneIndex::kMinCellDegrees);
+
+    auto linear_contains = [&](const geo::Point& pt) {
+        for (auto& circle : circles) {
+            if (circle->contains(pt)) {
+                return true;
+            }
+        }
+
+        for (auto& grid : grids) {
+            if (pt.lat >= grid->sw.lat && pt.lat <= grid->ne.lat && pt.lon >= grid->sw.lon && pt.lon <= grid->ne.lon) {
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    // The index agrees with testing every zone, inside, near and outside the zones.
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> offset(-0.01, 0.08);
+    uint64_t n_inside = 0;
+
+    for (int i = 0; i < 20000; ++i) {
+        geo::Point pt = (i % 3 == 0) ? geo::Point{ 35.9 + offset(gen), -83.9 + offset(gen) } : (i % 3 == 1) ? geo::Point{ 47.6 + offset(gen), -122.3 + offset(gen) } : geo::Point{ 40.0 + 20.0 * offset(gen), -100.0 + 20.0 * offset(gen) };
+        bool expected = linear_contains(pt);
+        REQUIRE(zones.contains(pt) == expected);
+        n_inside += expected ? 1 : 0;
+    }
+
+    CHECK(n_inside > 0);
+    CHECK(zones.contains(geo::Point{ 40.5, -99.5 }));
+    CHECK_FALSE(zones.contains(geo::Point{ 0.0, 0.0 }));
+
+    // An explicit cell size gives the same answers.
+    geofence::ZoneIndex coarse_zones(circles, grids, 0.05);
+    CHECK(coarse_zones.get_cell_degrees() == Approx(0.05));
+    CHECK(coarse_zones.contains(circles[10]->north) == zones.contains(circles[10]->north));
+    CHECK(coarse_zones.contains(geo::Point{ circles[10]->lat, circles[10]->lon }));
+
+    // Each run of trip points in a zone is one critical interval.
+    trajectory::Trajectory traj = make_line_trip(100, {});
+    geofence::ZoneIndex trip_zones({ std::make_shared<geo::Circle>(traj[20]->lat, traj[20]->lon, 5.0), std::make_shared<geo::Circle>(traj[99]->lat, traj[99]->lon, 2.0) }, {});
+    trajectory::Interval::PtrList intervals = trip_zones.find_intervals(traj);
+    REQUIRE(intervals.size() == 2);
+    CHECK(intervals[0]->left() == 16);
+    CHECK(intervals[0]->right() == 25);
+    CHECK(intervals[1]->left() == 98);
+    CHECK(intervals[1]->right() == 100);
+
+    CHECK(geofence::ZoneIndex({}, {}).find_intervals(traj).empty());
+    CHECK_THROWS_AS(geofence::ZoneIndex(circles, grids, -1.0), std::invalid_argument);
+}
+
 TEST_CASE("DI Algorithm", "[map match][intersection count][critical interval][privacy interval][de-identification]") {
     Quad::Ptr qptr = buildTestQuadTree();
 
@@ -842,6 +2343,19 @@ TEST_CASE("DI Algorithm", "[map match][intersection count][critical interval][pr
         trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
         MapFitter mf(qptr, 1.0, .5);
         mf.fit(traj);
+
+        // the planar containment test matches every point to the same edge.
+        trajectory::Trajectory planar_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        MapFitter planar_mf(qptr, 1.0, .5, nullptr, true, true);
+        planar_mf.fit(planar_traj);
+        REQUIRE(planar_traj.size() == traj.size());
+
+        for (uint64_t i = 0; i < traj.size(); ++i) {
+            CHECK(planar_traj[i]->get_fit_edge() == traj[i]->get_fit_edge());
+        }
+
+        CHECK_THROWS_AS(MapFitter(qptr, 1.0, .5, nullptr, true, true, -1.0), std::invalid_argument);
+
         ImplicitMapFitter imf{36, 10};
         imf.fit(traj);
 
@@ -903,6 +2417,158 @@ TEST_CASE("DI Algorithm", "[map match][intersection count][critical interval][pr
         }
     }
 
+    SECTION("Edge Area Cache") {
+        shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+        shape_factory.make_shapes(); 
+
+        EdgeAreaCache::CPtr area_cache = std::make_shared<const EdgeAreaCache>(shape_factory.get_edges(), 1.0, .5);
+        CHECK(area_cache->size() > 0);
+        CHECK(area_cache->matches(1.0, .5));
+        CHECK_FALSE(area_cache->matches(1.5, .5));
+        CHECK_THROWS_AS(MapFitter(qptr, 1.5, .5, area_cache), std::invalid_argument);
+
+        geo::AreaCPtr aptr = nullptr;
+        CHECK(area_cache->find(shape_factory.get_edges()[0], aptr));
+
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        trajectory::Trajectory cached_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+
+        MapFitter mf(qptr, 1.0, .5);
+        mf.fit(traj);
+        MapFitter cached_mf(qptr, 1.0, .5, area_cache);
+        cached_mf.fit(cached_traj);
+
+        // The cache must not change the matching.
+        REQUIRE(traj.size() == cached_traj.size());
+
+        for (uint64_t i = 0; i < traj.size(); ++i) {
+            CHECK(traj[i]->has_edge() == cached_traj[i]->has_edge());
+
+            if (traj[i]->has_edge() && cached_traj[i]->has_edge()) {
+                CHECK(traj[i]->get_fit_edge()->get_uid() == cached_traj[i]->get_fit_edge()->get_uid());
+            }
+        }
+    }
+
+    SECTION("Point Pipeline") {
+        std::vector<std::string> inputs{ "unit-test-data/lib-test-data/utk_test.csv", "unit-test-data/lib-test-data/utk_err_test.csv" };
+
+        for (auto& input : inputs) {
+            BSMP1::BSMP1CSVTrajectoryFactory factory;
+            BSMP1::BSMP1CSVTrajectoryFactory fused_factory;
+            trajectory::Trajectory traj = factory.make_trajectory(input);
+            trajectory::Trajectory fused_traj = fused_factory.make_trajectory(input);
+
+            MapFitter mf(qptr, 1.0, .5);
+            mf.fit(traj);
+            ImplicitMapFitter imf{36, 10};
+            imf.fit(traj);
+            IntersectionCounter ic{};
+            ic.count_intersections(traj);
+            Detector::TurnAround tad{20, 30.0, 100.0, 90.0};
+            trajectory::Interval::PtrList ta_intervals = tad.find_turn_arounds(traj);
+            Detector::Stop stop_detector{1.0, 50.0, 2.5};
+            trajectory::Interval::PtrList stop_intervals = stop_detector.find_stops(traj);
+
+            MapFitter fused_mf(qptr, 1.0, .5);
+            ImplicitMapFitter fused_imf{36, 10};
+            IntersectionCounter fused_ic{};
+            Detector::TurnAround fused_tad{20, 30.0, 100.0, 90.0};
+            Detector::Stop fused_stop_detector{1.0, 50.0, 2.5};
+
+            PointPipeline pipeline{fused_mf, fused_imf, fused_ic, fused_tad, fused_stop_detector};
+            pipeline.run(fused_traj);
+
+            // The single pass must produce the same annotations and intervals as the separate passes.
+            REQUIRE(traj.size() == fused_traj.size());
+
+            for (uint64_t i = 0; i < traj.size(); ++i) {
+                CHECK(traj[i]->is_explicitly_fit() == fused_traj[i]->is_explicitly_fit());
+                CHECK(traj[i]->get_out_degree() == fused_traj[i]->get_out_degree());
+
+                if (traj[i]->has_edge() && fused_traj[i]->has_edge()) {
+                    CHECK(traj[i]->get_fit_edge()->get_uid() == fused_traj[i]->get_fit_edge()->get_uid());
+                }
+            }
+
+            CHECK(imf.area_set.size() == fused_imf.area_set.size());
+            CHECK(tad.area_set.size() == fused_tad.area_set.size());
+
+            const trajectory::Interval::PtrList& fused_ta_intervals = fused_tad.get_turn_arounds();
+            const trajectory::Interval::PtrList& fused_stop_intervals = fused_stop_detector.get_stops();
+
+            REQUIRE(ta_intervals.size() == fused_ta_intervals.size());
+
+            for (std::size_t i = 0; i < ta_intervals.size(); ++i) {
+                CHECK(ta_intervals[i]->left() == fused_ta_intervals[i]->left());
+                CHECK(ta_intervals[i]->right() == fused_ta_intervals[i]->right());
+                CHECK(ta_intervals[i]->get_aux_str() == fused_ta_intervals[i]->get_aux_str());
+            }
+
+            REQUIRE(stop_intervals.size() == fused_stop_intervals.size());
+
+            for (std::size_t i = 0; i < stop_intervals.size(); ++i) {
+                CHECK(stop_intervals[i]->left() == fused_stop_intervals[i]->left());
+                CHECK(stop_intervals[i]->right() == fused_stop_intervals[i]->right());
+            }
+
+            // Without collecting the plotted areas the annotations and intervals are unchanged.
+            BSMP1::BSMP1CSVTrajectoryFactory lean_factory;
+            trajectory::Trajectory lean_traj = lean_factory.make_trajectory(input);
+
+            MapFitter lean_mf(qptr, 1.0, .5, nullptr, false);
+            ImplicitMapFitter lean_imf{36, 10, false};
+            IntersectionCounter lean_ic{};
+            Detector::TurnAround lean_tad{20, 30.0, 100.0, 90.0, false};
+            Detector::Stop lean_stop_detector{1.0, 50.0, 2.5};
+
+            PointPipeline lean_pipeline{lean_mf, lean_imf, lean_ic, lean_tad, lean_stop_detector};
+            lean_pipeline.run(lean_traj);
+
+            CHECK(lean_mf.area_set.empty());
+            CHECK(lean_imf.edge_set.empty());
+            CHECK(lean_imf.area_set.empty());
+            CHECK(lean_tad.area_set.empty());
+            CHECK(lean_tad.get_turn_arounds().size() == ta_intervals.size());
+            CHECK(lean_stop_detector.get_stops().size() == stop_intervals.size());
+
+            for (uint64_t i = 0; i < traj.size(); ++i) {
+                CHECK(traj[i]->is_explicitly_fit() == lean_traj[i]->is_explicitly_fit());
+                CHECK(traj[i]->get_out_degree() == lean_traj[i]->get_out_degree());
+            }
+
+            // Fitting the trip in segments on several threads must give the fit of the single pass.
+            for (unsigned n_segments : { 2u, 3u, 7u, 64u }) {
+                trajectory::Trajectory split_traj = lean_factory.make_trajectory(input);
+
+                MapFitter split_mf(qptr, 1.0, .5, nullptr, false);
+                ImplicitMapFitter split_imf{36, 10, false};
+                IntersectionCounter split_ic{};
+                Detector::TurnAround split_tad{20, 30.0, 100.0, 90.0, false};
+                Detector::Stop split_stop_detector{1.0, 50.0, 2.5};
+
+                PointPipeline split_pipeline{split_mf, split_imf, split_ic, split_tad, split_stop_detector};
+                split_pipeline.run(split_traj, n_segments);
+
+                REQUIRE(split_traj.size() == lean_traj.size());
+
+                for (uint64_t i = 0; i < lean_traj.size(); ++i) {
+                    REQUIRE(split_traj[i]->has_edge() == lean_traj[i]->has_edge());
+
+                    if (lean_traj[i]->is_explicitly_fit()) {
+                        CHECK(split_traj[i]->get_fit_edge()->get_uid() == lean_traj[i]->get_fit_edge()->get_uid());
+                    }
+
+                    CHECK(split_traj[i]->get_out_degree() == lean_traj[i]->get_out_degree());
+                }
+
+                CHECK(split_tad.get_turn_arounds().size() == ta_intervals.size());
+                CHECK(split_stop_detector.get_stops().size() == stop_intervals.size());
+            }
+        }
+    }
+
     SECTION("Out Degree Max") {
         BSMP1::BSMP1CSVTrajectoryFactory factory;
         trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
@@ -1095,6 +2761,55 @@ TEST_CASE("DI Algorithm", "[map match][intersection count][critical interval][pr
         CHECK(priv_intervals[3]->get_aux_str() == "backward:pi");
     }
 
+    SECTION("Seeded Thresholds") {
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        MapFitter mf(qptr, 1.0, .5);
+        mf.fit(traj);
+        ImplicitMapFitter imf{36, 10};
+        imf.fit(traj);
+
+        IntersectionCounter ic{};
+        ic.count_intersections(traj);
+
+        StartEndIntervals sei;
+        trajectory::Interval::PtrList se_intervals = sei.get_start_end_intervals(traj);
+
+        Detector::TurnAround tad{20, 30.0, 100.0, 90.0};
+        trajectory::Interval::PtrList ta_critical_intervals = tad.find_turn_arounds(traj);
+
+        IntervalMarker im( { ta_critical_intervals, se_intervals } );
+        im.mark_trajectory( traj );
+
+        uint64_t seed = PrivacyIntervalFinder::trip_seed(7, factory.get_uid());
+        CHECK(seed == PrivacyIntervalFinder::trip_seed(7, factory.get_uid()));
+        CHECK(seed != PrivacyIntervalFinder::trip_seed(8, factory.get_uid()));
+        CHECK(seed != PrivacyIntervalFinder::trip_seed(7, factory.get_uid() + "_2"));
+        CHECK(PrivacyIntervalFinder::random_seed() != PrivacyIntervalFinder::random_seed());
+
+        auto find = [&traj, seed]() {
+            PrivacyIntervalFinder::RandomEngine engine{ seed };
+            PrivacyIntervalFinder pif(300.0, 300.0, 2, 11000.0, 11000.0, 10, 1.0, 1.0, 1.0, &engine);
+            std::vector<std::pair<trajectory::Index, trajectory::Index>> bounds;
+
+            for (auto& iptr : pif.find_intervals(traj)) {
+                bounds.emplace_back(iptr->left(), iptr->right());
+            }
+
+            return bounds;
+        };
+
+        // The same seed gives the same intervals, whichever thread draws the thresholds.
+        std::vector<std::pair<trajectory::Index, trajectory::Index>> bounds = find();
+        std::vector<std::pair<trajectory::Index, trajectory::Index>> thread_bounds;
+        std::thread other([&thread_bounds, &find]() { thread_bounds = find(); });
+        other.join();
+
+        CHECK_FALSE(bounds.empty());
+        CHECK(find() == bounds);
+        CHECK(thread_bounds == bounds);
+    }
+
     SECTION("DI") {
         BSMP1::BSMP1CSVTrajectoryFactory factory;
         trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
@@ -1143,6 +2858,136 @@ TEST_CASE("DI Algorithm", "[map match][intersection count][critical interval][pr
         CHECK(di_traj.size() == 134);
     }
 
+    SECTION("Stream") {
+        // collects the retained records of every trip.
+        struct RecordSinkFactory : public trajectory::PointSinkFactory {
+            struct Sink : public trajectory::PointSink {
+                Sink(std::vector<std::string>& records) : records(records) {}
+                void write_point(const trajectory::Point& tp) { records.push_back(tp.get_data()); }
+                std::vector<std::string>& records;
+            };
+
+            std::unique_ptr<trajectory::PointSink> open_trajectory(const std::string& uid, bool) {
+                return std::unique_ptr<trajectory::PointSink>(new Sink(records[uid]));
+            }
+
+            std::map<std::string, std::vector<std::string>> records;
+        };
+
+        const std::string input = "unit-test-data/lib-test-data/utk_test.csv";
+        StreamDeIdentifier::Settings settings;
+        settings.min_edge_trip_points = 10;
+        settings.ta_max_speed = 0.0;
+        settings.stop_max_speed = 0.0;
+        settings.min_direct_distance = 10.0;
+        settings.min_manhattan_distance = 10.0;
+        settings.min_out_degree = 0;
+        settings.max_direct_distance = 11000.0;
+        settings.max_manhattan_distance = 11000.0;
+        settings.max_out_degree = 10;
+        auto make_fitter = [&qptr]() { return MapFitter(qptr, 1.0, .5, nullptr, false); };
+
+        // the batch de-identification of the whole trip.
+        auto batch = [&](trajectory::Trajectory& traj, const std::string& uid, trajectory::PointSink& sink) {
+            ErrorCorrector ec(settings.ec_sample_size);
+            ec.correct_error(traj, uid);
+            MapFitter mf = make_fitter();
+            ImplicitMapFitter imf{settings.n_heading_groups, settings.min_edge_trip_points, false};
+            IntersectionCounter ic{};
+            Detector::TurnAround tad{settings.ta_max_q_size, settings.ta_area_width, settings.ta_max_speed, settings.ta_heading_delta, false};
+            Detector::Stop stop_detector{settings.stop_max_time, settings.stop_min_distance, settings.stop_max_speed};
+            PointPipeline pipeline{mf, imf, ic, tad, stop_detector};
+            pipeline.run(traj);
+
+            StartEndIntervals sei;
+            IntervalMarker im({ tad.get_turn_arounds(), stop_detector.get_stops(), sei.get_start_end_intervals(traj) });
+            im.mark_trajectory(traj);
+
+            PrivacyIntervalFinder::RandomEngine engine{ PrivacyIntervalFinder::trip_seed(settings.rand_seed, uid) };
+            PrivacyIntervalFinder pif(settings.min_direct_distance, settings.min_manhattan_distance, settings.min_out_degree, settings.max_direct_distance, settings.max_manhattan_distance, settings.max_out_degree, 0.0, 0.0, 0.0, &engine);
+            PrivacyIntervalMarker pim({ pif.find_intervals(traj) });
+            pim.mark_trajectory(traj);
+
+            DeIdentifier di;
+            di.de_identify(traj, sink);
+        };
+
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory traj = factory.make_trajectory(input);
+        std::vector<std::string> expected;
+        RecordSinkFactory::Sink expected_sink{ expected };
+        batch(traj, "trip", expected_sink);
+        REQUIRE_FALSE(expected.empty());
+
+        std::set<std::string> critical_records;
+
+        for (auto& tp : traj) {
+            if (tp->is_critical()) critical_records.insert(tp->get_data());
+        }
+
+        // the trip is shorter than the privacy distances, so it is released as one segment when it ends.
+        RecordSinkFactory sinks;
+        StreamDeIdentifier stream{ settings, make_fitter, sinks };
+        trajectory::Trajectory stream_traj = factory.make_trajectory(input);
+
+        for (auto& tp : stream_traj) {
+            CHECK(stream.push("trip", tp) == 0);
+        }
+
+        CHECK(stream.n_trips() == 1);
+        CHECK(stream.held_points() == stream_traj.size());
+        CHECK(stream.flush("trip") == stream_traj.size());
+        CHECK(stream.flush("trip") == 0);
+        CHECK(stream.n_trips() == 0);
+        CHECK(sinks.records["trip"] == expected);
+        CHECK(stream.written_points() + stream.suppressed_points() == stream_traj.size());
+
+        // short privacy distances release the points while the trip goes on, and never a critical point.
+        settings.max_direct_distance = 60.0;
+        settings.max_manhattan_distance = 60.0;
+        RecordSinkFactory short_sinks;
+        StreamDeIdentifier short_stream{ settings, make_fitter, short_sinks };
+        trajectory::Trajectory short_traj = factory.make_trajectory(input);
+        std::size_t n_released = 0;
+
+        for (auto& tp : short_traj) {
+            n_released += short_stream.push("trip", tp);
+        }
+
+        CHECK(n_released > 0);
+        CHECK(short_stream.held_points() == short_traj.size() - n_released);
+        CHECK(short_stream.flush_idle(short_traj.back()->get_time(), 0) == 0);
+        CHECK(short_stream.flush_idle(short_traj.back()->get_time() + 2, 1) == 1);
+        CHECK(short_stream.held_points() == 0);
+        CHECK(short_stream.written_points() + short_stream.suppressed_points() == short_traj.size());
+        CHECK_FALSE(short_sinks.records["trip"].empty());
+
+        for (auto& record : short_sinks.records["trip"]) {
+            CHECK(critical_records.count(record) == 0);
+        }
+
+        // a window that does not settle is bounded.
+        settings.max_window = 40;
+        settings.ec_sample_size = 10;
+        settings.max_direct_distance = 11000.0;
+        settings.max_manhattan_distance = 11000.0;
+        RecordSinkFactory bounded_sinks;
+        StreamDeIdentifier bounded_stream{ settings, make_fitter, bounded_sinks };
+        trajectory::Trajectory bounded_traj = factory.make_trajectory(input);
+
+        for (auto& tp : bounded_traj) {
+            bounded_stream.push("a", tp);
+            CHECK(bounded_stream.held_points() <= settings.max_window);
+        }
+
+        CHECK(bounded_stream.flush_all() == 1);
+        CHECK(bounded_stream.written_points() + bounded_stream.suppressed_points() == bounded_traj.size());
+        CHECK(bounded_stream.written_points() < expected.size());
+
+        settings.max_window = 0;
+        CHECK_THROWS_AS(StreamDeIdentifier(settings, make_fitter, sinks), std::invalid_argument);
+    }
+
     SECTION("Error And Point Counter") {
         BSMP1::BSMP1CSVTrajectoryFactory factory_1;
         instrument::PointCounter point_counter_1; 
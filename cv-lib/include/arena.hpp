@@ -0,0 +1,182 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_ARENA_HPP
+#define CVDP_DI_ARENA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace memory {
+
+    /**
+     * \brief A monotonic buffer for the short-lived objects of one trip.
+     *
+     * Allocation bumps a pointer through large blocks and deallocation only counts, so a worker thread does not touch
+     * the global allocator for each point, interval or area. reset() rewinds the blocks for the next trip once every
+     * object allocated from the arena has been released; while any are still alive it leaves them untouched and the
+     * arena keeps growing instead.
+     *
+     * An arena is used by one thread at a time and must outlive the objects allocated from it. While a Scope is active
+     * every memory::make_shared of the thread comes from the arena, so objects that are shared with other threads or
+     * kept past the trip (e.g., cached map tiles and their areas) must not be created inside it; build them under
+     * Scope( nullptr ), which suspends the arena for the calling thread.
+     *
+     * Objects may be released on other threads; their release happens before a reset() that sees them released.
+     */
+    class Arena {
+        public:
+            static constexpr std::size_t kDefaultBlockSize = 1 << 20;      ///< bytes in each block.
+
+            /**
+             * \brief Return the arena installed in the calling thread by Scope.
+             *
+             * \return the arena, or nullptr when objects should come from the global allocator.
+             */
+            static Arena* current();
+
+            /**
+             * \brief Install an arena for the calling thread for the lifetime of the scope.
+             */
+            class Scope {
+                public:
+                    explicit Scope( Arena& arena );
+
+                    /**
+                     * \brief Install an arena, or with nullptr let the objects come from the global allocator, for the
+                     * lifetime of the scope.
+                     */
+                    explicit Scope( Arena* arena );
+                    ~Scope();
+
+                    Scope( const Scope& ) = delete;
+                    Scope& operator=( const Scope& ) = delete;
+
+                private:
+                    Arena* previous_;               ///< the arena to restore when the scope ends.
+            };
+
+            /**
+             * \brief Construct an arena; no memory is allocated until the first allocation.
+             *
+             * \param block_size the number of bytes in each block; larger requests get a block of their own.
+             */
+            explicit Arena( std::size_t block_size = kDefaultBlockSize );
+
+            Arena( const Arena& ) = delete;
+            Arena& operator=( const Arena& ) = delete;
+
+            /**
+             * \brief Allocate uninitialized memory.
+             *
+             * \param bytes the number of bytes.
+             * \param alignment the alignment; a power of two no greater than alignof(std::max_align_t).
+             * \return the memory.
+             */
+            void* allocate( std::size_t bytes, std::size_t alignment );
+
+            /**
+             * \brief Release memory; it is only reclaimed by reset().
+             */
+            void deallocate( void* p, std::size_t bytes );
+
+            /**
+             * \brief Rewind the arena when none of its allocations are alive.
+             *
+             * \return true if the arena was rewound, false if allocations are still alive.
+             */
+            bool reset();
+
+            /**
+             * \brief Return the number of allocations that have not been released.
+             */
+            std::size_t n_live() const;
+
+            /**
+             * \brief Return the number of bytes held in blocks.
+             */
+            std::size_t capacity() const;
+
+        private:
+            using Block = std::unique_ptr<char[]>;
+
+            std::size_t block_size_;
+            std::vector<Block> blocks_;             ///< the blocks of block_size_ bytes; kept across resets.
+            std::vector<Block> large_;              ///< the blocks for large requests; freed by reset.
+            std::size_t large_bytes_;
+            std::size_t block_;                     ///< the index of the block being filled.
+            char* pos_;                             ///< the next free byte in the block being filled.
+            char* end_;                             ///< one past the last byte of the block being filled.
+            std::atomic<std::size_t> n_live_;
+
+            void next_block();
+    };
+
+    /**
+     * \brief A standard allocator that allocates from an Arena.
+     */
+    template<typename T>
+    class Allocator {
+        public:
+            using value_type = T;
+
+            explicit Allocator( Arena* arena ) : arena_{ arena } {}
+
+            template<typename U>
+            Allocator( const Allocator<U>& other ) : arena_{ other.arena() } {}
+
+            T* allocate( std::size_t n ) {
+                return static_cast<T*>(arena_->allocate( n * sizeof(T), alignof(T) ));
+            }
+
+            void deallocate( T* p, std::size_t n ) {
+                arena_->deallocate( p, n * sizeof(T) );
+            }
+
+            Arena* arena() const { return arena_; }
+
+        private:
+            Arena* arena_;
+    };
+
+    template<typename T, typename U>
+    bool operator==( const Allocator<T>& a, const Allocator<U>& b ) { return a.arena() == b.arena(); }
+
+    template<typename T, typename U>
+    bool operator!=( const Allocator<T>& a, const Allocator<U>& b ) { return a.arena() != b.arena(); }
+
+    /**
+     * \brief Like std::make_shared, but the object and its control block come from the calling thread's arena when one
+     * is installed.
+     */
+    template<typename T, typename... Args>
+    std::shared_ptr<T> make_shared( Args&&... args ) {
+        Arena* arena = Arena::current();
+
+        if (arena) {
+            return std::allocate_shared<T>( Allocator<T>{ arena }, std::forward<Args>(args)... );
+        }
+
+        return std::make_shared<T>( std::forward<Args>(args)... );
+    }
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_ASYNC_WRITER_HPP
+#define CVDP_DI_ASYNC_WRITER_HPP
+
+#include "ring_queue.hpp"
+#include "trajectory.hpp"
+
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace output {
+
+    /**
+     * \brief The location of one trajectory in a block of output records.
+     */
+    struct TripEntry {
+        std::string uid;                ///< the trajectories UID.
+        uint64_t offset;                ///< the first byte of the trajectory in the block.
+        uint64_t size;                  ///< the number of bytes of the trajectory.
+        uint64_t n_records;             ///< the number of records (lines) of the trajectory.
+    };
+
+    /**
+     * \brief A block of complete trajectories bound for one output shard.
+     */
+    struct Block {
+        using Ptr = std::unique_ptr<Block>;
+
+        unsigned shard;                 ///< the destination shard; unused when each trajectory has its own file.
+        std::string data;               ///< the records, one per line.
+        std::vector<TripEntry> trips;   ///< the trajectories in data, in order.
+    };
+
+    /**
+     * \brief Write blocks of trajectory records on a dedicated I/O thread.
+     *
+     * With no shards, each trajectory is written to "<uid>.csv" in the output directory, as the synchronous writer
+     * does, but the file is created on the I/O thread. With N shards, every trajectory is appended to one of the files
+     * "trips_<k>.csv" and an index line "uid,offset,bytes,records" giving its byte range is appended to "trips_<k>.idx".
+     * Every data file begins with the header line.
+     *
+     * An I/O error stops the writer; it is rethrown by the next submit() or by close().
+     */
+    class AsyncWriter {
+        public:
+            using Ptr = std::shared_ptr<AsyncWriter>;
+
+            static const std::size_t kDefaultMaxQueued = 16;        ///< blocks waiting for the I/O thread.
+
+            /**
+             * \brief Open the shard files (if any) and start the I/O thread.
+             *
+             * \param out_dir the output directory; empty for the working directory.
+             * \param header the header line written at the start of each data file.
+             * \param n_shards the number of shard files; 0 for one file per trajectory.
+             * \param max_queued the number of blocks submitted ahead of the I/O thread before submit() waits.
+             *
+             * \throws invalid_argument if a shard file cannot be opened.
+             */
+            AsyncWriter(const std::string& out_dir, const std::string& header, unsigned n_shards, std::size_t max_queued = kDefaultMaxQueued);
+
+            /**
+             * \brief Close the writer; errors are discarded, call close() to see them.
+             */
+            ~AsyncWriter();
+
+            AsyncWriter(const AsyncWriter&) = delete;
+            AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+            /**
+             * \brief The number of shard files; 0 when each trajectory has its own file.
+             */
+            unsigned n_shards() const;
+
+            /**
+             * \brief Return the shard of a trajectory; the same UID always maps to the same shard.
+             */
+            unsigned shard_of(const std::string& uid) const;
+
+            /**
+             * \brief Hand a block to the I/O thread, waiting while too many blocks are queued.
+             *
+             * \param block the block; safe to call from several threads.
+             * \throws invalid_argument if the I/O thread has failed.
+             */
+            void submit(Block::Ptr block);
+
+            /**
+             * \brief Write the queued blocks, close the files and stop the I/O thread. Call once every submitter is
+             * done.
+             *
+             * \throws invalid_argument if any write failed.
+             */
+            void close();
+
+        private:
+            std::string out_dir_;
+            std::string header_;
+            std::vector<std::unique_ptr<std::ofstream>> shards_;
+            std::vector<std::unique_ptr<std::ofstream>> indexes_;
+            std::vector<uint64_t> shard_sizes_;                     ///< the bytes written to each shard file.
+            MultiThread::RingQueue<Block::Ptr> queue_;              ///< a null block stops the I/O thread.
+            std::thread thread_;
+            std::atomic<bool> failed_;
+            std::exception_ptr error_;                              ///< the first failure; set before failed_.
+            std::mutex close_mutex_;
+            bool closed_;
+
+            void run();
+            void write_block(const Block& block);
+            std::string output_path(const std::string& name) const;
+            void rethrow_error() const;
+    };
+
+    /**
+     * \brief A per-thread front end of an AsyncWriter that collects trajectories into large blocks.
+     *
+     * Records are appended to the pending block of the trajectories shard (without flushing) and a block is handed
+     * to the I/O thread once it holds block_size bytes. One trajectory is written at a time; a sink destroyed before
+     * close() discards its records.
+     */
+    class BufferedTrajectoryWriter : public trajectory::PointSinkFactory {
+        public:
+            static const std::size_t kDefaultBlockSize = 4 << 20;   ///< bytes collected before a block is submitted.
+
+            /**
+             * \brief Constructor
+             *
+             * \param writer the shared I/O thread; it must outlive this writer.
+             * \param block_size the number of bytes collected before a block is submitted.
+             */
+            BufferedTrajectoryWriter(AsyncWriter& writer, std::size_t block_size = kDefaultBlockSize);
+
+            /**
+             * \brief Submit the pending blocks; errors are discarded, call flush() to see them.
+             */
+            ~BufferedTrajectoryWriter();
+
+            BufferedTrajectoryWriter(const BufferedTrajectoryWriter&) = delete;
+            BufferedTrajectoryWriter& operator=(const BufferedTrajectoryWriter&) = delete;
+
+            std::unique_ptr<trajectory::PointSink> open_trajectory(const std::string& uid, bool strip_cr);
+
+            /**
+             * \brief Submit the pending blocks.
+             *
+             * \throws invalid_argument if the I/O thread has failed.
+             */
+            void flush();
+
+        private:
+            class Sink;
+
+            AsyncWriter& writer_;
+            std::size_t block_size_;
+            std::vector<Block::Ptr> pending_;                        ///< the block being filled for each shard.
+
+            Block& pending_block(unsigned shard);
+            void finish_trip(unsigned shard);
+    };
+}
+
+#endif
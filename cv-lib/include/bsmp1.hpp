@@ -20,9 +20,15 @@
 #ifndef CTES_BSMP1_HPP
 #define CTES_BSMP1_HPP
 
+#include "columnar.hpp"
+#include "columns.hpp"
+#include "compression.hpp"
 #include "instrument.hpp"
+#include "mapped_file.hpp"
 #include "trajectory.hpp"
 
+#include <fstream>
+
 namespace BSMP1 {
 
     const std::string kCSVHeader = "RxDevice,FileId,TxDevice,Gentime,TxRandom,MsgCount,DSecond,Latitude,Longitude,Elevation,Speed,Heading,Ax,Ay,Az,Yawrate,PathCount,RadiusOfCurve,Confidence";
@@ -30,6 +36,9 @@ namespace BSMP1 {
     
     /**
      * \brief Instances of this class build trajectories from the BSMP1 dataset.
+     *
+     * Input files compressed with gzip or zstd (see compression.hpp) are decompressed as they are read; the memory
+     * mapped methods hold the decompressed bytes in memory instead of mapping the file.
      */
     class BSMP1CSVTrajectoryFactory : public trajectory::TrajectoryFactory {
         public:
@@ -52,11 +61,81 @@ namespace BSMP1 {
              * \brief Build a Trajectory instance from an input file and count the number of points in the trajectory.
              *
              * \param input the name of the file containing the trajectory data.
-             * \param point_counter a PointCounter instance that keeps track of various statistics about a trajectory.
+             * \param point_counter keeps track of various statistics about a trajectory (a PointCounter or a NullCounter).
+             * \return a Trajectory instance (a vector of pointers to Point instances).
+             * \throws invalid argument if the file cannot be opened or it doesn't have a header.
+             */
+            template <typename Counter>
+            const trajectory::Trajectory make_trajectory(const std::string& input, Counter& point_counter);
+
+            /**
+             * \brief Build a Trajectory instance from a memory-mapped input file.
+             *
+             * The points reference their records in the mapping instead of copying them; the mapping is released when
+             * the last point is destroyed.
+             *
+             * \param input the name of the file containing the trajectory data.
              * \return a Trajectory instance (a vector of pointers to Point instances).
              * \throws invalid argument if the file cannot be opened or it doesn't have a header.
              */
-            const trajectory::Trajectory make_trajectory(const std::string& input, instrument::PointCounter& point_counter);
+            const trajectory::Trajectory make_mapped_trajectory(const std::string& input);
+
+            /**
+             * \brief Build a Trajectory instance from a memory-mapped input file and count the number of points in the
+             * trajectory.
+             *
+             * \param input the name of the file containing the trajectory data.
+             * \param point_counter keeps track of various statistics about a trajectory (a PointCounter or a NullCounter).
+             * \return a Trajectory instance (a vector of pointers to Point instances).
+             * \throws invalid argument if the file cannot be opened or it doesn't have a header.
+             */
+            template <typename Counter>
+            const trajectory::Trajectory make_mapped_trajectory(const std::string& input, Counter& point_counter);
+
+            /**
+             * \brief Build a Trajectory instance from the records in a byte range of a mapped file, e.g., one trip of a
+             * file holding many trips (see trip_index::index_trips).
+             *
+             * \param file the mapped file; the points reference their records in it.
+             * \param begin the offset of the first record (the range has no header).
+             * \param end one past the last byte of the last record.
+             * \return a Trajectory instance (a vector of pointers to Point instances).
+             * \throws invalid argument if the range is empty or not within the file.
+             */
+            const trajectory::Trajectory make_mapped_trajectory(const MappedFile::CPtr& file, uint64_t begin, uint64_t end);
+
+            /**
+             * \brief Build a Trajectory instance from the records in a byte range of a mapped file and count the number
+             * of points in the trajectory.
+             *
+             * \param file the mapped file; the points reference their records in it.
+             * \param begin the offset of the first record (the range has no header).
+             * \param end one past the last byte of the last record.
+             * \param point_counter keeps track of various statistics about a trajectory (a PointCounter or a NullCounter).
+             * \return a Trajectory instance (a vector of pointers to Point instances).
+             * \throws invalid argument if the range is empty or not within the file.
+             */
+            template <typename Counter>
+            const trajectory::Trajectory make_mapped_trajectory(const MappedFile::CPtr& file, uint64_t begin, uint64_t end, Counter& point_counter);
+
+            /**
+             * \brief Build a columnar trajectory from an input file; the records are copied into one buffer.
+             *
+             * \param input the name of the file containing the trajectory data.
+             * \return the trajectory columns.
+             * \throws invalid argument if the file cannot be opened or it doesn't have a header.
+             */
+            trajectory::Columns make_columns(const std::string& input);
+
+            /**
+             * \brief Build a columnar trajectory from a memory-mapped input file; the records are offsets into the
+             * mapping, which is released when the columns are destroyed.
+             *
+             * \param input the name of the file containing the trajectory data.
+             * \return the trajectory columns.
+             * \throws invalid argument if the file cannot be opened or it doesn't have a header.
+             */
+            trajectory::Columns make_mapped_columns(const std::string& input);
 
             /**
              * \brief Return the current trajectory unique identifier.
@@ -75,45 +154,206 @@ namespace BSMP1 {
              */
             static const std::string make_uid(const std::string& line);
 
+        protected:
+            /**
+             * \brief Build a Trajectory instance from the header and records of a trip held in one buffer; the points
+             * reference their records in it.
+             *
+             * \param records the trip file contents.
+             * \param input the name of the trip file (for the error messages).
+             * \param point_counter keeps track of various statistics about a trajectory (a PointCounter or a NullCounter).
+             * \throws invalid argument if the buffer doesn't have a header or records.
+             */
+            template <typename Counter>
+            const trajectory::Trajectory make_buffered_trajectory(const std::shared_ptr<const std::string>& records, const std::string& input, Counter& point_counter);
+
         private:
             uint64_t index_;
             uint64_t line_number_;
             std::string uid_;
 
 
-            /**
-             * \brief Using the provided point record from an input file, make and return a shared pointer to the Point instance.
+            /** \brief Using the provided point record from an input file, make and return a shared pointer to the Point
+             * instance and update the provided counter.
+             *
+             * \param line a line from a trajectory file that represents data for a single point.  
+             * \param buffer the shared buffer that contains line, e.g., an aliasing pointer into a mapped file; the
+             * point references its record in it.
+             * \param point_counter the counter to update based on the exception checks.
              *
-             * \param line a line from a trajectory file that represents data for a single point.
              * \throws out_of_range if the number of fields in the record exceeds expectations, the geolocation latitude
              * and longitude is out of range, and heading is outside of the interval: [0,360].
              */
-            trajectory::Point::Ptr make_point(const std::string& line);
+            template <typename Counter>
+            trajectory::Point::Ptr make_point(const string_utilities::CharSpan& line, const std::shared_ptr<const char>& buffer, Counter& point_counter);
 
-            /** \brief Using the provided point record from an input file, make and return a shared pointer to the Point
-             * instance and update the provided PointCounter.
-             *
-             * \param line a line from a trajectory file that represents data for a single point.  
-             * \param point_counter a PointCounter instance to update based on the exception checks
+            /**
+             * \brief Convert and check the record fields used by the algorithm, counting the invalid records.
              *
              * \throws out_of_range if the number of fields in the record exceeds expectations, the geolocation latitude
              * and longitude is out of range, and heading is outside of the interval: [0,360].
              */
-            trajectory::Point::Ptr make_point(const std::string& line, instrument::PointCounter& point_counter); };
+            template <typename Counter>
+            void parse_point(const string_utilities::CharSpan& line, uint64_t& gentime, double& lat, double& lon, double& heading, double& speed, Counter& point_counter) const;
+
+            /**
+             * \brief Construct the point referencing its record in the shared buffer.
+             */
+            trajectory::Point::Ptr new_point(const string_utilities::CharSpan& line, const std::shared_ptr<const char>& buffer, uint64_t gentime, double lat, double lon, double heading, double speed);
+    };
+
+    /**
+     * \brief Instances of this class build trajectories from BSMP1 trips stored in columnar files (see columnar.hpp).
+     */
+    class BSMP1ColumnarTrajectoryFactory : public BSMP1CSVTrajectoryFactory {
+        public:
+
+            /**
+             * \brief Build a Trajectory instance from a columnar input file.
+             *
+             * \param input the name of the columnar file containing the trajectory data.
+             * \return a Trajectory instance (a vector of pointers to Point instances).
+             * \throws invalid argument if the file cannot be opened, it is not a columnar file of the BSMP1 fields, or it
+             * has no records.
+             */
+            const trajectory::Trajectory make_trajectory(const std::string& input);
+
+            /**
+             * \brief Build a Trajectory instance from a columnar input file and count the number of points in the
+             * trajectory.
+             *
+             * \param input the name of the columnar file containing the trajectory data.
+             * \param point_counter keeps track of various statistics about a trajectory (a PointCounter or a NullCounter).
+             * \return a Trajectory instance (a vector of pointers to Point instances).
+             * \throws invalid argument if the file cannot be opened, it is not a columnar file of the BSMP1 fields, or it
+             * has no records.
+             */
+            template <typename Counter>
+            const trajectory::Trajectory make_trajectory(const std::string& input, Counter& point_counter);
+    };
 
     /**
      * \brief Instances of this class write trajectories in the BSMP1 form.
      */
-    class BSMP1CSVTrajectoryWriter : public trajectory::TrajectoryWriter {
+    class BSMP1CSVTrajectoryWriter : public trajectory::TrajectoryWriter, public trajectory::PointSinkFactory {
+        public:
+
+            /**
+             * \brief A sink that writes one trajectory to its output file as the points arrive.
+             */
+            class Sink : public trajectory::PointSink {
+                public:
+                    /**
+                     * \brief Open the output file and write the header.
+                     *
+                     * \param output_file_path the path to the output file.
+                     * \param strip_cr flag to signal carriage returns should be removed.
+                     * \param compression the format the file is compressed in.
+                     * \throws invalid_argument when the output stream cannot be opened.
+                     */
+                    Sink(const std::string& output_file_path, bool strip_cr, compression::Format compression = compression::Format::kNone);
+
+                    void write_point(const trajectory::Point& tp);
+                    void write_record(const string_utilities::CharSpan& record);
+                    void close();
+
+                private:
+                    compression::OutputFile os_;
+                    trajectory::StreamPointSink stream_sink_;
+            };
+
+            /**
+             * \brief Constructor
+             *
+             * \param output directory in which to store the file containing the trajectory data; file names are based
+             * on the unique id of the trajectory.
+             * \param compression the format the files are compressed in; the file names end with its extension.
+             */
+            BSMP1CSVTrajectoryWriter(const std::string& output, compression::Format compression = compression::Format::kNone);
+
+            /**
+             * \brief Write a trajectory to a file named based on the trajectories unique id (uid).
+             *
+             * \param trajectory the trajectory to write.
+             * \param uid the trajectories UID -- this will be used to name the output file.
+             * \param strip_cr flag to signal carriage returns should be removed.
+             *
+             * \throws invalid_argument when the output stream cannot be opened.
+             */
+            void write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const;
+
+            /**
+             * \brief Write a columnar trajectory to a file named based on the trajectories unique id (uid).
+             *
+             * \param cols the trajectory to write.
+             * \param uid the trajectories UID -- this will be used to name the output file.
+             * \param strip_cr flag to signal carriage returns should be removed.
+             *
+             * \throws invalid_argument when the output stream cannot be opened.
+             */
+            void write_trajectory(const trajectory::Columns& cols, const std::string& uid, bool strip_cr) const;
+
+            /**
+             * \brief Open the output file of a trajectory so its points can be written as they are produced.
+             *
+             * \param uid the trajectories UID -- this will be used to name the output file.
+             * \param strip_cr flag to signal carriage returns should be removed.
+             * \return the sink; close it after the last point.
+             *
+             * \throws invalid_argument when the output stream cannot be opened.
+             */
+            std::unique_ptr<trajectory::PointSink> open_trajectory(const std::string& uid, bool strip_cr);
+
+            /**
+             * \brief Return the path to the output file of a trajectory.
+             */
+            std::string output_path(const std::string& uid) const;
+
+        private:
+            std::string output_;            ///> The output directory.
+            compression::Format compression_;   ///> The format of the output files.
+    };
+
+    /**
+     * \brief Instances of this class write trajectories as columnar files of the BSMP1 fields (see columnar.hpp); a
+     * trajectory is one row group unless it is longer than columnar::kDefaultRowGroupSize.
+     */
+    class BSMP1ColumnarTrajectoryWriter : public trajectory::TrajectoryWriter, public trajectory::PointSinkFactory {
         public:
 
+            /**
+             * \brief A sink that writes one trajectory to its columnar output file; the records are held until the
+             * sink is closed.
+             */
+            class Sink : public trajectory::PointSink {
+                public:
+                    /**
+                     * \brief Open the output file and write the columnar header.
+                     *
+                     * \param output_file_path the path to the output file.
+                     * \param strip_cr flag to signal carriage returns should be removed.
+                     * \throws invalid_argument when the output stream cannot be opened.
+                     */
+                    Sink(const std::string& output_file_path, bool strip_cr);
+
+                    void write_point(const trajectory::Point& tp);
+                    void write_record(const string_utilities::CharSpan& record);
+                    void close();
+
+                private:
+                    std::ofstream os_;
+                    columnar::Writer writer_;
+
+                    static std::ostream& open(std::ofstream& os, const std::string& output_file_path);
+            };
+
             /**
              * \brief Constructor
              *
              * \param output directory in which to store the file containing the trajectory data; file names are based
              * on the unique id of the trajectory.
              */
-            BSMP1CSVTrajectoryWriter(const std::string& output);
+            BSMP1ColumnarTrajectoryWriter(const std::string& output);
 
             /**
              * \brief Write a trajectory to a file named based on the trajectories unique id (uid).
@@ -126,6 +366,22 @@ namespace BSMP1 {
              */
             void write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const;
 
+            /**
+             * \brief Open the output file of a trajectory so its points can be written as they are produced.
+             *
+             * \param uid the trajectories UID -- this will be used to name the output file.
+             * \param strip_cr flag to signal carriage returns should be removed.
+             * \return the sink; close it after the last point.
+             *
+             * \throws invalid_argument when the output stream cannot be opened.
+             */
+            std::unique_ptr<trajectory::PointSink> open_trajectory(const std::string& uid, bool strip_cr);
+
+            /**
+             * \brief Return the path to the output file of a trajectory.
+             */
+            std::string output_path(const std::string& uid) const;
+
         private:
             std::string output_;            ///> The output directory.
     };
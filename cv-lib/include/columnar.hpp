@@ -0,0 +1,205 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_COLUMNAR_HPP
+#define CVDP_DI_COLUMNAR_HPP
+
+#include "trajectory.hpp"
+#include "utilities.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * \brief A columnar file format for CSV records, e.g., de-identified trips.
+ *
+ * A file starts with kMagic and the column names. The rows follow in row groups; each group holds the number of its
+ * rows and then every column in turn, which can be skipped by its size. A group with no rows ends the file. The
+ * column of a group is typed by its values:
+ *
+ * - kInteger: every value is a plain integer; the values are stored as variable length differences.
+ * - kDecimal: every value is a plain number; the values are scaled to the most fraction digits of the column and stored
+ *   like integers, followed by the runs of the fraction digits of each value.
+ * - kString: anything else; runs of equal values are stored once.
+ *
+ * A value is only typed when it is written back exactly as it was read (e.g., 1.50 is a decimal with 2 digits, but 01
+ * is a string), so every record is restored byte for byte.
+ */
+namespace columnar {
+
+    const std::string kMagic = "CVDICOL1";                  ///< the first bytes of a columnar file.
+    const std::string kFileExtension = ".cvcol";            ///< the extension of columnar trip files.
+    const std::size_t kDefaultRowGroupSize = 65536;         ///< the rows held in a group unless flushed earlier.
+
+    /**
+     * \brief How the values of a column are stored in a row group.
+     */
+    enum class Encoding : uint8_t {
+        kInteger = 0,
+        kDecimal = 1,
+        kString = 2
+    };
+
+    /**
+     * \brief The values of one column in a row group.
+     */
+    struct Column {
+        Encoding encoding = Encoding::kString;
+        uint8_t scale = 0;                                  ///< the most fraction digits of the kDecimal values.
+        std::vector<int64_t> values;                        ///< the kInteger values or the kDecimal values times 10^scale.
+        std::vector<uint8_t> scales;                        ///< the fraction digits of each kDecimal value.
+        std::vector<std::string> strings;                   ///< the kString values.
+
+        /**
+         * \brief Return the number of values.
+         */
+        std::size_t size() const;
+
+        /**
+         * \brief Return a value as a number.
+         *
+         * \throws invalid_argument for a kString value that is not a number.
+         */
+        double to_double(std::size_t row) const;
+
+        /**
+         * \brief Append a value as the text it was read from.
+         */
+        void append_text(std::size_t row, std::string& text) const;
+    };
+
+    /**
+     * \brief Writes CSV records into a columnar stream; the records are held until their row group is full.
+     */
+    class Writer : public trajectory::PointSink {
+        public:
+            /**
+             * \brief Write the magic and the column names.
+             *
+             * \param os the output stream; it must outlive the writer.
+             * \param names the column names; every record must have this many fields.
+             * \param strip_cr flag to signal carriage returns should be removed.
+             * \param row_group_size the records held in a row group.
+             * \throws invalid_argument if there are no names or the row group size is 0.
+             */
+            Writer(std::ostream& os, const std::vector<std::string>& names, bool strip_cr, std::size_t row_group_size = kDefaultRowGroupSize);
+
+            void write_point(const trajectory::Point& tp);
+
+            /**
+             * \brief Add a record to the current row group.
+             *
+             * \param record the characters of the record without the newline.
+             * \throws invalid_argument if the record does not have a field for every column.
+             */
+            void write_record(string_utilities::CharSpan record);
+
+            /**
+             * \brief Write the held records as a row group, e.g., at the end of a trip.
+             */
+            void flush_group();
+
+            /**
+             * \brief Write the held records and the end of the file; nothing may be written afterward.
+             */
+            void close();
+
+        private:
+            std::ostream& os_;
+            std::size_t n_columns_;
+            bool strip_cr_;
+            std::size_t row_group_size_;
+            std::size_t n_rows_;                            ///< the records held.
+            std::string text_;                              ///< the fields of the held records.
+            std::vector<uint32_t> field_ends_;              ///< the end of each held field in text_.
+            std::string payload_;                           ///< the encoded column being written.
+            bool closed_;
+
+            /**
+             * \brief Return the characters of a held field.
+             */
+            string_utilities::CharSpan field(std::size_t row, std::size_t column) const;
+
+            void write_column(std::size_t column);
+    };
+
+    /**
+     * \brief Reads a columnar stream one row group at a time.
+     */
+    class Reader {
+        public:
+            /**
+             * \brief Read the magic and the column names.
+             *
+             * \param is the input stream; it must outlive the reader.
+             * \throws invalid_argument if the stream does not start with a columnar header.
+             */
+            Reader(std::istream& is);
+
+            /**
+             * \brief Return the column names.
+             */
+            const std::vector<std::string>& get_column_names() const;
+
+            /**
+             * \brief Read the next row group.
+             *
+             * \return false at the end of the file.
+             * \throws invalid_argument if the stream ends before the end of the file or a column is corrupt.
+             */
+            bool next_group();
+
+            /**
+             * \brief Return the number of rows in the current row group.
+             */
+            std::size_t group_size() const;
+
+            /**
+             * \brief Return a column of the current row group.
+             */
+            const Column& get_column(std::size_t column) const;
+
+            /**
+             * \brief Append a row of the current row group as its CSV record (without a newline).
+             */
+            void append_record(std::size_t row, std::string& record) const;
+
+        private:
+            std::istream& is_;
+            std::vector<std::string> names_;
+            std::vector<Column> columns_;
+            std::size_t n_rows_;
+            std::string payload_;
+            bool done_;
+    };
+
+    /**
+     * \brief Split a CSV header line into its column names.
+     */
+    std::vector<std::string> column_names(const std::string& header);
+
+    /**
+     * \brief Return true if the file name ends with kFileExtension, possibly followed by a compression extension.
+     */
+    bool is_columnar_path(const std::string& path);
+}
+
+#endif
@@ -0,0 +1,211 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_COLUMNS_HPP
+#define CVDP_DI_COLUMNS_HPP
+
+#include "mapped_file.hpp"
+#include "trajectory.hpp"
+
+#include <limits>
+#include <unordered_map>
+
+namespace trajectory {
+
+    /**
+     * \brief A trajectory stored as a structure of arrays.
+     *
+     * Each point field is a contiguous column. Fit edges and critical intervals are kept once in per-trajectory tables,
+     * and each point holds only an id into those tables. The original records are offsets into one buffer: either a
+     * MappedFile shared with the reader, or a buffer owned by this instance. A point uses well under half the memory of
+     * a trajectory::Point, and no point needs its own heap allocation.
+     *
+     * The adapters convert to and from trajectory::Trajectory, so the stages without a columnar overload still work.
+     */
+    class Columns
+    {
+        public:
+            using Id = uint32_t;
+
+            static constexpr Id kNoId = std::numeric_limits<Id>::max();     ///< id of a missing edge or interval.
+
+            /**
+             * \brief Bits in the flags column.
+             */
+            enum Flag : uint8_t {
+                kPrivate = 0x01                                             ///< the point is in a privacy interval.
+            };
+
+            /**
+             * \brief Construct an empty trajectory whose records are copied into a buffer owned by this instance.
+             */
+            Columns();
+
+            /**
+             * \brief Construct an empty trajectory whose records reference the provided file instead of being copied.
+             *
+             * \param source the file that holds every record appended to this instance.
+             */
+            explicit Columns( const MappedFile::CPtr& source );
+
+            /**
+             * \brief Adapter: build the columns from a trajectory; the records are copied into one buffer.
+             *
+             * \param traj the trajectory to convert.
+             */
+            explicit Columns( const Trajectory& traj );
+
+            /**
+             * \brief Adapter: build a trajectory of Point instances with the same state as these columns.
+             *
+             * The points share one copy of the owned record buffer (or the mapped file), so they stay valid after this
+             * instance is destroyed.
+             *
+             * \return the trajectory.
+             */
+            Trajectory to_trajectory() const;
+
+            /**
+             * \brief Reserve room for n points in every column.
+             */
+            void reserve( std::size_t n );
+
+            /**
+             * \brief Append a point that is not fit, not critical, and not private.
+             *
+             * \param record the original record; with a mapped source it must lie within that file.
+             * \param time the time when this point was measured in microseconds.
+             * \param lat the point's latitude
+             * \param lon the point's longitude
+             * \param heading the heading at the time.
+             * \param speed the speed (m/s) at the time.
+             * \param index the 0-based index number of this point in the trip.
+             * \throws invalid_argument if the record is outside of the mapped source.
+             */
+            void push_back( const string_utilities::CharSpan& record, uint64_t time, double lat, double lon, double heading, double speed, uint64_t index );
+
+            /**
+             * \brief Append a copy of a point and all its state.
+             *
+             * \param tp the point to append.
+             * \throws invalid_argument if this instance has a mapped source that does not hold the point's record.
+             */
+            void push_back( const Point& tp );
+
+            /**
+             * \brief Append a copy of a point (row) in another Columns instance and all of its state.
+             *
+             * An empty instance without a mapped source adopts the mapped source of other.
+             *
+             * \param other the instance that holds the point.
+             * \param i the position of the point in other.
+             * \throws invalid_argument if this instance has a mapped source that does not hold the point's record.
+             */
+            void push_back( const Columns& other, Index i );
+
+            /**
+             * \brief Remove all the points; the mapped source (if any) is retained.
+             */
+            void clear();
+
+            std::size_t size() const;
+            bool empty() const;
+
+            /// \brief The columns; the numeric columns are contiguous so stages can process them in bulk.
+            const std::vector<double>& lats() const;
+            const std::vector<double>& lons() const;
+            const std::vector<float>& headings() const;
+            const std::vector<float>& speeds() const;
+            const std::vector<uint64_t>& times() const;
+            const std::vector<uint64_t>& indexes() const;
+            const std::vector<Id>& edge_ids() const;
+            const std::vector<Id>& interval_ids() const;
+            const std::vector<uint32_t>& out_degrees() const;
+            const std::vector<uint8_t>& flags() const;
+
+            /**
+             * \brief Get the original record of a point without copying it.
+             *
+             * \param i the position of the point.
+             * \return a span that is valid until the next push_back or the destruction of this instance.
+             */
+            string_utilities::CharSpan record( Index i ) const;
+
+            /**
+             * \brief Get the edge a point is fit to.
+             *
+             * \return the edge, or nullptr if the point has not been fit.
+             */
+            geo::EdgeCPtr get_fit_edge( Index i ) const;
+
+            /**
+             * \brief Fit a point to an edge; each distinct edge is stored once.
+             */
+            void set_fit_edge( Index i, const geo::EdgeCPtr& eptr );
+
+            /**
+             * \brief Get the critical interval that contains a point.
+             *
+             * \return the interval, or nullptr if the point is not critical.
+             */
+            IntervalCPtr get_critical_interval( Index i ) const;
+
+            /**
+             * \brief Set the critical interval that contains a point; each distinct interval is stored once.
+             */
+            void set_critical_interval( Index i, const IntervalCPtr& iptr );
+
+            void set_out_degree( Index i, uint32_t degree );
+            void set_private( Index i );
+
+            bool has_edge( Index i ) const;
+            bool is_critical( Index i ) const;
+            bool is_private( Index i ) const;
+
+        private:
+            MappedFile::CPtr source_;                   ///< the file that holds the records; nullptr when they are owned.
+            std::string records_;                       ///< the owned records, back to back.
+
+            std::vector<double> lat_;
+            std::vector<double> lon_;
+            std::vector<float> heading_;              ///< as in Point, the records carry far less precision than a float.
+            std::vector<float> speed_;
+            std::vector<uint64_t> time_;
+            std::vector<uint64_t> index_;
+            std::vector<Id> edge_id_;
+            std::vector<Id> interval_id_;
+            std::vector<uint32_t> out_degree_;
+            std::vector<uint8_t> flags_;
+            std::vector<uint64_t> record_offset_;       ///< the offset of each record in the source or owned buffer.
+            std::vector<uint32_t> record_size_;
+
+            std::vector<geo::EdgeCPtr> edges_;          ///< the edge table; edge ids index this table.
+            std::vector<IntervalCPtr> intervals_;       ///< the interval table; interval ids index this table.
+            std::unordered_map<const geo::Edge*, Id> edge_lookup_;
+            std::unordered_map<const Interval*, Id> interval_lookup_;
+
+            const char* records_base() const;
+            void push_record( const string_utilities::CharSpan& record );
+            Id edge_id( const geo::EdgeCPtr& eptr );
+            Id interval_id( const IntervalCPtr& iptr );
+    };
+
+}
+
+#endif
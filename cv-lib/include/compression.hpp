@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_COMPRESSION_HPP
+#define CVDP_DI_COMPRESSION_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+/**
+ * \brief Read and write gzip or zstd compressed files as plain streams.
+ *
+ * The format of an input file is found from its first bytes, so a compressed file is read like a plain file whatever
+ * its name. The output format is chosen by the caller, and kFileExtension gives the name suffix of each format. gzip
+ * is available when the library is built with zlib and zstd when it is built with libzstd (see is_supported); a file
+ * in a format that is not available cannot be opened.
+ */
+namespace compression {
+    enum class Format {
+        kNone,                                              ///< plain bytes.
+        kGzip,                                              ///< gzip (RFC 1952) members, as written by gzip or pigz.
+        kZstd                                               ///< zstd frames.
+    };
+
+    const std::size_t kBufferSize = 1 << 16;               ///< the bytes read or written at a time.
+    const uint64_t kSizeEstimateRatio = 4;                  ///< assumed uncompressed bytes per byte when the size is not recorded.
+
+    /**
+     * \brief Return true if the library was built with the codec of the format.
+     */
+    bool is_supported(Format format);
+
+    /**
+     * \brief Return the file name suffix of the format, e.g., ".gz"; empty for kNone.
+     */
+    std::string file_extension(Format format);
+
+    /**
+     * \brief Return the format named by name: none, gzip (gz) or zstd (zst).
+     *
+     * \throws invalid_argument if the name is not a format.
+     */
+    Format parse_format(const std::string& name);
+
+    /**
+     * \brief Return the format of the bytes that start a file.
+     *
+     * \param is the file, which is read from its start and left there.
+     * \return the format; kNone if the bytes are not a known compressed format.
+     */
+    Format detect_format(std::istream& is);
+
+    /**
+     * \brief Return the (possibly estimated) number of bytes of a file once decompressed.
+     *
+     * gzip records the size modulo 2^32 at the end of its last member and zstd usually records it in its first frame
+     * header. When the size is not recorded, or is clearly short of the whole file, it is estimated from the file size
+     * with kSizeEstimateRatio.
+     *
+     * \param is the file, which is left at its start.
+     * \return the size; the file size for a plain file.
+     */
+    uint64_t size_hint(std::istream& is);
+
+    /**
+     * \brief Read the rest of a stream into a buffer, e.g., a std::string or std::vector<char>.
+     *
+     * \param is the stream.
+     * \param buffer the buffer the bytes are appended to.
+     * \throws invalid_argument when a compressed stream is corrupt or truncated.
+     */
+    template <typename Buffer>
+    void read_all(std::istream& is, Buffer& buffer) {
+        std::size_t n = buffer.size();
+
+        while (is) {
+            buffer.resize(n + kBufferSize);
+            is.read(&buffer[n], kBufferSize);
+            n += static_cast<std::size_t>(is.gcount());
+        }
+
+        buffer.resize(n);
+    }
+
+    /**
+     * \brief An input file stream that decompresses the file if it is compressed.
+     *
+     * Like std::ifstream the stream fails when the file cannot be opened. A corrupt or truncated compressed file makes
+     * the read that finds it throw invalid_argument.
+     */
+    class InputFile : public std::istream {
+        public:
+            /**
+             * \brief Open the file and find its format.
+             *
+             * \param file_path the path to the file.
+             * \throws invalid_argument if the file is compressed in a format that is not supported.
+             */
+            explicit InputFile(const std::string& file_path);
+            ~InputFile();
+
+            InputFile(const InputFile&) = delete;
+            InputFile& operator=(const InputFile&) = delete;
+
+            Format get_format() const;
+            void close();
+
+        private:
+            std::filebuf file_;
+            std::unique_ptr<std::streambuf> decoder_;       ///< reads from file_; null for a plain file.
+            Format format_;
+    };
+
+    /**
+     * \brief An output file stream that compresses what is written to it.
+     *
+     * The compressed stream is finished by close or the destructor; the stream fails when the file cannot be opened or
+     * written.
+     */
+    class OutputFile : public std::ostream {
+        public:
+            /**
+             * \brief Open (truncate) the file.
+             *
+             * \param file_path the path to the file.
+             * \param format the format of the file.
+             * \throws invalid_argument if the format is not supported.
+             */
+            OutputFile(const std::string& file_path, Format format);
+            ~OutputFile();
+
+            OutputFile(const OutputFile&) = delete;
+            OutputFile& operator=(const OutputFile&) = delete;
+
+            void close();
+
+        private:
+            std::filebuf file_;
+            std::unique_ptr<std::streambuf> encoder_;       ///< writes to file_; null for a plain file.
+    };
+}
+
+#endif
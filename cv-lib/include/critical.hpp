@@ -23,8 +23,10 @@
 #include "names.hpp"
 #include "entity.hpp"
 #include "trajectory.hpp"
+#include "columns.hpp"
 
 #include <deque>
+#include <vector>
 
 namespace Detector {
 
@@ -34,9 +36,27 @@ namespace Detector {
     class TurnAround
     {
         public:
-            using AreaIndexPair = std::pair<geo::Area::Ptr, uint64_t>;
             using AreaSet = std::unordered_set<geo::Area::Ptr>;
 
+            /**
+             * \brief The area around an edge the trip left, kept inline in the area ring.
+             */
+            struct AreaRecord {
+                geo::Point corners[4];                              ///> the corners of the area, as Edge::to_area gives them.
+                double min_lat;                                     ///> the bounding box of the corners.
+                double max_lat;
+                double min_lon;
+                double max_lon;
+                uint64_t index;                                     ///> the index of the first trip point past the edge.
+                geo::Area::Ptr area;                                ///> the area once it is collected in area_set.
+
+                /**
+                 * \brief Predicate that indicates whether the area contains the point; the same test as
+                 * geo::Area::contains after a bounding box check.
+                 */
+                bool contains( const geo::Point& pt ) const;
+            };
+
             /**
              * \brief Construct a Turnaround Detector
              *
@@ -44,8 +64,9 @@ namespace Detector {
              * \param area_width The width of boxes that encapsulate edges (in meters)
              * \param max_speed Trip point speed below max_speed is a turnaround property.
              * \param heading_delta Heading changes greater that heading_delta is one turnaround property.
+             * \param collect_areas when true the turnaround areas are kept in area_set (e.g., to plot them in KML).
              */
-            TurnAround( size_t max_q_size, double area_width, double max_speed, double heading_delta );
+            TurnAround( size_t max_q_size, double area_width, double max_speed, double heading_delta, bool collect_areas = true );
 
             /**
              * \brief Detect all turnarounds in a trajectory and return a list of intervals where those turnarounds
@@ -57,27 +78,44 @@ namespace Detector {
              */
             trajectory::Interval::PtrList& find_turn_arounds( const trajectory::Trajectory& traj );
 
+            /**
+             * \brief Update detector state variables based on the next trip point; turnarounds are collected in the
+             * list returned by get_turn_arounds.
+             *
+             * \param tp The trip point currently being evaluated; it must already be map fit.
+             */
+            void update_turn_around_state( const trajectory::Point::Ptr& tp );
+
+            /**
+             * \brief Return the intervals where turnarounds were detected so far.
+             */
+            const trajectory::Interval::PtrList& get_turn_arounds() const;
+
+            /**
+             * \brief Return the index of the oldest trip point that a turnaround found later could still include.
+             *
+             * \param next_index the index of the next trip point to evaluate.
+             * \return the index, or next_index when no earlier point can become part of a turnaround.
+             */
+            trajectory::Index open_index( trajectory::Index next_index ) const;
+
         private:
             size_t max_q_size;
             double area_width;
             double max_speed;
             double heading_delta;
+            bool collect_areas;                                     ///> keep the turnaround areas in area_set.
             bool is_previous_trip_point_fit;
             trajectory::Point::Ptr fit_exit_point;
             bool is_fit_exit;
 
-            std::deque<std::shared_ptr<AreaIndexPair>> area_q;
+            std::vector<AreaRecord> area_q;                         ///> ring of the most recent areas; allocated once.
+            size_t area_q_head;                                     ///> the slot of the most recent area.
+            size_t area_q_size;                                     ///> the number of areas in the ring.
             geo::EdgeCPtr current_edge;                             ///> the current edge that the traj is fit to.
 
             trajectory::Interval::PtrList interval_list;
 
-            /**
-             * \brief Update detector state variables based on the current trip point.
-             *
-             * \param tp The trip point currently being evaluated.
-             */
-            void update_turn_around_state( const trajectory::Point::Ptr& tp );
-
             /**
              * \brief Predicate that indicates whether this trip point is in a turn around critical interval.
              *
@@ -87,6 +125,26 @@ namespace Detector {
              */
             bool is_critical_interval( const trajectory::Point::Ptr& tp );
 
+            /**
+             * \brief Return the i-th area in the ring; 0 is the most recent one.
+             */
+            AreaRecord& queued_area( size_t i );
+            const AreaRecord& queued_area( size_t i ) const;
+
+            /**
+             * \brief Add the area around current_edge to the front of the ring; the oldest area drops out when the
+             * ring is full.
+             *
+             * \param index the index of the first trip point past the edge.
+             * \throws geo::ZeroAreaException when the area has no width.
+             */
+            void push_area( uint64_t index );
+
+            /**
+             * \brief Keep the area in area_set when areas are collected.
+             */
+            void collect_area( AreaRecord& record );
+
         public:
             AreaSet area_set;                                       ///> the set of areas around implicit edges where turn around behavior occurs.
     };
@@ -105,7 +163,7 @@ namespace Detector {
             {
                 public:
                     friend class Stop;     // so Stop can see private members (state variables) of Deque.
-                    using size_type = std::deque<trajectory::CIterator>::size_type;
+                    using size_type = std::deque<trajectory::Point::Ptr>::size_type;
 
                     /**
                      * \brief Construct a Stop Deque
@@ -129,12 +187,11 @@ namespace Detector {
                     double cover_distance() const;
 
                     /**
-                     * \brief Add a point (iterator) to the back (right) of the deque and update the point-to-point
-                     * distance.
+                     * \brief Add a point to the back (right) of the deque and update the point-to-point distance.
                      *
-                     * \param it An iterator to a trajectory point.
+                     * \param tp A trajectory point.
                      */
-                    void push_right( const trajectory::CIterator& it );
+                    void push_right( const trajectory::Point::Ptr& tp );
 
                     /**
                      * \brief Remove iterators (points) from the front of the deque until the following conditions are met:
@@ -196,15 +253,15 @@ namespace Detector {
 
                 private:
                     Stop& stop_detector;                    ///< reference to stop to access parameters.
-                    std::deque<trajectory::CIterator> q;    ///< deque of iterators to points where between them there is distance.
+                    std::deque<trajectory::Point::Ptr> q;   ///< deque of points where between them there is distance.
                     double cumulative_distance;             ///< cumulative distance across points in the deque.
 
                     /**
                      * \brief Remove the iterator from the front (left) of the deque and update the cumulative distance.
                      *
-                     * \return A constant iterator to the point removed from the deque.
+                     * \return The point removed from the deque.
                      */
-                    trajectory::CIterator pop_left();
+                    trajectory::Point::Ptr pop_left();
 
                     /**
                      * \brief Return the number of trip points represented in the deque.
@@ -236,25 +293,34 @@ namespace Detector {
             };
 
         private:
-            static osm::HighwaySet          excluded_highways;
+            osm::HighwaySet                 excluded_highways;    ///< the OSM highway types where stops are ignored.
             uint64_t                        max_time;             ///< in this implementation this is in microseconds and it is converted during construction.
             double                          min_distance;
             double                          max_speed;
 
             trajectory::Interval::PtrList   critical_intervals;
+            Deque                           q;                    ///< the deque used when stepping through a trajectory.
 
         public:
             friend class Deque;
 
             /**
-             * \brief Set the OSM highway types where stops should be ignored.
+             * \brief Return the OSM highway types where stops are ignored by default: the motorways, trunks, primary
+             * roads and their links.
+             *
+             * \return the default set.
+             */
+            static const osm::HighwaySet& default_excluded_highways();
+
+            /**
+             * \brief Set the OSM highway types where this detector ignores stops.
              *
-             * This static method will clear the set first.
+             * This method will clear the set first.
              *
              * \param excludes a constant set of OSM highway types.
              * \return the size of the set to ignore.
              */
-            static std::size_t set_excluded_highways( const osm::HighwaySet& excludes );
+            std::size_t set_excluded_highways( const osm::HighwaySet& excludes );
 
             /**
              * \brief Add an OSM highway type to the current exclude set.
@@ -262,7 +328,7 @@ namespace Detector {
              * \param hw an OSM highway to add to the excluded set.
              * \return the size of the set to ignore.
              */
-            static std::size_t add_excluded_highway( const osm::Highway& hw );
+            std::size_t add_excluded_highway( const osm::Highway& hw );
 
             /**
              * \brief Predicate that indicates this point should be considered for stop detection.
@@ -272,7 +338,7 @@ namespace Detector {
              * Return false if the road the trip point is on is EXPLICIT and fit to a black list road -- we ignore stops on
              * those roads.
              */
-            static bool valid_highway( const trajectory::Point::Ptr& pt );
+            bool valid_highway( const trajectory::Point::Ptr& pt ) const;
 
             /**
              * \brief Construct a stop detector.
@@ -283,8 +349,12 @@ namespace Detector {
              * \param max_time (seconds) the maximum loiter time considered as a stop.
              * \param min_distance (meters) stops not cover more than this distance.
              * \param max_speed (meters/second) only consider trip points whose speed is less than max speed for stops.
+             * \param excluded_highways the OSM highway types where stops are ignored, e.g., the policy of a MapContext.
              */
-            Stop( double max_time, double min_distance, double max_speed );
+            Stop( double max_time, double min_distance, double max_speed, const osm::HighwaySet& excluded_highways = default_excluded_highways() );
+
+            Stop( const Stop& ) = delete;                       // q refers to this instance; disable copying
+            Stop& operator=( const Stop& ) = delete;            // disable assignment
 
             /**
              * \brief Find the critical intervals in the trajectory that exhibit stop behavior.
@@ -293,6 +363,42 @@ namespace Detector {
              * \return a list of pointers to intervals; the intervals capture the stop critical intervals.
              */
             trajectory::Interval::PtrList& find_stops( const trajectory::Trajectory& traj );
+
+            /**
+             * \brief Update the detector with the next trip point; stops are collected in the list returned by
+             * get_stops.
+             *
+             * \param it An iterator to the next trip point.
+             */
+            void update_stop_state( const trajectory::CIterator& it );
+
+            /**
+             * \brief Update the detector with the next trip point; the detector holds on to the points that may belong
+             * to a stop, so they need not remain in a trajectory (e.g., when the points arrive one at a time).
+             *
+             * \param tp The next trip point.
+             */
+            void update_stop_state( const trajectory::Point::Ptr& tp );
+
+            /**
+             * \brief Finish stepping through a trajectory; a partial stop still in the deque is ignored.
+             *
+             * \return a list of pointers to intervals; the intervals capture the stop critical intervals.
+             */
+            trajectory::Interval::PtrList& finish_stops();
+
+            /**
+             * \brief Return the stop critical intervals found so far.
+             */
+            const trajectory::Interval::PtrList& get_stops() const;
+
+            /**
+             * \brief Return the index of the oldest trip point that a stop found later could still include.
+             *
+             * \param next_index the index of the next trip point to evaluate.
+             * \return the index, or next_index when no earlier point can become part of a stop.
+             */
+            trajectory::Index open_index( trajectory::Index next_index ) const;
     };
 
 }
@@ -337,6 +443,13 @@ class IntervalMarker
          */
         void mark_trajectory( trajectory::Trajectory& traj ); 
 
+        /**
+         * \brief Mark a columnar trajectory the same way as mark_trajectory( trajectory::Trajectory& ).
+         *
+         * \param cols The trajectory to mark.
+         */
+        void mark_trajectory( trajectory::Columns& cols ); 
+
     private:
         trajectory::Interval::PtrList intervals;
         
@@ -345,6 +458,7 @@ class IntervalMarker
 
         void merge_intervals( const std::initializer_list<trajectory::Interval::PtrList> list );
         void mark_trip_point( trajectory::Point::Ptr& tp );
+        trajectory::IntervalCPtr containing_interval( trajectory::Index index );
         void set_next_interval();
         static bool compare( trajectory::IntervalCPtr a, trajectory::IntervalCPtr b );
 };
@@ -107,6 +107,14 @@ struct Point {
      */
     Point(const Point& pt);
 
+    /**
+     * @brief Assign the coordinates of another point.
+     * 
+     * @param const Point& pt The other point.
+     * @return Point& This point.
+     */
+    Point& operator=(const Point& pt) = default;
+
     /**
      * @brief Compare this point with another point. Two points are equal if 
      * respective coordinates are equivalent.
@@ -547,6 +555,14 @@ class Vertex : public Location {
          */
         bool add_edges(EdgePtrSet& edges);
 
+        /**
+         * Remove all the incident edges of this vertex.
+         *
+         * Vertices and their incident edges refer to each other; clearing the
+         * edges breaks the cycle so a road network can be released.
+         */
+        void clear_edges();
+
         /**
          * Get the degree of this vertex.
          *  
@@ -568,6 +584,20 @@ class Vertex : public Location {
          */ 
         uint32_t outdegree() const;
 
+        /**
+         * Record an out-degree of this vertex in its incident edges.
+         *
+         * Called once the road network is loaded so an edge can give the
+         * out-degree of its ends without visiting them. Edges added later
+         * are not counted.
+         *
+         * @param uint32_t outdegree The out-degree to record, e.g., 
+         *                           outdegree() or the out-degree stored in 
+         *                           a map snapshot.
+         * @see Edge::end_outdegree()
+         */
+        void record_outdegree(uint32_t outdegree);
+
         /**
          * Update the location of this vertex.
          *
@@ -847,6 +877,36 @@ class Edge : public Entity {
          */
         AreaPtr to_area( double capwidth, double extension ) const;
 
+        /**
+         * @brief Compute the corners of the area to_area( capwidth, extension ) would return without allocating it.
+         *
+         * @param capwidth the total width of the area in meters.
+         * @param extension the meters to extend the area from each end of the
+         * edge.
+         * @param corners set to the upper left, upper right, lower right, and lower left corners.
+         * @throws ZeroAreaException when there area characterizes 0 space.
+         */
+        void area_corners( double capwidth, double extension, Point (&corners)[4] ) const;
+
+        /**
+         * @brief Return the out-degree of the vertex at one end of this edge.
+         *
+         * The out-degree recorded when the road network was loaded (see Vertex::record_outdegree) is held by the
+         * edge; without one the vertex's out-degree is returned.
+         *
+         * @param end 0 for v1, 1 for v2.
+         * @return the out-degree of the end.
+         */
+        uint32_t end_outdegree( int end ) const;
+
+        /**
+         * @brief Record the out-degree of the ends of this edge at a vertex.
+         *
+         * @param vertex v1 or v2 of this edge; any other vertex is ignored.
+         * @param outdegree the out-degree of the vertex.
+         */
+        void set_end_outdegree( const Vertex& vertex, uint32_t outdegree );
+
         /**
          * @brief Operator that evaluates whether two edges are equivalent based ONLY
          * on their vertex coordinates.
@@ -882,6 +942,7 @@ class Edge : public Entity {
         uint64_t uid_;                       ///< This edge's unique identifier.
         osm::Highway way_type_;              ///< This edge's OSM way type.
         bool explicit_edge_;                 ///< Indicates how this edge was constructed: from an OSM segment or inferred from the trip.
+        uint32_t end_outdegree_[2];          ///< The recorded out-degree of v1 and v2; kUnrecorded when not recorded.
 };
 
 /**
@@ -907,6 +968,20 @@ class Area : public Entity {
     private:
         std::vector<Point> corners_;                 ///< The corner points that describe this area; order starts in upper left corner and procedes clockwise.
 
+        double frame_lat_;                          ///< The origin of the local planar frame (the first corner).
+        double frame_lon_;
+        double frame_kx_;                           ///< Meters per degree of longitude in the local frame.
+        double frame_ky_;                           ///< Meters per degree of latitude in the local frame.
+        double edge_a_[4];                          ///< Signed distance from edge i in meters is a * x + b * y + c.
+        double edge_b_[4];
+        double edge_c_[4];
+
+        /**
+         * @brief Project the corners into an equirectangular frame centered on the first corner and compute the unit
+         * normal form of each edge.
+         */
+        void init_frame();
+
     public:
         using Ptr = std::shared_ptr<Area>;          ///< Shared pointer to an Area.
 
@@ -981,6 +1056,47 @@ class Area : public Entity {
          */
         bool outside_edge( int edge, const Point& loc ) const;
 
+        /**
+         * @brief Predicate that indicates whether the point is outside (to the
+         * left of) the directed line from c1 to c2; the member outside_edge
+         * applies this to consecutive corners.
+         *
+         * @param c1 the first point of the edge.
+         * @param c2 the second point of the edge.
+         * @param loc the point whose position is being checked.
+         * @return true if the point is to the left of the edge.
+         */
+        static bool outside_edge( const Point& c1, const Point& c2, const Point& loc );
+
+        /**
+         * @brief Predicate that indicates whether this Area contains the
+         * provided point using the local planar frame of the area.
+         *
+         * The point is projected once into meters relative to the first corner
+         * and tested against the precomputed edge normals. Over the extent of
+         * an area the projection agrees with contains() except for points
+         * within rounding of an edge.
+         *
+         * @param loc the location whose containment is checked.
+         * @param tolerance points up to this many meters outside an edge are
+         * still contained.
+         * @return true if the point is within the area; false otherwise.
+         */
+        bool contains_planar( const Point& loc, double tolerance = 0.0 ) const;
+
+        /**
+         * @brief Predicate that indicates whether the point is more than
+         * tolerance meters outside (to the left of) the designated edge using
+         * the local planar frame of the area; see outside_edge.
+         *
+         * @param edge the 0-indexed edge.
+         * @param loc the point whose position is being checked.
+         * @param tolerance the distance in meters a point may be outside the
+         * edge.
+         * @return true if the point is outside the edge.
+         */
+        bool outside_edge_planar( int edge, const Point& loc, double tolerance = 0.0 ) const;
+
         /**
          * @brief Return a constant reference to the list of corners that
          * describe this area.
@@ -23,6 +23,8 @@
 #include "instrument.hpp"
 #include "trajectory.hpp"
 
+#include <vector>
+
 /**
  * \brief GPS measurements are sometime inaccurate. When the inaccuracies manifest as specific points (North or South
  * Pole), they are easy to detect and throw out.  Sometimes inaccuracies manifest as non-specific points.  This class
@@ -37,12 +39,16 @@ class ErrorCorrector
          * \brief Construct an ErrorCorrector that will operate using a given sample size.
          *
          * \param sample_size The number of points to use for detecting anomolies.
+         * \param sliding_window When true, every point is compared to the median of the sample_size points around
+         * it instead of only examining the points at the beginning and ending of the trip.
+         * \throws invalid_argument if the sample size is 0.
          */
-        ErrorCorrector(uint64_t sample_size);
+        ErrorCorrector(uint64_t sample_size, bool sliding_window = false);
 
         /**
-         * \brief Examine sample_size points from the beginning and ending of the traj and remove those points that were
-         * found to be inaccurate.  When points are removed, the trip is re-indexed.
+         * \brief Examine sample_size points from the beginning and ending of the traj (or the whole traj with a sliding
+         * window) and remove those points that were found to be inaccurate.  When points are removed, the trip is
+         * re-indexed.
          *
          * \param The trajectory to examine.
          * \param The UID of the trajectory.
@@ -50,25 +56,54 @@ class ErrorCorrector
         void correct_error(trajectory::Trajectory& traj, const std::string& uid);
 
         /**
-         * \brief Examine sample_size points from the beginning and ending of the traj and remove those points that were
-         * found to be inaccurate.  When points are removed, the trip is re-indexed.  A count of the erroneous points is
-         * stored in the point_counter.
+         * \brief Examine sample_size points from the beginning and ending of the traj (or the whole traj with a sliding
+         * window) and remove those points that were found to be inaccurate.  When points are removed, the trip is
+         * re-indexed.  A count of the erroneous points is stored in the point_counter.
          *
          * \param The trajectory to examine.
          * \param The UID of the trajectory.
+         * \param point_counter a PointCounter, or a NullCounter when the points are not counted.
          */
-        void correct_error(trajectory::Trajectory& traj, const std::string& uid, instrument::PointCounter& point_counter);
+        template <typename Counter>
+        void correct_error(trajectory::Trajectory& traj, const std::string& uid, Counter& point_counter);
 
     private:
-        void remove_points(trajectory::Trajectory& traj, uint64_t start, uint64_t end, const std::string& uid);
-        void remove_points(trajectory::Trajectory& traj, uint64_t start, uint64_t end, const std::string& uid, instrument::PointCounter& point_counter);
+        /**
+         * \brief Find the errors and remove them from the trajectory.
+         *
+         * \return the number of points removed.
+         */
+        uint64_t remove_errors(trajectory::Trajectory& traj);
+
+        /**
+         * \brief Compare the points from start against the median of the points in [start,end) and remove the
+         * inaccurate ones in a single pass.  Testing continues until end - start points have been kept, i.e., the
+         * points that move into the window as others are removed are tested too.
+         *
+         * \return the number of points removed.
+         */
+        uint64_t remove_points(trajectory::Trajectory& traj, uint64_t start, uint64_t end);
+
+        /**
+         * \brief Compare every point against the median of the sample_size points centered on it and remove the
+         * inaccurate ones; the windows are clipped to the trip so the ends use the first and last sample_size points.
+         *
+         * \return the number of points removed.
+         */
+        uint64_t remove_points_sliding(trajectory::Trajectory& traj);
+
         void correct_indices(trajectory::Trajectory& traj);
 
         uint64_t sample_size_;
-        bool is_explicit_edge_;
-        geo::EdgeCPtr current_eptr_;
-        geo::EdgeCPtr previous_eptr_;
-        std::vector<trajectory::Point> edge_pts_;
+        bool sliding_window_;
+        std::vector<double> lats_;              ///< sample scratch space reused across trips.
+        std::vector<double> lons_;
+        std::vector<char> errors_;              ///< the points marked for removal by the sliding window.
+        std::vector<double> latrs_;             ///< the tested points in radians.
+        std::vector<double> lonrs_;
+        std::vector<double> med_latrs_;         ///< the medians the sliding window compares against in radians.
+        std::vector<double> med_lonrs_;
+        std::vector<double> distances_;         ///< the distances from the tested points to their medians.
 };
 
 #endif
@@ -0,0 +1,147 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_GEOFENCE_HPP
+#define CVDP_DI_GEOFENCE_HPP
+
+#include "entity.hpp"
+#include "trajectory.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace geofence {
+
+    /**
+     * \brief The suppression zones of a run (e.g., circles around depots and homes and grid squares) bucketed into a
+     * uniform grid of cells when they are loaded. A point is only tested against the zones whose bounding box overlaps
+     * its cell, so the cost of a point does not grow with the number of zones.
+     *
+     * The cells are square in degrees and only the cells some zone overlaps are stored, so zones spread over several
+     * regions do not fill the space between them with empty cells. A zone that would overlap more than kMaxZoneCells
+     * cells is kept apart and tested for every point inside its bounding box. The index is immutable and shared by all
+     * threads.
+     */
+    class ZoneIndex {
+        public:
+            using CPtr = std::shared_ptr<const ZoneIndex>;
+
+            static const std::size_t kMaxZoneCells = 4096;      ///< the most cells a zone is bucketed into.
+            static constexpr double kMinCellDegrees = 1e-4;     ///< the smallest automatic cell size (about 11 m).
+
+            /**
+             * \brief Build the index.
+             *
+             * \param circles the circular zones; a point within the radius of the center is in the zone.
+             * \param grids the rectangular zones; a point within the bounds is in the zone.
+             * \param cell_degrees the width and height of a cell in degrees; 0 uses twice the median zone extent.
+             *
+             * \throws invalid_argument if cell_degrees is negative.
+             */
+            ZoneIndex( const std::vector<geo::Circle::CPtr>& circles, const std::vector<geo::Grid::CPtr>& grids, double cell_degrees = 0.0 );
+
+            /**
+             * \brief Load the circle and grid shapes of a shape file (see shapes::CSVInputFactory) as zones; the other
+             * shapes are ignored.
+             *
+             * \throws invalid_argument if the file cannot be read.
+             */
+            static CPtr load( const std::string& file_path, double cell_degrees = 0.0 );
+
+            /**
+             * \brief Predicate indicating whether a point is in any zone.
+             */
+            bool contains( const geo::Point& pt ) const;
+
+            /**
+             * \brief Return one critical interval, with the aux "geofence", for each run of consecutive trip points
+             * that are in a zone; the points of the intervals are suppressed like those of the other critical
+             * intervals (see IntervalMarker) and the privacy intervals are found around them.
+             *
+             * \param traj the trajectory.
+             * \return the intervals in the order of the trip.
+             */
+            trajectory::Interval::PtrList find_intervals( const trajectory::Trajectory& traj ) const;
+
+            /**
+             * \brief Return the number of zones.
+             */
+            std::size_t size() const;
+
+            /**
+             * \brief Return the number of stored (non-empty) cells.
+             */
+            std::size_t cell_count() const;
+
+            /**
+             * \brief Return the width and height of a cell in degrees.
+             */
+            double get_cell_degrees() const;
+
+        private:
+            /**
+             * \brief A zone with its bounding box; grid zones are their bounding box.
+             */
+            struct Zone {
+                double min_lat;
+                double max_lat;
+                double min_lon;
+                double max_lon;
+                geo::Circle::CPtr circle;                       ///< the circle of a circular zone; nullptr for a grid.
+            };
+
+            /**
+             * \brief The zones overlapping a cell: a range of zone_ids_.
+             */
+            struct Cell {
+                uint32_t begin;
+                uint32_t end;
+            };
+
+            std::vector<Zone> zones_;
+            std::vector<uint32_t> zone_ids_;                    ///< the zones of each cell, one cell after another.
+            std::vector<uint32_t> large_zone_ids_;              ///< the zones too large to bucket.
+            std::unordered_map<uint64_t, Cell> cells_;          ///< the cells some zone overlaps, by cell key.
+            double cell_degrees_;
+            double min_lat_;                                    ///< the bounding box of all the zones.
+            double max_lat_;
+            double min_lon_;
+            double max_lon_;
+
+            /**
+             * \brief Return the cell row of a latitude or column of a longitude.
+             */
+            int64_t cell_coordinate( double degrees ) const;
+
+            /**
+             * \brief Return the key of a cell.
+             */
+            static uint64_t cell_key( int64_t row, int64_t col );
+
+            /**
+             * \brief Predicate indicating whether a point is in a zone.
+             */
+            static bool zone_contains( const Zone& zone, const geo::Point& pt );
+    };
+}
+
+#endif
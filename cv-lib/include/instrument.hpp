@@ -20,8 +20,13 @@
 #ifndef CTES_DI_INSTRUMENT_HPP
 #define CTES_DI_INSTRUMENT_HPP
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace instrument {
 
@@ -80,6 +85,276 @@ namespace instrument {
          */
         friend std::ostream& operator<<( std::ostream& os, const PointCounter& point_counter );
     };
+
+    /**
+     * \brief A count that discards its updates; the increments of a NullCounter compile away.
+     */
+    struct NullCount
+    {
+        NullCount& operator++() { return *this; }
+        NullCount operator++( int ) { return *this; }
+        NullCount& operator+=( uint64_t ) { return *this; }
+    };
+
+    /**
+     * \brief The counter policy of the uncounted code paths: it has the fields of a PointCounter, but counts nothing.
+     *
+     * The functions that gather statistics are templates on the counter, instantiated for PointCounter and
+     * NullCounter, so the same code path is used whether or not the points are counted.
+     */
+    struct NullCounter
+    {
+        NullCount n_points;
+        NullCount n_invalid_field_points;
+        NullCount n_invalid_geo_points;
+        NullCount n_invalid_heading_points;
+        NullCount n_error_points;
+        NullCount n_ci_points;
+        NullCount n_pi_points;
+    };
+
+    /**
+     * \brief The stages of the de-identification pipeline that are timed.
+     */
+    enum class Stage : std::size_t {
+        kParse,                                 ///> Reading and parsing the trip file.
+        kErrorCorrect,                          ///> ErrorCorrector.
+        kMapFit,                                ///> MapFitter.
+        kImplicitMapFit,                        ///> ImplicitMapFitter.
+        kIntersectionCount,                     ///> IntersectionCounter.
+        kTurnAround,                            ///> Detector::TurnAround.
+        kStop,                                  ///> Detector::Stop.
+        kGeofence,                              ///> geofence::ZoneIndex suppression zones.
+        kPointAnalysis,                         ///> The fused pass of map fitting through stop detection (PointPipeline).
+        kIntervalMark,                          ///> Critical and privacy interval marking.
+        kPrivacyInterval,                       ///> PrivacyIntervalFinder.
+        kDeIdentify,                            ///> DeIdentifier.
+        kKML,                                   ///> KML debug output.
+        kWrite,                                 ///> Writing the de-identified trip.
+        kNStages
+    };
+
+    /**
+     * \brief A class to gather the time spent in each pipeline stage; one instance per thread.
+     */
+    struct StageTimer
+    {
+        /**
+         * \brief The totals for one stage.
+         */
+        struct Totals
+        {
+            uint64_t n_calls;                   ///> The number of times the stage ran.
+            uint64_t n_points;                  ///> The number of points the stage processed.
+            double wall_seconds;                ///> Elapsed (wall clock) time.
+            double cpu_seconds;                 ///> CPU time of the thread that ran the stage.
+        };
+
+        std::array<Totals, static_cast<std::size_t>(Stage::kNStages)> stages;
+
+        /**
+         * \brief Default constructor.
+         *
+         * All statistics are initialized to 0.
+         */
+        StageTimer();
+
+        /**
+         * \brief Add one run of a stage.
+         *
+         * \param stage the stage.
+         * \param n_points the number of points processed by the run.
+         * \param wall_seconds the elapsed time of the run.
+         * \param cpu_seconds the CPU time of the run.
+         */
+        void add(Stage stage, uint64_t n_points, double wall_seconds, double cpu_seconds);
+
+        /**
+         * \brief Return the totals of a stage.
+         */
+        const Totals& get(Stage stage) const;
+
+        /**
+         * \brief Return a new StageTimer instance = this StageTimer + other StageTimer. The totals of each stage are
+         * added together.
+         *
+         * This StageTimer is NOT modified.
+         *
+         * \param other the StageTimer whose totals are to be added to this timer.
+         * \return a NEW StageTimer instance.
+         */
+        StageTimer operator+( const StageTimer& other ) const;
+
+        /**
+         * \brief Return the name of a stage as printed in the summary.
+         */
+        static const char* stage_name( Stage stage );
+
+        /**
+         * \brief The CPU time consumed by the calling thread in seconds; process CPU time where per-thread time is not
+         * available.
+         */
+        static double thread_cpu_seconds();
+
+        /**
+         * \brief Write a StageTimer to an output stream.
+         *
+         * The form of the output is one comma-delimited line per stage: name, calls, points, wall seconds, CPU seconds.
+         *
+         * \param os the output stream to write the string form of this StageTimer
+         * \param stage_timer the StageTimer to write.
+         * \return the output stream after the write for chaining.
+         */
+        friend std::ostream& operator<<( std::ostream& os, const StageTimer& stage_timer );
+    };
+
+    /**
+     * \brief The timed spans of one thread, written as Chrome trace events (chrome://tracing or Perfetto).
+     *
+     * Each thread appends to its own buffer without locking; the buffers are written together after the threads are
+     * done.
+     */
+    class TraceBuffer
+    {
+        public:
+            using Ptr = std::shared_ptr<TraceBuffer>;
+            using Clock = std::chrono::steady_clock;
+
+            /**
+             * \brief One span of a thread.
+             */
+            struct Event
+            {
+                const char* name;               ///> The span name; it must outlive the buffer (e.g., a stage name).
+                const char* category;           ///> The span category; as the name.
+                std::string detail;             ///> An argument shown with the span (e.g., the trip); may be empty.
+                int64_t start_us;               ///> The start in microseconds since origin().
+                int64_t duration_us;            ///> The length in microseconds.
+            };
+
+            /**
+             * \brief Construct an empty buffer.
+             *
+             * \param thread_id the thread the spans are shown on.
+             * \param reserve the number of events to make room for up front.
+             */
+            explicit TraceBuffer( unsigned thread_id, std::size_t reserve = kDefaultReserve );
+
+            /**
+             * \brief Add a span.
+             *
+             * \param name the span name; it must outlive the buffer.
+             * \param category the span category; it must outlive the buffer.
+             * \param start the start of the span.
+             * \param end the end of the span.
+             * \param detail an argument shown with the span; may be empty.
+             */
+            void span( const char* name, const char* category, Clock::time_point start, Clock::time_point end, const std::string& detail = std::string() );
+
+            /**
+             * \brief Return the thread the spans are shown on.
+             */
+            unsigned thread_id() const;
+
+            /**
+             * \brief Return the spans in the order they were added.
+             */
+            const std::vector<Event>& events() const;
+
+            /**
+             * \brief The time all the buffers of the process measure from: the construction of the first buffer.
+             */
+            static Clock::time_point origin();
+
+            /**
+             * \brief Write buffers as a Chrome trace-event JSON document: one complete ("X") event per span and a
+             * thread name for each buffer.
+             *
+             * \param os the output stream.
+             * \param buffers the buffers to write; nullptr entries are skipped.
+             * \param process_name the name the process is shown with.
+             */
+            static void write_chrome_trace( std::ostream& os, const std::vector<Ptr>& buffers, const std::string& process_name );
+
+        private:
+            static const std::size_t kDefaultReserve = 4096;
+
+            unsigned thread_id_;
+            std::vector<Event> events_;
+    };
+
+    /**
+     * \brief Adds a span to a TraceBuffer from construction to destruction; does nothing when the buffer is nullptr.
+     */
+    class TraceScope
+    {
+        public:
+            /**
+             * \brief Start the span.
+             *
+             * \param buffer the buffer to add the span to; may be nullptr.
+             * \param name the span name; it must outlive the buffer.
+             * \param category the span category; it must outlive the buffer.
+             */
+            TraceScope( TraceBuffer* buffer, const char* name, const char* category );
+
+            TraceScope( const TraceScope& ) = delete;
+            TraceScope& operator=( const TraceScope& ) = delete;
+
+            /**
+             * \brief End the span and add it to the buffer.
+             */
+            ~TraceScope();
+
+            /**
+             * \brief Set the argument shown with the span.
+             */
+            void set_detail( const std::string& detail );
+
+        private:
+            TraceBuffer* buffer_;
+            const char* name_;
+            const char* category_;
+            std::string detail_;
+            TraceBuffer::Clock::time_point start_;
+    };
+
+    /**
+     * \brief A stopwatch that charges the time between laps to pipeline stages of a StageTimer and, when tracing, adds
+     * a span per lap to a TraceBuffer.
+     *
+     * All operations do nothing when the timer and the trace are nullptr so the pipeline can run the same code untimed.
+     */
+    class StageClock
+    {
+        public:
+            /**
+             * \brief Construct the clock and start timing.
+             *
+             * \param timer the timer to charge; may be nullptr.
+             * \param trace the buffer to add a span per lap to; may be nullptr.
+             */
+            explicit StageClock( StageTimer* timer, TraceBuffer* trace = nullptr );
+
+            /**
+             * \brief Charge the time since the last lap (or reset) to a stage and restart timing.
+             *
+             * \param stage the stage that just finished.
+             * \param n_points the number of points the stage processed.
+             */
+            void lap( Stage stage, uint64_t n_points );
+
+            /**
+             * \brief Restart timing without charging any stage.
+             */
+            void reset();
+
+        private:
+            StageTimer* timer_;
+            TraceBuffer* trace_;
+            std::chrono::steady_clock::time_point wall_start_;
+            double cpu_start_;
+    };
 }
 
 #endif
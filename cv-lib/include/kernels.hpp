@@ -0,0 +1,92 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_KERNELS_HPP
+#define CVDP_DI_KERNELS_HPP
+
+#include "entity.hpp"
+#include "trajectory.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace geo {
+
+    /**
+     * \brief Batch forms of the Location distance and bearing functions over arrays of coordinates in radians.
+     *
+     * Each kernel gives exactly the value of the scalar function for every element; only the arithmetic that follows
+     * the trigonometry is done two elements at a time (SSE2) when the target supports it, and one at a time otherwise.
+     * The output arrays must hold n values and may not overlap the inputs.
+     */
+    namespace kernels {
+
+        /**
+         * \brief Return true when the vector form of the kernels was compiled.
+         */
+        bool is_vectorized();
+
+        /**
+         * \brief Convert n angles from degrees to radians as to_radians does.
+         */
+        void to_radians(const double* degrees, std::size_t n, double* radians);
+
+        /**
+         * \brief Gather the coordinates of a trajectory in radians.
+         *
+         * \param traj the trajectory.
+         * \param latr receives the latitudes.
+         * \param lonr receives the longitudes.
+         */
+        void gather_radians(const trajectory::Trajectory& traj, std::vector<double>& latr, std::vector<double>& lonr);
+
+        /**
+         * \brief Compute Location::distance between the locations a[i] and b[i].
+         */
+        void pairwise_distances(const double* latr_a, const double* lonr_a, const double* latr_b, const double* lonr_b, std::size_t n, double* distances);
+
+        /**
+         * \brief Compute Location::distance from one location to each of n locations.
+         *
+         * \param latr the latitude of the origin in radians.
+         * \param lonr the longitude of the origin in radians.
+         */
+        void distances_from(double latr, double lonr, const double* latrs, const double* lonrs, std::size_t n, double* distances);
+
+        /**
+         * \brief Compute the distance from each location to the next; distances[0] is 0 and distances[i] is the
+         * distance from location i - 1 to location i.
+         */
+        void consecutive_distances(const double* latr, const double* lonr, std::size_t n, double* distances);
+
+        /**
+         * \brief Compute the distance traveled along the locations; cumulative[i] is the sum of the consecutive
+         * distances up to location i.
+         */
+        void cumulative_distances(const double* latr, const double* lonr, std::size_t n, double* cumulative);
+
+        /**
+         * \brief Compute Location::bearing from each location to the next; bearings[0] is 0 and bearings[i] is the bearing
+         * from location i - 1 to location i. The sine and cosine of each latitude are computed once.
+         */
+        void consecutive_bearings(const double* latr, const double* lonr, std::size_t n, double* bearings);
+    }
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_MAP_CONTEXT_HPP
+#define CVDP_DI_MAP_CONTEXT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "critical.hpp"
+#include "entity.hpp"
+#include "mapfit.hpp"
+#include "osm.hpp"
+#include "quad.hpp"
+#include "tiles.hpp"
+#include "trajectory.hpp"
+
+/**
+ * \brief The road network one region's trips are de-identified against: a compiled quad tree with its fit areas and
+ * vertex table, or a tiled map, together with the highway policy of the stop detector.
+ *
+ * A context is immutable once constructed, so any number of threads and runs can share one, and a process can hold the
+ * contexts of several regions at once and route each trip to one of them (see route). MapFitter and Detector::Stop
+ * take their map and policy from a context instead of from process-wide state.
+ */
+class MapContext {
+    public:
+        using CPtr = std::shared_ptr<const MapContext>;
+        using VertexTable = std::unordered_map<uint64_t, std::shared_ptr<const geo::Vertex>>;
+
+        /**
+         * \brief Construct the context of a compiled road network.
+         *
+         * \param edges the edges of the network; they are kept alive by the context.
+         * \param quad the compiled quad tree indexing the edges.
+         * \param fit_width_scaling the scaling factor applied to the OSM road widths for the fit areas.
+         * \param fit_extension the number of meters to extend each fit area from the ends of its edge.
+         * \param area_cache the fit areas of the edges; built from the edges when nullptr.
+         * \param stop_excluded_highways the OSM highway types where the stop detector ignores stops.
+         * \throws invalid_argument if the quad tree is nullptr or the area cache was built with other fit parameters.
+         */
+        MapContext( const std::vector<geo::EdgeCPtr>& edges, const FlatQuad::CPtr& quad, double fit_width_scaling = 1.0, double fit_extension = 5.0, const EdgeAreaCache::CPtr& area_cache = nullptr, const osm::HighwaySet& stop_excluded_highways = Detector::Stop::default_excluded_highways() );
+
+        /**
+         * \brief Construct the context of a tiled map; the vertex table is empty since each tile holds its own vertices.
+         *
+         * \param tiled_map the tiled map.
+         * \param fit_width_scaling the scaling factor the tile area caches were built with.
+         * \param fit_extension the extension the tile area caches were built with.
+         * \param stop_excluded_highways the OSM highway types where the stop detector ignores stops.
+         * \throws invalid_argument if the map is nullptr or its areas were built with other fit parameters.
+         */
+        MapContext( const tiles::TiledMap::CPtr& tiled_map, double fit_width_scaling = 1.0, double fit_extension = 5.0, const osm::HighwaySet& stop_excluded_highways = Detector::Stop::default_excluded_highways() );
+
+        MapContext( const MapContext& ) = delete;
+        MapContext& operator=( const MapContext& ) = delete;
+
+        /**
+         * \brief Return the edges of a compiled network; empty for a tiled map.
+         */
+        const std::vector<geo::EdgeCPtr>& get_edges() const;
+
+        /**
+         * \brief Return the compiled quad tree; nullptr for a tiled map.
+         */
+        const FlatQuad::CPtr& get_quad() const;
+
+        /**
+         * \brief Return the fit areas of a compiled network; nullptr for a tiled map.
+         */
+        const EdgeAreaCache::CPtr& get_area_cache() const;
+
+        /**
+         * \brief Return the tiled map; nullptr for a compiled network.
+         */
+        const tiles::TiledMap::CPtr& get_tiled_map() const;
+
+        /**
+         * \brief Return the bounds of the quad tree root or the tile grid.
+         */
+        const geo::Bounds& get_bounds() const;
+
+        double get_fit_width_scaling() const;
+        double get_fit_extension() const;
+
+        /**
+         * \brief Predicate indicating whether the fit areas of this context are built with the provided parameters.
+         */
+        bool matches( double fit_width_scaling, double fit_extension ) const;
+
+        /**
+         * \brief Return the OSM highway types where the stop detector ignores stops.
+         */
+        const osm::HighwaySet& get_stop_excluded_highways() const;
+
+        /**
+         * \brief Return a vertex of a compiled network by its unique identifier.
+         *
+         * \param uid the vertex identifier.
+         * \return the vertex or nullptr if the network has no such vertex.
+         */
+        std::shared_ptr<const geo::Vertex> find_vertex( uint64_t uid ) const;
+
+        /**
+         * \brief Return the size of the vertex table.
+         */
+        std::size_t vertex_count() const;
+
+        /**
+         * \brief Return the bounding box of the points of a trip.
+         *
+         * \param traj the trip; must not be empty.
+         * \return the smallest bounds holding every point.
+         * \throws invalid_argument if the trip is empty.
+         */
+        static geo::Bounds trip_bounds( const trajectory::Trajectory& traj );
+
+        /**
+         * \brief Choose the context a trip is de-identified against: the first whose bounds hold the whole trip
+         * bounding box, otherwise the one with the largest overlap, otherwise the first context.
+         *
+         * \param contexts the candidate contexts in order of preference.
+         * \param bounds the trip bounding box (see trip_bounds).
+         * \return the chosen context.
+         * \throws invalid_argument if there are no contexts.
+         */
+        static const CPtr& route( const std::vector<CPtr>& contexts, const geo::Bounds& bounds );
+
+    private:
+        std::vector<geo::EdgeCPtr> edges_;
+        FlatQuad::CPtr quad_;
+        EdgeAreaCache::CPtr area_cache_;
+        tiles::TiledMap::CPtr tiled_map_;
+        geo::Bounds bounds_;
+        double fit_width_scaling_;
+        double fit_extension_;
+        osm::HighwaySet stop_excluded_highways_;
+        VertexTable vertex_table_;                          ///< the vertices of edges_ by unique identifier.
+
+        /**
+         * \brief Return the area (square degrees) shared by the context bounds and other bounds.
+         */
+        double overlap( const geo::Bounds& bounds ) const;
+};
+
+#endif
@@ -30,6 +30,70 @@
 #include <unordered_map>
 #include <queue>
 
+namespace tiles {
+    class Tile;
+    class TiledMap;
+}
+
+class MapContext;
+
+/**
+ * \brief An immutable lookup table from edge unique identifier to the area that encapsulates that edge for map
+ * matching.
+ *
+ * The areas are built once using the (fit_width_scaling, fit_extension) pair and are never modified afterwards, so a
+ * single instance can be shared read-only by MapFitter instances running in different threads.
+ */
+class EdgeAreaCache
+{
+    public:
+        using Ptr = std::shared_ptr<EdgeAreaCache>;
+        using CPtr = std::shared_ptr<const EdgeAreaCache>;
+        using AreaMap = std::unordered_map<uint64_t, geo::AreaCPtr>;
+
+        /**
+         * \brief Build the area for every edge in the list.
+         *
+         * Edges that produce zero areas are recorded with a nullptr area so they are skipped during fitting without
+         * rebuilding them.
+         *
+         * \param edges The road network edges (normally, those inserted into the quad tree).
+         * \param fit_width_scaling The scaling factor applied to the prescribed OSM road widths.
+         * \param fit_extension The number of meters to extend each area from the ends of its edge.
+         */
+        EdgeAreaCache( const std::vector<geo::EdgeCPtr>& edges, double fit_width_scaling = 1.0, double fit_extension = 5.0 );
+
+        /**
+         * \brief Predicate indicating whether this cache was built with the provided area parameters.
+         *
+         * \param fit_width_scaling The scaling factor applied to the prescribed OSM road widths.
+         * \param fit_extension The number of meters to extend each area from the ends of its edge.
+         * \return true if the cached areas were built using these parameters, false otherwise.
+         */
+        bool matches( double fit_width_scaling, double fit_extension ) const;
+
+        /**
+         * \brief Look up the area for an edge.
+         *
+         * \param eptr The edge whose area is needed.
+         * \param aptr Set to the cached area; nullptr if the edge produces a zero area.
+         * \return true if the edge is in the cache, false otherwise (aptr is not modified).
+         */
+        bool find( const geo::EdgeCPtr& eptr, geo::AreaCPtr& aptr ) const;
+
+        /**
+         * \brief Return the number of edges in the cache.
+         *
+         * \return the number of edges.
+         */
+        std::size_t size() const;
+
+    private:
+        double fit_width_scaling;                   ///< the width scaling used to build the areas.
+        double fit_extension;                       ///< the extension (meters) used to build the areas.
+        AreaMap area_map;                           ///< edge uid to encapsulating area.
+};
+
 /**
  * \brief The map matching algorithm to use for our privacy procedures. 
  *
@@ -46,7 +110,7 @@
 class MapFitter
 {
     public:
-        using AreaEdgePair = std::pair<geo::Area::Ptr, geo::EdgeCPtr>;
+        using AreaEdgePair = std::pair<geo::AreaCPtr, geo::EdgeCPtr>;
         using PriorityPair = std::pair<double, AreaEdgePair>;
         using AreaEdgePairList = std::vector<AreaEdgePair>;
         using AreaSet = std::unordered_set<geo::AreaCPtr>;
@@ -59,8 +123,65 @@ class MapFitter
          * \param fit_width_scaling A scaling factor to apply to the prescribed widths of various types of OSM roads,
          * e.g., 1.0 will use the prescribed width; 1.5 will increase that width by 50%.
          * \param fit_extension The number of meters to extend the bounding box on each end (meters)
+         * \param area_cache An optional cache of prebuilt edge areas; must be built with the same scaling and extension.
+         * \param collect_areas when true the matched areas are kept in area_set (e.g., to plot them in KML).
+         * \param planar_fit when true the areas are tested in their local planar frames (see Area::contains_planar).
+         * \param planar_tolerance the distance in meters a point may be outside an area and still match when
+         * planar_fit is true.
+         *
+         * \throws invalid_argument if the area cache was built with different scaling or extension parameters or the
+         * tolerance is negative.
+         */
+        MapFitter( const Quad::CPtr& quadtree, double fit_width_scaling = 1.0, double fit_extension = 5.0, const EdgeAreaCache::CPtr& area_cache = nullptr, bool collect_areas = true, bool planar_fit = false, double planar_tolerance = 0.0 );
+
+        /**
+         * \brief Construct a map-matching instance that uses a compiled (frozen) quad tree.
+         *
+         * \param flat_quadtree The compiled quad tree containing the OSM road network to match to.
+         * \param fit_width_scaling A scaling factor to apply to the prescribed widths of various types of OSM roads.
+         * \param fit_extension The number of meters to extend the bounding box on each end (meters)
+         * \param area_cache An optional cache of prebuilt edge areas; must be built with the same scaling and extension.
+         * \param collect_areas when true the matched areas are kept in area_set (e.g., to plot them in KML).
+         * \param planar_fit when true the areas are tested in their local planar frames (see Area::contains_planar).
+         * \param planar_tolerance the distance in meters a point may be outside an area and still match when
+         * planar_fit is true.
+         *
+         * \throws invalid_argument if the area cache was built with different scaling or extension parameters or the
+         * tolerance is negative.
+         */
+        MapFitter( const FlatQuad::CPtr& flat_quadtree, double fit_width_scaling = 1.0, double fit_extension = 5.0, const EdgeAreaCache::CPtr& area_cache = nullptr, bool collect_areas = true, bool planar_fit = false, double planar_tolerance = 0.0 );
+
+        /**
+         * \brief Construct a map-matching instance that uses a tiled map; each point is matched against the tile that
+         * holds it and the tile area caches replace the area cache. The tiles used are kept loaded for the life of the
+         * fitter since the fit edges of the points belong to them.
+         *
+         * \param tiled_map The tiled map containing the OSM road network to match to.
+         * \param fit_width_scaling A scaling factor to apply to the prescribed widths of various types of OSM roads.
+         * \param fit_extension The number of meters to extend the bounding box on each end (meters)
+         * \param collect_areas when true the matched areas are kept in area_set (e.g., to plot them in KML).
+         * \param planar_fit when true the areas are tested in their local planar frames (see Area::contains_planar).
+         * \param planar_tolerance the distance in meters a point may be outside an area and still match when
+         * planar_fit is true.
+         *
+         * \throws invalid_argument if the map is nullptr, its areas were built with different scaling or extension
+         * parameters or the tolerance is negative.
+         */
+        MapFitter( const std::shared_ptr<const tiles::TiledMap>& tiled_map, double fit_width_scaling = 1.0, double fit_extension = 5.0, bool collect_areas = true, bool planar_fit = false, double planar_tolerance = 0.0 );
+
+        /**
+         * \brief Construct a map-matching instance for the road network of a map context; the quad tree or tiled map,
+         * the areas and the fit parameters all come from the context.
+         *
+         * \param context The map context of the region the trip is in.
+         * \param collect_areas when true the matched areas are kept in area_set (e.g., to plot them in KML).
+         * \param planar_fit when true the areas are tested in their local planar frames (see Area::contains_planar).
+         * \param planar_tolerance the distance in meters a point may be outside an area and still match when
+         * planar_fit is true.
+         *
+         * \throws invalid_argument if the tolerance is negative.
          */
-        MapFitter( const Quad::CPtr& quadtree, double fit_width_scaling = 1.0, double fit_extension = 5.0);
+        explicit MapFitter( const MapContext& context, bool collect_areas = true, bool planar_fit = false, double planar_tolerance = 0.0 );
 
         /**
          * \brief Fit a trip point to a OSM segment.
@@ -76,13 +197,40 @@ class MapFitter
          */
         void fit( trajectory::Trajectory& traj );
 
+        /**
+         * \brief Fit an entire trip in consecutive segments, each on its own thread; the points are fit exactly as
+         * fit(traj) fits them.
+         *
+         * The first segment continues the state of this fitter; the others are fit by copies that start without a
+         * current edge. The state of a fitter after a point follows from the edge the point was fit to, so at each
+         * segment boundary the points are fit again with the state carried over from the points before, until a point
+         * is fit to the edge it already had; the rest of the segment is left as it is. This fitter holds the state of
+         * the last point afterwards.
+         *
+         * The trip is fit on the calling thread alone when n_segments is less than 2, when the fitter collects areas
+         * (the areas of the discarded fits would be kept) or when it uses a tiled map (the current tile is not part of
+         * the carried state).
+         *
+         * \param traj the trip to match to the road network.
+         * \param n_segments the number of segments; at most one per point is used.
+         */
+        void fit( trajectory::Trajectory& traj, unsigned n_segments );
+
     private:
-        Quad::CPtr quadtree;
+        Quad::CPtr quadtree;                        ///> the quad tree to search; nullptr when flat_quadtree is used.
+        FlatQuad::CPtr flat_quadtree;               ///> the compiled quad tree to search; nullptr when quadtree is used.
+        std::shared_ptr<const tiles::TiledMap> tiled_map;   ///> the tiled map to search; nullptr when a quad tree is used.
+        std::shared_ptr<const tiles::Tile> current_tile;    ///> the tile current_edge belongs to.
+        std::vector<std::shared_ptr<const tiles::Tile>> held_tiles;    ///> every tile used so far; keeps fit edges valid.
 
         double fit_width_scaling;                   ///> applied to uniformly to all road type widths.
         double fit_extension;                       ///> distance (in meters) area is extended from ends of edge.
+        EdgeAreaCache::CPtr area_cache;             ///> prebuilt edge areas shared between fitters; may be nullptr.
+        bool collect_areas;                         ///> keep the matched areas in area_set.
+        bool planar_fit;                            ///> test containment in the local planar frames of the areas.
+        double planar_tolerance;                    ///> meters a point may be outside a planar area and still match.
 
-        geo::Area::Ptr current_area;                ///> the area that contained the last traj point or nullptr if no edge matched.
+        geo::AreaCPtr current_area;                ///> the area that contained the last traj point or nullptr if no edge matched.
         geo::EdgeCPtr current_edge;                 ///> the edge that matched the last traj point.
 
         /**
@@ -130,6 +278,55 @@ class MapFitter
          */
         bool set_fit_area( const trajectory::Point& tp, const geo::Entity::PtrList& edges );
 
+        /**
+         * \brief Attempt to find the edge in the range of entities that best matches the provided point; see the
+         * list version above.
+         *
+         * \param tp The trip point that needs to be matched to a nearest road.
+         * \param first The beginning of the range of entities to match to.
+         * \param last The end of the range of entities to match to.
+         * \return true if a match is made, false otherwise.
+         */
+        bool set_fit_area( const trajectory::Point& tp, FlatQuad::EntityCIterator first, FlatQuad::EntityCIterator last );
+
+        /**
+         * \brief Return the area that encapsulates the edge; the area cache is used when it has the edge.
+         *
+         * \param eptr The edge to encapsulate.
+         * \return The encapsulating area or nullptr if the edge produces a zero area.
+         */
+        geo::AreaCPtr get_fit_area( const geo::EdgeCPtr& eptr ) const;
+
+        /**
+         * \brief Return true if the area contains the trip point using the containment test selected at construction.
+         */
+        bool area_contains( const geo::AreaCPtr& aptr, const trajectory::Point& tp ) const;
+
+        /**
+         * \brief Return true if the trip point is outside the edge of the area using the test selected at construction.
+         */
+        bool area_outside_edge( const geo::AreaCPtr& aptr, int edge, const trajectory::Point& tp ) const;
+
+        /**
+         * \brief Make a tile the current tile and keep it loaded.
+         */
+        void use_tile( const std::shared_ptr<const tiles::Tile>& tile );
+
+        /**
+         * \brief Find the tile vertex, with all of its incident edges, to follow the road network from; the tile holding
+         * the trip point is used when the current tile does not have all the edges of the vertex.
+         *
+         * \param tp The trip point that needs to be matched.
+         * \param shared_vertex The vertex of the current edge to continue from.
+         * \return the vertex or nullptr if no tile has all of its incident edges.
+         */
+        geo::Vertex::Ptr tile_vertex( const trajectory::Point& tp, const geo::Vertex::Ptr& shared_vertex );
+
+        /**
+         * \brief Fit the points of traj with indices in [first, last).
+         */
+        void fit( trajectory::Trajectory& traj, std::size_t first, std::size_t last );
+
         static bool compare( const PriorityPair& p1, const PriorityPair& p2 );
 
     public:
@@ -151,8 +348,10 @@ class ImplicitMapFitter
          *
          * \param num_sectors the compass rose is divided into this number of equally sized sectors.
          * \param min_fit_points use no less than this many points to infer a road segment.
+         * \param collect_areas when true the implicit edges and their areas are kept in edge_set and area_set (e.g., to
+         * plot them in KML).
          */
-        ImplicitMapFitter( uint32_t num_sectors = 36, uint32_t min_fit_points = 50 );
+        ImplicitMapFitter( uint32_t num_sectors = 36, uint32_t min_fit_points = 50, bool collect_areas = true );
 
 
         /**
@@ -169,12 +368,18 @@ class ImplicitMapFitter
          */
         void fit( trajectory::Trajectory& traj );
 
+        /**
+         * \brief Build the areas of the implicit edges; call once after the trip has been fit one point at a time.
+         */
+        void finish();
+
     private:
 
         uint64_t next_edge_id;                          ///< The UID to use for the next implicit edge.
         uint32_t num_sectors;                           ///< The number of divisions of the compass rose to determine when to change implicit edge.
         double sector_size;                             ///< Size in degrees of a sector.
         uint32_t min_fit_points;                        ///< Use no less than this many points to infer a road segment.
+        bool collect_areas;                             ///< Keep the implicit edges and their areas.
 
         // state vars.
         uint32_t current_sector;                        ///< The compass rose sector the trajectory is currently in (between 0 and num_sectors - 1)
@@ -191,6 +396,9 @@ class ImplicitMapFitter
 
 /**
  * \brief Annotate a trip with a cumulative count of intersection outdegree.
+ *
+ * The outdegree of an intersection is read from the fit edge (geo::Edge::end_outdegree), where it is recorded when
+ * the road network is loaded.
  */
 class IntersectionCounter
 {
@@ -206,9 +414,17 @@ class IntersectionCounter
          */
         void count_intersections( trajectory::Trajectory& traj );
 
+        /**
+         * \brief Annotate the next trip point with the cumulative intersection outdegree count.
+         *
+         * \param tp the trip point; it must already be map fit.
+         */
+        void count_intersections( trajectory::Point& tp );
+
     private:
         geo::EdgeCPtr current_eptr;
-        geo::Vertex::Ptr last_vertex_ptr;
+        uint64_t last_vertex_uid;                       ///< The last intersection counted.
+        bool has_last_vertex;
         uint32_t cumulative_outdegree;
 
         uint32_t current_count( trajectory::Point& tp );
@@ -0,0 +1,84 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_MAPPED_FILE_HPP
+#define CVDP_DI_MAPPED_FILE_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * \brief A read-only view of an entire file.
+ *
+ * On POSIX platforms the file is memory-mapped; elsewhere, or when mapping fails, the file is read into a single
+ * buffer. A gzip or zstd compressed file (see compression.hpp) is always decompressed into the buffer. Either way the
+ * bytes stay valid and unchanged for the lifetime of the instance, so other objects can hold shared ownership of the
+ * instance and reference its bytes directly.
+ */
+class MappedFile {
+    public:
+        using Ptr = std::shared_ptr<MappedFile>;
+        using CPtr = std::shared_ptr<const MappedFile>;
+
+        /**
+         * \brief Map (or read) a file.
+         *
+         * \param file_path the path to the file.
+         * \throws invalid_argument if the file cannot be opened or read.
+         */
+        explicit MappedFile( const std::string& file_path );
+
+        /**
+         * \brief Unmap the file.
+         */
+        ~MappedFile();
+
+        MappedFile( const MappedFile& ) = delete;
+        MappedFile& operator=( const MappedFile& ) = delete;
+
+        /**
+         * \brief Return a pointer to the first byte of the file.
+         *
+         * \return the pointer; nullptr for an empty file.
+         */
+        const char* data() const;
+
+        /**
+         * \brief Return the number of bytes in the file.
+         *
+         * \return the number of bytes.
+         */
+        std::size_t size() const;
+
+        /**
+         * \brief Predicate indicating the file is memory-mapped rather than buffered.
+         *
+         * \return true if the file is memory-mapped, false otherwise.
+         */
+        bool is_mapped() const;
+
+    private:
+        const char* data_;                          ///< The start of the file's bytes.
+        std::size_t size_;                          ///< The number of bytes in the file.
+        bool mapped_;                               ///< true when data_ is a mapping that must be released.
+        std::vector<char> buffer_;                  ///< The file contents when the file is not mapped.
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_PIPELINE_HPP
+#define CVDP_DI_PIPELINE_HPP
+
+#include "critical.hpp"
+#include "mapfit.hpp"
+#include "trajectory.hpp"
+
+/**
+ * \brief Run the point-local analysis stages over a trajectory in a single pass.
+ *
+ * Each trip point goes through explicit map fitting, implicit map fitting, intersection counting, turnaround detection
+ * and stop detection before the next point is considered, so the trajectory is streamed from memory once instead of
+ * once per stage.  Every stage only depends on the points before it, so the results are the same as running the
+ * stages one after another over the whole trajectory.
+ *
+ * The stages are owned by the caller so their results (area sets, intervals) remain available after the pass.
+ */
+class PointPipeline
+{
+    public:
+        /**
+         * \brief Construct the pipeline from freshly constructed stages.
+         *
+         * \param mf the explicit map fitter.
+         * \param imf the implicit map fitter.
+         * \param ic the intersection counter.
+         * \param tad the turnaround detector; its intervals are available from get_turn_arounds after the pass.
+         * \param stop_detector the stop detector; its intervals are available from get_stops after the pass.
+         */
+        PointPipeline( MapFitter& mf, ImplicitMapFitter& imf, IntersectionCounter& ic, Detector::TurnAround& tad, Detector::Stop& stop_detector );
+
+        /**
+         * \brief Analyze every point of the trajectory.
+         *
+         * \param traj the trajectory; its points are fit and annotated with their intersection counts.
+         */
+        void run( trajectory::Trajectory& traj );
+
+        /**
+         * \brief Analyze every point of a long trajectory: the trip is map fit in segments on several threads (see
+         * MapFitter::fit( traj, n_segments )), then the other stages run in one pass over the fit points. The results
+         * are the same as those of run( traj ).
+         *
+         * \param traj the trajectory; its points are fit and annotated with their intersection counts.
+         * \param n_segments the number of map fit segments; the single pass of run( traj ) is used when less than 2.
+         */
+        void run( trajectory::Trajectory& traj, unsigned n_segments );
+
+    private:
+        MapFitter& mf;
+        ImplicitMapFitter& imf;
+        IntersectionCounter& ic;
+        Detector::TurnAround& tad;
+        Detector::Stop& stop_detector;
+};
+
+#endif
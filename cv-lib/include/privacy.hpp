@@ -24,9 +24,11 @@
 #include "entity.hpp"
 #include "instrument.hpp"
 #include "trajectory.hpp"
+#include "columns.hpp"
 #include "quad.hpp"
 
 #include <iterator>
+#include <random>
 
 /**
  * \brief Define the intervals that "hide" critical intervals. Instances of this class determine the portion of a trajectory extended from the ends
@@ -39,6 +41,27 @@ class PrivacyIntervalFinder
         using TrajectoryIterator = trajectory::Trajectory::iterator;
         using RevTrajectoryIterator = trajectory::Trajectory::reverse_iterator;
 
+        /**
+         * The engine that draws the randomized thresholds. Its output sequence is fixed by the standard, so a seed
+         * reproduces the same privacy intervals on every platform.
+         */
+        using RandomEngine = std::mt19937_64;
+
+        /**
+         * \brief Return a run seed drawn from std::random_device; the thresholds of a run seeded with it cannot be
+         * reproduced from its output.
+         */
+        static uint64_t random_seed();
+
+        /**
+         * \brief Return the seed of the engine for one trip; the same run seed and UID always give the same seed.
+         *
+         * \param run_seed the seed of the whole run.
+         * \param uid the trajectories UID.
+         * \return the trip seed.
+         */
+        static uint64_t trip_seed( uint64_t run_seed, const std::string& uid );
+
         /**
          * \brief Construct a PrivacyIntervalFinder
          *
@@ -51,8 +74,11 @@ class PrivacyIntervalFinder
          * \param dd_rand direct distance randomization factor
          * \param md_rand manhattan distance randomization factor
          * \param out_degree_rand out degree randomization factor
+         * \param engine the source of the randomized thresholds, typically one per thread seeded with trip_seed; when
+         * nullptr an engine of the calling thread seeded with random_seed is used, so the thresholds are only
+         * reproducible with an engine passed in.
          */
-        PrivacyIntervalFinder( double min_dd, double min_md, uint32_t min_out_degree, double max_dd, double max_md, uint32_t max_out_degree, double dd_rand, double md_rand, double out_degree_rand );
+        PrivacyIntervalFinder( double min_dd, double min_md, uint32_t min_out_degree, double max_dd, double max_md, uint32_t max_out_degree, double dd_rand, double md_rand, double out_degree_rand, RandomEngine* engine = nullptr );
 
         /**
          * \brief Find the privacy intervals in the provided trajectory.
@@ -75,6 +101,7 @@ class PrivacyIntervalFinder
         double rand_min_dd;
         double rand_min_md;
         uint32_t rand_min_out_degree;
+        RandomEngine* engine;
         trajectory::IntervalCPtr curr_ciptr;
         trajectory::Point::Ptr init_priv_point;
         double md;
@@ -83,8 +110,45 @@ class PrivacyIntervalFinder
         trajectory::Index last_pi_end;
         trajectory::Interval::PtrList interval_list;
 	    TrajectoryIterator curr_tp_it;
+        TrajectoryIterator traj_begin;
+        trajectory::Index n_points;
+        std::vector<trajectory::Index> run_starts;          ///< the first point of each run of points fit to the same edge.
+        std::vector<trajectory::Index> critical_points;     ///< the points in critical intervals, in order.
+
+        /**
+         * \brief The points where an interval search has to stop and evaluate the privacy metrics.
+         */
+        enum class Event { kNone, kCritical, kPrivacyEnd, kEdgeChange };
+
+        bool is_edge_change(const geo::EdgeCPtr& a, const geo::EdgeCPtr& b) const;
 
-        bool is_edge_change(geo::EdgeCPtr a, geo::EdgeCPtr b) const;
+        /**
+         * \brief Build the edge run and critical point tables of traj; the interval searches jump between the edge
+         * changes and critical points found by binary search in them instead of visiting every point.
+         */
+        void index_trajectory( trajectory::Trajectory& traj );
+
+        /**
+         * \brief Find the next event of a forward search from the point at pos: the first critical point at or after
+         * pos, or else the first edge change after pos.
+         *
+         * \param pos the position of the current point.
+         * \param position set to the position of the event.
+         * \return the kind of the event; kNone at the end of the trajectory.
+         */
+        Event next_event( trajectory::Index pos, trajectory::Index& position ) const;
+
+        /**
+         * \brief Find the next event of a backward search from the point at pos: the last critical point or the end of
+         * the previous privacy interval at or before pos, or else the last edge change before pos.
+         *
+         * \param pos the position of the current point.
+         * \param position set to the position of the event.
+         * \return the kind of the event; kNone at the start of the trajectory.
+         */
+        Event previous_event( trajectory::Index pos, trajectory::Index& position ) const;
+        double draw_unit();
+        void draw_thresholds();
         void update_intervals( const TrajectoryIterator tp_it, trajectory::Trajectory& traj );
         void find_interval( const TrajectoryIterator start, const TrajectoryIterator end );
         void find_interval( const RevTrajectoryIterator start, const RevTrajectoryIterator end );
@@ -116,6 +180,13 @@ class PrivacyIntervalMarker
          */
         void mark_trajectory( trajectory::Trajectory& traj ); 
 
+        /**
+         * \brief Mark a columnar trajectory the same way as mark_trajectory( trajectory::Trajectory& ).
+         *
+         * \param cols The trajectory to mark.
+         */
+        void mark_trajectory( trajectory::Columns& cols ); 
+
     private:
         trajectory::Interval::PtrList intervals;
         
@@ -124,6 +195,7 @@ class PrivacyIntervalMarker
 
         void merge_intervals( const std::initializer_list<trajectory::Interval::PtrList> list );
         void mark_trip_point( trajectory::Point::Ptr& tp );
+        trajectory::IntervalCPtr containing_interval( trajectory::Index index );
         void set_next_interval();
         static bool compare( trajectory::IntervalCPtr a, trajectory::IntervalCPtr b );
 };
@@ -151,8 +223,60 @@ class DeIdentifier
          * \return The de-identified trajectory.
          */
         const trajectory::Trajectory& de_identify( const trajectory::Trajectory& traj,  instrument::PointCounter& point_counter);
+
+        /**
+         * \brief Remove the marked privacy and critical interval points from a columnar trajectory returning the new
+         * trajectory; the records are not copied when cols has a mapped source.
+         *
+         * \param cols The marked trajectory.
+         * \return The de-identified trajectory.
+         */
+        const trajectory::Columns& de_identify( const trajectory::Columns& cols );
+
+        /**
+         * \brief Remove the marked privacy and critical interval points from a columnar trajectory returning the new
+         * trajectory. Count the number of records in privacy and critical intervals.
+         *
+         * \param cols The marked trajectory.
+         * \param point_counter a statistics aggregator.
+         * \return The de-identified trajectory.
+         */
+        const trajectory::Columns& de_identify( const trajectory::Columns& cols,  instrument::PointCounter& point_counter);
+
+        /**
+         * \brief Write the points of traj that are outside the marked privacy and critical intervals to sink without
+         * building the de-identified trajectory.
+         *
+         * \param traj The marked trajectory.
+         * \param sink The destination of the retained points.
+         * \return The number of points written to sink.
+         */
+        uint64_t de_identify( const trajectory::Trajectory& traj, trajectory::PointSink& sink );
+
+        /**
+         * \brief Write the points of traj that are outside the marked privacy and critical intervals to sink without
+         * building the de-identified trajectory. Count the number of records in privacy and critical intervals.
+         *
+         * \param traj The marked trajectory.
+         * \param sink The destination of the retained points.
+         * \param point_counter a statistics aggregator: a PointCounter, or a NullCounter to count nothing.
+         * \return The number of points written to sink.
+         */
+        template <typename Counter>
+        uint64_t de_identify( const trajectory::Trajectory& traj, trajectory::PointSink& sink, Counter& point_counter );
     private:
         trajectory::Trajectory new_traj;
+        trajectory::Columns new_cols;
+
+        /**
+         * \brief The one implementation of the counted and uncounted forms of de_identify; the uncounted forms pass
+         * an instrument::NullCounter, whose increments compile away.
+         */
+        template <typename Counter>
+        const trajectory::Trajectory& remove_points( const trajectory::Trajectory& traj, Counter& point_counter );
+
+        template <typename Counter>
+        const trajectory::Columns& remove_points( const trajectory::Columns& cols, Counter& point_counter );
 };
 
 #endif
@@ -25,11 +25,19 @@
 #include <sstream>
 #include <stack>
 #include <memory>
+#include <vector>
 
 #include "names.hpp"
 #include "entity.hpp"
 #include "osm.hpp"
 
+class FlatQuad;
+
+namespace snapshot {
+    class MapWriter;
+    class MapReader;
+}
+
 /**
  * \brief A Quad instance is a special tree. Instances are geographically defined and divided into four children. Each
  * Quad is a container. Leaf quads, those with no children, contain entities, e.g., Edges. This Quad implementation uses
@@ -70,6 +78,22 @@ class Quad : public geo::Bounds {
          */
         static bool insert( Ptr& quadptr, Entity::CPtr entity_ptr );
 
+        /**
+         * \brief Insert a whole list of Entities into an empty Quad tree at once.
+         *
+         * The tree is built top down: the entities touching a quad's fuzzy bounds are partitioned among its children
+         * whenever there are more than MAX_ELEMENTS of them, and the subtrees of the upper levels are built on
+         * separate threads. The leaves hold the same entities in the same order as inserting the list one entity at
+         * a time.
+         *
+         * \param quadptr A pointer to the empty quad in which to insert the entities.
+         * \param entities The entities to insert in insertion order.
+         * \param n_threads The maximum number of threads used to build the subtrees.
+         * \return The number of entities inserted into the quad.
+         * \throws invalid_argument if the quad already has elements or children.
+         */
+        static std::size_t bulk_insert( Ptr& quadptr, const Entity::PtrList& entities, unsigned n_threads = 1 );
+
         /**
          * \brief Construct a Quad
          *
@@ -142,9 +166,19 @@ class Quad : public geo::Bounds {
          */
         friend std::ostream& operator<< (std::ostream& os, const Quad& quad);
 
+        /**
+         * \brief Compile this Quad tree into a read-only FlatQuad for lookups.
+         *
+         * The Quad tree should not be modified after it is frozen; later inserts are not reflected in the FlatQuad.
+         *
+         * \return A pointer to the new FlatQuad.
+         */
+        std::shared_ptr<const FlatQuad> freeze() const;
+
+        friend class FlatQuad;
+
     private:
-        static geo::Vertex::IdToPtrMap elementmap;              ///< Lookup table from vertex unique identifer to pointers to Vertex instance; prevents duplicating Vertex creation.
-        static geo::Entity::PtrList empty_element_list;                ///< Fixed empty set of Edges; returned when a point is contained in a Quad with no Entities.
+        static const geo::Entity::PtrList empty_element_list;   ///< Fixed empty set of Edges; returned when a point is contained in a Quad with no Entities.
 
         int level_;                                             ///< The tree depth, or level, of this Quad.
         std::string position_;                                  ///< The relative position of this Quad amoung siblings.
@@ -188,6 +222,100 @@ class Quad : public geo::Bounds {
          * \return True if the quad is split, False otherise.
          */
         bool split( );
+
+        /**
+         * \brief Build the subtree rooted at this Quad from the entities that touch its fuzzy bounds.
+         *
+         * \param entities The entities that reach this Quad, in insertion order.
+         * \param n_threads The maximum number of threads used to build this subtree.
+         */
+        void build( Entity::PtrList entities, unsigned n_threads );
+};
+
+/**
+ * \brief A read-only Quad tree compiled into contiguous arrays.
+ *
+ * Nodes are stored in breadth-first order so the children of a node are adjacent. The node bounds are kept as separate
+ * arrays (structure of arrays), children are referenced by 32-bit offsets, and each leaf references a range in one flat
+ * entity array. Retrievals return the same entities, in the same order, as the Quad the FlatQuad was built from.
+ */
+class FlatQuad {
+    public:
+        using Point  = geo::Point;
+        using Entity = geo::Entity;
+
+        using Ptr = std::shared_ptr<FlatQuad>;
+        using CPtr = std::shared_ptr<const FlatQuad>;
+        using EntityCIterator = Entity::PtrList::const_iterator;
+        using EntityRange = std::pair<EntityCIterator, EntityCIterator>;
+
+        /**
+         * \brief Compile a Quad tree.
+         *
+         * \param quad The root of the Quad tree to compile.
+         */
+        explicit FlatQuad( const Quad& quad );
+
+        /**
+         * \brief Return the range of Entities in the leaf that contains the provided geopoint.
+         *
+         * \param pt The point whose containing leaf we are interested in.
+         * \return An iterator range over the leaf entities; the range is empty if pt is outside the root bounds.
+         */
+        EntityRange retrieve_elements( const Point& pt ) const;
+
+        /**
+         * \brief Return the number of nodes (internal and leaf) in this tree.
+         *
+         * \return the number of nodes.
+         */
+        std::size_t node_count() const;
+
+        /**
+         * \brief Return the number of entity references held by the leaves; entities in more than one leaf are
+         * counted for each leaf.
+         *
+         * \return the number of entity references.
+         */
+        std::size_t element_count() const;
+
+        /**
+         * \brief Return the bounds of the root node, i.e., of the whole tree.
+         *
+         * \return the root bounds; empty bounds if the tree has no nodes.
+         */
+        geo::Bounds bounds() const;
+
+        friend class snapshot::MapWriter;
+        friend class snapshot::MapReader;
+
+    private:
+        std::vector<double> sw_lat_;                            ///< The southern boundary of each node.
+        std::vector<double> sw_lon_;                            ///< The western boundary of each node.
+        std::vector<double> ne_lat_;                            ///< The northern boundary of each node.
+        std::vector<double> ne_lon_;                            ///< The eastern boundary of each node.
+
+        std::vector<uint32_t> child_begin_;                     ///< Index of the first child of each node.
+        std::vector<uint8_t> child_count_;                      ///< Number of children of each node; 0 for leaves.
+
+        std::vector<uint32_t> element_begin_;                   ///< Index of the first entity of each leaf.
+        std::vector<uint32_t> element_end_;                     ///< One past the index of the last entity of each leaf.
+
+        Entity::PtrList elements_;                              ///< The entities of all the leaves concatenated.
+
+        /**
+         * \brief Predicate indicating whether the node contains the point; same test as geo::Bounds::contains.
+         *
+         * \param node The index of the node.
+         * \param pt The point to test.
+         * \return true if the point is within (or on) the node bounds, false otherwise.
+         */
+        bool contains( uint32_t node, const Point& pt ) const;
+
+        /**
+         * \brief Construct an empty FlatQuad; used when reading a snapshot.
+         */
+        FlatQuad() = default;
 };
 
 #endif
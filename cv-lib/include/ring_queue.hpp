@@ -0,0 +1,234 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_RING_QUEUE_HPP
+#define CVDP_DI_RING_QUEUE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace MultiThread {
+
+    /**
+     * \brief A bounded multi-producer multi-consumer ring buffer.
+     *
+     * Each slot carries a sequence number that tells producers and consumers whether it is free or full, so push and
+     * pop only contend on a compare-and-swap of the head or tail position. Items are moved in and out. The blocking
+     * calls spin for a short while and then park on a condition variable.
+     */
+    template <typename T>
+    class RingQueue
+    {
+        public:
+            using Ptr = std::shared_ptr<RingQueue>;
+
+            /**
+             * \brief Construct a ring buffer.
+             *
+             * \param capacity the minimum number of items held; it is rounded up to a power of two (at least 2).
+             * \throws invalid_argument if the capacity is 0.
+             */
+            explicit RingQueue(std::size_t capacity) :
+                mask_(0),
+                head_(0),
+                tail_(0),
+                n_waiters_(0)
+            {
+                if (capacity == 0) {
+                    throw std::invalid_argument("RingQueue capacity must be greater than 0");
+                }
+
+                // A single slot cannot tell full from empty by its sequence number alone.
+                std::size_t size = 2;
+
+                while (size < capacity) {
+                    size <<= 1;
+                }
+
+                mask_ = size - 1;
+                slots_.reset(new Slot[size]);
+
+                for (std::size_t i = 0; i < size; ++i) {
+                    slots_[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            RingQueue(const RingQueue&) = delete;               // disable copying
+            RingQueue& operator=(const RingQueue&) = delete;    // disable assignment
+
+            /**
+             * \brief The number of items the ring holds.
+             */
+            std::size_t capacity() const {
+                return mask_ + 1;
+            }
+
+            /**
+             * \brief Add an item if there is room.
+             *
+             * \param item the item; it is moved from only on success.
+             * \return true if the item was added, false if the ring is full.
+             */
+            bool try_push(T& item) {
+                if (!push_slot(item)) {
+                    return false;
+                }
+
+                wake();
+                return true;
+            }
+
+            /**
+             * \brief Remove the oldest item if there is one.
+             *
+             * \param item receives the item on success.
+             * \return true if an item was removed, false if the ring is empty.
+             */
+            bool try_pop(T& item) {
+                if (!pop_slot(item)) {
+                    return false;
+                }
+
+                wake();
+                return true;
+            }
+
+            /**
+             * \brief Add an item, waiting while the ring is full.
+             */
+            void push(T item) {
+                wait_until([this, &item]() { return push_slot(item); });
+                wake();
+            }
+
+            /**
+             * \brief Remove the oldest item, waiting while the ring is empty.
+             */
+            T pop() {
+                T item;
+                wait_until([this, &item]() { return pop_slot(item); });
+                wake();
+                return item;
+            }
+
+        private:
+            static const int kSpins = 64;                       ///< attempts made before parking the thread.
+
+            struct Slot {
+                std::atomic<std::size_t> sequence;
+                T item;
+            };
+
+            std::unique_ptr<Slot[]> slots_;
+            std::size_t mask_;
+            std::atomic<std::size_t> head_;                     ///< the next position to pop.
+            std::atomic<std::size_t> tail_;                     ///< the next position to push.
+
+            std::mutex park_mutex_;
+            std::condition_variable park_cond_;
+            std::atomic<unsigned> n_waiters_;                   ///< the number of parked (or parking) threads.
+
+            bool push_slot(T& item) {
+                std::size_t pos = tail_.load(std::memory_order_relaxed);
+
+                for (;;) {
+                    Slot& slot = slots_[pos & mask_];
+                    std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                    std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+
+                    if (diff == 0) {
+                        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            slot.item = std::move(item);
+                            slot.sequence.store(pos + 1, std::memory_order_release);
+                            return true;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = tail_.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            bool pop_slot(T& item) {
+                std::size_t pos = head_.load(std::memory_order_relaxed);
+
+                for (;;) {
+                    Slot& slot = slots_[pos & mask_];
+                    std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                    std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+
+                    if (diff == 0) {
+                        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            item = std::move(slot.item);
+                            slot.item = T();
+                            slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                            return true;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = head_.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            /**
+             * \brief Wake the parked threads after a push or pop; cheap when nobody is parked.
+             */
+            void wake() {
+                // Pairs with the fence in wait_until: either the parking thread sees this change or we see it waiting.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (n_waiters_.load(std::memory_order_relaxed) > 0) {
+                    std::unique_lock<std::mutex> lock(park_mutex_);
+                    lock.unlock();
+                    park_cond_.notify_all();
+                }
+            }
+
+            template <typename Attempt>
+            void wait_until(Attempt attempt) {
+                for (int i = 0; i < kSpins; ++i) {
+                    if (attempt()) {
+                        return;
+                    }
+
+                    std::this_thread::yield();
+                }
+
+                std::unique_lock<std::mutex> lock(park_mutex_);
+                n_waiters_.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                while (!attempt()) {
+                    park_cond_.wait(lock);
+                }
+
+                n_waiters_.fetch_sub(1, std::memory_order_relaxed);
+            }
+    };
+}
+
+#endif
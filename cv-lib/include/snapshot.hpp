@@ -0,0 +1,139 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_SNAPSHOT_HPP
+#define CVDP_DI_SNAPSHOT_HPP
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "entity.hpp"
+#include "quad.hpp"
+
+/**
+ * \brief Binary snapshots of a road network and its compiled quad tree.
+ *
+ * A snapshot lets a run skip parsing the CSV shape file and rebuilding the quad tree. The file is a sequence of
+ * fixed-width sections written in host byte order:
+ *
+ * - header : magic, format version, vertex count, edge count, quad node count, quad element count.
+ * - vertices : uid (uint64), latitude (double), longitude (double).
+ * - vertex out-degrees : the out-degree (uint32) of each vertex in the complete road network, so the edges of a map
+ *   tile have the out-degrees of their ends even when the tile does not hold all of their incident edges.
+ * - edges : uid (uint64), first vertex index (uint32), second vertex index (uint32), OSM way type (uint32), explicit flag (uint32).
+ * - quad nodes : the FlatQuad arrays, each written contiguously (bounds, child offsets, leaf element ranges).
+ * - quad elements : the edge index of each leaf element.
+ *
+ * Way widths are not stored; they are derived from the way type as they are for the CSV shape file. Every section
+ * starts on an 8-byte boundary so the file layout can be used directly from a memory map.
+ */
+namespace snapshot {
+
+    constexpr uint32_t MAGIC = 0x50414d43;           ///< "CMAP" when read as little-endian bytes.
+    constexpr uint32_t VERSION = 2;                  ///< Incremented whenever the layout changes.
+    constexpr uint32_t MIN_VERSION = 1;              ///< The oldest version read; version 1 has no vertex out-degrees.
+
+    /**
+     * \brief Write a road network and its compiled quad tree as a binary snapshot.
+     */
+    class MapWriter {
+        public:
+            /**
+             * \brief Construct a writer.
+             *
+             * \param edges The edges of the road network.
+             * \param quad The compiled quad tree containing the edges.
+             */
+            MapWriter( const std::vector<geo::EdgeCPtr>& edges, const FlatQuad& quad );
+
+            /**
+             * \brief Write the snapshot to an output stream.
+             *
+             * \param os The binary output stream.
+             * \throws invalid_argument if the quad contains an entity that is not one of the edges or the write fails.
+             */
+            void write( std::ostream& os ) const;
+
+            /**
+             * \brief Write the snapshot to a file.
+             *
+             * \param file_path The path of the snapshot file; it is truncated.
+             * \throws invalid_argument if the file cannot be written.
+             */
+            void write( const std::string& file_path ) const;
+
+        private:
+            const std::vector<geo::EdgeCPtr>& edges_;
+            const FlatQuad& quad_;
+    };
+
+    /**
+     * \brief Read a road network and its compiled quad tree from a binary snapshot.
+     */
+    class MapReader {
+        public:
+            /**
+             * \brief Predicate indicating the file starts with the snapshot magic number.
+             *
+             * \param file_path The path of the file to check.
+             * \return true if the file looks like a snapshot, false otherwise.
+             */
+            static bool is_snapshot( const std::string& file_path );
+
+            /**
+             * \brief Read a snapshot from a stream.
+             *
+             * \param is The binary input stream.
+             * \throws invalid_argument if the stream is not a snapshot, has the wrong version, or is corrupt.
+             */
+            explicit MapReader( std::istream& is );
+
+            /**
+             * \brief Read a snapshot from a file.
+             *
+             * \param file_path The path of the snapshot file.
+             * \throws invalid_argument if the file cannot be opened, is not a snapshot, has the wrong version, or is corrupt.
+             */
+            explicit MapReader( const std::string& file_path );
+
+            /**
+             * \brief Return the edges of the road network; vertices have their incident edges set.
+             *
+             * \return an immutable vector of pointers to the edges.
+             */
+            const std::vector<geo::EdgeCPtr>& get_edges() const;
+
+            /**
+             * \brief Return the compiled quad tree containing the edges.
+             *
+             * \return a pointer to the quad tree.
+             */
+            const FlatQuad::CPtr& get_quad() const;
+
+        private:
+            std::vector<geo::EdgeCPtr> edges_;
+            FlatQuad::CPtr quad_;
+
+            void read( std::istream& is );
+    };
+}
+
+#endif
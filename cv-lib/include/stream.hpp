@@ -0,0 +1,179 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_STREAM_HPP
+#define CVDP_DI_STREAM_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "critical.hpp"
+#include "error.hpp"
+#include "mapfit.hpp"
+#include "privacy.hpp"
+#include "trajectory.hpp"
+
+/**
+ * \brief De-identify trips whose points arrive one at a time, e.g., a live BSM feed, with a bounded delay and memory.
+ *
+ * The points of every trip (vehicle UID) are map fit and passed through the turnaround and stop detectors as they
+ * arrive, and held in a look-behind window. The oldest points of the window are released as one segment as soon as
+ * their fate is settled:
+ *
+ * - the detectors can no longer put them in a critical interval (see Detector::TurnAround::open_index and
+ *   Detector::Stop::open_index), and
+ * - they are farther along the route than max(max_md, max_dd) from every critical interval that is not released with
+ *   them (including the trip start and the intervals that may still be found), so no privacy interval can reach across
+ *   the end of the segment.
+ *
+ * A released segment is marked and de-identified as a trajectory of its own (IntervalMarker, PrivacyIntervalFinder,
+ * DeIdentifier) and the retained points are written to the trip's sink. When a trip ends (flush) its remaining points
+ * are released with the end point interval. The first ec_sample_size points of a trip are error corrected before they
+ * are analyzed; the end of a live trip is not known in time, so it is not corrected (its points are mostly covered by
+ * the end privacy interval).
+ *
+ * A window that grows beyond max_window points without settling (e.g., a vehicle parked with its radio on) drops its
+ * older half without releasing it, and the points after the gap are protected like the start of a trip.
+ *
+ * An instance is not thread safe.
+ */
+class StreamDeIdentifier
+{
+    public:
+        using MapFitterFactory = std::function<MapFitter()>;
+
+        /**
+         * \brief The de-identification parameters; the defaults are those of the command line tool.
+         */
+        struct Settings {
+            uint32_t ec_sample_size         = 50;           ///< points at the start of a trip examined by the error corrector.
+            uint32_t n_heading_groups       = 36;           ///< implicit map fit compass rose sectors.
+            uint32_t min_edge_trip_points   = 50;           ///< minimum points of an implicit edge.
+            uint32_t ta_max_q_size          = 20;
+            double ta_area_width            = 30.0;         ///< meters.
+            double ta_max_speed             = 15.0;         ///< meters per second.
+            double ta_heading_delta         = 90.0;         ///< degrees.
+            double stop_max_time            = 120.0;        ///< seconds.
+            double stop_min_distance        = 15.0;         ///< meters.
+            double stop_max_speed           = 3.0;          ///< meters per second.
+            double min_direct_distance      = 500.0;        ///< meters.
+            double max_direct_distance      = 2500.0;       ///< meters.
+            double min_manhattan_distance   = 650.0;        ///< meters.
+            double max_manhattan_distance   = 3000.0;       ///< meters.
+            uint32_t min_out_degree         = 8;
+            uint32_t max_out_degree         = 16;
+            double rand_direct_distance     = 0.0;
+            double rand_manhattan_distance  = 0.0;
+            double rand_out_degree          = 0.0;
+            uint64_t rand_seed              = PrivacyIntervalFinder::random_seed();  ///< combined with each trip UID; set it only to reproduce a run.
+            std::size_t max_window          = 100000;       ///< the most points held for one trip.
+        };
+
+        /**
+         * \brief Construct a stream de-identifier.
+         *
+         * \param settings the de-identification parameters.
+         * \param make_fitter returns a new explicit map fitter for every trip.
+         * \param sink_factory opens the output of every trip; it must outlive this instance.
+         * \param strip_cr flag to signal carriage returns should be removed from the written records.
+         * \throws invalid_argument if the error corrector sample size or the window size is 0.
+         */
+        StreamDeIdentifier( const Settings& settings, const MapFitterFactory& make_fitter, trajectory::PointSinkFactory& sink_factory, bool strip_cr = false );
+
+        ~StreamDeIdentifier();
+
+        /**
+         * \brief Add the next point of a trip; a trip starts with its first point.
+         *
+         * \param uid the trip UID.
+         * \param tp the point; its index is assigned by the stream and it must not be shared with other trips.
+         * \return the number of points of the trip released by this point (written or suppressed).
+         */
+        std::size_t push( const std::string& uid, const trajectory::Point::Ptr& tp );
+
+        /**
+         * \brief End a trip: release its remaining points and close its sink. Unknown UIDs are ignored.
+         *
+         * \param uid the trip UID.
+         * \return the number of points released.
+         */
+        std::size_t flush( const std::string& uid );
+
+        /**
+         * \brief End the trips that have not received a point for longer than idle_time.
+         *
+         * \param time the current time in the units of the point times (microseconds for BSMs).
+         * \param idle_time the time without points that ends a trip.
+         * \return the number of trips ended.
+         */
+        std::size_t flush_idle( uint64_t time, uint64_t idle_time );
+
+        /**
+         * \brief End every trip.
+         *
+         * \return the number of trips ended.
+         */
+        std::size_t flush_all();
+
+        /**
+         * \brief Return the number of trips in progress.
+         */
+        std::size_t n_trips() const;
+
+        /**
+         * \brief Return the number of points held in all the trips in progress.
+         */
+        std::size_t held_points() const;
+
+        /**
+         * \brief Return the number of points written to the sinks so far.
+         */
+        uint64_t written_points() const;
+
+        /**
+         * \brief Return the number of points suppressed so far.
+         */
+        uint64_t suppressed_points() const;
+
+    private:
+        struct Trip;
+
+        Settings settings_;
+        MapFitterFactory make_fitter_;
+        trajectory::PointSinkFactory& sink_factory_;
+        bool strip_cr_;
+        ErrorCorrector ec_;
+        std::unordered_map<std::string, std::unique_ptr<Trip>> trips_;
+        uint64_t n_written_;
+        uint64_t n_suppressed_;
+
+        double quiet_distance() const;
+        void analyze( Trip& trip, const trajectory::Point::Ptr& tp );
+        void collect_intervals( Trip& trip );
+        trajectory::Index settled_end( const Trip& trip ) const;
+        trajectory::Index cut_before( const Trip& trip, trajectory::Index index ) const;
+        void drop( Trip& trip, std::size_t n );
+        std::size_t release( Trip& trip, std::size_t n, bool trip_end );
+        std::size_t end_trip( const std::string& uid, Trip& trip );
+};
+
+#endif
@@ -0,0 +1,241 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_TILES_HPP
+#define CVDP_DI_TILES_HPP
+
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "entity.hpp"
+#include "mapfit.hpp"
+#include "quad.hpp"
+
+/**
+ * \brief A road network split into a grid of square tiles that are loaded on demand.
+ *
+ * A tiled map is a directory holding a manifest (kManifestName) and one map snapshot (see snapshot::MapWriter) per
+ * tile that has roads. A tile holds every edge that touches its bounds extended by a halo, indexed by a quad tree over
+ * the tile, and also the edges that share a vertex with those (not indexed) so the vertices of the indexed edges have
+ * all their incident edges and the right degree. Trips are map matched against the tile that holds each point.
+ *
+ * The manifest is a text file:
+ *
+ * - a version line (kManifestVersion).
+ * - sw:<lat>,<lon> and ne:<lat>,<lon> : the bounds of the grid.
+ * - tile_degrees:<degrees> : the width and height of a tile.
+ * - rows:<n> and cols:<n> : the grid dimensions.
+ * - one tile:<row>,<col>,<file name>,<indexed edge count> line for every tile with roads.
+ */
+namespace tiles {
+
+    const std::string kManifestName = "tiles.idx";
+    const std::string kManifestVersion = "# cvdi map tiles 1";
+
+    /**
+     * \brief The loaded road network of one tile.
+     */
+    class Tile {
+        public:
+            using CPtr = std::shared_ptr<const Tile>;
+
+            /**
+             * \brief Load a tile from its snapshot.
+             *
+             * \param bounds The bounds of the tile (without the halo).
+             * \param file_path The path of the tile snapshot.
+             * \param n_indexed The number of edges at the start of the snapshot that are indexed by its quad tree.
+             * \param fit_width_scaling The scaling factor applied to the OSM road widths for the tile's area cache.
+             * \param fit_extension The number of meters to extend each area from the ends of its edge.
+             * \throws invalid_argument if the snapshot cannot be read.
+             */
+            Tile( const geo::Bounds& bounds, const std::string& file_path, std::size_t n_indexed, double fit_width_scaling, double fit_extension );
+
+            /**
+             * \brief Release the road network; the cycles between the vertices and their incident edges are broken.
+             */
+            ~Tile();
+
+            Tile( const Tile& ) = delete;
+            Tile& operator=( const Tile& ) = delete;
+
+            /**
+             * \brief Return the bounds of the tile (without the halo).
+             */
+            const geo::Bounds& bounds() const;
+
+            /**
+             * \brief Return the compiled quad tree of the indexed edges.
+             */
+            const FlatQuad::CPtr& quad() const;
+
+            /**
+             * \brief Return the prebuilt fit areas of the tile's edges.
+             */
+            const EdgeAreaCache::CPtr& area_cache() const;
+
+            /**
+             * \brief Return all the edges of the tile, the indexed ones first.
+             */
+            const std::vector<geo::EdgeCPtr>& edges() const;
+
+            /**
+             * \brief Find a vertex of an indexed edge; these vertices have all of their incident edges.
+             *
+             * \param uid The unique identifier of the vertex.
+             * \return the tile's vertex or nullptr if no indexed edge ends at it.
+             */
+            geo::Vertex::Ptr find_vertex( uint64_t uid ) const;
+
+            /**
+             * \brief Return the size of the tile snapshot in bytes; the memory budget of a TiledMap is counted in these.
+             */
+            std::size_t size() const;
+
+        private:
+            geo::Bounds bounds_;
+            FlatQuad::CPtr quad_;
+            EdgeAreaCache::CPtr area_cache_;
+            std::vector<geo::EdgeCPtr> edges_;
+            std::unordered_map<uint64_t, geo::Vertex::Ptr> vertices_;      ///< the vertices of the indexed edges by uid.
+            std::size_t size_;
+    };
+
+    /**
+     * \brief Split a road network into tiles and write them and their manifest to a directory.
+     *
+     * \param edges The edges of the road network.
+     * \param sw The southwest corner of the region to tile.
+     * \param ne The northeast corner of the region to tile.
+     * \param tile_degrees The width and height of a tile in degrees.
+     * \param halo_degrees The distance in degrees the tile bounds are extended to collect their edges; at least the
+     * fuzzy margin of the tile's quad tree (a tenth of the tile) is used.
+     * \param dir_path The existing directory to write to.
+     * \return the number of tiles written.
+     * \throws invalid_argument if the region or tile size is not positive or a file cannot be written.
+     */
+    std::size_t write_tiles( const std::vector<geo::EdgeCPtr>& edges, const geo::Point& sw, const geo::Point& ne, double tile_degrees, double halo_degrees, const std::string& dir_path );
+
+    /**
+     * \brief A tiled map whose tiles are loaded the first time a point falls in them and kept in a least recently used
+     * cache limited by a memory budget. The map is shared by all the threads; lookups are thread safe.
+     */
+    class TiledMap {
+        public:
+            using Ptr = std::shared_ptr<TiledMap>;
+            using CPtr = std::shared_ptr<const TiledMap>;
+
+            /**
+             * \brief Predicate indicating the path is a directory holding a tiled map manifest.
+             *
+             * \param path The path to check.
+             * \return true if path/kManifestName can be read, false otherwise.
+             */
+            static bool is_tiled( const std::string& path );
+
+            /**
+             * \brief Open a tiled map; no tile is loaded until it is needed.
+             *
+             * \param dir_path The directory written by write_tiles.
+             * \param memory_budget The number of tile bytes (see Tile::size) to keep loaded; the most recently used
+             * tile is always kept.
+             * \param fit_width_scaling The scaling factor applied to the OSM road widths for the tile area caches.
+             * \param fit_extension The number of meters to extend each area from the ends of its edge.
+             * \throws invalid_argument if the manifest cannot be read or is corrupt.
+             */
+            TiledMap( const std::string& dir_path, std::size_t memory_budget, double fit_width_scaling = 1.0, double fit_extension = 5.0 );
+
+            /**
+             * \brief Return the tile that holds a point, loading it if needed.
+             *
+             * \param pt The point to look up.
+             * \return the tile or nullptr if the point is outside the grid or its tile has no roads.
+             * \throws invalid_argument if the tile cannot be loaded.
+             */
+            Tile::CPtr tile( const geo::Point& pt ) const;
+
+            /**
+             * \brief Predicate indicating whether the tile area caches are built with the provided fit parameters.
+             */
+            bool matches( double fit_width_scaling, double fit_extension ) const;
+
+            /**
+             * \brief Return the bounds of the tile grid.
+             */
+            geo::Bounds bounds() const;
+
+            /**
+             * \brief Return the number of tile loads so far.
+             */
+            uint64_t load_count() const;
+
+            /**
+             * \brief Return the number of bytes of the tiles kept loaded.
+             */
+            std::size_t resident_size() const;
+
+        private:
+            using TileFuture = std::shared_future<Tile::CPtr>;
+
+            struct Entry {
+                std::string file_name;                          ///< the tile snapshot; empty when the tile has no roads.
+                std::size_t n_indexed;                          ///< the edges at the start of the snapshot in its quad tree.
+            };
+
+            struct Resident {
+                TileFuture tile;
+                std::list<std::size_t>::iterator lru_it;        ///< the position of the tile in lru_.
+                std::size_t size;                               ///< 0 until the tile is loaded.
+            };
+
+            std::string dir_path_;
+            std::size_t memory_budget_;
+            double fit_width_scaling_;
+            double fit_extension_;
+            geo::Point sw_;
+            double tile_degrees_;
+            std::size_t n_rows_;
+            std::size_t n_cols_;
+            std::vector<Entry> entries_;                        ///< the tiles in row major order.
+
+            mutable std::mutex mutex_;                          ///< guards the members below.
+            mutable std::list<std::size_t> lru_;                ///< the resident tile indices, most recently used first.
+            mutable std::unordered_map<std::size_t, Resident> resident_;
+            mutable std::size_t resident_size_;
+            mutable uint64_t n_loads_;
+
+            /**
+             * \brief Return the bounds of a tile.
+             */
+            geo::Bounds tile_bounds( std::size_t row, std::size_t col ) const;
+
+            /**
+             * \brief Record the size of a loaded tile and evict the least recently used tiles over the budget.
+             */
+            void admit( std::size_t index, std::size_t size ) const;
+    };
+}
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "names.hpp"
 #include "entity.hpp"
+#include "utilities.hpp"
 
 #include <tuple>
 
@@ -79,11 +80,33 @@ namespace trajectory {
             Point( const std::string& data, uint64_t time, double lat, double lon, double heading, double speed, uint64_t index );
 
             /**
-             * \brief Get the original record data that was used to define this point.
+             * \brief Construct a point that references its record in a buffer instead of copying it.
              *
-             * \return the original record data as a constant reference.
+             * \param data_ref a pointer to the first character of the record that shares ownership of the buffer, e.g., an
+             * aliasing pointer into a MappedFile.
+             * \param data_size the number of characters in the record.
+             * \param time the time when this point was measured in microseconds.
+             * \param lat the point's latitude
+             * \param lon the point's longitude
+             * \param heading the heading at the time.
+             * \param speed the speed (m/s) at the time.
+             * \param index the 0-based index number of this point in the trip.
              */
-            const std::string& get_data() const;
+            Point( const std::shared_ptr<const char>& data_ref, std::size_t data_size, uint64_t time, double lat, double lon, double heading, double speed, uint64_t index );
+
+            /**
+             * \brief Get a copy of the original record data that was used to define this point.
+             *
+             * \return the original record data.
+             */
+            std::string get_data() const;
+
+            /**
+             * \brief Get the original record data without copying it; the span is valid as long as this point.
+             *
+             * \return a span over the original record data.
+             */
+            string_utilities::CharSpan get_data_span() const;
 
             /**
              * \brief Output stream "printer" for a point.
@@ -171,7 +194,7 @@ namespace trajectory {
              *
              * \return a shared pointer to the matched edge; the edge is constant.
              */
-            geo::EdgeCPtr get_fit_edge();
+            const geo::EdgeCPtr& get_fit_edge() const;
 
             /**
              * \brief Get the critical interval associated with this point; this may be nullptr in which case it is not
@@ -179,14 +202,14 @@ namespace trajectory {
              *
              * \return a shared pointer to the critical interval; nullptr if no critical interval has been assigned.
              */
-            IntervalCPtr get_critical_interval() const;
+            const IntervalCPtr& get_critical_interval() const;
 
             /**
              * \brief Set the critical interval associated, or containing, this point.
              *
              * \param iptr A shared pointer to the critical interval.
              */
-            void set_critical_interval(IntervalCPtr iptr);
+            void set_critical_interval(const IntervalCPtr& iptr);
         
             /**
              * \brief Predicate that indicates the point has been matched to an edge and the edge is an implicit edge
@@ -251,17 +274,19 @@ namespace trajectory {
             bool consistent_with( const geo::Edge& edge ) const;
 
         private:
-            std::string data;               //> all the data so we don't need fields for every piece.
-            double heading;
-            double speed;
+            // The fields are ordered and sized to keep the point small; peak memory per thread grows with the points
+            // of the longest trips.
+            std::shared_ptr<const char> data_ref;   //> all the data so we don't need fields for every piece: a copy, or the record in a shared buffer.
             uint64_t time;
-            uint64_t index;
+            float heading;                  //> degrees; the records carry far less precision than a float.
+            float speed;                    //> m/s.
+            uint32_t index;                 //> trips are far shorter than 2^32 points.
+            uint32_t data_size;             //> the size of the data referenced by data_ref.
 
             geo::EdgeCPtr fitedge;
             IntervalCPtr critical_interval;
-            bool _private;
-            bool is_hmm_map_match_;
-            uint32_t outdegree;
+            uint32_t outdegree : 31;
+            uint32_t _private : 1;
     };
 
     using Trajectory  = std::vector<Point::Ptr>;
@@ -395,5 +420,71 @@ namespace trajectory {
         virtual void write_trajectory(const Trajectory& trajectory, const std::string& uid, bool strip_cr) const = 0;
     };
 
+    /**
+     * \brief Abstract base class for receivers of a stream of trajectory points, e.g., an open output file, so a
+     * filtered trajectory can be written without collecting it first.
+     */
+    class PointSink {
+        public:
+            virtual ~PointSink() {}
+
+            /**
+             * \brief Receive the next point of the trajectory.
+             *
+             * \param tp the point.
+             */
+            virtual void write_point(const Point& tp) = 0;
+
+            /**
+             * \brief Finish the trajectory; no points may be written afterward.
+             */
+            virtual void close() {}
+    };
+
+    /**
+     * \brief Abstract base class for outputs that receive each trajectory as a stream of points.
+     */
+    class PointSinkFactory {
+        public:
+            virtual ~PointSinkFactory() {}
+
+            /**
+             * \brief Start the output of a trajectory.
+             *
+             * \param uid the trajectories UID.
+             * \param strip_cr flag to signal carriage returns should be removed.
+             * \return the sink receiving the points; close it after the last point.
+             */
+            virtual std::unique_ptr<PointSink> open_trajectory(const std::string& uid, bool strip_cr) = 0;
+    };
+
+    /**
+     * \brief A sink that writes the original record of each point as one line of an output stream. The stream is not
+     * flushed after each line.
+     */
+    class StreamPointSink : public PointSink {
+        public:
+            /**
+             * \brief Constructor
+             *
+             * \param os the output stream; it must outlive the sink.
+             * \param strip_cr flag to signal carriage returns should be removed.
+             */
+            StreamPointSink(std::ostream& os, bool strip_cr);
+
+            void write_point(const Point& tp);
+
+            /**
+             * \brief Write a record and a newline.
+             *
+             * \param record the characters of the record.
+             */
+            void write_record(string_utilities::CharSpan record);
+
+        private:
+            std::ostream& os_;
+            bool strip_cr_;
+    };
+
 }
 #endif
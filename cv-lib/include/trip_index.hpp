@@ -0,0 +1,180 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_DI_TRIP_INDEX_HPP
+#define CVDP_DI_TRIP_INDEX_HPP
+
+#include "utilities.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace trip_index {
+
+    /**
+     * \brief The byte range of one trip's records in a CSV file holding many trips.
+     */
+    struct TripRange {
+        std::string uid;                ///< the trip UID built from the UID fields of its records.
+        uint64_t begin;                 ///< the first byte of the trip's first record.
+        uint64_t end;                   ///< one past the newline of the trip's last record.
+        uint64_t n_records;             ///< the number of (non-empty) records.
+        double min_lat;                 ///< the bounding box of the records' locations; empty (min > max) when the
+        double min_lon;                 ///< locations were not read or none could be converted.
+        double max_lat;
+        double max_lon;
+
+        TripRange();
+        TripRange(const std::string& uid, uint64_t begin, uint64_t end);
+
+        /**
+         * \brief Extend the bounding box to include a location.
+         */
+        void include(double lat, double lon);
+
+        /**
+         * \brief Return true when the bounding box holds at least one location.
+         */
+        bool has_bounds() const;
+    };
+
+    using TripRangeList = std::vector<TripRange>;
+
+    /**
+     * \brief Build trip UIDs from the fields of a record the same way the CSV splitter does: the named UID fields are
+     * found in the header in order and their values are joined with '_'.
+     */
+    class UIDExtractor {
+        public:
+            /**
+             * \brief Map the UID field names to their columns.
+             *
+             * \param header the header line of the file.
+             * \param uid_fields the delimiter separated names of the UID fields.
+             * \param delimiter the field delimiter.
+             * \throws invalid_argument if a UID field is not in the header (after the fields before it).
+             */
+            UIDExtractor(const std::string& header, const std::string& uid_fields, char delimiter = ',');
+
+            /**
+             * \brief Return the UID of a record; a trailing carriage return is ignored and missing fields are empty.
+             *
+             * \param record the record without its newline.
+             * \return the UID.
+             */
+            std::string uid(const string_utilities::CharSpan& record) const;
+
+        private:
+            std::vector<std::size_t> indices_;          ///< the columns of the UID fields.
+            std::size_t n_fields_;                      ///< the number of leading fields that hold them.
+            char delimiter_;
+    };
+
+    /**
+     * \brief Read the location of a record from its latitude and longitude fields.
+     */
+    class LocationExtractor {
+        public:
+            /**
+             * \brief Find the latitude and longitude fields in the header.
+             *
+             * \param header the header line of the file.
+             * \param lat_field the name of the latitude field.
+             * \param lon_field the name of the longitude field.
+             * \param delimiter the field delimiter.
+             * \throws invalid_argument if either field is not in the header.
+             */
+            LocationExtractor(const std::string& header, const std::string& lat_field, const std::string& lon_field, char delimiter = ',');
+
+            /**
+             * \brief Convert the location of a record.
+             *
+             * \param record the record without its newline.
+             * \param lat set to the latitude.
+             * \param lon set to the longitude.
+             * \return false if the record lacks the fields or they are not numbers.
+             */
+            bool location(const string_utilities::CharSpan& record, double& lat, double& lon) const;
+
+        private:
+            std::size_t lat_index_;
+            std::size_t lon_index_;
+            char delimiter_;
+    };
+
+    const std::size_t kMinChunkSize = 1 << 20;          ///< the smallest range of bytes given to an indexing thread.
+
+    /**
+     * \brief Find the trips in the records of a CSV file. A trip is a run of consecutive records with the same UID;
+     * empty lines belong to the trip before them.
+     *
+     * The records are split into chunks at line boundaries and each chunk is scanned by its own thread; runs that
+     * continue across a chunk edge are joined, so the result is the same for any number of threads.
+     *
+     * \param data the file contents.
+     * \param size the number of bytes in data.
+     * \param begin the offset of the first record, i.e., just past the header.
+     * \param extractor builds the UID of each record.
+     * \param n_threads the maximum number of threads to use.
+     * \param min_chunk_size the fewest bytes a thread scans; fewer threads are used for small files.
+     * \return the trips in file order.
+     */
+    TripRangeList index_trips(const char* data, std::size_t size, std::size_t begin, const UIDExtractor& extractor, unsigned n_threads, std::size_t min_chunk_size = kMinChunkSize);
+
+    /**
+     * \brief Find the trips in the records of a CSV file as above and also collect the bounding box of each trip.
+     *
+     * \param locator reads the location of each record.
+     */
+    TripRangeList index_trips(const char* data, std::size_t size, std::size_t begin, const UIDExtractor& extractor, const LocationExtractor& locator, unsigned n_threads, std::size_t min_chunk_size = kMinChunkSize);
+
+    const std::string kIndexSuffix = ".tripidx";        ///< appended to the source path to name its index file.
+
+    /**
+     * \brief Return the path of the index file kept next to a source file.
+     */
+    std::string index_path(const std::string& source_path);
+
+    /**
+     * \brief Read the saved trips of a source file.
+     *
+     * The index is only used when it was built with the same UID fields and the size and modification time
+     * (seconds) of the source file are those recorded in it.
+     *
+     * \param source_path the CSV file that was indexed.
+     * \param uid_fields the UID fields the trips must have been found with.
+     * \param trips set to the saved trips when the index is valid.
+     * \return true if a valid index was read; false if it is missing, stale or malformed.
+     */
+    bool read_index(const std::string& source_path, const std::string& uid_fields, TripRangeList& trips);
+
+    /**
+     * \brief Save the trips of a source file in its index file, stamped with the size and modification time of the
+     * source. The file is written under a temporary name and then renamed, so readers never see a partial index.
+     *
+     * \param source_path the CSV file that was indexed.
+     * \param uid_fields the UID fields the trips were found with.
+     * \param trips the trips.
+     * \throws invalid_argument if the source cannot be examined or the index cannot be written.
+     */
+    void write_index(const std::string& source_path, const std::string& uid_fields, const TripRangeList& trips);
+}
+
+#endif
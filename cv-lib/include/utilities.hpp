@@ -20,6 +20,7 @@
 #ifndef CTES_UTILITIES_H
 #define CTES_UTILITIES_H
 
+#include <cstdint>
 #include <string>
 #include <sstream>
 #include <iterator>
@@ -151,6 +152,51 @@ T remove_extension(T const& filename)
   return p > 0 && p != T::npos ? filename.substr(0, p) : filename;
 }
 
+/**
+ * \brief A non-owning view of a range of characters, e.g., a field in a line; the characters must outlive the span.
+ */
+struct CharSpan {
+    const char* first;                      ///< The first character in the span.
+    const char* last;                       ///< One past the last character in the span.
+
+    std::size_t size() const { return static_cast<std::size_t>(last - first); }
+    std::string str() const { return std::string(first, last); }
+};
+
+/**
+ * \brief Split the character range at every occurrence of delim without copying.
+ *
+ * The fields are counted the same way as split: a trailing delimiter does not start an empty field and an empty
+ * range has no fields. Only the first max_fields spans are stored, but all the fields are counted.
+ *
+ * \param first the first character of the range.
+ * \param last one past the last character of the range.
+ * \param delim the char where the splits are to be performed.
+ * \param fields the array where the field spans are stored.
+ * \param max_fields the capacity of fields.
+ * \return the number of fields in the range.
+ */
+std::size_t split(const char* first, const char* last, char delim, CharSpan* fields, std::size_t max_fields);
+
+/**
+ * \brief Convert a span to a double with the same results as std::stod in the "C" locale.
+ *
+ * Plain decimal numbers are converted without copying or consulting the locale; anything else falls back to strtod.
+ *
+ * \param span the characters to convert.
+ * \return the converted value.
+ * \throws invalid_argument if no conversion could be performed; out_of_range if the value is out of range.
+ */
+double to_double(const CharSpan& span);
+
+/**
+ * \brief Convert a span to an unsigned 64-bit integer with the same results as std::stoull.
+ *
+ * \param span the characters to convert.
+ * \return the converted value.
+ * \throws invalid_argument if no conversion could be performed; out_of_range if the value is out of range.
+ */
+uint64_t to_uint64(const CharSpan& span);
 
 }  // end namespace.
 
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "arena.hpp"
+
+#include <cstdint>
+
+namespace memory {
+
+    namespace {
+        thread_local Arena* current_arena = nullptr;
+    }
+
+    constexpr std::size_t Arena::kDefaultBlockSize;
+
+    Arena* Arena::current() {
+        return current_arena;
+    }
+
+    Arena::Scope::Scope( Arena& arena ) :
+        Scope( &arena )
+        {}
+
+    Arena::Scope::Scope( Arena* arena ) :
+        previous_{ current_arena }
+    {
+        current_arena = arena;
+    }
+
+    Arena::Scope::~Scope() {
+        current_arena = previous_;
+    }
+
+    Arena::Arena( std::size_t block_size ) :
+        block_size_{ block_size },
+        large_bytes_{ 0 },
+        block_{ 0 },
+        pos_{ nullptr },
+        end_{ nullptr },
+        n_live_{ 0 }
+    {}
+
+    void Arena::next_block() {
+        if (pos_ != nullptr) {
+            ++block_;
+        }
+
+        if (block_ == blocks_.size()) {
+            blocks_.emplace_back( new char[block_size_] );
+        }
+
+        pos_ = blocks_[block_].get();
+        end_ = pos_ + block_size_;
+    }
+
+    void* Arena::allocate( std::size_t bytes, std::size_t alignment ) {
+        n_live_.fetch_add( 1, std::memory_order_relaxed );
+
+        if (bytes > block_size_ / 4) {
+            // new[] memory is suitably aligned for any fundamental alignment.
+            large_.emplace_back( new char[bytes] );
+            large_bytes_ += bytes;
+            return large_.back().get();
+        }
+
+        for (;;) {
+            if (pos_ != nullptr) {
+                std::uintptr_t p = reinterpret_cast<std::uintptr_t>(pos_);
+                std::uintptr_t aligned = (p + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1);
+                char* first = pos_ + (aligned - p);
+
+                if (first + bytes <= end_) {
+                    pos_ = first + bytes;
+                    return first;
+                }
+            }
+
+            next_block();
+        }
+    }
+
+    void Arena::deallocate( void*, std::size_t ) {
+        // releases the destructor's writes to the thread that resets the arena.
+        n_live_.fetch_sub( 1, std::memory_order_release );
+    }
+
+    bool Arena::reset() {
+        if (n_live_.load( std::memory_order_acquire ) != 0) {
+            return false;
+        }
+
+        large_.clear();
+        large_bytes_ = 0;
+        block_ = 0;
+
+        if (blocks_.empty()) {
+            pos_ = end_ = nullptr;
+        } else {
+            pos_ = blocks_[0].get();
+            end_ = pos_ + block_size_;
+        }
+
+        return true;
+    }
+
+    std::size_t Arena::n_live() const {
+        return n_live_.load( std::memory_order_relaxed );
+    }
+
+    std::size_t Arena::capacity() const {
+        return blocks_.size() * block_size_ + large_bytes_;
+    }
+}
@@ -0,0 +1,300 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "async_writer.hpp"
+
+#include <stdexcept>
+
+namespace output {
+
+    const std::size_t AsyncWriter::kDefaultMaxQueued;
+    const std::size_t BufferedTrajectoryWriter::kDefaultBlockSize;
+
+    // AsyncWriter
+
+    AsyncWriter::AsyncWriter(const std::string& out_dir, const std::string& header, unsigned n_shards, std::size_t max_queued) :
+        out_dir_(out_dir),
+        header_(header),
+        shard_sizes_(n_shards, 0),
+        queue_(max_queued),
+        failed_(false),
+        closed_(false)
+    {
+        for (unsigned i = 0; i < n_shards; ++i) {
+            std::string name = "trips_" + std::to_string(i);
+            std::string shard_path = output_path(name + ".csv");
+            std::string index_path = output_path(name + ".idx");
+
+            shards_.emplace_back(new std::ofstream(shard_path, std::ofstream::trunc | std::ofstream::binary));
+
+            if (shards_.back()->fail()) {
+                throw std::invalid_argument("Could not open output shard: " + shard_path);
+            }
+
+            indexes_.emplace_back(new std::ofstream(index_path, std::ofstream::trunc));
+
+            if (indexes_.back()->fail()) {
+                throw std::invalid_argument("Could not open output shard index: " + index_path);
+            }
+
+            *shards_.back() << header_ << '\n';
+            *indexes_.back() << "uid,offset,bytes,records\n";
+            shard_sizes_[i] = header_.size() + 1;
+        }
+
+        thread_ = std::thread(&AsyncWriter::run, this);
+    }
+
+    AsyncWriter::~AsyncWriter() {
+        try {
+            close();
+        } catch (...) {
+            // close() reports the errors.
+        }
+    }
+
+    unsigned AsyncWriter::n_shards() const {
+        return static_cast<unsigned>(shards_.size());
+    }
+
+    unsigned AsyncWriter::shard_of(const std::string& uid) const {
+        if (shards_.empty()) {
+            return 0;
+        }
+
+        // FNV-1a, so the assignment does not depend on the standard library.
+        uint64_t hash = 14695981039346656037ULL;
+
+        for (unsigned char c : uid) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+
+        return static_cast<unsigned>(hash % shards_.size());
+    }
+
+    void AsyncWriter::submit(Block::Ptr block) {
+        rethrow_error();
+
+        if (!block) {
+            return;
+        }
+
+        queue_.push(std::move(block));
+    }
+
+    void AsyncWriter::close() {
+        std::lock_guard<std::mutex> lock(close_mutex_);
+
+        if (!closed_) {
+            closed_ = true;
+            queue_.push(nullptr);
+            thread_.join();
+
+            for (auto& os : shards_) {
+                os->close();
+            }
+
+            for (auto& os : indexes_) {
+                os->close();
+            }
+
+            if (!failed_.load(std::memory_order_acquire)) {
+                for (auto& os : shards_) {
+                    if (os->fail()) {
+                        error_ = std::make_exception_ptr(std::invalid_argument("Could not write output shard."));
+                        failed_.store(true, std::memory_order_release);
+                        break;
+                    }
+                }
+            }
+        }
+
+        rethrow_error();
+    }
+
+    void AsyncWriter::run() {
+        for (Block::Ptr block = queue_.pop(); block != nullptr; block = queue_.pop()) {
+            // Keep draining after a failure so the submitters never wait on a full queue.
+            if (failed_.load(std::memory_order_relaxed)) {
+                continue;
+            }
+
+            try {
+                write_block(*block);
+            } catch (...) {
+                error_ = std::current_exception();
+                failed_.store(true, std::memory_order_release);
+            }
+        }
+    }
+
+    void AsyncWriter::write_block(const Block& block) {
+        if (shards_.empty()) {
+            for (auto& trip : block.trips) {
+                std::string file_path = output_path(trip.uid + ".csv");
+                std::ofstream os(file_path, std::ofstream::trunc | std::ofstream::binary);
+
+                if (os.fail()) {
+                    throw std::invalid_argument("Could not open output file: " + file_path);
+                }
+
+                os << header_ << '\n';
+                os.write(block.data.data() + trip.offset, trip.size);
+                os.close();
+
+                if (os.fail()) {
+                    throw std::invalid_argument("Could not write output file: " + file_path);
+                }
+            }
+
+            return;
+        }
+
+        std::ofstream& os = *shards_[block.shard];
+        std::ofstream& index = *indexes_[block.shard];
+        uint64_t base = shard_sizes_[block.shard];
+
+        os.write(block.data.data(), block.data.size());
+
+        for (auto& trip : block.trips) {
+            index << trip.uid << ',' << base + trip.offset << ',' << trip.size << ',' << trip.n_records << '\n';
+        }
+
+        if (os.fail() || index.fail()) {
+            throw std::invalid_argument("Could not write output shard: " + std::to_string(block.shard));
+        }
+
+        shard_sizes_[block.shard] += block.data.size();
+    }
+
+    std::string AsyncWriter::output_path(const std::string& name) const {
+        if (out_dir_.empty()) {
+            return name;
+        }
+
+        return out_dir_ + "/" + name;
+    }
+
+    void AsyncWriter::rethrow_error() const {
+        if (failed_.load(std::memory_order_acquire)) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    // BufferedTrajectoryWriter
+
+    /**
+     * \brief Append the records of one trajectory to the pending block of its shard.
+     */
+    class BufferedTrajectoryWriter::Sink : public trajectory::PointSink {
+        public:
+            Sink(BufferedTrajectoryWriter& writer, const std::string& uid, bool strip_cr) :
+                writer_(writer),
+                shard_(writer.writer_.shard_of(uid)),
+                block_(writer.pending_block(shard_)),
+                entry_{ uid, block_.data.size(), 0, 0 },
+                strip_cr_(strip_cr),
+                closed_(false)
+            {}
+
+            ~Sink() {
+                if (!closed_) {
+                    block_.data.resize(entry_.offset);
+                }
+            }
+
+            void write_point(const trajectory::Point& tp) {
+                string_utilities::CharSpan record = tp.get_data_span();
+
+                if (strip_cr_ && record.size() > 0 && *(record.last - 1) == '\r') {
+                    --record.last;
+                }
+
+                block_.data.append(record.first, record.size());
+                block_.data.push_back('\n');
+                ++entry_.n_records;
+            }
+
+            void close() {
+                if (closed_) {
+                    return;
+                }
+
+                closed_ = true;
+                entry_.size = block_.data.size() - entry_.offset;
+                block_.trips.push_back(std::move(entry_));
+                writer_.finish_trip(shard_);
+            }
+
+        private:
+            BufferedTrajectoryWriter& writer_;
+            unsigned shard_;
+            Block& block_;
+            TripEntry entry_;
+            bool strip_cr_;
+            bool closed_;
+    };
+
+    BufferedTrajectoryWriter::BufferedTrajectoryWriter(AsyncWriter& writer, std::size_t block_size) :
+        writer_(writer),
+        block_size_(block_size),
+        pending_(writer.n_shards() > 0 ? writer.n_shards() : 1)
+        {}
+
+    BufferedTrajectoryWriter::~BufferedTrajectoryWriter() {
+        try {
+            flush();
+        } catch (...) {
+            // flush() reports the errors.
+        }
+    }
+
+    std::unique_ptr<trajectory::PointSink> BufferedTrajectoryWriter::open_trajectory(const std::string& uid, bool strip_cr) {
+        return std::unique_ptr<trajectory::PointSink>(new Sink(*this, uid, strip_cr));
+    }
+
+    void BufferedTrajectoryWriter::flush() {
+        for (auto& block : pending_) {
+            if (block && !block->trips.empty()) {
+                writer_.submit(std::move(block));
+            }
+
+            block.reset();
+        }
+    }
+
+    Block& BufferedTrajectoryWriter::pending_block(unsigned shard) {
+        Block::Ptr& block = pending_[shard];
+
+        if (!block) {
+            block.reset(new Block());
+            block->shard = shard;
+        }
+
+        return *block;
+    }
+
+    void BufferedTrajectoryWriter::finish_trip(unsigned shard) {
+        if (pending_[shard]->data.size() >= block_size_) {
+            writer_.submit(std::move(pending_[shard]));
+            pending_[shard].reset();
+        }
+    }
+}
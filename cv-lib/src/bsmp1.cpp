@@ -18,8 +18,10 @@
  * For issues, question, and comments, please submit a issue via GitHub.
  *******************************************************************************/
 #include "bsmp1.hpp"
+#include "arena.hpp"
 #include "utilities.hpp"
 
+#include <algorithm>
 #include <fstream>
 
 namespace BSMP1 {
@@ -29,129 +31,277 @@ namespace BSMP1 {
         {}
 
     const std::string BSMP1CSVTrajectoryFactory::make_uid(const std::string& line) {
-        StrVector parts = string_utilities::split(line, ',');
+        string_utilities::CharSpan parts[kNFields];
 
-        if (parts.size() != kNFields) {
+        if (string_utilities::split(line.data(), line.data() + line.size(), ',', parts, kNFields) != kNFields) {
             throw std::out_of_range("BSMP1 CSV: Could not extract UID -> invalid number of fields");
         }
 
-        return parts[0] + "_" + parts[1];
+        return parts[0].str() + "_" + parts[1].str();
     }
 
-    trajectory::Point::Ptr BSMP1CSVTrajectoryFactory::make_point(const std::string& line) {
-        StrVector parts = string_utilities::split(line, ',');
+    trajectory::Point::Ptr BSMP1CSVTrajectoryFactory::new_point(const string_utilities::CharSpan& line, const std::shared_ptr<const char>& buffer, uint64_t gentime, double lat, double lon, double heading, double speed) {
+        // aliasing pointer: references the record and keeps the buffer alive.
+        return memory::make_shared<trajectory::Point>(std::shared_ptr<const char>(buffer, line.first), line.size(), gentime, lat, lon, heading, speed, index_++);
+    }
+
+    template <typename Counter>
+    void BSMP1CSVTrajectoryFactory::parse_point(const string_utilities::CharSpan& line, uint64_t& gentime, double& lat, double& lon, double& heading, double& speed, Counter& point_counter) const {
+        // tokenize in place; only the fields used by the algorithm are converted.
+        string_utilities::CharSpan parts[kNFields];
 
-        if (parts.size() != kNFields) {
+        if (string_utilities::split(line.first, line.last, ',', parts, kNFields) != kNFields) {
+            point_counter.n_invalid_field_points++;
             throw std::out_of_range("BSMP1 CSV: invalid number of fields");
         }
 
-        double lat = std::stod(parts[7]);
+        lat = string_utilities::to_double(parts[7]);
 
         if (lat > 80.0 || lat < -84.0) {
-            throw std::out_of_range("BSMP1 CSV: bad latitude: " + parts[7]);
+            point_counter.n_invalid_geo_points++;
+            throw std::out_of_range("BSMP1 CSV: bad latitude: " + parts[7].str());
         }
 
-        double lon = std::stod(parts[8]);
+        lon = string_utilities::to_double(parts[8]);
 
         if (lon >= 180.0 || lon <= -180.0) {
-            throw std::out_of_range("BSMP1 CSV: bad longitude: " + parts[8]);
+            point_counter.n_invalid_geo_points++;
+            throw std::out_of_range("BSMP1 CSV: bad longitude: " + parts[8].str());
         }
 
         if (lat == 0.0 && lon == 0.0) {
+            point_counter.n_invalid_geo_points++;
             throw std::out_of_range("BSMP1 CSV: equator point");
         }
 
-        double heading = std::stod(parts[11]);
+        heading = string_utilities::to_double(parts[11]);
 
         if (heading > 360.0 || heading < 0.0) {
-            throw std::out_of_range("BSMP1 CSV: bad heading: " + parts[11]);
+            point_counter.n_invalid_heading_points++;
+            throw std::out_of_range("BSMP1 CSV: bad heading: " + parts[11].str());
         }
 
-        double speed = std::stod(parts[10]);
-        uint64_t gentime = std::stoull(parts[3]);
+        speed = string_utilities::to_double(parts[10]);
+        gentime = string_utilities::to_uint64(parts[3]);
+    }
+
+    template <typename Counter>
+    trajectory::Point::Ptr BSMP1CSVTrajectoryFactory::make_point(const string_utilities::CharSpan& line, const std::shared_ptr<const char>& buffer, Counter& point_counter) {
+        uint64_t gentime;
+        double lat, lon, heading, speed;
 
-        return std::make_shared<trajectory::Point>(line, gentime, lat, lon, heading, speed, index_++);
+        parse_point(line, gentime, lat, lon, heading, speed, point_counter);
+
+        return new_point(line, buffer, gentime, lat, lon, heading, speed);
     }
+    
+    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_trajectory(const std::string& input) {
+        instrument::NullCounter point_counter;
 
-    trajectory::Point::Ptr BSMP1CSVTrajectoryFactory::make_point(const std::string& line, instrument::PointCounter& point_counter) {
-        StrVector parts = string_utilities::split(line, ',');
+        return make_trajectory(input, point_counter);
+    }
 
-        if (parts.size() != kNFields) {
-            point_counter.n_invalid_field_points++;
-            throw std::out_of_range("BSMP1 CSV: invalid number of fields");
+    namespace {
+        /**
+         * Find the next line like std::getline: the newline is not part of the line and a final newline does not start
+         * another line.
+         */
+        bool next_line(const char*& pos, const char* end, string_utilities::CharSpan& line) {
+            if (pos == end) {
+                return false;
+            }
+
+            const char* eol = std::find(pos, end, '\n');
+            line = string_utilities::CharSpan{ pos, eol };
+            pos = eol == end ? end : eol + 1;
+
+            return true;
         }
+    }
 
-        double lat = std::stod(parts[7]);
+    template <typename Counter>
+    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_trajectory(const std::string& input, Counter& point_counter) {
+        compression::InputFile file(input);
 
-        if (lat > 80.0 || lat < -84.0) {
-            point_counter.n_invalid_geo_points++;
-            throw std::out_of_range("BSMP1 CSV: bad latitude: " + parts[7]);
+        if (file.fail()) {
+            throw std::invalid_argument("Could not open BSMP1 CSV file: " + input);
         }
 
-        double lon = std::stod(parts[8]);
+        // the whole trip is read (and decompressed) into one buffer shared by its points instead of a copy of each record.
+        std::shared_ptr<std::string> contents = std::make_shared<std::string>();
+        compression::read_all(file, *contents);
+        file.close();
 
-        if (lon >= 180.0 || lon <= -180.0) {
-            point_counter.n_invalid_geo_points++;
-            throw std::out_of_range("BSMP1 CSV: bad longitude: " + parts[8]);
+        return make_buffered_trajectory(contents, input, point_counter);
+    }
+
+    template <typename Counter>
+    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_buffered_trajectory(const std::shared_ptr<const std::string>& records, const std::string& input, Counter& point_counter) {
+        string_utilities::CharSpan line;
+        trajectory::Trajectory traj;
+        std::shared_ptr<const char> buffer(records, records->data());
+        const char* pos = records->data();
+        const char* end = pos + records->size();
+
+        if (!next_line(pos, end, line)) {
+            throw std::invalid_argument("BSMP1 CSV: " + input + " missing header!");
         }
 
-        if (lat == 0.0 && lon == 0.0) {
-            point_counter.n_invalid_geo_points++;
-            throw std::out_of_range("BSMP1 CSV: equator point");
+        if (!next_line(pos, end, line)) {
+            throw std::invalid_argument("BSMP1 CSV: " + input + " is empty!");
         }
 
-        double heading = std::stod(parts[11]);
+        uid_ = make_uid(line.str()); 
+        
+        do {
+            point_counter.n_points++;
+            line_number_++;
+    
+            try {
+                traj.push_back(make_point(line, buffer, point_counter));
+            } catch (std::exception&) {
+                continue;
+            }
+        } while (next_line(pos, end, line));
 
-        if (heading > 360.0 || heading < 0.0) {
-            point_counter.n_invalid_heading_points++;
-            throw std::out_of_range("BSMP1 CSV: bad heading: " + parts[11]);
-        }
+        // NRVO / copy elision.
+        return traj;
+    }
 
-        double speed = std::stod(parts[10]);
-        uint64_t gentime = std::stoull(parts[3]);
+    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_mapped_trajectory(const std::string& input) {
+        instrument::NullCounter point_counter;
 
-        return std::make_shared<trajectory::Point>(line, gentime, lat, lon, heading, speed, index_++);
+        return make_mapped_trajectory(input, point_counter);
     }
-    
-    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_trajectory(const std::string& input) {
-        std::string line;
+
+    template <typename Counter>
+    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_mapped_trajectory(const std::string& input, Counter& point_counter) {
+        string_utilities::CharSpan line;
         trajectory::Trajectory traj;
-        std::ifstream file(input);
+        MappedFile::CPtr file;
 
-        if (file.fail()) {
+        try {
+            file = std::make_shared<const MappedFile>(input);
+        } catch (std::invalid_argument&) {
             throw std::invalid_argument("Could not open BSMP1 CSV file: " + input);
         }
 
-        if (!std::getline(file, line)) {
+        const char* pos = file->data();
+        const char* end = pos + file->size();
+
+        if (!next_line(pos, end, line)) {
             throw std::invalid_argument("BSMP1 CSV: " + input + " missing header!");
         }
 
-        if (!std::getline(file, line)) {
+        if (!next_line(pos, end, line)) {
             throw std::invalid_argument("BSMP1 CSV: " + input + " is empty!");
         }
 
-        uid_ = make_uid(line); 
+        uid_ = make_uid(line.str()); 
+        std::shared_ptr<const char> buffer(file, file->data());
         
         do {
+            point_counter.n_points++;
             line_number_++;
     
             try {
-                traj.push_back(make_point(line));
+                traj.push_back(make_point(line, buffer, point_counter));
             } catch (std::exception&) {
                 continue;
             }
-        } while (std::getline(file, line));
+        } while (next_line(pos, end, line));
 
-        file.close();
+        // NRVO / copy elision.
+        return traj;
+    }
+
+    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_mapped_trajectory(const MappedFile::CPtr& file, uint64_t begin, uint64_t end) {
+        instrument::NullCounter point_counter;
+
+        return make_mapped_trajectory(file, begin, end, point_counter);
+    }
+
+    template <typename Counter>
+    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_mapped_trajectory(const MappedFile::CPtr& file, uint64_t begin, uint64_t end, Counter& point_counter) {
+        string_utilities::CharSpan line;
+        trajectory::Trajectory traj;
+
+        if (begin > end || end > file->size()) {
+            throw std::invalid_argument("BSMP1 CSV: trip range is outside of the file!");
+        }
+
+        const char* pos = file->data() + begin;
+        const char* last = file->data() + end;
+
+        if (!next_line(pos, last, line)) {
+            throw std::invalid_argument("BSMP1 CSV: trip range is empty!");
+        }
+
+        uid_ = make_uid(line.str()); 
+        std::shared_ptr<const char> buffer(file, file->data());
+        
+        do {
+            point_counter.n_points++;
+            line_number_++;
+    
+            try {
+                traj.push_back(make_point(line, buffer, point_counter));
+            } catch (std::exception&) {
+                continue;
+            }
+        } while (next_line(pos, last, line));
 
         // NRVO / copy elision.
         return traj;
     }
 
-    const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_trajectory(const std::string& input, instrument::PointCounter& point_counter) {
+    template const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_trajectory(const std::string&, instrument::PointCounter&);
+    template const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_trajectory(const std::string&, instrument::NullCounter&);
+    template const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_mapped_trajectory(const std::string&, instrument::PointCounter&);
+    template const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_mapped_trajectory(const std::string&, instrument::NullCounter&);
+    template const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_mapped_trajectory(const MappedFile::CPtr&, uint64_t, uint64_t, instrument::PointCounter&);
+    template const trajectory::Trajectory BSMP1CSVTrajectoryFactory::make_mapped_trajectory(const MappedFile::CPtr&, uint64_t, uint64_t, instrument::NullCounter&);
+
+    const trajectory::Trajectory BSMP1ColumnarTrajectoryFactory::make_trajectory(const std::string& input) {
+        instrument::NullCounter point_counter;
+
+        return make_trajectory(input, point_counter);
+    }
+
+    template <typename Counter>
+    const trajectory::Trajectory BSMP1ColumnarTrajectoryFactory::make_trajectory(const std::string& input, Counter& point_counter) {
+        compression::InputFile file(input);
+
+        if (file.fail()) {
+            throw std::invalid_argument("Could not open BSMP1 columnar file: " + input);
+        }
+
+        columnar::Reader reader(file);
+
+        if (reader.get_column_names() != columnar::column_names(kCSVHeader)) {
+            throw std::invalid_argument("BSMP1 columnar: " + input + " does not have the BSMP1 columns!");
+        }
+
+        // the records are restored as CSV text and parsed like a CSV trip.
+        std::string records = kCSVHeader + '\n';
+
+        while (reader.next_group()) {
+            for (std::size_t row = 0; row < reader.group_size(); ++row) {
+                reader.append_record(row, records);
+                records.push_back('\n');
+            }
+        }
+
+        return make_buffered_trajectory(std::make_shared<const std::string>(std::move(records)), input, point_counter);
+    }
+
+    template const trajectory::Trajectory BSMP1ColumnarTrajectoryFactory::make_trajectory(const std::string&, instrument::PointCounter&);
+    template const trajectory::Trajectory BSMP1ColumnarTrajectoryFactory::make_trajectory(const std::string&, instrument::NullCounter&);
+
+    trajectory::Columns BSMP1CSVTrajectoryFactory::make_columns(const std::string& input) {
         std::string line;
-        trajectory::Trajectory traj;
-        std::ifstream file(input);
+        trajectory::Columns cols;
+        compression::InputFile file(input);
 
         if (file.fail()) {
             throw std::invalid_argument("Could not open BSMP1 CSV file: " + input);
@@ -166,59 +316,190 @@ namespace BSMP1 {
         }
 
         uid_ = make_uid(line); 
+
+        uint64_t gentime;
+        double lat, lon, heading, speed;
+        instrument::NullCounter point_counter;
         
         do {
-            point_counter.n_points++;
             line_number_++;
+            string_utilities::CharSpan record{ line.data(), line.data() + line.size() };
     
             try {
-                traj.push_back(make_point(line, point_counter));
+                parse_point(record, gentime, lat, lon, heading, speed, point_counter);
             } catch (std::exception&) {
                 continue;
             }
+
+            cols.push_back(record, gentime, lat, lon, heading, speed, index_++);
         } while (std::getline(file, line));
 
         file.close();
 
-        // NRVO // copy elision
-        return traj;
+        // NRVO / copy elision.
+        return cols;
+    }
+
+    trajectory::Columns BSMP1CSVTrajectoryFactory::make_mapped_columns(const std::string& input) {
+        string_utilities::CharSpan line;
+        MappedFile::CPtr file;
+
+        try {
+            file = std::make_shared<const MappedFile>(input);
+        } catch (std::invalid_argument&) {
+            throw std::invalid_argument("Could not open BSMP1 CSV file: " + input);
+        }
+
+        trajectory::Columns cols{ file };
+        const char* pos = file->data();
+        const char* end = pos + file->size();
+
+        if (!next_line(pos, end, line)) {
+            throw std::invalid_argument("BSMP1 CSV: " + input + " missing header!");
+        }
+
+        if (!next_line(pos, end, line)) {
+            throw std::invalid_argument("BSMP1 CSV: " + input + " is empty!");
+        }
+
+        uid_ = make_uid(line.str()); 
+
+        uint64_t gentime;
+        double lat, lon, heading, speed;
+        instrument::NullCounter point_counter;
+        
+        do {
+            line_number_++;
+    
+            try {
+                parse_point(line, gentime, lat, lon, heading, speed, point_counter);
+            } catch (std::exception&) {
+                continue;
+            }
+
+            cols.push_back(line, gentime, lat, lon, heading, speed, index_++);
+        } while (next_line(pos, end, line));
+
+        // NRVO / copy elision.
+        return cols;
     }
 
     const std::string BSMP1CSVTrajectoryFactory::get_uid() const {
         return uid_;
     }
 
-    BSMP1CSVTrajectoryWriter::BSMP1CSVTrajectoryWriter(const std::string& output) :
-        output_(output)
+    BSMP1CSVTrajectoryWriter::BSMP1CSVTrajectoryWriter(const std::string& output, compression::Format compression) :
+        output_(output),
+        compression_(compression)
         {}
 
-    void BSMP1CSVTrajectoryWriter::write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const {
-        std::string output_file_path;
+    std::string BSMP1CSVTrajectoryWriter::output_path(const std::string& uid) const {
+        std::string file_name = uid + ".csv" + compression::file_extension(compression_);
 
         if (output_.empty()) {
-            output_file_path = uid + ".csv";
-        } else {
-            output_file_path = output_ + "/" + uid + ".csv";
+            return file_name;
         }
 
-        std::ofstream os(output_file_path, std::ofstream::trunc);
+        return output_ + "/" + file_name;
+    }
 
-        if (os.fail()) {
+    BSMP1CSVTrajectoryWriter::Sink::Sink(const std::string& output_file_path, bool strip_cr, compression::Format compression) :
+        os_(output_file_path, compression),
+        stream_sink_(os_, strip_cr)
+    {
+        if (os_.fail()) {
             throw std::invalid_argument("Could not open BSMP1 CSV output file: " + output_file_path);
         }
 
-        os << kCSVHeader << std::endl;
+        os_ << kCSVHeader << '\n';
+    }
+
+    void BSMP1CSVTrajectoryWriter::Sink::write_point(const trajectory::Point& tp) {
+        stream_sink_.write_point(tp);
+    }
+
+    void BSMP1CSVTrajectoryWriter::Sink::write_record(const string_utilities::CharSpan& record) {
+        stream_sink_.write_record(record);
+    }
+
+    void BSMP1CSVTrajectoryWriter::Sink::close() {
+        os_.close();
+    }
+
+    std::unique_ptr<trajectory::PointSink> BSMP1CSVTrajectoryWriter::open_trajectory(const std::string& uid, bool strip_cr) {
+        return std::unique_ptr<trajectory::PointSink>(new Sink(output_path(uid), strip_cr, compression_));
+    }
+
+    void BSMP1CSVTrajectoryWriter::write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const {
+        Sink sink(output_path(uid), strip_cr, compression_);
 
         for (auto& tp : traj) {
-            std::string data = tp->get_data();
+            sink.write_point(*tp);
+        }
 
-            if (strip_cr && !data.empty() && data[data.size() - 1] == '\r') {
-                data.erase(data.size() - 1);
-            }
+        sink.close();
+    }
+
+    void BSMP1CSVTrajectoryWriter::write_trajectory(const trajectory::Columns& cols, const std::string& uid, bool strip_cr) const {
+        Sink sink(output_path(uid), strip_cr, compression_);
 
-            os << data << std::endl;
+        for (trajectory::Index i = 0; i < cols.size(); ++i) {
+            sink.write_record(cols.record(i));
+        }
+
+        sink.close();
+    }
+
+    BSMP1ColumnarTrajectoryWriter::BSMP1ColumnarTrajectoryWriter(const std::string& output) :
+        output_(output)
+        {}
+
+    std::string BSMP1ColumnarTrajectoryWriter::output_path(const std::string& uid) const {
+        if (output_.empty()) {
+            return uid + columnar::kFileExtension;
+        }
+
+        return output_ + "/" + uid + columnar::kFileExtension;
+    }
+
+    BSMP1ColumnarTrajectoryWriter::Sink::Sink(const std::string& output_file_path, bool strip_cr) :
+        os_(output_file_path, std::ofstream::trunc | std::ofstream::binary),
+        writer_(open(os_, output_file_path), columnar::column_names(kCSVHeader), strip_cr)
+    {}
+
+    std::ostream& BSMP1ColumnarTrajectoryWriter::Sink::open(std::ofstream& os, const std::string& output_file_path) {
+        // checked before the writer puts its header.
+        if (os.fail()) {
+            throw std::invalid_argument("Could not open BSMP1 columnar output file: " + output_file_path);
+        }
+
+        return os;
+    }
+
+    void BSMP1ColumnarTrajectoryWriter::Sink::write_point(const trajectory::Point& tp) {
+        writer_.write_point(tp);
+    }
+
+    void BSMP1ColumnarTrajectoryWriter::Sink::write_record(const string_utilities::CharSpan& record) {
+        writer_.write_record(record);
+    }
+
+    void BSMP1ColumnarTrajectoryWriter::Sink::close() {
+        writer_.close();
+        os_.close();
+    }
+
+    std::unique_ptr<trajectory::PointSink> BSMP1ColumnarTrajectoryWriter::open_trajectory(const std::string& uid, bool strip_cr) {
+        return std::unique_ptr<trajectory::PointSink>(new Sink(output_path(uid), strip_cr));
+    }
+
+    void BSMP1ColumnarTrajectoryWriter::write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const {
+        Sink sink(output_path(uid), strip_cr);
+
+        for (auto& tp : traj) {
+            sink.write_point(*tp);
         }
 
-        os.close();
+        sink.close();
     }
 }
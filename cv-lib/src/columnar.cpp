@@ -0,0 +1,551 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "columnar.hpp"
+#include "compression.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace columnar {
+
+    namespace {
+        const std::size_t kMaxGroupBytes = std::size_t{ 1 } << 26;     // held field bytes that flush a row group.
+        const std::size_t kMaxDigits = 18;                              // digits that always fit an int64_t.
+
+        void put_varint(std::string& out, uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+
+            out.push_back(static_cast<char>(value));
+        }
+
+        bool get_varint(const char*& pos, const char* end, uint64_t& value) {
+            value = 0;
+
+            for (int shift = 0; shift < 64 && pos != end; shift += 7) {
+                uint8_t byte = static_cast<uint8_t>(*pos++);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        uint64_t read_varint(std::istream& is) {
+            uint64_t value = 0;
+
+            for (int shift = 0; shift < 64; shift += 7) {
+                int c = is.get();
+
+                if (c == std::char_traits<char>::eof()) {
+                    throw std::invalid_argument("Columnar: the file is truncated");
+                }
+
+                value |= static_cast<uint64_t>(c & 0x7f) << shift;
+
+                if ((c & 0x80) == 0) {
+                    return value;
+                }
+            }
+
+            throw std::invalid_argument("Columnar: bad variable length integer");
+        }
+
+        std::string read_bytes(std::istream& is, uint64_t size) {
+            std::string bytes(static_cast<std::size_t>(size), '\0');
+
+            if (size > 0 && !is.read(&bytes[0], static_cast<std::streamsize>(size))) {
+                throw std::invalid_argument("Columnar: the file is truncated");
+            }
+
+            return bytes;
+        }
+
+        uint64_t zigzag(int64_t value) {
+            return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        }
+
+        int64_t unzigzag(uint64_t value) {
+            return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        }
+
+        /**
+         * Parse the digits of the integer part; only the text to_string would write back is accepted.
+         */
+        bool parse_digits(const char* first, const char* last, int64_t& value) {
+            std::size_t n = static_cast<std::size_t>(last - first);
+
+            if (n == 0 || n > kMaxDigits || (n > 1 && *first == '0')) {
+                return false;
+            }
+
+            value = 0;
+
+            for (const char* p = first; p != last; ++p) {
+                if (*p < '0' || *p > '9') {
+                    return false;
+                }
+
+                value = value * 10 + (*p - '0');
+            }
+
+            return true;
+        }
+
+        /**
+         * Parse a plain number, e.g., -12.50; scale is set to the number of fraction digits (0 without a point) and
+         * digits to the number times 10^scale.
+         */
+        bool parse_number(const string_utilities::CharSpan& text, int64_t& digits, std::size_t& scale, std::size_t& whole_digits) {
+            bool negative = text.size() > 0 && *text.first == '-';
+            const char* first = text.first + (negative ? 1 : 0);
+            const char* point = std::find(first, text.last, '.');
+            int64_t whole;
+
+            whole_digits = static_cast<std::size_t>(point - first);
+            scale = point == text.last ? 0 : static_cast<std::size_t>(text.last - point - 1);
+
+            // a point must have fraction digits; they may have leading zeros.
+            if ((point != text.last && scale == 0) || whole_digits + scale > kMaxDigits || !parse_digits(first, point, whole)) {
+                return false;
+            }
+
+            digits = whole;
+
+            for (const char* p = point + (scale > 0 ? 1 : 0); p != text.last; ++p) {
+                if (*p < '0' || *p > '9') {
+                    return false;
+                }
+
+                digits = digits * 10 + (*p - '0');
+            }
+
+            if (negative && digits == 0) {
+                return false;
+            }
+
+            digits = negative ? -digits : digits;
+            return true;
+        }
+
+        int64_t power_of_ten(std::size_t exponent) {
+            int64_t power = 1;
+
+            while (exponent-- > 0) {
+                power *= 10;
+            }
+
+            return power;
+        }
+    }
+
+    std::size_t Column::size() const {
+        return encoding == Encoding::kString ? strings.size() : values.size();
+    }
+
+    double Column::to_double(std::size_t row) const {
+        std::string text;
+        append_text(row, text);
+
+        return string_utilities::to_double(string_utilities::CharSpan{ text.data(), text.data() + text.size() });
+    }
+
+    void Column::append_text(std::size_t row, std::string& text) const {
+        if (encoding == Encoding::kString) {
+            text += strings[row];
+            return;
+        }
+
+        int64_t value = values[row];
+        std::size_t value_scale = encoding == Encoding::kDecimal ? scales[row] : 0;
+
+        if (value_scale == 0) {
+            text += std::to_string(encoding == Encoding::kDecimal ? value / power_of_ten(scale) : value);
+            return;
+        }
+
+        value /= power_of_ten(scale - value_scale);
+
+        // at least one digit before the point.
+        std::string digits = std::to_string(value < 0 ? -value : value);
+
+        if (digits.size() <= value_scale) {
+            digits.insert(0, value_scale + 1 - digits.size(), '0');
+        }
+
+        if (value < 0) {
+            text.push_back('-');
+        }
+
+        text.append(digits, 0, digits.size() - value_scale);
+        text.push_back('.');
+        text.append(digits, digits.size() - value_scale, value_scale);
+    }
+
+    Writer::Writer(std::ostream& os, const std::vector<std::string>& names, bool strip_cr, std::size_t row_group_size) :
+        os_(os),
+        n_columns_(names.size()),
+        strip_cr_(strip_cr),
+        row_group_size_(row_group_size),
+        n_rows_(0),
+        text_(),
+        field_ends_(),
+        payload_(),
+        closed_(false)
+    {
+        if (names.empty()) {
+            throw std::invalid_argument("Columnar: there must be at least one column");
+        }
+
+        if (row_group_size == 0) {
+            throw std::invalid_argument("Columnar: the row group size must be greater than 0");
+        }
+
+        std::string header = kMagic;
+        put_varint(header, n_columns_);
+
+        for (auto& name : names) {
+            put_varint(header, name.size());
+            header += name;
+        }
+
+        os_.write(header.data(), header.size());
+    }
+
+    void Writer::write_point(const trajectory::Point& tp) {
+        write_record(tp.get_data_span());
+    }
+
+    void Writer::write_record(string_utilities::CharSpan record) {
+        if (strip_cr_ && record.size() > 0 && *(record.last - 1) == '\r') {
+            --record.last;
+        }
+
+        // every comma separates two fields, even at the end of the record.
+        std::size_t n_fields = static_cast<std::size_t>(std::count(record.first, record.last, ',')) + 1;
+
+        if (n_fields != n_columns_) {
+            throw std::invalid_argument("Columnar: record has " + std::to_string(n_fields) + " fields; expected " + std::to_string(n_columns_));
+        }
+
+        const char* first = record.first;
+
+        while (true) {
+            const char* last = std::find(first, record.last, ',');
+            text_.append(first, last);
+            field_ends_.push_back(static_cast<uint32_t>(text_.size()));
+
+            if (last == record.last) {
+                break;
+            }
+
+            first = last + 1;
+        }
+
+        if (++n_rows_ == row_group_size_ || text_.size() >= kMaxGroupBytes) {
+            flush_group();
+        }
+    }
+
+    string_utilities::CharSpan Writer::field(std::size_t row, std::size_t column) const {
+        std::size_t k = row * n_columns_ + column;
+        std::size_t first = k == 0 ? 0 : field_ends_[k - 1];
+
+        return string_utilities::CharSpan{ text_.data() + first, text_.data() + field_ends_[k] };
+    }
+
+    void Writer::write_column(std::size_t column) {
+        Encoding encoding = Encoding::kInteger;
+        std::size_t scale = 0;
+        std::size_t whole_digits = 0;
+        int64_t value;
+
+        for (std::size_t row = 0; row < n_rows_; ++row) {
+            std::size_t value_scale, value_whole_digits;
+
+            if (!parse_number(field(row, column), value, value_scale, value_whole_digits)) {
+                encoding = Encoding::kString;
+                break;
+            }
+
+            scale = std::max(scale, value_scale);
+            whole_digits = std::max(whole_digits, value_whole_digits);
+        }
+
+        if (encoding == Encoding::kInteger && scale > 0) {
+            // the scaled values must still fit.
+            encoding = whole_digits + scale > kMaxDigits ? Encoding::kString : Encoding::kDecimal;
+        }
+
+        payload_.clear();
+
+        if (encoding == Encoding::kString) {
+            for (std::size_t row = 0; row < n_rows_; ) {
+                string_utilities::CharSpan text = field(row, column);
+                std::size_t run = 1;
+
+                while (row + run < n_rows_ && field(row + run, column).size() == text.size() && std::equal(text.first, text.last, field(row + run, column).first)) {
+                    ++run;
+                }
+
+                put_varint(payload_, run);
+                put_varint(payload_, text.size());
+                payload_.append(text.first, text.last);
+                row += run;
+            }
+        } else {
+            int64_t previous = 0;
+
+            for (std::size_t row = 0; row < n_rows_; ++row) {
+                std::size_t value_scale, value_whole_digits;
+                parse_number(field(row, column), value, value_scale, value_whole_digits);
+                value *= power_of_ten(scale - value_scale);
+
+                put_varint(payload_, zigzag(value - previous));
+                previous = value;
+            }
+
+            // the runs of the fraction digits of the values.
+            for (std::size_t row = 0; encoding == Encoding::kDecimal && row < n_rows_; ) {
+                std::size_t value_scale, value_whole_digits, run_scale;
+                parse_number(field(row, column), value, run_scale, value_whole_digits);
+                std::size_t run = 1;
+
+                while (row + run < n_rows_ && parse_number(field(row + run, column), value, value_scale, value_whole_digits) && value_scale == run_scale) {
+                    ++run;
+                }
+
+                put_varint(payload_, run);
+                payload_.push_back(static_cast<char>(run_scale));
+                row += run;
+            }
+        }
+
+        std::string header(1, static_cast<char>(encoding));
+
+        if (encoding == Encoding::kDecimal) {
+            header.push_back(static_cast<char>(scale));
+        }
+
+        put_varint(header, payload_.size());
+        os_.write(header.data(), header.size());
+        os_.write(payload_.data(), payload_.size());
+    }
+
+    void Writer::flush_group() {
+        if (n_rows_ == 0) {
+            return;
+        }
+
+        std::string header;
+        put_varint(header, n_rows_);
+        os_.write(header.data(), header.size());
+
+        for (std::size_t column = 0; column < n_columns_; ++column) {
+            write_column(column);
+        }
+
+        n_rows_ = 0;
+        text_.clear();
+        field_ends_.clear();
+    }
+
+    void Writer::close() {
+        if (closed_) {
+            return;
+        }
+
+        flush_group();
+
+        // a group without rows ends the file.
+        os_.put('\0');
+        os_.flush();
+        closed_ = true;
+    }
+
+    Reader::Reader(std::istream& is) :
+        is_(is),
+        names_(),
+        columns_(),
+        n_rows_(0),
+        payload_(),
+        done_(false)
+    {
+        std::string magic(kMagic.size(), '\0');
+
+        if (!is_.read(&magic[0], magic.size()) || magic != kMagic) {
+            throw std::invalid_argument("Columnar: not a columnar file");
+        }
+
+        uint64_t n_columns = read_varint(is_);
+
+        for (uint64_t i = 0; i < n_columns; ++i) {
+            names_.push_back(read_bytes(is_, read_varint(is_)));
+        }
+
+        columns_.resize(names_.size());
+    }
+
+    const std::vector<std::string>& Reader::get_column_names() const {
+        return names_;
+    }
+
+    bool Reader::next_group() {
+        if (done_) {
+            return false;
+        }
+
+        n_rows_ = static_cast<std::size_t>(read_varint(is_));
+
+        if (n_rows_ == 0) {
+            done_ = true;
+            return false;
+        }
+
+        for (auto& column : columns_) {
+            int encoding = is_.get();
+
+            if (encoding < 0 || encoding > static_cast<int>(Encoding::kString)) {
+                throw std::invalid_argument("Columnar: bad column encoding");
+            }
+
+            column.encoding = static_cast<Encoding>(encoding);
+            int scale = column.encoding == Encoding::kDecimal ? is_.get() : 0;
+
+            if (scale < 0 || scale > static_cast<int>(kMaxDigits)) {
+                throw std::invalid_argument("Columnar: bad decimal scale");
+            }
+
+            column.scale = static_cast<uint8_t>(scale);
+            column.values.clear();
+            column.scales.clear();
+            column.strings.clear();
+            payload_ = read_bytes(is_, read_varint(is_));
+
+            const char* pos = payload_.data();
+            const char* end = pos + payload_.size();
+            uint64_t value;
+
+            if (column.encoding == Encoding::kString) {
+                while (column.strings.size() < n_rows_) {
+                    uint64_t run, size;
+
+                    if (!get_varint(pos, end, run) || !get_varint(pos, end, size) || run == 0 || run > n_rows_ - column.strings.size() || size > static_cast<uint64_t>(end - pos)) {
+                        throw std::invalid_argument("Columnar: corrupt string column");
+                    }
+
+                    column.strings.insert(column.strings.end(), static_cast<std::size_t>(run), std::string(pos, static_cast<std::size_t>(size)));
+                    pos += size;
+                }
+            } else {
+                int64_t previous = 0;
+
+                while (column.values.size() < n_rows_) {
+                    if (!get_varint(pos, end, value)) {
+                        throw std::invalid_argument("Columnar: corrupt numeric column");
+                    }
+
+                    previous += unzigzag(value);
+                    column.values.push_back(previous);
+                }
+
+                while (column.encoding == Encoding::kDecimal && column.scales.size() < n_rows_) {
+                    uint64_t run;
+
+                    if (!get_varint(pos, end, run) || run == 0 || run > n_rows_ - column.scales.size() || pos == end || static_cast<uint8_t>(*pos) > column.scale) {
+                        throw std::invalid_argument("Columnar: corrupt decimal column");
+                    }
+
+                    column.scales.insert(column.scales.end(), static_cast<std::size_t>(run), static_cast<uint8_t>(*pos++));
+                }
+            }
+
+            if (pos != end) {
+                throw std::invalid_argument("Columnar: column has extra bytes");
+            }
+        }
+
+        return true;
+    }
+
+    std::size_t Reader::group_size() const {
+        return n_rows_;
+    }
+
+    const Column& Reader::get_column(std::size_t column) const {
+        return columns_.at(column);
+    }
+
+    void Reader::append_record(std::size_t row, std::string& record) const {
+        for (std::size_t column = 0; column < columns_.size(); ++column) {
+            if (column > 0) {
+                record.push_back(',');
+            }
+
+            columns_[column].append_text(row, record);
+        }
+    }
+
+    std::vector<std::string> column_names(const std::string& header) {
+        std::vector<std::string> names;
+        std::size_t last = header.size();
+
+        if (last > 0 && header[last - 1] == '\r') {
+            --last;
+        }
+
+        std::size_t first = 0;
+
+        while (true) {
+            std::size_t comma = header.find(',', first);
+
+            if (comma == std::string::npos || comma >= last) {
+                names.push_back(header.substr(first, last - first));
+                break;
+            }
+
+            names.push_back(header.substr(first, comma - first));
+            first = comma + 1;
+        }
+
+        return names;
+    }
+
+    bool is_columnar_path(const std::string& path) {
+        std::size_t end = path.size();
+
+        for (compression::Format format : { compression::Format::kGzip, compression::Format::kZstd }) {
+            std::string extension = compression::file_extension(format);
+
+            if (end >= extension.size() && path.compare(end - extension.size(), extension.size(), extension) == 0) {
+                end -= extension.size();
+
+                break;
+            }
+        }
+
+        return end >= kFileExtension.size() && path.compare(end - kFileExtension.size(), kFileExtension.size(), kFileExtension) == 0;
+    }
+}
@@ -0,0 +1,309 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "columns.hpp"
+#include "arena.hpp"
+
+#include <stdexcept>
+
+namespace trajectory {
+
+    constexpr Columns::Id Columns::kNoId;
+
+    Columns::Columns() :
+        source_{ nullptr }
+    {}
+
+    Columns::Columns( const MappedFile::CPtr& source ) :
+        source_{ source }
+    {}
+
+    Columns::Columns( const Trajectory& traj ) :
+        source_{ nullptr }
+    {
+        reserve( traj.size() );
+
+        for (auto& tp : traj) {
+            push_back( *tp );
+        }
+    }
+
+    Trajectory Columns::to_trajectory() const
+    {
+        Trajectory traj;
+        traj.reserve( size() );
+
+        // One shared buffer for all the points; the mapped file is already shared.
+        std::shared_ptr<const char> buffer;
+
+        if (source_) {
+            buffer = std::shared_ptr<const char>( source_, source_->data() );
+        } else {
+            std::shared_ptr<const std::string> records = std::make_shared<const std::string>( records_ );
+            buffer = std::shared_ptr<const char>( records, records->data() );
+        }
+
+        for (Index i = 0; i < size(); ++i) {
+            std::shared_ptr<const char> data_ref( buffer, buffer.get() + record_offset_[i] );
+            Point::Ptr tp = memory::make_shared<Point>( data_ref, record_size_[i], time_[i], lat_[i], lon_[i], heading_[i], speed_[i], index_[i] );
+
+            if (edge_id_[i] != kNoId) {
+                tp->set_fit_edge( edges_[edge_id_[i]] );
+            }
+
+            if (interval_id_[i] != kNoId) {
+                tp->set_critical_interval( intervals_[interval_id_[i]] );
+            }
+
+            if (flags_[i] & kPrivate) {
+                tp->set_private();
+            }
+
+            tp->set_out_degree( out_degree_[i] );
+            traj.push_back( tp );
+        }
+
+        return traj;
+    }
+
+    void Columns::reserve( std::size_t n )
+    {
+        lat_.reserve( n );
+        lon_.reserve( n );
+        heading_.reserve( n );
+        speed_.reserve( n );
+        time_.reserve( n );
+        index_.reserve( n );
+        edge_id_.reserve( n );
+        interval_id_.reserve( n );
+        out_degree_.reserve( n );
+        flags_.reserve( n );
+        record_offset_.reserve( n );
+        record_size_.reserve( n );
+    }
+
+    const char* Columns::records_base() const
+    {
+        return source_ ? source_->data() : records_.data();
+    }
+
+    void Columns::push_record( const string_utilities::CharSpan& record )
+    {
+        if (source_) {
+            const char* first = source_->data();
+
+            if (record.first < first || record.last > first + source_->size()) {
+                throw std::invalid_argument( "Columns: record is not in the mapped source" );
+            }
+
+            record_offset_.push_back( static_cast<uint64_t>(record.first - first) );
+        } else {
+            record_offset_.push_back( records_.size() );
+            records_.append( record.first, record.size() );
+        }
+
+        record_size_.push_back( static_cast<uint32_t>(record.size()) );
+    }
+
+    void Columns::push_back( const string_utilities::CharSpan& record, uint64_t time, double lat, double lon, double heading, double speed, uint64_t index )
+    {
+        push_record( record );
+
+        lat_.push_back( lat );
+        lon_.push_back( lon );
+        heading_.push_back( static_cast<float>(heading) );
+        speed_.push_back( static_cast<float>(speed) );
+        time_.push_back( time );
+        index_.push_back( index );
+        edge_id_.push_back( kNoId );
+        interval_id_.push_back( kNoId );
+        out_degree_.push_back( 0 );
+        flags_.push_back( 0 );
+    }
+
+    void Columns::push_back( const Point& tp )
+    {
+        push_back( tp.get_data_span(), tp.get_time(), tp.lat, tp.lon, tp.get_heading(), tp.get_speed(), tp.get_index() );
+
+        Index i = size() - 1;
+
+        if (tp.has_edge()) {
+            set_fit_edge( i, tp.get_fit_edge() );
+        }
+
+        if (tp.is_critical()) {
+            set_critical_interval( i, tp.get_critical_interval() );
+        }
+
+        if (tp.is_private()) {
+            set_private( i );
+        }
+
+        set_out_degree( i, tp.get_out_degree() );
+    }
+
+    void Columns::push_back( const Columns& other, Index i )
+    {
+        if (empty() && !source_) {
+            source_ = other.source_;
+        }
+
+        if (source_ != other.source_ && source_) {
+            throw std::invalid_argument( "Columns: the points reference different mapped sources" );
+        }
+
+        push_back( other.record( i ), other.time_[i], other.lat_[i], other.lon_[i], other.heading_[i], other.speed_[i], other.index_[i] );
+
+        Index j = size() - 1;
+
+        if (other.edge_id_[i] != kNoId) {
+            set_fit_edge( j, other.edges_[other.edge_id_[i]] );
+        }
+
+        if (other.interval_id_[i] != kNoId) {
+            set_critical_interval( j, other.intervals_[other.interval_id_[i]] );
+        }
+
+        out_degree_[j] = other.out_degree_[i];
+        flags_[j] = other.flags_[i];
+    }
+
+    void Columns::clear()
+    {
+        records_.clear();
+        lat_.clear();
+        lon_.clear();
+        heading_.clear();
+        speed_.clear();
+        time_.clear();
+        index_.clear();
+        edge_id_.clear();
+        interval_id_.clear();
+        out_degree_.clear();
+        flags_.clear();
+        record_offset_.clear();
+        record_size_.clear();
+        edges_.clear();
+        intervals_.clear();
+        edge_lookup_.clear();
+        interval_lookup_.clear();
+    }
+
+    std::size_t Columns::size() const
+    {
+        return lat_.size();
+    }
+
+    bool Columns::empty() const
+    {
+        return lat_.empty();
+    }
+
+    const std::vector<double>& Columns::lats() const { return lat_; }
+    const std::vector<double>& Columns::lons() const { return lon_; }
+    const std::vector<float>& Columns::headings() const { return heading_; }
+    const std::vector<float>& Columns::speeds() const { return speed_; }
+    const std::vector<uint64_t>& Columns::times() const { return time_; }
+    const std::vector<uint64_t>& Columns::indexes() const { return index_; }
+    const std::vector<Columns::Id>& Columns::edge_ids() const { return edge_id_; }
+    const std::vector<Columns::Id>& Columns::interval_ids() const { return interval_id_; }
+    const std::vector<uint32_t>& Columns::out_degrees() const { return out_degree_; }
+    const std::vector<uint8_t>& Columns::flags() const { return flags_; }
+
+    string_utilities::CharSpan Columns::record( Index i ) const
+    {
+        const char* first = records_base() + record_offset_[i];
+        return string_utilities::CharSpan{ first, first + record_size_[i] };
+    }
+
+    Columns::Id Columns::edge_id( const geo::EdgeCPtr& eptr )
+    {
+        auto it = edge_lookup_.find( eptr.get() );
+
+        if (it != edge_lookup_.end()) {
+            return it->second;
+        }
+
+        Id id = static_cast<Id>(edges_.size());
+        edges_.push_back( eptr );
+        edge_lookup_.emplace( eptr.get(), id );
+
+        return id;
+    }
+
+    Columns::Id Columns::interval_id( const IntervalCPtr& iptr )
+    {
+        auto it = interval_lookup_.find( iptr.get() );
+
+        if (it != interval_lookup_.end()) {
+            return it->second;
+        }
+
+        Id id = static_cast<Id>(intervals_.size());
+        intervals_.push_back( iptr );
+        interval_lookup_.emplace( iptr.get(), id );
+
+        return id;
+    }
+
+    geo::EdgeCPtr Columns::get_fit_edge( Index i ) const
+    {
+        return edge_id_[i] == kNoId ? nullptr : edges_[edge_id_[i]];
+    }
+
+    void Columns::set_fit_edge( Index i, const geo::EdgeCPtr& eptr )
+    {
+        edge_id_[i] = eptr ? edge_id( eptr ) : kNoId;
+    }
+
+    IntervalCPtr Columns::get_critical_interval( Index i ) const
+    {
+        return interval_id_[i] == kNoId ? nullptr : intervals_[interval_id_[i]];
+    }
+
+    void Columns::set_critical_interval( Index i, const IntervalCPtr& iptr )
+    {
+        interval_id_[i] = iptr ? interval_id( iptr ) : kNoId;
+    }
+
+    void Columns::set_out_degree( Index i, uint32_t degree )
+    {
+        out_degree_[i] = degree;
+    }
+
+    void Columns::set_private( Index i )
+    {
+        flags_[i] |= kPrivate;
+    }
+
+    bool Columns::has_edge( Index i ) const
+    {
+        return edge_id_[i] != kNoId;
+    }
+
+    bool Columns::is_critical( Index i ) const
+    {
+        return interval_id_[i] != kNoId;
+    }
+
+    bool Columns::is_private( Index i ) const
+    {
+        return (flags_[i] & kPrivate) != 0;
+    }
+}
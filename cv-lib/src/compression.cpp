@@ -0,0 +1,634 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "compression.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#ifdef CVLIB_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef CVLIB_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace compression {
+
+    namespace {
+        const unsigned char kGzipMagic[] = { 0x1f, 0x8b };
+        const unsigned char kZstdMagic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+        const std::size_t kGzipTrailerSize = 8;                 // CRC32 and ISIZE.
+        const std::size_t kZstdMaxHeaderSize = 18;              // magic, descriptor, window, dictionary id and content size.
+
+        bool starts_with(const unsigned char* bytes, std::size_t n, const unsigned char* magic, std::size_t n_magic) {
+            return n >= n_magic && std::equal(magic, magic + n_magic, bytes);
+        }
+
+        uint64_t get_le(const unsigned char* bytes, std::size_t n) {
+            uint64_t value = 0;
+
+            for (std::size_t i = n; i > 0; --i) {
+                value = (value << 8) | bytes[i - 1];
+            }
+
+            return value;
+        }
+
+        /**
+         * Find the content size in a zstd frame header (RFC 8878 3.1.1.1); return false if it is not recorded.
+         */
+        bool zstd_content_size(const unsigned char* header, std::size_t n, uint64_t& size) {
+            if (n < 5) {
+                return false;
+            }
+
+            unsigned char descriptor = header[4];
+            unsigned fcs_flag = descriptor >> 6;
+            bool single_segment = (descriptor & 0x20) != 0;
+            const std::size_t dictionary_id_sizes[] = { 0, 1, 2, 4 };
+            const std::size_t fcs_sizes[] = { single_segment ? 1u : 0u, 2, 4, 8 };
+            std::size_t pos = 5 + (single_segment ? 0 : 1) + dictionary_id_sizes[descriptor & 0x03];
+            std::size_t fcs_size = fcs_sizes[fcs_flag];
+
+            if (fcs_size == 0 || pos + fcs_size > n) {
+                return false;
+            }
+
+            size = get_le(header + pos, fcs_size) + (fcs_size == 2 ? 256 : 0);
+
+            return true;
+        }
+
+        /**
+         * A read buffer that decodes the bytes of a source buffer a block at a time.
+         */
+        class DecodingBuffer : public std::streambuf {
+            public:
+                explicit DecodingBuffer(std::streambuf& source) :
+                    source_(source),
+                    in_(kBufferSize),
+                    out_(kBufferSize),
+                    in_begin_(0),
+                    in_end_(0),
+                    pending_(false)
+                {
+                    setg(out_.data(), out_.data(), out_.data());
+                }
+
+                virtual ~DecodingBuffer() {}
+
+            protected:
+                int_type underflow() {
+                    while (gptr() == egptr()) {
+                        // a full output block may leave decoded bytes in the codec.
+                        if (in_begin_ == in_end_ && !pending_) {
+                            in_begin_ = 0;
+                            in_end_ = static_cast<std::size_t>(source_.sgetn(in_.data(), static_cast<std::streamsize>(in_.size())));
+
+                            if (in_end_ == 0) {
+                                finish();
+
+                                return traits_type::eof();
+                            }
+                        }
+
+                        std::size_t n_in = in_end_ - in_begin_;
+                        std::size_t n_out = decode(in_.data() + in_begin_, n_in, out_.data(), out_.size());
+                        in_begin_ += n_in;
+                        pending_ = n_out == out_.size();
+                        setg(out_.data(), out_.data(), out_.data() + n_out);
+                    }
+
+                    return traits_type::to_int_type(*gptr());
+                }
+
+                /**
+                 * Decode the bytes of in into out; set in_size to the bytes used and return the bytes put in out.
+                 */
+                virtual std::size_t decode(const char* in, std::size_t& in_size, char* out, std::size_t out_size) = 0;
+
+                /**
+                 * Called at the end of the source; throw if the compressed stream is not complete.
+                 */
+                virtual void finish() = 0;
+
+            private:
+                std::streambuf& source_;
+                std::vector<char> in_;
+                std::vector<char> out_;
+                std::size_t in_begin_;
+                std::size_t in_end_;
+                bool pending_;
+        };
+
+        /**
+         * A write buffer that encodes its bytes into a sink buffer a block at a time.
+         */
+        class EncodingBuffer : public std::streambuf {
+            public:
+                explicit EncodingBuffer(std::streambuf& sink) :
+                    sink_(sink),
+                    in_(kBufferSize),
+                    out_(kBufferSize),
+                    finished_(false)
+                {
+                    setp(in_.data(), in_.data() + in_.size());
+                }
+
+                virtual ~EncodingBuffer() {}
+
+                /**
+                 * Encode the rest of the bytes and end the compressed stream; return false if the sink fails.
+                 */
+                bool finish() {
+                    if (finished_) {
+                        return true;
+                    }
+
+                    finished_ = true;
+
+                    return encode_block(true);
+                }
+
+            protected:
+                int_type overflow(int_type c) {
+                    if (finished_ || !encode_block(false)) {
+                        return traits_type::eof();
+                    }
+
+                    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                        *pptr() = traits_type::to_char_type(c);
+                        pbump(1);
+                    }
+
+                    return traits_type::not_eof(c);
+                }
+
+                /**
+                 * Encode the bytes of in into out; set in_size to the bytes used and out_size to the bytes put in out.
+                 * Return true when all of in is used and, at the end, the compressed stream is complete.
+                 */
+                virtual bool encode(const char* in, std::size_t& in_size, char* out, std::size_t& out_size, bool end) = 0;
+
+            private:
+                std::streambuf& sink_;
+                std::vector<char> in_;
+                std::vector<char> out_;
+                bool finished_;
+
+                bool encode_block(bool end) {
+                    const char* in = pbase();
+                    std::size_t n = static_cast<std::size_t>(pptr() - pbase());
+                    bool done = false;
+
+                    while (!done) {
+                        std::size_t n_in = n;
+                        std::size_t n_out = out_.size();
+                        done = encode(in, n_in, out_.data(), n_out, end);
+                        in += n_in;
+                        n -= n_in;
+
+                        if (n_out > 0 && sink_.sputn(out_.data(), static_cast<std::streamsize>(n_out)) != static_cast<std::streamsize>(n_out)) {
+                            return false;
+                        }
+                    }
+
+                    setp(in_.data(), in_.data() + in_.size());
+
+                    return true;
+                }
+        };
+
+#ifdef CVLIB_HAVE_ZLIB
+        const int kGzipWindowBits = 15 + 16;                    // the largest window, with a gzip wrapper.
+
+        std::string zlib_error(const z_stream& z) {
+            return std::string("gzip: ") + (z.msg ? z.msg : "corrupt data");
+        }
+
+        class GzipDecoder : public DecodingBuffer {
+            public:
+                explicit GzipDecoder(std::streambuf& source) :
+                    DecodingBuffer(source),
+                    z_(),
+                    in_member_(false)
+                {
+                    if (inflateInit2(&z_, kGzipWindowBits) != Z_OK) {
+                        throw std::invalid_argument("gzip: could not start the decoder");
+                    }
+                }
+
+                ~GzipDecoder() {
+                    inflateEnd(&z_);
+                }
+
+            protected:
+                std::size_t decode(const char* in, std::size_t& in_size, char* out, std::size_t out_size) {
+                    z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+                    z_.avail_in = static_cast<uInt>(in_size);
+                    z_.next_out = reinterpret_cast<Bytef*>(out);
+                    z_.avail_out = static_cast<uInt>(out_size);
+
+                    int rc = inflate(&z_, Z_NO_FLUSH);
+
+                    if (rc == Z_STREAM_END) {
+                        // another member may follow, e.g., from pigz or concatenated files.
+                        inflateReset(&z_);
+                        in_member_ = false;
+                    } else if (rc == Z_OK) {
+                        in_member_ = true;
+                    } else if (rc != Z_BUF_ERROR) {
+                        throw std::invalid_argument(zlib_error(z_));
+                    }
+
+                    in_size -= z_.avail_in;
+
+                    return out_size - z_.avail_out;
+                }
+
+                void finish() {
+                    if (in_member_) {
+                        throw std::invalid_argument("gzip: the file is truncated");
+                    }
+                }
+
+            private:
+                z_stream z_;
+                bool in_member_;                                // the last member read is not complete.
+        };
+
+        class GzipEncoder : public EncodingBuffer {
+            public:
+                explicit GzipEncoder(std::streambuf& sink) :
+                    EncodingBuffer(sink),
+                    z_()
+                {
+                    if (deflateInit2(&z_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, kGzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                        throw std::invalid_argument("gzip: could not start the encoder");
+                    }
+                }
+
+                ~GzipEncoder() {
+                    deflateEnd(&z_);
+                }
+
+            protected:
+                bool encode(const char* in, std::size_t& in_size, char* out, std::size_t& out_size, bool end) {
+                    z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+                    z_.avail_in = static_cast<uInt>(in_size);
+                    z_.next_out = reinterpret_cast<Bytef*>(out);
+                    z_.avail_out = static_cast<uInt>(out_size);
+
+                    int rc = deflate(&z_, end ? Z_FINISH : Z_NO_FLUSH);
+
+                    if (rc == Z_STREAM_ERROR) {
+                        throw std::invalid_argument(zlib_error(z_));
+                    }
+
+                    in_size -= z_.avail_in;
+                    out_size -= z_.avail_out;
+
+                    return end ? rc == Z_STREAM_END : z_.avail_in == 0;
+                }
+
+            private:
+                z_stream z_;
+        };
+#endif
+
+#ifdef CVLIB_HAVE_ZSTD
+        const int kZstdLevel = 3;                               // the zstd command line default.
+
+        class ZstdDecoder : public DecodingBuffer {
+            public:
+                explicit ZstdDecoder(std::streambuf& source) :
+                    DecodingBuffer(source),
+                    ds_(ZSTD_createDStream()),
+                    in_frame_(false)
+                {
+                    if (!ds_ || ZSTD_isError(ZSTD_initDStream(ds_))) {
+                        ZSTD_freeDStream(ds_);
+                        throw std::invalid_argument("zstd: could not start the decoder");
+                    }
+                }
+
+                ~ZstdDecoder() {
+                    ZSTD_freeDStream(ds_);
+                }
+
+            protected:
+                std::size_t decode(const char* in, std::size_t& in_size, char* out, std::size_t out_size) {
+                    ZSTD_inBuffer in_buffer = { in, in_size, 0 };
+                    ZSTD_outBuffer out_buffer = { out, out_size, 0 };
+                    std::size_t rc = ZSTD_decompressStream(ds_, &out_buffer, &in_buffer);
+
+                    if (ZSTD_isError(rc)) {
+                        throw std::invalid_argument(std::string("zstd: ") + ZSTD_getErrorName(rc));
+                    }
+
+                    // 0 when a frame is complete and flushed.
+                    in_frame_ = rc != 0;
+                    in_size = in_buffer.pos;
+
+                    return out_buffer.pos;
+                }
+
+                void finish() {
+                    if (in_frame_) {
+                        throw std::invalid_argument("zstd: the file is truncated");
+                    }
+                }
+
+            private:
+                ZSTD_DStream* ds_;
+                bool in_frame_;                                 // the last frame read is not complete.
+        };
+
+        class ZstdEncoder : public EncodingBuffer {
+            public:
+                explicit ZstdEncoder(std::streambuf& sink) :
+                    EncodingBuffer(sink),
+                    cs_(ZSTD_createCStream())
+                {
+                    if (!cs_ || ZSTD_isError(ZSTD_initCStream(cs_, kZstdLevel))) {
+                        ZSTD_freeCStream(cs_);
+                        throw std::invalid_argument("zstd: could not start the encoder");
+                    }
+                }
+
+                ~ZstdEncoder() {
+                    ZSTD_freeCStream(cs_);
+                }
+
+            protected:
+                bool encode(const char* in, std::size_t& in_size, char* out, std::size_t& out_size, bool end) {
+                    ZSTD_inBuffer in_buffer = { in, in_size, 0 };
+                    ZSTD_outBuffer out_buffer = { out, out_size, 0 };
+                    // the frame is ended once all of the input is taken.
+                    bool ending = end && in_size == 0;
+                    std::size_t rc = ending ? ZSTD_endStream(cs_, &out_buffer) : ZSTD_compressStream(cs_, &out_buffer, &in_buffer);
+
+                    if (ZSTD_isError(rc)) {
+                        throw std::invalid_argument(std::string("zstd: ") + ZSTD_getErrorName(rc));
+                    }
+
+                    in_size = in_buffer.pos;
+                    out_size = out_buffer.pos;
+
+                    return ending ? rc == 0 : !end && in_buffer.pos == in_buffer.size;
+                }
+
+            private:
+                ZSTD_CStream* cs_;
+        };
+#endif
+
+        std::streambuf* make_decoder(Format format, std::streambuf& source) {
+            switch (format) {
+#ifdef CVLIB_HAVE_ZLIB
+                case Format::kGzip:
+                    return new GzipDecoder(source);
+#endif
+#ifdef CVLIB_HAVE_ZSTD
+                case Format::kZstd:
+                    return new ZstdDecoder(source);
+#endif
+                default:
+                    return nullptr;
+            }
+        }
+
+        EncodingBuffer* make_encoder(Format format, std::streambuf& sink) {
+            switch (format) {
+#ifdef CVLIB_HAVE_ZLIB
+                case Format::kGzip:
+                    return new GzipEncoder(sink);
+#endif
+#ifdef CVLIB_HAVE_ZSTD
+                case Format::kZstd:
+                    return new ZstdEncoder(sink);
+#endif
+                default:
+                    return nullptr;
+            }
+        }
+
+        std::string format_name(Format format) {
+            switch (format) {
+                case Format::kGzip:
+                    return "gzip";
+                case Format::kZstd:
+                    return "zstd";
+                default:
+                    return "none";
+            }
+        }
+    }
+
+    bool is_supported(Format format) {
+        switch (format) {
+            case Format::kNone:
+                return true;
+            case Format::kGzip:
+#ifdef CVLIB_HAVE_ZLIB
+                return true;
+#else
+                return false;
+#endif
+            case Format::kZstd:
+#ifdef CVLIB_HAVE_ZSTD
+                return true;
+#else
+                return false;
+#endif
+        }
+
+        return false;
+    }
+
+    std::string file_extension(Format format) {
+        switch (format) {
+            case Format::kGzip:
+                return ".gz";
+            case Format::kZstd:
+                return ".zst";
+            default:
+                return "";
+        }
+    }
+
+    Format parse_format(const std::string& name) {
+        if (name.empty() || name == "none") {
+            return Format::kNone;
+        }
+
+        if (name == "gzip" || name == "gz") {
+            return Format::kGzip;
+        }
+
+        if (name == "zstd" || name == "zst") {
+            return Format::kZstd;
+        }
+
+        throw std::invalid_argument("Unknown compression format: " + name + "; expected none, gzip or zstd");
+    }
+
+    Format detect_format(std::istream& is) {
+        unsigned char magic[sizeof(kZstdMagic)];
+
+        is.clear();
+        is.seekg(0);
+        is.read(reinterpret_cast<char*>(magic), sizeof(magic));
+        std::size_t n = static_cast<std::size_t>(is.gcount());
+        is.clear();
+        is.seekg(0);
+
+        if (starts_with(magic, n, kGzipMagic, sizeof(kGzipMagic))) {
+            return Format::kGzip;
+        }
+
+        if (starts_with(magic, n, kZstdMagic, sizeof(kZstdMagic))) {
+            return Format::kZstd;
+        }
+
+        return Format::kNone;
+    }
+
+    uint64_t size_hint(std::istream& is) {
+        Format format = detect_format(is);
+
+        is.seekg(0, std::ios::end);
+        std::streamoff end = is.tellg();
+        uint64_t size = end > 0 ? static_cast<uint64_t>(end) : 0;
+        uint64_t hint = size * kSizeEstimateRatio;
+
+        if (format == Format::kGzip && size >= sizeof(kGzipMagic) + kGzipTrailerSize) {
+            unsigned char isize[4];
+            is.seekg(end - static_cast<std::streamoff>(sizeof(isize)));
+
+            // ISIZE is modulo 2^32 and only covers the last member, so a smaller size than the file is not trusted.
+            if (is.read(reinterpret_cast<char*>(isize), sizeof(isize)) && get_le(isize, sizeof(isize)) >= size) {
+                hint = get_le(isize, sizeof(isize));
+            }
+        } else if (format == Format::kZstd) {
+            unsigned char header[kZstdMaxHeaderSize];
+            is.clear();
+            is.seekg(0);
+            is.read(reinterpret_cast<char*>(header), sizeof(header));
+            uint64_t content_size;
+
+            if (zstd_content_size(header, static_cast<std::size_t>(is.gcount()), content_size) && content_size >= size) {
+                hint = content_size;
+            }
+        } else {
+            hint = size;
+        }
+
+        is.clear();
+        is.seekg(0);
+
+        return hint;
+    }
+
+    InputFile::InputFile(const std::string& file_path) :
+        std::istream(nullptr),
+        format_(Format::kNone)
+    {
+        rdbuf(&file_);
+
+        if (!file_.open(file_path, std::ios::in | std::ios::binary)) {
+            setstate(std::ios::failbit);
+
+            return;
+        }
+
+        format_ = detect_format(*this);
+
+        if (format_ == Format::kNone) {
+            return;
+        }
+
+        if (!is_supported(format_)) {
+            throw std::invalid_argument(file_path + " is " + format_name(format_) + " compressed, which this build cannot read");
+        }
+
+        decoder_.reset(make_decoder(format_, file_));
+        rdbuf(decoder_.get());
+        // the decoder reports corrupt data by throwing from the read.
+        exceptions(std::ios::badbit);
+    }
+
+    InputFile::~InputFile() {}
+
+    Format InputFile::get_format() const {
+        return format_;
+    }
+
+    void InputFile::close() {
+        if (!file_.close()) {
+            setstate(std::ios::failbit);
+        }
+    }
+
+    OutputFile::OutputFile(const std::string& file_path, Format format) :
+        std::ostream(nullptr)
+    {
+        if (!is_supported(format)) {
+            throw std::invalid_argument(format_name(format) + " compression is not supported by this build");
+        }
+
+        rdbuf(&file_);
+
+        if (!file_.open(file_path, std::ios::out | std::ios::trunc | std::ios::binary)) {
+            setstate(std::ios::failbit);
+
+            return;
+        }
+
+        if (format != Format::kNone) {
+            encoder_.reset(make_encoder(format, file_));
+            rdbuf(encoder_.get());
+        }
+    }
+
+    OutputFile::~OutputFile() {
+        try {
+            close();
+        } catch (std::exception&) {
+            // the stream cannot report a failure from here.
+        }
+    }
+
+    void OutputFile::close() {
+        if (!file_.is_open()) {
+            return;
+        }
+
+        if (encoder_ && !static_cast<EncodingBuffer*>(encoder_.get())->finish()) {
+            setstate(std::ios::badbit);
+        }
+
+        if (!file_.close()) {
+            setstate(std::ios::failbit);
+        }
+    }
+}
@@ -20,19 +20,23 @@
 #include <algorithm>
 
 #include "critical.hpp"
+#include "arena.hpp"
 
 namespace Detector {
 
     /******************************** TurnAround ************************************************/
-    TurnAround::TurnAround( size_t max_q_size, double area_width, double max_speed, double heading_delta ) :
+    TurnAround::TurnAround( size_t max_q_size, double area_width, double max_speed, double heading_delta, bool collect_areas ) :
         max_q_size{ max_q_size },
         area_width{ area_width },
         max_speed{ max_speed },
         heading_delta{ heading_delta  },
+        collect_areas{ collect_areas },
         is_previous_trip_point_fit{ false },
         fit_exit_point{ nullptr },
         is_fit_exit{ false },
-        area_q{},
+        area_q( max_q_size > 1 ? max_q_size - 1 : 0 ),
+        area_q_head{ 0 },
+        area_q_size{ 0 },
         current_edge{ nullptr },
         interval_list{},
         area_set{}
@@ -46,6 +50,86 @@ namespace Detector {
         return interval_list;
     }
 
+    const trajectory::Interval::PtrList& TurnAround::get_turn_arounds() const {
+        return interval_list;
+    }
+
+    trajectory::Index TurnAround::open_index( trajectory::Index next_index ) const {
+        trajectory::Index index = next_index;
+
+        // an implicit stretch may still end in a heading change back to the last explicitly fit point.
+        if (is_fit_exit && !is_previous_trip_point_fit) {
+            index = std::min<trajectory::Index>( index, fit_exit_point->get_index() );
+        }
+
+        // a turnaround into a queued area starts where the trip left that area's edge.
+        for (size_t i = 0; i < area_q_size; ++i) {
+            index = std::min<trajectory::Index>( index, queued_area( i ).index );
+        }
+
+        return index;
+    }
+
+    bool TurnAround::AreaRecord::contains( const geo::Point& pt ) const {
+        if (pt.lat < min_lat || pt.lat > max_lat || pt.lon < min_lon || pt.lon > max_lon) {
+            return false;
+        }
+
+        return !(geo::Area::outside_edge( corners[0], corners[1], pt ) ||
+                 geo::Area::outside_edge( corners[1], corners[2], pt ) ||
+                 geo::Area::outside_edge( corners[2], corners[3], pt ) ||
+                 geo::Area::outside_edge( corners[3], corners[0], pt ));
+    }
+
+    TurnAround::AreaRecord& TurnAround::queued_area( size_t i ) {
+        return area_q[(area_q_head + area_q.size() - i) % area_q.size()];
+    }
+
+    const TurnAround::AreaRecord& TurnAround::queued_area( size_t i ) const {
+        return area_q[(area_q_head + area_q.size() - i) % area_q.size()];
+    }
+
+    void TurnAround::push_area( uint64_t index ) {
+        geo::Point corners[4];
+
+        current_edge->area_corners( area_width, 0.0, corners );
+
+        if (area_q.empty()) {
+            // a queue of one or fewer areas keeps nothing.
+            return;
+        }
+
+        area_q_head = (area_q_head + 1) % area_q.size();
+        area_q_size = std::min( area_q_size + 1, area_q.size() );
+
+        AreaRecord& record = area_q[area_q_head];
+        record.min_lat = record.max_lat = corners[0].lat;
+        record.min_lon = record.max_lon = corners[0].lon;
+
+        for (int i = 0; i < 4; ++i) {
+            record.corners[i] = corners[i];
+            record.min_lat = std::min( record.min_lat, corners[i].lat );
+            record.max_lat = std::max( record.max_lat, corners[i].lat );
+            record.min_lon = std::min( record.min_lon, corners[i].lon );
+            record.max_lon = std::max( record.max_lon, corners[i].lon );
+        }
+
+        record.index = index;
+        record.area.reset();
+    }
+
+    void TurnAround::collect_area( AreaRecord& record ) {
+        if (!collect_areas) {
+            return;
+        }
+
+        if (!record.area) {
+            record.area = memory::make_shared<geo::Area>( record.corners[0], record.corners[1], record.corners[2], record.corners[3] );
+        }
+
+        area_set.insert( record.area );
+    }
+
     void TurnAround::update_turn_around_state( const trajectory::Point::Ptr& tp ) {
         geo::EdgeCPtr tp_edge = tp->get_fit_edge();
 
@@ -60,11 +144,11 @@ namespace Detector {
                 if (is_fit_exit && tp->heading_delta( *fit_exit_point ) >= heading_delta) {
                     // There is a change in fit trajectory headings.
                     // This is a critical interval.
-                    interval_list.push_back( std::make_shared<trajectory::Interval>( fit_exit_point->get_index(), tp->get_index(), "ta_fit" ) );
+                    interval_list.push_back( memory::make_shared<trajectory::Interval>( fit_exit_point->get_index(), tp->get_index(), "ta_fit" ) );
                 }
 
                 current_edge = nullptr;
-                area_q.clear();
+                area_q_size = 0;
                 is_previous_trip_point_fit = true;
             }
             
@@ -82,18 +166,11 @@ namespace Detector {
             if (is_critical_interval( tp )) {
                 // A turn around was detected.
                 // Reset the queue.
-                bool first;
-
-                for (auto& atptr : area_q) {
-                    if (first) {
-                        area_set.insert( atptr->first );
-                        first = false;
-
-                        continue;
-                    }
+                if (area_q_size > 0) {
+                    collect_area( queued_area( 0 ) );
                 }
 
-                area_q.clear();
+                area_q_size = 0;
             }
 
             if (current_edge->get_uid() != tp_edge->get_uid()) {
@@ -101,12 +178,7 @@ namespace Detector {
                 // Add the edge to the area queue and update the edge.
                 try 
                 {
-                    geo::Area::Ptr aptr = current_edge->to_area( area_width, 0.0 );
-                    area_q.push_front( std::make_shared<AreaIndexPair>( aptr, tp->get_index() ));
-
-                    if (area_q.size() >= max_q_size) {
-                        area_q.pop_back();
-                    }
+                    push_area( tp->get_index() );
                 }
                 catch (geo::ZeroAreaException)
                 {
@@ -120,18 +192,14 @@ namespace Detector {
     }
 
     bool TurnAround::is_critical_interval( const trajectory::Point::Ptr& tp ) {
-        bool first = true;
+        // the most recent area is around the edge the trip just left.
+        for (size_t i = 1; i < area_q_size; ++i) {
+            AreaRecord& record = queued_area( i );
 
-        for (auto& atptr : area_q) {
-            if (first) {
-                first = false;
-
-                continue;
-            }
+            if (record.contains( *tp ) && tp->get_speed() < max_speed) {
+                collect_area( record );
 
-            if (atptr->first->contains( *tp ) && tp->get_speed() < max_speed) {
-                area_set.insert( atptr->first );
-                interval_list.push_back( std::make_shared<trajectory::Interval>(atptr->second, tp->get_index(), "ta"));
+                interval_list.push_back( memory::make_shared<trajectory::Interval>(record.index, tp->get_index(), "ta"));
 
                 return true;
             }
@@ -160,7 +228,7 @@ namespace Detector {
     Stop::Deque::size_type Stop::Deque::length() const
     {
         if (q.empty()) return 0;
-        return (*q.back())->get_index() - (*q.front())->get_index() + 1;
+        return q.back()->get_index() - q.front()->get_index() + 1;
     }
 
     /**
@@ -170,7 +238,7 @@ namespace Detector {
     uint64_t Stop::Deque::delta_time() const
     {
         if (q.empty()) return 0;
-        return (*q.back())->get_time() - (*q.front())->get_time();
+        return q.back()->get_time() - q.front()->get_time();
     }
 
     /**
@@ -201,8 +269,8 @@ namespace Detector {
         // must have at least 2 points to have non-zero distance.
         if (q.size()<2) return 0.0;
 
-        trajectory::Point::Ptr f = *q.front();
-        trajectory::Point::Ptr b = *q.back();
+        trajectory::Point::Ptr f = q.front();
+        trajectory::Point::Ptr b = q.back();
 
         return geo::Location::distance( *f, *b );
     }
@@ -214,7 +282,7 @@ namespace Detector {
      */
     bool Stop::Deque::under_time( const trajectory::Point::Ptr& ptptr ) const
     {
-        uint64_t time_period = ptptr->get_time() - (*q.front())->get_time();
+        uint64_t time_period = ptptr->get_time() - q.front()->get_time();
         return (time_period <= stop_detector.max_time);
     }
 
@@ -237,7 +305,7 @@ namespace Detector {
     Stop::Deque::size_type Stop::Deque::left_index() const
     {
         if (!q.empty()) {
-            return (*q.front())->get_index();
+            return q.front()->get_index();
         } else {
             return 0;
         }
@@ -249,7 +317,7 @@ namespace Detector {
     Stop::Deque::size_type Stop::Deque::right_index() const
     {
         if (!q.empty()) {
-            return (*q.back())->get_index();
+            return q.back()->get_index();
         } else {
             return 0;
         }
@@ -274,7 +342,7 @@ namespace Detector {
         // second, we can remove all points that should not have been placed on the deque in the first place.
         // the reason they are on the deque now is because previous points met the conditions we are checking
         // for here.
-        while ( !q.empty() && !(under_speed( *q.front() ) && Stop::valid_highway( *q.front() ) ) ) {
+        while ( !q.empty() && !(under_speed( q.front() ) && stop_detector.valid_highway( q.front() ) ) ) {
             pop_left();
         }
 
@@ -284,15 +352,15 @@ namespace Detector {
     /**
      * Add a point/iterator to the back (right) of the deque and update the manhattan distance.
      */
-    void Stop::Deque::push_right( const trajectory::CIterator& it )
+    void Stop::Deque::push_right( const trajectory::Point::Ptr& tp )
     {
         if ( !q.empty() ) {
             // Compute the distance covered between the last point and the newly added point.
-            double dd = geo::Location::distance( *(*it), *(*(q.back())) ); 
+            double dd = geo::Location::distance( *tp, *q.back() ); 
             cumulative_distance += dd;
         }
 
-        q.push_back(it);
+        q.push_back(tp);
     }
 
     void Stop::Deque::reset()
@@ -309,23 +377,23 @@ namespace Detector {
      * If the deque contain one or fewer points or the manhattan distance goes negative this code RESETS the manhattan
      * distance state variable to 0.0.
      */
-    trajectory::CIterator Stop::Deque::pop_left()
+    trajectory::Point::Ptr Stop::Deque::pop_left()
     {
         // remove the oldest point from the left side of the deque.
-        trajectory::CIterator it = q.front();
+        trajectory::Point::Ptr tp = q.front();
         q.pop_front();
 
         if ( q.size() > 1 ) {   // some cumulative distance remains to be tracked.
             // update the cumulative distance by subtracting the straight-line distance between the point
             // removed and the new back of the deque.  We know the deque is not empty.
-            cumulative_distance -= geo::Location::distance( *(*it), *(*(q.back())) );
+            cumulative_distance -= geo::Location::distance( *tp, *q.back() );
 
         } else {                // q.size() <= 1, i.e., no distance.
 
             cumulative_distance = 0.0;
         }
 
-        return it;
+        return tp;
     }
 
     std::ostream& operator<<( std::ostream& os, const Stop::Deque& q )
@@ -341,14 +409,19 @@ namespace Detector {
 
     /******************************** Stop ************************************************/
 
-    osm::HighwaySet Stop::excluded_highways{ 
-        { osm::Highway::MOTORWAY,
-        osm::Highway::TRUNK,
-        osm::Highway::PRIMARY,
-        osm::Highway::MOTORWAY_LINK,
-        osm::Highway::TRUNK_LINK,
-        osm::Highway::PRIMARY_LINK }
-    };
+    const osm::HighwaySet& Stop::default_excluded_highways()
+    {
+        static const osm::HighwaySet excludes{ 
+            { osm::Highway::MOTORWAY,
+            osm::Highway::TRUNK,
+            osm::Highway::PRIMARY,
+            osm::Highway::MOTORWAY_LINK,
+            osm::Highway::TRUNK_LINK,
+            osm::Highway::PRIMARY_LINK }
+        };
+
+        return excludes;
+    }
 
     std::size_t Stop::set_excluded_highways( const osm::HighwaySet& excludes )
     {
@@ -368,7 +441,7 @@ namespace Detector {
      * Return false if the road the trip point is on is EXPLICIT and fit to a black list road -- we ignore stops on
      * those roads.
      */
-    bool Stop::valid_highway( const trajectory::Point::Ptr& ptptr )
+    bool Stop::valid_highway( const trajectory::Point::Ptr& ptptr ) const
     {
         if (ptptr->is_explicitly_fit()) {           // this trip point has an OSM way type.
             
@@ -382,11 +455,13 @@ namespace Detector {
         return true;
     }
 
-    Stop::Stop( double max_time, double min_distance, double max_speed ) :
+    Stop::Stop( double max_time, double min_distance, double max_speed, const osm::HighwaySet& excluded_highways ) :
+        excluded_highways {excluded_highways},
         max_time {static_cast<uint64_t>( max_time * 1000000 )},
         min_distance {min_distance},
         max_speed {max_speed},
-        critical_intervals{}
+        critical_intervals{},
+        q{ *this }
     {
     }
 
@@ -397,55 +472,79 @@ namespace Detector {
      */
     trajectory::Interval::PtrList& Stop::find_stops( const trajectory::Trajectory& traj )
     {
-        Stop::Deque q{*this};
-
         // made a const_iterator so we can keep the traj const-correctness.
-        trajectory::CIterator t_it = traj.begin();
+        for ( trajectory::CIterator t_it = traj.begin(); t_it != traj.end(); ++t_it ) {
+            update_stop_state( t_it );
+        }
 
-        while ( t_it != traj.end() ) {                  // outer loop.
+        return finish_stops();
+    }
 
-            // only investigate trip points that are under max_speed and on the right kind of roads.
-            if ( q.under_speed( *t_it ) && valid_highway( *t_it ) ) {
+    /**
+     * Consider the next trip point.  An empty deque means we are looking for the first point of a new interval; a
+     * non-empty deque means we are trying to maximize the deque's invariant time condition with the point in hand.
+     */
+    void Stop::update_stop_state( const trajectory::CIterator& t_it )
+    {
+        update_stop_state( *t_it );
+    }
 
-                q.push_right( t_it );                   // this should always be the first point into the q.
-                ++t_it;                                 // we work with a non-empty q and a point in hand in the second phase.
+    void Stop::update_stop_state( const trajectory::Point::Ptr& tp )
+    {
+        while ( true ) {
 
-                while ( t_it != traj.end() ) {          // inner loop to maximize the deque's invariant time condition.
+            if ( q.q.empty() ) {
 
-                    if ( q.under_time( *t_it ) ) {      // time of current point - oldest point in deque <= max_time.
+                // only investigate trip points that are under max_speed and on the right kind of roads.
+                if ( q.under_speed( tp ) && valid_highway( tp ) ) {
+                    q.push_right( tp );               // this should always be the first point into the q.
+                }                                       // speed >= max_speed OR on black listed highway; just skip.
 
-                        
-                        q.push_right( t_it );           // invariant continues to hold based on the check just done.
-                        ++t_it;                         // new point in hand.
+                return;
+            }
+
+            if ( q.under_time( tp ) ) {              // time of current point - oldest point in deque <= max_time.
 
-                    } else {                            // this point will break the invariant condition, so check for distance.
+                q.push_right( tp );                   // invariant continues to hold based on the check just done.
+                return;
 
-                        if ( q.under_distance() ) {     // distance covered in the deque <= minimum distance parameter; CI detected.
+            }                                           // this point will break the invariant condition, so check for distance.
 
-                            // critical interval to save.  The entire deque, so it is empty.
-                            trajectory::IntervalPtr ciptr =  std::make_shared<trajectory::Interval>( trajectory::Interval{ q.left_index(), q.right_index(), "stop" } );
-                            critical_intervals.push_back( ciptr );
-                            q.reset();                  // prepare for next critical interval.
-                            break;                      // t_it is a valid point that needs checking in outer loop for new interval.
+            if ( q.under_distance() ) {                 // distance covered in the deque <= minimum distance parameter; CI detected.
 
-                        } else {                        // "over distance"
+                // critical interval to save.  The entire deque, so it is empty.
+                trajectory::IntervalPtr ciptr =  memory::make_shared<trajectory::Interval>( trajectory::Interval{ q.left_index(), q.right_index(), "stop" } );
+                critical_intervals.push_back( ciptr );
+                q.reset();                              // prepare for next critical interval; tp needs checking for a new interval.
 
-                            // remove points from front of deque; could empty deque.
-                            if (q.unwind()) break;
+            } else {                                    // "over distance"
 
-                        }
-                    }
-                }  
+                // remove points from front of deque; could empty deque; either way tp is checked again.
+                q.unwind();
 
-            } else {                                    // speed >= max_speed OR on black listed highway; just skip.
-                ++t_it;                                 // new point in hand.
             }
-        }                                               // outer loop end.
+        }
+    }
 
+    trajectory::Interval::PtrList& Stop::finish_stops()
+    {
         // could have a non-empty deque... decision: since the deque has not satisfied the conditions we IGNORE this
         // interval.  It should be made up using the begin and end point use anyway.
+        q.reset();
+
+        return critical_intervals;
+    }
+
+    const trajectory::Interval::PtrList& Stop::get_stops() const
+    {
         return critical_intervals;
     }
+
+    trajectory::Index Stop::open_index( trajectory::Index next_index ) const
+    {
+        // a stop found later starts with a point still in the deque or with a point not seen yet.
+        return q.q.empty() ? next_index : q.q.front()->get_index();
+    }
 }
 
 /******************************** StartEndIntervals ************************************************/
@@ -457,8 +556,8 @@ const trajectory::Interval::PtrList& StartEndIntervals::get_start_end_intervals(
     }
    
     trajectory::Index second_to_last_index = traj.size() > 0 ? traj.size() - 1 : 0;
-    intervals.push_back( std::make_shared<trajectory::Interval>( 0, 1, "start_pt" ) );
-    intervals.push_back( std::make_shared<trajectory::Interval>( second_to_last_index, second_to_last_index + 1, "end_pt" ) );
+    intervals.push_back( memory::make_shared<trajectory::Interval>( 0, 1, "start_pt" ) );
+    intervals.push_back( memory::make_shared<trajectory::Interval>( second_to_last_index, second_to_last_index + 1, "end_pt" ) );
 
     return intervals;
 } 
@@ -554,7 +653,7 @@ void IntervalMarker::merge_intervals( const std::initializer_list<trajectory::In
             // This interval starts after the saved interval.
             // Add the saved interval to the list and update the 
             // saved interval state.
-            intervals.push_back( std::make_shared<trajectory::Interval>( start, end, aux_set_ptr, n_merged ) );
+            intervals.push_back( memory::make_shared<trajectory::Interval>( start, end, aux_set_ptr, n_merged ) );
             n_merged++;
 
             start = next_start;
@@ -565,7 +664,7 @@ void IntervalMarker::merge_intervals( const std::initializer_list<trajectory::In
     
     // The intevals were exhausted.
     // Add the removing saved interval to the list.
-    intervals.push_back( std::make_shared<trajectory::Interval>( start, end, aux_set_ptr, n_merged ) );
+    intervals.push_back( memory::make_shared<trajectory::Interval>( start, end, aux_set_ptr, n_merged ) );
 }
 
 void IntervalMarker::set_next_interval()
@@ -587,16 +686,38 @@ void IntervalMarker::mark_trajectory( trajectory::Trajectory& traj )
     }
 }
 
+void IntervalMarker::mark_trajectory( trajectory::Columns& cols ) 
+{
+    for (trajectory::Index i = 0; i < cols.size(); ++i) {
+        trajectory::IntervalCPtr interval = containing_interval( cols.indexes()[i] );
+
+        if (interval) {
+            // Set critical interval for the trip point.
+            cols.set_critical_interval( i, interval );
+        }
+    }
+}
+
 void IntervalMarker::mark_trip_point( trajectory::Point::Ptr& tp ) 
+{
+    trajectory::IntervalCPtr interval = containing_interval( tp->get_index() );
+
+    if (interval) {
+        // Set critical interval for the trip point.
+        tp->set_critical_interval( interval );
+    }
+}
+
+trajectory::IntervalCPtr IntervalMarker::containing_interval( trajectory::Index index ) 
 {
     if (!iptr) 
     {
         // There are no more intervals.
         // Nothing can be done for this trip point.
-        return;
+        return nullptr;
     }
     
-    while (iptr->is_before( tp->get_index() ))
+    while (iptr->is_before( index ))
     {
         // The trip point is after the end of the interval.
         // Find the next interval that contains the trip point.
@@ -606,21 +727,19 @@ void IntervalMarker::mark_trip_point( trajectory::Point::Ptr& tp )
         {
             // There are no more intervals.
             // Nothing can be done for this trip point.
-            return;
+            return nullptr;
         }
     }
         
     // The trip point is before or within the interval.
     // Check if it is within.
-    if (iptr->contains( tp->get_index() )) 
+    if (iptr->contains( index )) 
     {
         // The trip point is within the interval.
-        // Set critical interval for the trip point.
-        tp->set_critical_interval( iptr );
-
-        return;
+        return iptr;
     }
 
     // The trip point is before the interval.
     // Check the next trip point.
+    return nullptr;
 }
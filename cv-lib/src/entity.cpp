@@ -22,10 +22,15 @@
 #include <sstream>
 
 #include "entity.hpp"
+#include "arena.hpp"
 #include "utilities.hpp"
 
 namespace geo {
 
+namespace {
+    const uint32_t kUnrecorded = std::numeric_limits<uint32_t>::max();       // an edge end without a recorded out-degree.
+}
+
 Point::Point() :
     lat{0.0},
     lon{0.0}
@@ -227,6 +232,13 @@ uint32_t Vertex::outdegree() const
     return 0;
 }
 
+void Vertex::record_outdegree( uint32_t d )
+{
+    for (auto& eptr : edges_) {
+        eptr->set_end_outdegree( *this, d );
+    }
+}
+
 bool Vertex::add_edge( EdgePtr eptr )
 {
     auto result = edges_.insert( eptr );
@@ -242,6 +254,11 @@ bool Vertex::add_edges( EdgePtrSet& eptrs )
     return (degree() > before);
 }
 
+void Vertex::clear_edges()
+{
+    edges_.clear();
+}
+
 void Vertex::update_location( const Location& loc )
 {
     uid = loc.uid;
@@ -265,7 +282,8 @@ Edge::Edge( const Vertex::Ptr& vp1, const Vertex::Ptr& vp2, const osm::Highway t
     v2{ vp2 },
     uid_{id},
     way_type_{type},
-    explicit_edge_{explicit_edge}
+    explicit_edge_{explicit_edge},
+    end_outdegree_{ kUnrecorded, kUnrecorded }
 {
 }
 
@@ -328,6 +346,26 @@ uint64_t Edge::get_uid() const
     return uid_;
 }
 
+uint32_t Edge::end_outdegree( int end ) const
+{
+    if (end_outdegree_[end] != kUnrecorded) {
+        return end_outdegree_[end];
+    }
+
+    return end == 0 ? v1->outdegree() : v2->outdegree();
+}
+
+void Edge::set_end_outdegree( const Vertex& vertex, uint32_t d )
+{
+    if (v1.get() == &vertex) {
+        end_outdegree_[0] = d;
+    }
+
+    if (v2.get() == &vertex) {
+        end_outdegree_[1] = d;
+    }
+}
+
 double Edge::get_way_width() const
 {
     return osm::highway_width_map[static_cast<int>(way_type_)];
@@ -429,13 +467,21 @@ AreaPtr Edge::to_area( double extension ) const
 }
 
 AreaPtr Edge::to_area( double cap_width, double extension ) const
+{
+    Point corners[4];
+
+    area_corners( cap_width, extension, corners );
+
+    // Return the area described by the corners.
+    return memory::make_shared<Area>( corners[0], corners[1], corners[2], corners[3] );
+}
+
+void Edge::area_corners( double cap_width, double extension, Point (&corners)[4] ) const
 {
     double half_width;
     double ab_bearing;
     double x_bearing;
     double y_bearing;
-    Vertex::Ptr v1_tmp;
-    Vertex::Ptr v2_tmp;
 
     if (cap_width <= 0.0) {
         throw ZeroAreaException();
@@ -444,24 +490,24 @@ AreaPtr Edge::to_area( double cap_width, double extension ) const
     half_width = cap_width / 2.0;
     ab_bearing = v1->bearing_to(*v2);
 
-    v1_tmp = v1; 
-    v2_tmp = v2; 
+    Location v1_tmp = *v1;
+    Location v2_tmp = *v2;
 
     if (extension > 0.0) {
         // Extend the nodes of this edge.
-        v1_tmp = std::make_shared<Vertex>(v1_tmp->project_position(std::fmod(ab_bearing - 180.0, 360.0), extension));
-        v2_tmp = std::make_shared<Vertex>(v2_tmp->project_position(ab_bearing, extension));
+        v1_tmp = v1_tmp.project_position(std::fmod(ab_bearing - 180.0, 360.0), extension);
+        v2_tmp = v2_tmp.project_position(ab_bearing, extension);
     }
 
     // Get the bearing to the area corners.
     x_bearing = std::fmod(ab_bearing - 90.0, 360.0);
     y_bearing = std::fmod(ab_bearing + 90.0, 360.0);
     
-    // Get the locations of the corners and return the area.
-    return std::make_shared<Area>(v1_tmp->project_position(x_bearing, half_width),
-        v2_tmp->project_position(x_bearing, half_width),
-        v2_tmp->project_position(y_bearing, half_width),
-        v1_tmp->project_position(y_bearing, half_width));
+    // Get the locations of the corners.
+    corners[0] = v1_tmp.project_position(x_bearing, half_width);
+    corners[1] = v2_tmp.project_position(x_bearing, half_width);
+    corners[2] = v2_tmp.project_position(y_bearing, half_width);
+    corners[3] = v1_tmp.project_position(y_bearing, half_width);
 }
 
 Area::Area( const Point& p1, const Point& p2, const Point& p3, const Point& p4 ) :
@@ -471,6 +517,7 @@ Area::Area( const Point& p1, const Point& p2, const Point& p3, const Point& p4 )
     corners_.push_back( p2 );
     corners_.push_back( p3 );
     corners_.push_back( p4 );
+    init_frame();
 }
 
 Area::Area( const Point&& p1, const Point&& p2, const Point&& p3, const Point&& p4 ) :
@@ -480,6 +527,7 @@ Area::Area( const Point&& p1, const Point&& p2, const Point&& p3, const Point&&
     corners_.push_back( p2 );
     corners_.push_back( p3 );
     corners_.push_back( p4 );
+    init_frame();
 }
 
 const EntityType Area::get_entity_type(void) const {
@@ -528,10 +576,15 @@ bool Area::outside_edge( int p1, const Point& pt ) const
     // p1+1%4 is the index of the second point that defines the edge of interest.
     int p2 = (p1 + 1) % 4;
 
-    double C = corners_[p1].lat * ( corners_[p2].lon - corners_[p1].lon ) - corners_[p1].lon * ( corners_[p2].lat - corners_[p1].lat );
-    double D = -pt.lat * ( corners_[p2].lon - corners_[p1].lon ) + pt.lon * ( corners_[p2].lat - corners_[p1].lat ) + C;
+    return outside_edge( corners_[p1], corners_[p2], pt );
+}
+
+bool Area::outside_edge( const Point& c1, const Point& c2, const Point& pt )
+{
+    double C = c1.lat * ( c2.lon - c1.lon ) - c1.lon * ( c2.lat - c1.lat );
+    double D = -pt.lat * ( c2.lon - c1.lon ) + pt.lon * ( c2.lat - c1.lat ) + C;
 
-    // negative D indicates pt is to the left of a line from p1 to p2.
+    // negative D indicates pt is to the left of a line from c1 to c2.
     return (D < 0.0);
 }
 
@@ -543,6 +596,61 @@ bool Area::contains( const Point& pt ) const
              outside_edge( 3, pt ));
 }
 
+void Area::init_frame()
+{
+    // an equirectangular projection is an affine map with a positive determinant, so the sides of the edges the
+    // points fall on are those of outside_edge; the lengths are meters.
+    frame_lat_ = corners_[0].lat;
+    frame_lon_ = corners_[0].lon;
+    frame_ky_ = to_radians( 1.0 ) * kEarthRadiusM;
+    frame_kx_ = frame_ky_ * std::cos( to_radians( frame_lat_ ) );
+
+    for (int p1 = 0; p1 < 4; ++p1) {
+        int p2 = (p1 + 1) % 4;
+
+        double x1 = (corners_[p1].lon - frame_lon_) * frame_kx_;
+        double y1 = (corners_[p1].lat - frame_lat_) * frame_ky_;
+        double dx = (corners_[p2].lon - frame_lon_) * frame_kx_ - x1;
+        double dy = (corners_[p2].lat - frame_lat_) * frame_ky_ - y1;
+        double length = std::sqrt( dx * dx + dy * dy );
+
+        if (length == 0.0) {
+            // a degenerate edge has no outside.
+            edge_a_[p1] = edge_b_[p1] = edge_c_[p1] = 0.0;
+            continue;
+        }
+
+        // negative values are to the left of the line from p1 to p2.
+        edge_a_[p1] = dy / length;
+        edge_b_[p1] = -dx / length;
+        edge_c_[p1] = (dx * y1 - dy * x1) / length;
+    }
+}
+
+bool Area::outside_edge_planar( int edge, const Point& pt, double tolerance ) const
+{
+    if (edge < 0 || edge > 3) return false;
+
+    double x = (pt.lon - frame_lon_) * frame_kx_;
+    double y = (pt.lat - frame_lat_) * frame_ky_;
+
+    return edge_a_[edge] * x + edge_b_[edge] * y + edge_c_[edge] < -tolerance;
+}
+
+bool Area::contains_planar( const Point& pt, double tolerance ) const
+{
+    double x = (pt.lon - frame_lon_) * frame_kx_;
+    double y = (pt.lat - frame_lat_) * frame_ky_;
+
+    for (int edge = 0; edge < 4; ++edge) {
+        if (edge_a_[edge] * x + edge_b_[edge] * y + edge_c_[edge] < -tolerance) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 const std::string Area::get_poly_string() const
 {
     std::ostringstream ss;
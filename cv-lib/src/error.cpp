@@ -18,109 +18,274 @@
  * For issues, question, and comments, please submit a issue via GitHub.
  *******************************************************************************/
 #include "error.hpp"
+#include "kernels.hpp"
 
 #include <algorithm>
 #include <cmath>
+#include <iterator>
+#include <set>
+#include <stdexcept>
 
-ErrorCorrector::ErrorCorrector(uint64_t sample_size) :
-    sample_size_(sample_size),
-    is_explicit_edge_(false),
-    current_eptr_(nullptr)
-{}
+namespace {
+    /**
+     * Select the element a full sort would put at index size / 2 without sorting; the samples are reordered.
+     */
+    double select_median(std::vector<double>& samples) {
+        std::vector<double>::iterator mid = samples.begin() + samples.size() / 2;
+        std::nth_element(samples.begin(), mid, samples.end());
 
-void ErrorCorrector::correct_error(trajectory::Trajectory& traj, const std::string& uid) {
-    if (traj.size() <= 1) {
-        return;
+        return *mid;
     }
 
-    remove_points(traj, 0, sample_size_, uid);
+    /**
+     * A point is an error when reaching it from the median position would take an implausible speed.
+     */
+    bool is_error(double distance, std::size_t n_samples) {
+        double time_est = (static_cast<double>(n_samples) / 2.0) * 0.1;
 
-    if (traj.size() <= sample_size_) {
-        correct_indices(traj);
+        // 44.7 m/s = 100 mph (a heuristic)
+        return distance / time_est > 44.7;
+    }
 
-        return;
+    bool is_error(const trajectory::Point& tp, double med_lat, double med_lon, std::size_t n_samples) {
+        return is_error(geo::Location::distance(tp.lat, tp.lon, med_lat, med_lon), n_samples);
     }
 
-    remove_points(traj, traj.size() - sample_size_, traj.size(), uid);
+    /**
+     * The median (element size / 2 of the sorted values) of a window of values that slides; each update is
+     * logarithmic in the window size.
+     */
+    class SlidingMedian {
+        public:
+            void insert(double x) {
+                if (values_.empty()) {
+                    mid_ = values_.insert(x);
+                    mid_index_ = 0;
 
-    correct_indices(traj);
+                    return;
+                }
+
+                // equal values are inserted after the existing ones, i.e., after mid_.
+                values_.insert(x);
+
+                if (x < *mid_) {
+                    ++mid_index_;
+                }
+
+                rebalance();
+            }
+
+            void erase(double x) {
+                if (x == *mid_) {
+                    // the successor of the median moves into its index.
+                    std::multiset<double>::iterator next = std::next(mid_);
+                    values_.erase(mid_);
+                    mid_ = next;
+
+                    if (values_.empty()) {
+                        return;
+                    }
+
+                    if (mid_ == values_.end()) {
+                        --mid_;
+                        --mid_index_;
+                    }
+                } else {
+                    values_.erase(values_.find(x));
+
+                    if (x < *mid_) {
+                        --mid_index_;
+                    }
+                }
+
+                rebalance();
+            }
+
+            double median() const {
+                return *mid_;
+            }
+
+        private:
+            std::multiset<double> values_;
+            std::multiset<double>::iterator mid_;
+            std::size_t mid_index_ = 0;
+
+            void rebalance() {
+                std::size_t k = values_.size() / 2;
+
+                while (mid_index_ < k) {
+                    ++mid_;
+                    ++mid_index_;
+                }
+
+                while (mid_index_ > k) {
+                    --mid_;
+                    --mid_index_;
+                }
+            }
+    };
+}
+
+ErrorCorrector::ErrorCorrector(uint64_t sample_size, bool sliding_window) :
+    sample_size_(sample_size),
+    sliding_window_(sliding_window)
+{
+    if (sample_size_ == 0) {
+        throw std::invalid_argument("ErrorCorrector: the sample size must be positive.");
+    }
+}
+
+void ErrorCorrector::correct_error(trajectory::Trajectory& traj, const std::string& uid) {
+    instrument::NullCounter point_counter;
+
+    correct_error(traj, uid, point_counter);
 }
 
-void ErrorCorrector::correct_error(trajectory::Trajectory& traj, const std::string& uid, instrument::PointCounter& point_counter) {
+template <typename Counter>
+void ErrorCorrector::correct_error(trajectory::Trajectory& traj, const std::string& uid, Counter& point_counter) {
     if (traj.size() <= 1) {
         return;
     }
 
-    remove_points(traj, 0, sample_size_, uid, point_counter);
+    point_counter.n_error_points += remove_errors(traj);
+    correct_indices(traj);
+}
 
-    if (traj.size() <= sample_size_) {
-        correct_indices(traj);
+template void ErrorCorrector::correct_error(trajectory::Trajectory&, const std::string&, instrument::PointCounter&);
+template void ErrorCorrector::correct_error(trajectory::Trajectory&, const std::string&, instrument::NullCounter&);
 
-        return;
+uint64_t ErrorCorrector::remove_errors(trajectory::Trajectory& traj) {
+    if (sliding_window_) {
+        return remove_points_sliding(traj);
     }
 
-    remove_points(traj, traj.size() - sample_size_, traj.size(), uid, point_counter);
+    uint64_t n_removed = remove_points(traj, 0, sample_size_);
 
-    correct_indices(traj);
+    if (traj.size() <= sample_size_) {
+        return n_removed;
+    }
+
+    return n_removed + remove_points(traj, traj.size() - sample_size_, traj.size());
 }
 
-void ErrorCorrector::remove_points(trajectory::Trajectory& traj, uint64_t start, uint64_t end, const std::string& uid) {
-    std::vector<double> lats;
-    std::vector<double> lons;
+uint64_t ErrorCorrector::remove_points(trajectory::Trajectory& traj, uint64_t start, uint64_t end) {
+    lats_.clear();
+    lons_.clear();
 
     for (uint64_t i = start; i < traj.size() && i < end; ++i) {
-        lats.push_back(traj[i]->lat);
-        lons.push_back(traj[i]->lon);
+        lats_.push_back(traj[i]->lat);
+        lons_.push_back(traj[i]->lon);
     }
 
-    std::sort(lats.begin(), lats.end());
-    std::sort(lons.begin(), lons.end());
+    if (lats_.empty()) {
+        return 0;
+    }
 
-    uint64_t med_index = sample_size_ / 2;
-    double med_lat = lats[med_index];
-    double med_lon = lons[med_index];
+    std::size_t n_samples = lats_.size();
 
-    double time_est = (static_cast<double>(lats.size()) / 2.0) * 0.1;
+    // the distances to the median of the points in the window are computed as one batch.
+    latrs_.resize(n_samples);
+    lonrs_.resize(n_samples);
+    distances_.resize(n_samples);
 
-    for (uint64_t i = start; i < traj.size() && i < end;) {
-        double distance = geo::Location::distance(traj[i]->lat, traj[i]->lon, med_lat, med_lon);
+    for (std::size_t i = 0; i < n_samples; ++i) {
+        latrs_[i] = traj[start + i]->latr;
+        lonrs_[i] = traj[start + i]->lonr;
+    }
 
-        // 44.7 m/s = 100 mph (a heuristic)
-        if (distance / time_est > 44.7) {
-            traj.erase(traj.begin() + i);
-        } else {
-            ++i;
+    double med_lat = select_median(lats_);
+    double med_lon = select_median(lons_);
+
+    geo::kernels::distances_from(geo::to_radians(med_lat), geo::to_radians(med_lon), latrs_.data(), lonrs_.data(), n_samples, distances_.data());
+
+    // compact in place: write is where the next kept point goes.
+    uint64_t write = start;
+    uint64_t read = start;
+
+    for (; read < traj.size() && write < end; ++read) {
+        // points past the window move into it as others are removed; those are tested one at a time.
+        bool error = read - start < n_samples ? is_error(distances_[read - start], n_samples) : is_error(*traj[read], med_lat, med_lon, n_samples);
+
+        if (error) {
+            continue;
         }
+
+        if (write != read) {
+            traj[write] = std::move(traj[read]);
+        }
+
+        ++write;
+    }
+
+    uint64_t n_removed = read - write;
+
+    if (n_removed > 0) {
+        std::move(traj.begin() + read, traj.end(), traj.begin() + write);
+        traj.resize(traj.size() - n_removed);
     }
+
+    return n_removed;
 }
 
-void ErrorCorrector::remove_points(trajectory::Trajectory& traj, uint64_t start, uint64_t end, const std::string& uid, instrument::PointCounter& point_counter) {
-    std::vector<double> lats;
-    std::vector<double> lons;
+uint64_t ErrorCorrector::remove_points_sliding(trajectory::Trajectory& traj) {
+    uint64_t n = traj.size();
+    uint64_t window = std::min(sample_size_, n);
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    SlidingMedian lat_median;
+    SlidingMedian lon_median;
 
-    for (uint64_t i = start; i < traj.size() && i < end; ++i) {
-        lats.push_back(traj[i]->lat);
-        lons.push_back(traj[i]->lon);
+    errors_.assign(n, 0);
+    latrs_.resize(n);
+    lonrs_.resize(n);
+    med_latrs_.resize(n);
+    med_lonrs_.resize(n);
+    distances_.resize(n);
+
+    // mark against the original points, then compact once.
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t window_lo = i >= window / 2 ? i - window / 2 : 0;
+        window_lo = std::min(window_lo, n - window);
+
+        for (; hi < window_lo + window; ++hi) {
+            lat_median.insert(traj[hi]->lat);
+            lon_median.insert(traj[hi]->lon);
+        }
+
+        for (; lo < window_lo; ++lo) {
+            lat_median.erase(traj[lo]->lat);
+            lon_median.erase(traj[lo]->lon);
+        }
+
+        latrs_[i] = traj[i]->latr;
+        lonrs_[i] = traj[i]->lonr;
+        med_latrs_[i] = geo::to_radians(lat_median.median());
+        med_lonrs_[i] = geo::to_radians(lon_median.median());
     }
 
-    std::sort(lats.begin(), lats.end());
-    std::sort(lons.begin(), lons.end());
+    geo::kernels::pairwise_distances(latrs_.data(), lonrs_.data(), med_latrs_.data(), med_lonrs_.data(), n, distances_.data());
+
+    for (uint64_t i = 0; i < n; ++i) {
+        errors_[i] = is_error(distances_[i], window);
+    }
 
-    uint64_t med_index = sample_size_ / 2;
-    double med_lat = lats[med_index];
-    double med_lon = lons[med_index];
-    double time_est = (static_cast<double>(lats.size()) / 2.0) * 0.1;
+    uint64_t write = 0;
 
-    for (uint64_t i = start; i < traj.size() && i < end;) {
-        double distance = geo::Location::distance(traj[i]->lat, traj[i]->lon, med_lat, med_lon);
+    for (uint64_t read = 0; read < n; ++read) {
+        if (errors_[read]) {
+            continue;
+        }
 
-        if (distance / time_est > 44.7) {
-            traj.erase(traj.begin() + i);
-            point_counter.n_error_points++;
-        } else {
-            ++i;
+        if (write != read) {
+            traj[write] = std::move(traj[read]);
         }
+
+        ++write;
     }
+
+    traj.resize(write);
+
+    return n - write;
 }
 
 void ErrorCorrector::correct_indices(trajectory::Trajectory& traj) {
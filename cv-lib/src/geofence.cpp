@@ -0,0 +1,201 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "geofence.hpp"
+#include "arena.hpp"
+#include "shapes.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace geofence {
+
+    constexpr double ZoneIndex::kMinCellDegrees;
+
+    ZoneIndex::ZoneIndex( const std::vector<geo::Circle::CPtr>& circles, const std::vector<geo::Grid::CPtr>& grids, double cell_degrees ) :
+        cell_degrees_{ cell_degrees },
+        min_lat_{ std::numeric_limits<double>::max() },
+        max_lat_{ std::numeric_limits<double>::lowest() },
+        min_lon_{ std::numeric_limits<double>::max() },
+        max_lon_{ std::numeric_limits<double>::lowest() }
+    {
+        if (cell_degrees < 0.0) {
+            throw std::invalid_argument( "The geofence cell size must not be negative." );
+        }
+
+        for (auto& circle : circles) {
+            // the cardinal points bound the circle; widened a little since the east and west points are not quite
+            // the farthest from the center in longitude.
+            double lat_margin = (circle->north.lat - circle->south.lat) * 0.01;
+            double lon_margin = (circle->east.lon - circle->west.lon) * 0.01;
+            zones_.push_back( Zone{ circle->south.lat - lat_margin, circle->north.lat + lat_margin, circle->west.lon - lon_margin, circle->east.lon + lon_margin, circle } );
+        }
+
+        for (auto& grid : grids) {
+            zones_.push_back( Zone{ grid->sw.lat, grid->ne.lat, grid->sw.lon, grid->ne.lon, nullptr } );
+        }
+
+        if (zones_.empty()) {
+            cell_degrees_ = cell_degrees > 0.0 ? cell_degrees : kMinCellDegrees;
+            return;
+        }
+
+        std::vector<double> extents;
+
+        for (auto& zone : zones_) {
+            min_lat_ = std::min( min_lat_, zone.min_lat );
+            max_lat_ = std::max( max_lat_, zone.max_lat );
+            min_lon_ = std::min( min_lon_, zone.min_lon );
+            max_lon_ = std::max( max_lon_, zone.max_lon );
+            extents.push_back( std::max( zone.max_lat - zone.min_lat, zone.max_lon - zone.min_lon ) );
+        }
+
+        if (cell_degrees_ == 0.0) {
+            // a typical zone then overlaps at most four cells.
+            std::nth_element( extents.begin(), extents.begin() + extents.size() / 2, extents.end() );
+            cell_degrees_ = std::max( 2.0 * extents[extents.size() / 2], kMinCellDegrees );
+        }
+
+        // (cell key, zone) for every cell a zone overlaps; sorted, they give the zones of each cell.
+        std::vector<std::pair<uint64_t, uint32_t>> entries;
+
+        for (uint32_t id = 0; id < zones_.size(); ++id) {
+            const Zone& zone = zones_[id];
+            int64_t row_begin = cell_coordinate( zone.min_lat );
+            int64_t row_end = cell_coordinate( zone.max_lat );
+            int64_t col_begin = cell_coordinate( zone.min_lon );
+            int64_t col_end = cell_coordinate( zone.max_lon );
+
+            if (static_cast<double>(row_end - row_begin + 1) * static_cast<double>(col_end - col_begin + 1) > static_cast<double>(kMaxZoneCells)) {
+                large_zone_ids_.push_back( id );
+                continue;
+            }
+
+            for (int64_t row = row_begin; row <= row_end; ++row) {
+                for (int64_t col = col_begin; col <= col_end; ++col) {
+                    entries.push_back( std::make_pair( cell_key( row, col ), id ) );
+                }
+            }
+        }
+
+        std::sort( entries.begin(), entries.end() );
+        zone_ids_.reserve( entries.size() );
+
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            if (i == 0 || entries[i].first != entries[i - 1].first) {
+                uint32_t begin = static_cast<uint32_t>(zone_ids_.size());
+                cells_[entries[i].first] = Cell{ begin, begin };
+            }
+
+            zone_ids_.push_back( entries[i].second );
+            cells_[entries[i].first].end = static_cast<uint32_t>(zone_ids_.size());
+        }
+    }
+
+    ZoneIndex::CPtr ZoneIndex::load( const std::string& file_path, double cell_degrees ) {
+        shapes::CSVInputFactory shape_factory( file_path );
+        shape_factory.make_shapes();
+
+        return std::make_shared<const ZoneIndex>( shape_factory.get_circles(), shape_factory.get_grids(), cell_degrees );
+    }
+
+    int64_t ZoneIndex::cell_coordinate( double degrees ) const {
+        return static_cast<int64_t>(std::floor( degrees / cell_degrees_ ));
+    }
+
+    uint64_t ZoneIndex::cell_key( int64_t row, int64_t col ) {
+        return (static_cast<uint64_t>(row) << 32) ^ static_cast<uint64_t>(static_cast<uint32_t>(col));
+    }
+
+    bool ZoneIndex::zone_contains( const Zone& zone, const geo::Point& pt ) {
+        if (pt.lat < zone.min_lat || pt.lat > zone.max_lat || pt.lon < zone.min_lon || pt.lon > zone.max_lon) {
+            return false;
+        }
+
+        return !zone.circle || zone.circle->contains( pt );
+    }
+
+    bool ZoneIndex::contains( const geo::Point& pt ) const {
+        if (zones_.empty() || pt.lat < min_lat_ || pt.lat > max_lat_ || pt.lon < min_lon_ || pt.lon > max_lon_) {
+            return false;
+        }
+
+        auto it = cells_.find( cell_key( cell_coordinate( pt.lat ), cell_coordinate( pt.lon ) ) );
+
+        if (it != cells_.end()) {
+            for (uint32_t i = it->second.begin; i < it->second.end; ++i) {
+                if (zone_contains( zones_[zone_ids_[i]], pt )) {
+                    return true;
+                }
+            }
+        }
+
+        for (uint32_t id : large_zone_ids_) {
+            if (zone_contains( zones_[id], pt )) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    trajectory::Interval::PtrList ZoneIndex::find_intervals( const trajectory::Trajectory& traj ) const {
+        trajectory::Interval::PtrList intervals;
+
+        if (zones_.empty()) {
+            return intervals;
+        }
+
+        bool in_zone = false;
+        trajectory::Index left = 0;
+
+        for (auto& tp : traj) {
+            bool contained = contains( *tp );
+
+            if (contained && !in_zone) {
+                left = tp->get_index();
+            } else if (!contained && in_zone) {
+                intervals.push_back( memory::make_shared<trajectory::Interval>( left, tp->get_index(), "geofence" ) );
+            }
+
+            in_zone = contained;
+        }
+
+        if (in_zone) {
+            intervals.push_back( memory::make_shared<trajectory::Interval>( left, traj.back()->get_index() + 1, "geofence" ) );
+        }
+
+        return intervals;
+    }
+
+    std::size_t ZoneIndex::size() const {
+        return zones_.size();
+    }
+
+    std::size_t ZoneIndex::cell_count() const {
+        return cells_.size();
+    }
+
+    double ZoneIndex::get_cell_degrees() const {
+        return cell_degrees_;
+    }
+}
@@ -19,6 +19,9 @@
  *******************************************************************************/
 #include "instrument.hpp"
 
+#include <ctime>
+#include <iomanip>
+
 namespace instrument {
     PointCounter::PointCounter() :
         n_points(0),
@@ -48,4 +51,241 @@ namespace instrument {
     std::ostream& operator<<(std::ostream& os, const PointCounter& point_counter) {
         return os << point_counter.n_points <<  "," << point_counter.n_invalid_field_points << "," << point_counter.n_invalid_geo_points << "," << point_counter.n_invalid_heading_points << "," << point_counter.n_error_points << "," << point_counter.n_ci_points << "," << point_counter.n_pi_points;
     }
+
+    StageTimer::StageTimer() 
+    {
+        for (auto& totals : stages) {
+            totals = Totals{ 0, 0, 0.0, 0.0 };
+        }
+    }
+
+    void StageTimer::add(Stage stage, uint64_t n_points, double wall_seconds, double cpu_seconds) {
+        Totals& totals = stages[static_cast<std::size_t>(stage)];
+
+        totals.n_calls++;
+        totals.n_points += n_points;
+        totals.wall_seconds += wall_seconds;
+        totals.cpu_seconds += cpu_seconds;
+    }
+
+    const StageTimer::Totals& StageTimer::get(Stage stage) const {
+        return stages[static_cast<std::size_t>(stage)];
+    }
+
+    StageTimer StageTimer::operator+(const StageTimer& other) const {
+        StageTimer stage_timer;
+
+        for (std::size_t i = 0; i < stages.size(); ++i) {
+            stage_timer.stages[i].n_calls = stages[i].n_calls + other.stages[i].n_calls;
+            stage_timer.stages[i].n_points = stages[i].n_points + other.stages[i].n_points;
+            stage_timer.stages[i].wall_seconds = stages[i].wall_seconds + other.stages[i].wall_seconds;
+            stage_timer.stages[i].cpu_seconds = stages[i].cpu_seconds + other.stages[i].cpu_seconds;
+        }
+
+        return stage_timer;
+    }
+
+    const char* StageTimer::stage_name(Stage stage) {
+        switch (stage) {
+            case Stage::kParse:                 return "parse";
+            case Stage::kErrorCorrect:          return "error_correct";
+            case Stage::kMapFit:                return "map_fit";
+            case Stage::kImplicitMapFit:        return "implicit_map_fit";
+            case Stage::kIntersectionCount:     return "intersection_count";
+            case Stage::kTurnAround:            return "turn_around";
+            case Stage::kStop:                  return "stop";
+            case Stage::kGeofence:              return "geofence";
+            case Stage::kPointAnalysis:         return "point_analysis";
+            case Stage::kIntervalMark:          return "interval_mark";
+            case Stage::kPrivacyInterval:       return "privacy_interval";
+            case Stage::kDeIdentify:            return "de_identify";
+            case Stage::kKML:                   return "kml";
+            case Stage::kWrite:                 return "write";
+            default:                            return "unknown";
+        }
+    }
+
+    double StageTimer::thread_cpu_seconds() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+        struct timespec ts;
+
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+            return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+        }
+#endif
+        return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+    }
+
+    std::ostream& operator<<(std::ostream& os, const StageTimer& stage_timer) {
+        std::ios::fmtflags flags = os.flags();
+        std::streamsize precision = os.precision();
+
+        os << std::fixed << std::setprecision(6);
+
+        for (std::size_t i = 0; i < stage_timer.stages.size(); ++i) {
+            const StageTimer::Totals& totals = stage_timer.stages[i];
+
+            os << StageTimer::stage_name(static_cast<Stage>(i)) << "," << totals.n_calls << "," << totals.n_points << "," << totals.wall_seconds << "," << totals.cpu_seconds << std::endl;
+        }
+
+        os.flags(flags);
+        os.precision(precision);
+
+        return os;
+    }
+
+    TraceBuffer::TraceBuffer(unsigned thread_id, std::size_t reserve) :
+        thread_id_(thread_id)
+    {
+        // fix the origin before any span of the buffer starts.
+        origin();
+        events_.reserve(reserve);
+    }
+
+    void TraceBuffer::span(const char* name, const char* category, Clock::time_point start, Clock::time_point end, const std::string& detail) {
+        Clock::time_point origin_time = origin();
+
+        events_.push_back(Event{ name, category, detail,
+                                 std::chrono::duration_cast<std::chrono::microseconds>(start - origin_time).count(),
+                                 std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() });
+    }
+
+    unsigned TraceBuffer::thread_id() const {
+        return thread_id_;
+    }
+
+    const std::vector<TraceBuffer::Event>& TraceBuffer::events() const {
+        return events_;
+    }
+
+    TraceBuffer::Clock::time_point TraceBuffer::origin() {
+        static const Clock::time_point origin_time = Clock::now();
+        return origin_time;
+    }
+
+    namespace {
+        /**
+         * \brief Write a string as a JSON string literal.
+         */
+        void write_json_string(std::ostream& os, const std::string& str) {
+            os << '"';
+
+            for (char c : str) {
+                switch (c) {
+                    case '"':   os << "\\\""; break;
+                    case '\\':  os << "\\\\"; break;
+                    case '\n':  os << "\\n"; break;
+                    case '\r':  os << "\\r"; break;
+                    case '\t':  os << "\\t"; break;
+                    default:
+                        if (static_cast<unsigned char>(c) < 0x20) {
+                            os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+                        } else {
+                            os << c;
+                        }
+                }
+            }
+
+            os << '"';
+        }
+    }
+
+    void TraceBuffer::write_chrome_trace(std::ostream& os, const std::vector<Ptr>& buffers, const std::string& process_name) {
+        const char* separator = "\n";
+
+        os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        os << separator << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":";
+        write_json_string(os, process_name);
+        os << "}}";
+        separator = ",\n";
+
+        for (auto& buffer : buffers) {
+            if (!buffer) {
+                continue;
+            }
+
+            os << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id() << ",\"args\":{\"name\":\"thread " << buffer->thread_id() << "\"}}";
+
+            for (auto& event : buffer->events()) {
+                os << separator << "{\"name\":";
+                write_json_string(os, event.name);
+                os << ",\"cat\":";
+                write_json_string(os, event.category);
+                os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id() << ",\"ts\":" << event.start_us << ",\"dur\":" << event.duration_us;
+
+                if (!event.detail.empty()) {
+                    os << ",\"args\":{\"detail\":";
+                    write_json_string(os, event.detail);
+                    os << "}";
+                }
+
+                os << "}";
+            }
+        }
+
+        os << "\n]}" << std::endl;
+    }
+
+    TraceScope::TraceScope(TraceBuffer* buffer, const char* name, const char* category) :
+        buffer_(buffer),
+        name_(name),
+        category_(category)
+    {
+        if (buffer_) {
+            start_ = TraceBuffer::Clock::now();
+        }
+    }
+
+    TraceScope::~TraceScope() {
+        if (buffer_) {
+            buffer_->span(name_, category_, start_, TraceBuffer::Clock::now(), detail_);
+        }
+    }
+
+    void TraceScope::set_detail(const std::string& detail) {
+        if (buffer_) {
+            detail_ = detail;
+        }
+    }
+
+    StageClock::StageClock(StageTimer* timer, TraceBuffer* trace) :
+        timer_(timer),
+        trace_(trace),
+        cpu_start_(0.0)
+    {
+        reset();
+    }
+
+    void StageClock::lap(Stage stage, uint64_t n_points) {
+        if (!timer_ && !trace_) {
+            return;
+        }
+
+        std::chrono::steady_clock::time_point wall_now = std::chrono::steady_clock::now();
+
+        if (trace_) {
+            trace_->span(StageTimer::stage_name(stage), "stage", wall_start_, wall_now);
+        }
+
+        if (timer_) {
+            double cpu_now = StageTimer::thread_cpu_seconds();
+
+            timer_->add(stage, n_points, std::chrono::duration<double>(wall_now - wall_start_).count(), cpu_now - cpu_start_);
+            cpu_start_ = cpu_now;
+        }
+
+        wall_start_ = wall_now;
+    }
+
+    void StageClock::reset() {
+        if (!timer_ && !trace_) {
+            return;
+        }
+
+        wall_start_ = std::chrono::steady_clock::now();
+
+        if (timer_) {
+            cpu_start_ = StageTimer::thread_cpu_seconds();
+        }
+    }
 }
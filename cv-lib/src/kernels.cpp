@@ -0,0 +1,151 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "kernels.hpp"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CVDP_DI_KERNELS_SSE2
+#endif
+
+namespace geo {
+    namespace kernels {
+
+        bool is_vectorized() {
+#ifdef CVDP_DI_KERNELS_SSE2
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        void to_radians(const double* degrees, std::size_t n, double* radians) {
+            for (std::size_t i = 0; i < n; ++i) {
+                radians[i] = geo::to_radians(degrees[i]);
+            }
+        }
+
+        void gather_radians(const trajectory::Trajectory& traj, std::vector<double>& latr, std::vector<double>& lonr) {
+            latr.resize(traj.size());
+            lonr.resize(traj.size());
+
+            for (std::size_t i = 0; i < traj.size(); ++i) {
+                latr[i] = traj[i]->latr;
+                lonr[i] = traj[i]->lonr;
+            }
+        }
+
+        void pairwise_distances(const double* latr_a, const double* lonr_a, const double* latr_b, const double* lonr_b, std::size_t n, double* distances) {
+            // The cosines are scalar library calls; keep them in the output until the second pass replaces them.
+            for (std::size_t i = 0; i < n; ++i) {
+                distances[i] = std::cos((latr_a[i] + latr_b[i]) / 2.0);
+            }
+
+            std::size_t i = 0;
+
+#ifdef CVDP_DI_KERNELS_SSE2
+            const __m128d radius = _mm_set1_pd(kEarthRadiusM);
+
+            for (; i + 2 <= n; i += 2) {
+                __m128d x = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(lonr_b + i), _mm_loadu_pd(lonr_a + i)), _mm_loadu_pd(distances + i));
+                __m128d y = _mm_sub_pd(_mm_loadu_pd(latr_b + i), _mm_loadu_pd(latr_a + i));
+                __m128d h = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)));
+                _mm_storeu_pd(distances + i, _mm_mul_pd(h, radius));
+            }
+#endif
+
+            for (; i < n; ++i) {
+                double x = (lonr_b[i] - lonr_a[i]) * distances[i];
+                double y = (latr_b[i] - latr_a[i]);
+                distances[i] = std::sqrt(x*x + y*y) * kEarthRadiusM;
+            }
+        }
+
+        void distances_from(double latr, double lonr, const double* latrs, const double* lonrs, std::size_t n, double* distances) {
+            for (std::size_t i = 0; i < n; ++i) {
+                distances[i] = std::cos((latr + latrs[i]) / 2.0);
+            }
+
+            std::size_t i = 0;
+
+#ifdef CVDP_DI_KERNELS_SSE2
+            const __m128d radius = _mm_set1_pd(kEarthRadiusM);
+            const __m128d origin_latr = _mm_set1_pd(latr);
+            const __m128d origin_lonr = _mm_set1_pd(lonr);
+
+            for (; i + 2 <= n; i += 2) {
+                __m128d x = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(lonrs + i), origin_lonr), _mm_loadu_pd(distances + i));
+                __m128d y = _mm_sub_pd(_mm_loadu_pd(latrs + i), origin_latr);
+                __m128d h = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)));
+                _mm_storeu_pd(distances + i, _mm_mul_pd(h, radius));
+            }
+#endif
+
+            for (; i < n; ++i) {
+                double x = (lonrs[i] - lonr) * distances[i];
+                double y = (latrs[i] - latr);
+                distances[i] = std::sqrt(x*x + y*y) * kEarthRadiusM;
+            }
+        }
+
+        void consecutive_distances(const double* latr, const double* lonr, std::size_t n, double* distances) {
+            if (n == 0) {
+                return;
+            }
+
+            distances[0] = 0.0;
+            pairwise_distances(latr, lonr, latr + 1, lonr + 1, n - 1, distances + 1);
+        }
+
+        void cumulative_distances(const double* latr, const double* lonr, std::size_t n, double* cumulative) {
+            consecutive_distances(latr, lonr, n, cumulative);
+
+            for (std::size_t i = 1; i < n; ++i) {
+                cumulative[i] += cumulative[i - 1];
+            }
+        }
+
+        void consecutive_bearings(const double* latr, const double* lonr, std::size_t n, double* bearings) {
+            if (n == 0) {
+                return;
+            }
+
+            std::vector<double> sines(n);
+            std::vector<double> cosines(n);
+
+            for (std::size_t i = 0; i < n; ++i) {
+                sines[i] = std::sin(latr[i]);
+                cosines[i] = std::cos(latr[i]);
+            }
+
+            bearings[0] = 0.0;
+
+            // Location::bearing with the sine and cosine of the latitudes looked up.
+            for (std::size_t i = 1; i < n; ++i) {
+                double lon_delta = lonr[i] - lonr[i - 1];
+                double x = std::sin(lon_delta) * cosines[i];
+                double y = cosines[i - 1] * sines[i] - sines[i - 1] * cosines[i] * std::cos(lon_delta);
+
+                bearings[i] = std::fmod(to_degrees(std::atan2(x, y)) + 360.0, 360.0);
+            }
+        }
+    }
+}
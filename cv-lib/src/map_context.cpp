@@ -0,0 +1,193 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "map_context.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+MapContext::MapContext( const std::vector<geo::EdgeCPtr>& edges, const FlatQuad::CPtr& quad, double fit_width_scaling, double fit_extension, const EdgeAreaCache::CPtr& area_cache, const osm::HighwaySet& stop_excluded_highways ) :
+    edges_{ edges },
+    quad_{ quad },
+    area_cache_{ area_cache },
+    tiled_map_{ nullptr },
+    bounds_{ quad ? quad->bounds() : geo::Bounds{} },
+    fit_width_scaling_{ fit_width_scaling },
+    fit_extension_{ fit_extension },
+    stop_excluded_highways_{ stop_excluded_highways },
+    vertex_table_{}
+{
+    if (!quad_) {
+        throw std::invalid_argument("MapContext needs a quad tree.");
+    }
+
+    if (!area_cache_) {
+        area_cache_ = std::make_shared<const EdgeAreaCache>( edges_, fit_width_scaling, fit_extension );
+    } else if (!area_cache_->matches( fit_width_scaling, fit_extension )) {
+        throw std::invalid_argument("MapContext area cache was built with different fit parameters.");
+    }
+
+    for (auto& eptr : edges_) {
+        vertex_table_.emplace( eptr->v1->uid, eptr->v1 );
+        vertex_table_.emplace( eptr->v2->uid, eptr->v2 );
+    }
+}
+
+MapContext::MapContext( const tiles::TiledMap::CPtr& tiled_map, double fit_width_scaling, double fit_extension, const osm::HighwaySet& stop_excluded_highways ) :
+    edges_{},
+    quad_{ nullptr },
+    area_cache_{ nullptr },
+    tiled_map_{ tiled_map },
+    bounds_{ tiled_map ? tiled_map->bounds() : geo::Bounds{} },
+    fit_width_scaling_{ fit_width_scaling },
+    fit_extension_{ fit_extension },
+    stop_excluded_highways_{ stop_excluded_highways },
+    vertex_table_{}
+{
+    if (!tiled_map_) {
+        throw std::invalid_argument("MapContext needs a tiled map.");
+    }
+
+    if (!tiled_map_->matches( fit_width_scaling, fit_extension )) {
+        throw std::invalid_argument("MapContext tiled map areas were built with different fit parameters.");
+    }
+}
+
+const std::vector<geo::EdgeCPtr>& MapContext::get_edges() const
+{
+    return edges_;
+}
+
+const FlatQuad::CPtr& MapContext::get_quad() const
+{
+    return quad_;
+}
+
+const EdgeAreaCache::CPtr& MapContext::get_area_cache() const
+{
+    return area_cache_;
+}
+
+const tiles::TiledMap::CPtr& MapContext::get_tiled_map() const
+{
+    return tiled_map_;
+}
+
+const geo::Bounds& MapContext::get_bounds() const
+{
+    return bounds_;
+}
+
+double MapContext::get_fit_width_scaling() const
+{
+    return fit_width_scaling_;
+}
+
+double MapContext::get_fit_extension() const
+{
+    return fit_extension_;
+}
+
+bool MapContext::matches( double fit_width_scaling, double fit_extension ) const
+{
+    return tiled_map_ ? tiled_map_->matches( fit_width_scaling, fit_extension ) : area_cache_->matches( fit_width_scaling, fit_extension );
+}
+
+const osm::HighwaySet& MapContext::get_stop_excluded_highways() const
+{
+    return stop_excluded_highways_;
+}
+
+std::shared_ptr<const geo::Vertex> MapContext::find_vertex( uint64_t uid ) const
+{
+    auto it = vertex_table_.find( uid );
+
+    if (it == vertex_table_.end()) {
+        return nullptr;
+    }
+
+    return it->second;
+}
+
+std::size_t MapContext::vertex_count() const
+{
+    return vertex_table_.size();
+}
+
+double MapContext::overlap( const geo::Bounds& bounds ) const
+{
+    double height = std::min( bounds_.ne.lat, bounds.ne.lat ) - std::max( bounds_.sw.lat, bounds.sw.lat );
+    double width = std::min( bounds_.ne.lon, bounds.ne.lon ) - std::max( bounds_.sw.lon, bounds.sw.lon );
+
+    if (height < 0.0 || width < 0.0) {
+        return -1.0;
+    }
+
+    return height * width;
+}
+
+geo::Bounds MapContext::trip_bounds( const trajectory::Trajectory& traj )
+{
+    if (traj.empty()) {
+        throw std::invalid_argument("MapContext cannot bound an empty trip.");
+    }
+
+    geo::Point sw{ traj.front()->lat, traj.front()->lon };
+    geo::Point ne{ sw };
+
+    for (auto& tp : traj) {
+        sw.lat = std::min( sw.lat, tp->lat );
+        sw.lon = std::min( sw.lon, tp->lon );
+        ne.lat = std::max( ne.lat, tp->lat );
+        ne.lon = std::max( ne.lon, tp->lon );
+    }
+
+    return geo::Bounds{ sw, ne };
+}
+
+/**
+ * A box that touches no context (overlap < 0) still goes to the first context so that the trip is de-identified the
+ * way a single map run would; its points are simply not fit to any road.
+ */
+const MapContext::CPtr& MapContext::route( const std::vector<CPtr>& contexts, const geo::Bounds& bounds )
+{
+    if (contexts.empty()) {
+        throw std::invalid_argument("MapContext route needs at least one context.");
+    }
+
+    std::size_t best = 0;
+    double best_overlap = -1.0;
+
+    for (std::size_t i = 0; i < contexts.size(); ++i) {
+        const geo::Bounds& context_bounds = contexts[i]->bounds_;
+
+        if (context_bounds.contains( bounds.sw ) && context_bounds.contains( bounds.ne )) {
+            return contexts[i];
+        }
+
+        double shared = contexts[i]->overlap( bounds );
+
+        if (shared > best_overlap) {
+            best = i;
+            best_overlap = shared;
+        }
+    }
+
+    return contexts[best];
+}
@@ -18,26 +18,152 @@
  * For issues, question, and comments, please submit a issue via GitHub.
  *******************************************************************************/
 #include "mapfit.hpp"
+#include "arena.hpp"
 #include "entity.hpp"
+#include "map_context.hpp"
+#include "tiles.hpp"
 #include "utilities.hpp"
 
 #include <algorithm>
 #include <cmath>
+#include <exception>
 #include <map>
 #include <iomanip>
 #include <iterator>
 #include <queue>
+#include <stdexcept>
+#include <thread>
 #include <unordered_set>
 #include <utility>
 
+/******************************** EdgeAreaCache ************************************************/
+
+EdgeAreaCache::EdgeAreaCache( const std::vector<geo::EdgeCPtr>& edges, double fit_width_scaling, double fit_extension ) :
+    fit_width_scaling{ fit_width_scaling },
+    fit_extension{ fit_extension },
+    area_map{}
+{
+    area_map.reserve( edges.size() );
+
+    for (auto& eptr : edges) {
+        geo::AreaCPtr aptr = nullptr;
+
+        try {
+            aptr = eptr->to_area( eptr->get_way_width() * fit_width_scaling, fit_extension );
+
+        } catch (geo::ZeroAreaException) {
+            // keep the nullptr so the edge is skipped without rebuilding it.
+        }
+
+        area_map.emplace( eptr->get_uid(), aptr );
+    }
+}
+
+bool EdgeAreaCache::matches( double fit_width_scaling, double fit_extension ) const
+{
+    return this->fit_width_scaling == fit_width_scaling && this->fit_extension == fit_extension;
+}
+
+bool EdgeAreaCache::find( const geo::EdgeCPtr& eptr, geo::AreaCPtr& aptr ) const
+{
+    auto it = area_map.find( eptr->get_uid() );
+
+    if (it == area_map.end()) {
+        return false;
+    }
+
+    aptr = it->second;
+    return true;
+}
+
+std::size_t EdgeAreaCache::size() const
+{
+    return area_map.size();
+}
+
 /******************************** MapFitter ************************************************/
 
-MapFitter::MapFitter( const Quad::CPtr& quadtree, double fit_width_scaling, double fit_extension) :
+MapFitter::MapFitter( const Quad::CPtr& quadtree, double fit_width_scaling, double fit_extension, const EdgeAreaCache::CPtr& area_cache, bool collect_areas, bool planar_fit, double planar_tolerance ) :
     quadtree{ quadtree },
+    flat_quadtree{ nullptr },
     fit_width_scaling{ fit_width_scaling },
     fit_extension{ fit_extension },
+    area_cache{ area_cache },
+    collect_areas{ collect_areas },
+    planar_fit{ planar_fit },
+    planar_tolerance{ planar_tolerance },
     area_set{}
-{}
+{
+    if (area_cache && !area_cache->matches( fit_width_scaling, fit_extension )) {
+        throw std::invalid_argument("MapFitter area cache was built with different fit parameters.");
+    }
+
+    if (planar_tolerance < 0.0) {
+        throw std::invalid_argument("MapFitter planar tolerance must not be negative.");
+    }
+}
+
+MapFitter::MapFitter( const FlatQuad::CPtr& flat_quadtree, double fit_width_scaling, double fit_extension, const EdgeAreaCache::CPtr& area_cache, bool collect_areas, bool planar_fit, double planar_tolerance ) :
+    quadtree{ nullptr },
+    flat_quadtree{ flat_quadtree },
+    fit_width_scaling{ fit_width_scaling },
+    fit_extension{ fit_extension },
+    area_cache{ area_cache },
+    collect_areas{ collect_areas },
+    planar_fit{ planar_fit },
+    planar_tolerance{ planar_tolerance },
+    area_set{}
+{
+    if (area_cache && !area_cache->matches( fit_width_scaling, fit_extension )) {
+        throw std::invalid_argument("MapFitter area cache was built with different fit parameters.");
+    }
+
+    if (planar_tolerance < 0.0) {
+        throw std::invalid_argument("MapFitter planar tolerance must not be negative.");
+    }
+}
+
+MapFitter::MapFitter( const std::shared_ptr<const tiles::TiledMap>& tiled_map, double fit_width_scaling, double fit_extension, bool collect_areas, bool planar_fit, double planar_tolerance ) :
+    quadtree{ nullptr },
+    flat_quadtree{ nullptr },
+    tiled_map{ tiled_map },
+    fit_width_scaling{ fit_width_scaling },
+    fit_extension{ fit_extension },
+    area_cache{ nullptr },
+    collect_areas{ collect_areas },
+    planar_fit{ planar_fit },
+    planar_tolerance{ planar_tolerance },
+    area_set{}
+{
+    if (!tiled_map) {
+        throw std::invalid_argument("MapFitter needs a tiled map.");
+    }
+
+    if (!tiled_map->matches( fit_width_scaling, fit_extension )) {
+        throw std::invalid_argument("MapFitter tiled map areas were built with different fit parameters.");
+    }
+
+    if (planar_tolerance < 0.0) {
+        throw std::invalid_argument("MapFitter planar tolerance must not be negative.");
+    }
+}
+
+MapFitter::MapFitter( const MapContext& context, bool collect_areas, bool planar_fit, double planar_tolerance ) :
+    quadtree{ nullptr },
+    flat_quadtree{ context.get_quad() },
+    tiled_map{ context.get_tiled_map() },
+    fit_width_scaling{ context.get_fit_width_scaling() },
+    fit_extension{ context.get_fit_extension() },
+    area_cache{ context.get_area_cache() },
+    collect_areas{ collect_areas },
+    planar_fit{ planar_fit },
+    planar_tolerance{ planar_tolerance },
+    area_set{}
+{
+    if (planar_tolerance < 0.0) {
+        throw std::invalid_argument("MapFitter planar tolerance must not be negative.");
+    }
+}
 
 /**
  * Comparator that is used to order the map edge candidates based on how well they align with the current travel
@@ -49,6 +175,37 @@ bool MapFitter::compare( const MapFitter::PriorityPair& p1, const MapFitter::Pri
     return p1.first > p2.first;
 }
 
+geo::AreaCPtr MapFitter::get_fit_area( const geo::EdgeCPtr& eptr ) const
+{
+    geo::AreaCPtr aptr = nullptr;
+    const EdgeAreaCache::CPtr& cache = current_tile ? current_tile->area_cache() : area_cache;
+
+    if (cache && cache->find( eptr, aptr )) {
+        return aptr;
+    }
+
+    // build the area that encapsulates this edge using the OSM width information.
+    try {
+        aptr = eptr->to_area( eptr->get_way_width() * fit_width_scaling, fit_extension );
+
+    } catch (geo::ZeroAreaException) {
+
+        return nullptr;
+    }
+
+    return aptr;
+}
+
+bool MapFitter::area_contains( const geo::AreaCPtr& aptr, const trajectory::Point& tp ) const
+{
+    return planar_fit ? aptr->contains_planar( tp, planar_tolerance ) : aptr->contains( tp );
+}
+
+bool MapFitter::area_outside_edge( const geo::AreaCPtr& aptr, int edge, const trajectory::Point& tp ) const
+{
+    return planar_fit ? aptr->outside_edge_planar( edge, tp, planar_tolerance ) : aptr->outside_edge( edge, tp );
+}
+
 void MapFitter::fit( trajectory::Point& tp )
 {
     if ( !set_fit_area( tp ) ) {
@@ -57,7 +214,7 @@ void MapFitter::fit( trajectory::Point& tp )
     }
 
     // current_area is set.
-    if (current_area->contains( tp )) {
+    if (area_contains( current_area, tp )) {
 
         // map matching.
         tp.set_fit_edge( current_edge );
@@ -70,7 +227,7 @@ void MapFitter::fit( trajectory::Point& tp )
         // for the below consider the area positioned horizontally (along a line of latitude) and the vehicle moving
         // from left to right.
 
-        if (current_area->outside_edge( 1, tp )) {
+        if (area_outside_edge( current_area, 1, tp )) {
             // this trip point is to the left of the area.
             if (!set_fit_area( tp, current_edge->v2)) {
                 // The trip point skipped an edge and no needs to hit the quad 
@@ -79,7 +236,7 @@ void MapFitter::fit( trajectory::Point& tp )
                 set_fit_area( tp );
             } 
 
-        } else if (current_area->outside_edge( 3, tp )) {
+        } else if (area_outside_edge( current_area, 3, tp )) {
             // this trip point is to the right of the area (edge 2).
             if (!set_fit_area( tp, current_edge->v1 )) {
                 // The trip point skipped an edge and no needs to hit the quad 
@@ -109,15 +266,156 @@ void MapFitter::fit( trajectory::Trajectory& traj )
     }
 } 
 
+void MapFitter::fit( trajectory::Trajectory& traj, std::size_t first, std::size_t last )
+{
+    for (std::size_t i = first; i < last; ++i) {
+        fit( *traj[i] );
+    }
+}
+
+void MapFitter::fit( trajectory::Trajectory& traj, unsigned n_segments )
+{
+    std::size_t n_points = traj.size();
+
+    if (n_segments > n_points) {
+        n_segments = static_cast<unsigned>( n_points );
+    }
+
+    if (n_segments < 2 || collect_areas || tiled_map) {
+        fit( traj );
+        return;
+    }
+
+    // segment k holds the points with indices in [bounds[k], bounds[k + 1]).
+    std::vector<std::size_t> bounds( n_segments + 1 );
+
+    for (unsigned k = 0; k <= n_segments; ++k) {
+        bounds[k] = n_points * k / n_segments;
+    }
+
+    // fitters[k - 1] fits segment k from no current edge; this fitter fits segment 0.
+    std::vector<MapFitter> fitters( n_segments - 1, *this );
+    std::vector<std::exception_ptr> errors( n_segments );
+    std::vector<std::thread> threads;
+
+    for (auto& segment_fitter : fitters) {
+        segment_fitter.current_area = nullptr;
+        segment_fitter.current_edge = nullptr;
+    }
+
+    for (unsigned k = 1; k < n_segments; ++k) {
+        threads.emplace_back( [&traj, &bounds, &fitters, &errors, k]() {
+            try {
+                fitters[k - 1].fit( traj, bounds[k], bounds[k + 1] );
+            } catch (...) {
+                errors[k] = std::current_exception();
+            }
+        });
+    }
+
+    try {
+        fit( traj, bounds[0], bounds[1] );
+    } catch (...) {
+        errors[0] = std::current_exception();
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception( error );
+        }
+    }
+
+    // This fitter holds the state of the point before segment k; refit the segment until a point keeps its edge, from
+    // then on both fitters have the same state and the segment's own fits stand.
+    for (unsigned k = 1; k < n_segments; ++k) {
+        for (std::size_t i = bounds[k]; i < bounds[k + 1]; ++i) {
+            trajectory::Point& tp = *traj[i];
+            geo::EdgeCPtr segment_edge = tp.get_fit_edge();
+
+            tp.set_fit_edge( nullptr );
+            fit( tp );
+
+            if (tp.get_fit_edge() == segment_edge) {
+                current_area = fitters[k - 1].current_area;
+                current_edge = fitters[k - 1].current_edge;
+                break;
+            }
+        }
+    }
+}
+
 bool MapFitter::set_fit_area( const trajectory::Point& tp )
 {
     if (current_area) return true;
 
     // don't have a current fit area; hit the quad tree and find one.
+    if (flat_quadtree) {
+        FlatQuad::EntityRange range = flat_quadtree->retrieve_elements( tp );
+        return set_fit_area( tp, range.first, range.second );
+    }
+
+    if (tiled_map) {
+        use_tile( tiled_map->tile( tp ) );
+
+        if (!current_tile) {
+            // no roads near this point.
+            current_area = nullptr;
+            current_edge = nullptr;
+            return false;
+        }
+
+        FlatQuad::EntityRange range = current_tile->quad()->retrieve_elements( tp );
+        return set_fit_area( tp, range.first, range.second );
+    }
+
     return set_fit_area( tp, quadtree->retrieve_elements( tp ) );
 }
 
+void MapFitter::use_tile( const tiles::Tile::CPtr& tile )
+{
+    current_tile = tile;
+
+    if (tile && std::find( held_tiles.begin(), held_tiles.end(), tile ) == held_tiles.end()) {
+        held_tiles.push_back( tile );
+    }
+}
+
+geo::Vertex::Ptr MapFitter::tile_vertex( const trajectory::Point& tp, const geo::Vertex::Ptr& shared_vertex )
+{
+    if (current_tile) {
+        geo::Vertex::Ptr vertex = current_tile->find_vertex( shared_vertex->uid );
+
+        if (vertex) {
+            return vertex;
+        }
+    }
+
+    // the vertex is at the far end of an edge that only borders the current tile.
+    tiles::Tile::CPtr tile = tiled_map->tile( tp );
+
+    if (!tile || tile == current_tile) {
+        return nullptr;
+    }
+
+    geo::Vertex::Ptr vertex = tile->find_vertex( shared_vertex->uid );
+
+    if (vertex) {
+        use_tile( tile );
+    }
+
+    return vertex;
+}
+
 bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Entity::PtrList& entities )
+{
+    return set_fit_area( tp, entities.begin(), entities.end() );
+}
+
+bool MapFitter::set_fit_area( const trajectory::Point& tp, FlatQuad::EntityCIterator first, FlatQuad::EntityCIterator last )
 {
     // assume no match
     bool successful_match = false;
@@ -130,7 +428,9 @@ bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Entity::Pt
         
     geo::EdgeCPtr eptr = nullptr;
     
-    for (auto& entity_ptr : entities) {
+    for (auto it = first; it != last; ++it) {
+        const geo::Entity::CPtr& entity_ptr = *it;
+
         if (entity_ptr->get_entity_type() != geo::EntityType::EDGE) {
             // matching only happens with edge types.
             continue;
@@ -138,18 +438,13 @@ bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Entity::Pt
 
         eptr = std::static_pointer_cast<const geo::Edge>(entity_ptr);
      
-        geo::Area::Ptr aptr = nullptr;
-
-        // build the area that encapsulates this edge using the OSM width information.
-        try {
-            aptr = eptr->to_area( eptr->get_way_width() * fit_width_scaling, fit_extension );
-
-        } catch (geo::ZeroAreaException) {
+        geo::AreaCPtr aptr = get_fit_area( eptr );
 
+        if (!aptr) {
             continue;
         }
 
-        if ( aptr->contains( tp ) ) {
+        if ( area_contains( aptr, tp ) ) {
             
             // compute the POSITIVE error between the heading of the vehicle and this road segment.
             // this is how we prioritize selection of areas when there are multiple candidates.
@@ -166,7 +461,11 @@ bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Entity::Pt
         auto& best = priority_areas.top();
         current_area = best.second.first;
         current_edge = best.second.second;
-        area_set.insert(current_area);
+
+        if (collect_areas) {
+            area_set.insert(current_area);
+        }
+
         successful_match = true;
     }
 
@@ -189,36 +488,37 @@ bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Entity::Pt
 bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Vertex::Ptr shared_vertex)
 {
     bool successful_match = false;
+    geo::Vertex::Ptr vertex = tiled_map ? tile_vertex( tp, shared_vertex ) : shared_vertex;
 
     // an empty priority queue.
     PriorityAreaQueue priority_areas{ compare };
 
     current_area = nullptr;
     current_edge = nullptr;
+
+    if (!vertex) {
+        // no loaded tile has all the roads at this vertex; the caller searches the quad tree instead.
+        return false;
+    }
     
     // Vertex of the non-shared portion of a candidate edge for the the fit.
     // used to prioritize the fit based on heading
     geo::Vertex::Ptr next_vertex = nullptr;
 
-    for (auto& eptr : shared_vertex->get_incident_edges()) {
-        geo::Area::Ptr aptr = nullptr;
-
-        // build the area that encapsulates this edge using the OSM width information.
-        try {
-            aptr = eptr->to_area( eptr->get_way_width() * fit_width_scaling, fit_extension );
-
-        } catch (geo::ZeroAreaException) {
+    for (auto& eptr : vertex->get_incident_edges()) {
+        geo::AreaCPtr aptr = get_fit_area( eptr );
 
+        if (!aptr) {
             continue;
         }
 
-        if ( aptr->contains( tp ) ) {
+        if ( area_contains( aptr, tp ) ) {
 
             // compute the POSITIVE error between the heading of the vehicle and this road segment.
             // this is how we prioritize selection of areas when there are multiple candidates.
             // this method ELIMINATES the effect of having heading and bearing 180 degree out from one another.
         
-            if (eptr->v2 == shared_vertex) {
+            if (eptr->v2 == vertex) {
                 next_vertex = eptr->v1; 
             } else {
                 next_vertex = eptr->v2; 
@@ -238,7 +538,11 @@ bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Vertex::Pt
         auto& best = priority_areas.top();
         current_area = best.second.first;
         current_edge = best.second.second;
-        area_set.insert(current_area);
+
+        if (collect_areas) {
+            area_set.insert(current_area);
+        }
+
         successful_match = true;
     }
 
@@ -246,11 +550,12 @@ bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Vertex::Pt
 }
 
 /******************************** ImplicitMapFitter ************************************************/
-ImplicitMapFitter::ImplicitMapFitter( uint32_t num_sectors, uint32_t min_fit_points  ) :
+ImplicitMapFitter::ImplicitMapFitter( uint32_t num_sectors, uint32_t min_fit_points, bool collect_areas ) :
     next_edge_id{ 0 },
     num_sectors{ num_sectors },
     sector_size{ 360.0 / num_sectors },
     min_fit_points{ min_fit_points },
+    collect_areas{ collect_areas },
     current_sector{ 0 },
     num_fit_points{ 0 },
     current_eptr{},
@@ -305,8 +610,12 @@ void ImplicitMapFitter::fit ( trajectory::Point& tp )
 
         // pointer to new implicit edge.
         geo::Vertex v{ tp };
-        current_eptr = std::make_shared<geo::Edge>( v, v, next_edge_id, false );
-        edge_set.insert( current_eptr );
+        current_eptr = memory::make_shared<geo::Edge>( v, v, next_edge_id, false );
+
+        if (collect_areas) {
+            edge_set.insert( current_eptr );
+        }
+
         ++next_edge_id;
         num_fit_points = 1;
         tp.set_fit_edge( current_eptr );
@@ -322,8 +631,12 @@ void ImplicitMapFitter::fit ( trajectory::Point& tp )
             current_eptr->v2->update_location( tp );
 
             // pointer to new implicit edge starting where the old one left off.
-            current_eptr = std::make_shared<geo::Edge>( tp, tp, next_edge_id, false );
-            edge_set.insert( current_eptr );
+            current_eptr = memory::make_shared<geo::Edge>( tp, tp, next_edge_id, false );
+
+            if (collect_areas) {
+                edge_set.insert( current_eptr );
+            }
+
             ++next_edge_id;
             num_fit_points = 1;
             current_sector = sector;
@@ -343,6 +656,11 @@ void ImplicitMapFitter::fit ( trajectory::Trajectory& traj )
         fit( *tp );
     }
 
+    finish();
+}
+
+void ImplicitMapFitter::finish()
+{
     // I am storing pointers to all the implicit edges and those pointers are built as they sit in the set.
     // Here we are taking all those fully built implicit edges and creating the associated areas from them.
     // so we can plot in KML.
@@ -360,30 +678,34 @@ void ImplicitMapFitter::fit ( trajectory::Trajectory& traj )
 
 IntersectionCounter::IntersectionCounter() :
     current_eptr{},
-    last_vertex_ptr{},
+    last_vertex_uid{ 0 },
+    has_last_vertex{ false },
     cumulative_outdegree{ 0 }
 {}
 
 void IntersectionCounter::count_intersections( trajectory::Trajectory& traj )
 {
     for (auto& tp : traj) {
-        // each trip point is annotated with the cumulative intersection count.
-        unsigned int d = current_count( *tp );
-        tp->set_out_degree( d );
+        count_intersections( *tp );
     }
 }
 
-unsigned int IntersectionCounter::current_count( trajectory::Point& tp )
+void IntersectionCounter::count_intersections( trajectory::Point& tp )
 {
-    geo::Vertex::Ptr shared_vertex_ptr = nullptr;
+    // each trip point is annotated with the cumulative intersection count.
+    unsigned int d = current_count( tp );
+    tp.set_out_degree( d );
+}
 
+unsigned int IntersectionCounter::current_count( trajectory::Point& tp )
+{
     if ( !tp.is_explicitly_fit() ) {
         // This point is not fit to an OSM segment, keep the previous outdegree count.
         return cumulative_outdegree;
     }
 
     // This point is fit to a road and we have an edge to work with.
-    geo::EdgeCPtr tp_edge = tp.get_fit_edge();
+    const geo::EdgeCPtr& tp_edge = tp.get_fit_edge();
 
     if (current_eptr) {
         // the counter was working with an edge previously.
@@ -394,26 +716,31 @@ unsigned int IntersectionCounter::current_count( trajectory::Point& tp )
             // since we don't track direction of travel, just check all four
             // cases of vertex matches.
 
-            if (( current_eptr->v1->uid == tp_edge->v1->uid ) ||
-                    ( current_eptr->v1->uid == tp_edge->v2->uid ) ) {
-                shared_vertex_ptr = current_eptr->v1;
-            } else if (( current_eptr->v2->uid == tp_edge->v1->uid ) ||
-                    ( current_eptr->v2->uid == tp_edge->v2->uid )) {
-                shared_vertex_ptr = current_eptr->v2;
+            // the out-degree is taken from the new edge's end: it was recorded when the map was loaded, so with a
+            // tiled map it does not matter which tile each edge comes from.
+            int shared_end = -1;
+
+            if ( current_eptr->v1->uid == tp_edge->v1->uid ) {
+                shared_end = 0;
+            } else if ( current_eptr->v1->uid == tp_edge->v2->uid ) {
+                shared_end = 1;
+            } else if ( current_eptr->v2->uid == tp_edge->v1->uid ) {
+                shared_end = 0;
+            } else if ( current_eptr->v2->uid == tp_edge->v2->uid ) {
+                shared_end = 1;
             }
-            // the counter was working with an edge previously.
-
-            // that this method will ignore...
 
-            if ( shared_vertex_ptr ) {
+            if ( shared_end >= 0 ) {
                 // we have a vertex usable to update the cumulative outdegree count.
+                uint64_t shared_uid = shared_end == 0 ? tp_edge->v1->uid : tp_edge->v2->uid;
 
-                if ( !last_vertex_ptr || last_vertex_ptr->uid != shared_vertex_ptr->uid ) {
+                if ( !has_last_vertex || last_vertex_uid != shared_uid ) {
                     // Case 1: Update with this shared vertex since we did not establish a previous shared vertex.
                     // Case 2: Update with this shared vertex since it is different from the previous shared vertex.
                     // In both cases, this is a new intersection.
-                    cumulative_outdegree += shared_vertex_ptr->outdegree();
-                    last_vertex_ptr = shared_vertex_ptr;
+                    cumulative_outdegree += tp_edge->end_outdegree( shared_end );
+                    last_vertex_uid = shared_uid;
+                    has_last_vertex = true;
                 } // otherwise pathelogical case: we are seeing the last vertex AGAIN.
 
             } // otherwise case: we've been fit to a disconnected edge; bad data?
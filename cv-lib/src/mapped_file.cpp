@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "mapped_file.hpp"
+#include "compression.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CVLIB_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile( const std::string& file_path ) :
+    data_{ nullptr },
+    size_{ 0 },
+    mapped_{ false },
+    buffer_{}
+{
+    // a compressed file is decompressed into the buffer.
+    compression::InputFile input( file_path );
+
+    if (input.fail()) {
+        throw std::invalid_argument("Could not open file: " + file_path);
+    }
+
+    if (input.get_format() != compression::Format::kNone) {
+        compression::read_all( input, buffer_ );
+        data_ = buffer_.empty() ? nullptr : buffer_.data();
+        size_ = buffer_.size();
+
+        return;
+    }
+
+    input.close();
+
+#ifdef CVLIB_HAVE_MMAP
+    int fd = ::open( file_path.c_str(), O_RDONLY );
+
+    if (fd < 0) {
+        throw std::invalid_argument("Could not open file: " + file_path);
+    }
+
+    struct stat st;
+
+    if (::fstat( fd, &st ) == 0 && st.st_size > 0) {
+        void* addr = ::mmap( nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0 );
+
+        if (addr != MAP_FAILED) {
+            // trip files are read front to back once.
+            ::madvise( addr, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL );
+            data_ = static_cast<const char*>(addr);
+            size_ = static_cast<std::size_t>(st.st_size);
+            mapped_ = true;
+        }
+    }
+
+    ::close( fd );
+
+    if (mapped_) {
+        return;
+    }
+#endif
+
+    // buffered fallback.
+    std::ifstream file( file_path, std::ios::binary | std::ios::ate );
+
+    if (file.fail()) {
+        throw std::invalid_argument("Could not open file: " + file_path);
+    }
+
+    std::streamoff size = file.tellg();
+
+    if (size > 0) {
+        buffer_.resize( static_cast<std::size_t>(size) );
+        file.seekg( 0 );
+
+        if (!file.read( buffer_.data(), size )) {
+            throw std::invalid_argument("Could not read file: " + file_path);
+        }
+
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+    }
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef CVLIB_HAVE_MMAP
+    if (mapped_) {
+        ::munmap( const_cast<char*>(data_), size_ );
+    }
+#endif
+}
+
+const char* MappedFile::data() const
+{
+    return data_;
+}
+
+std::size_t MappedFile::size() const
+{
+    return size_;
+}
+
+bool MappedFile::is_mapped() const
+{
+    return mapped_;
+}
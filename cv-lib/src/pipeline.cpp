@@ -0,0 +1,67 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "pipeline.hpp"
+
+PointPipeline::PointPipeline( MapFitter& mf, ImplicitMapFitter& imf, IntersectionCounter& ic, Detector::TurnAround& tad, Detector::Stop& stop_detector ) :
+    mf( mf ),
+    imf( imf ),
+    ic( ic ),
+    tad( tad ),
+    stop_detector( stop_detector )
+{}
+
+void PointPipeline::run( trajectory::Trajectory& traj )
+{
+    for (trajectory::Iterator it = traj.begin(); it != traj.end(); ++it) {
+        trajectory::Point& tp = **it;
+
+        mf.fit( tp );
+        imf.fit( tp );
+        ic.count_intersections( tp );
+        tad.update_turn_around_state( *it );
+        stop_detector.update_stop_state( it );
+    }
+
+    imf.finish();
+    stop_detector.finish_stops();
+}
+
+void PointPipeline::run( trajectory::Trajectory& traj, unsigned n_segments )
+{
+    if (n_segments < 2) {
+        run( traj );
+        return;
+    }
+
+    // only the explicit fit of a point depends on the state the points before it leave; the other stages follow.
+    mf.fit( traj, n_segments );
+
+    for (trajectory::Iterator it = traj.begin(); it != traj.end(); ++it) {
+        trajectory::Point& tp = **it;
+
+        imf.fit( tp );
+        ic.count_intersections( tp );
+        tad.update_turn_around_state( *it );
+        stop_detector.update_stop_state( it );
+    }
+
+    imf.finish();
+    stop_detector.finish_stops();
+}
@@ -18,12 +18,96 @@
  * For issues, question, and comments, please submit a issue via GitHub.
  *******************************************************************************/
 #include "privacy.hpp"
+#include "arena.hpp"
+#include "kernels.hpp"
 
 #include <algorithm>
 #include <cmath>
 
 /******************************** PrivacyIntervalFinder ************************************************/
-PrivacyIntervalFinder::PrivacyIntervalFinder( double min_dd, double min_md, uint32_t min_out_degree, double max_dd, double max_md, uint32_t max_out_degree, double dd_rand, double md_rand, double out_degree_rand ) :
+namespace {
+    /**
+     * \brief Return the engine of the calling thread used when a finder is not given one.
+     */
+    PrivacyIntervalFinder::RandomEngine& thread_engine()
+    {
+        thread_local PrivacyIntervalFinder::RandomEngine engine{ PrivacyIntervalFinder::random_seed() };
+
+        return engine;
+    }
+
+    /**
+     * \brief Return the index of the first point after start whose edge distance from start would exceed the remaining
+     * Manhattan distance or whose direct distance from the interval start exceeds max_dd, or the index of end when
+     * no point does. The distances are computed a chunk of points at a time.
+     */
+    template <typename Iterator>
+    trajectory::Index scan_interval_end( const Iterator start, const Iterator end, const trajectory::Point& init, double md, double max_md, double max_dd )
+    {
+        static const std::size_t kChunkSize = 32;
+
+        double latrs[kChunkSize];
+        double lonrs[kChunkSize];
+        double edge_distances[kChunkSize];
+        double direct_distances[kChunkSize];
+        Iterator chunk[kChunkSize];
+
+        const trajectory::Point& tp = **start;
+        Iterator tp_it = std::next( start, 1 );
+
+        while (tp_it != end)
+        {
+            std::size_t n = 0;
+
+            for (; tp_it != end && n < kChunkSize; ++tp_it, ++n)
+            {
+                chunk[n] = tp_it;
+                latrs[n] = (*tp_it)->latr;
+                lonrs[n] = (*tp_it)->lonr;
+            }
+
+            geo::kernels::distances_from( tp.latr, tp.lonr, latrs, lonrs, n, edge_distances );
+            geo::kernels::distances_from( init.latr, init.lonr, latrs, lonrs, n, direct_distances );
+
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (md + edge_distances[i] > max_md || direct_distances[i] > max_dd) 
+                {
+                    return (*chunk[i])->get_index();
+                }
+            }
+        }
+
+        return (*end)->get_index();
+    }
+}
+
+uint64_t PrivacyIntervalFinder::random_seed()
+{
+    std::random_device device;
+
+    // random_device returns 32 bits per call.
+    return (static_cast<uint64_t>( device() ) << 32) ^ device();
+}
+
+uint64_t PrivacyIntervalFinder::trip_seed( uint64_t run_seed, const std::string& uid )
+{
+    // FNV-1a of the UID, then a splitmix64 finalizer so nearby UIDs and run seeds give unrelated seeds.
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (unsigned char c : uid) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    uint64_t z = hash + run_seed * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+PrivacyIntervalFinder::PrivacyIntervalFinder( double min_dd, double min_md, uint32_t min_out_degree, double max_dd, double max_md, uint32_t max_out_degree, double dd_rand, double md_rand, double out_degree_rand, RandomEngine* engine ) :
     min_dd{ min_dd },
     min_md{ min_md },
     min_out_degree{ min_out_degree },
@@ -33,16 +117,18 @@ PrivacyIntervalFinder::PrivacyIntervalFinder( double min_dd, double min_md, uint
     dd_rand{ (max_dd - min_dd) * dd_rand },
     md_rand{ (max_md - min_md) * md_rand },
     out_degree_rand{ (max_out_degree - min_out_degree) * out_degree_rand },
+    engine{ engine ? engine : &thread_engine() },
     curr_ciptr{ nullptr },
     init_priv_point{ nullptr },
     md{ 0.0 },
     out_degree{ 0 },
     interval_start{ 0 },
     last_pi_end{ 0 },
-    interval_list{}
+    interval_list{},
+    n_points{ 0 }
 {}
 
-bool PrivacyIntervalFinder::is_edge_change(geo::EdgeCPtr a, geo::EdgeCPtr b) const {
+bool PrivacyIntervalFinder::is_edge_change(const geo::EdgeCPtr& a, const geo::EdgeCPtr& b) const {
     if ((a->is_implicit() && !b->is_implicit()) || (!a->is_implicit() && b->is_implicit())) {
         return true;
     }
@@ -50,8 +136,108 @@ bool PrivacyIntervalFinder::is_edge_change(geo::EdgeCPtr a, geo::EdgeCPtr b) con
     return a->get_uid() != b->get_uid();
 }
 
+double PrivacyIntervalFinder::draw_unit()
+{
+    // The top 53 bits give a uniform double in [0, 1) without depending on the library's distributions.
+    return static_cast<double>( (*engine)() >> 11 ) / 9007199254740992.0;
+}
+
+void PrivacyIntervalFinder::draw_thresholds()
+{
+    rand_min_md = md_rand * draw_unit() + min_md;
+    rand_min_dd = dd_rand * draw_unit() + min_dd;
+    rand_min_out_degree = static_cast <uint32_t> (out_degree_rand * draw_unit()) + min_out_degree;
+}
+
+void PrivacyIntervalFinder::index_trajectory( trajectory::Trajectory& traj )
+{
+    traj_begin = traj.begin();
+    n_points = traj.size();
+    run_starts.clear();
+    critical_points.clear();
+
+    for (trajectory::Index i = 0; i < n_points; ++i)
+    {
+        const geo::EdgeCPtr& eptr = traj[i]->get_fit_edge();
+
+        if (i == 0)
+        {
+            run_starts.push_back( i );
+        }
+        else
+        {
+            const geo::EdgeCPtr& prev_eptr = traj[i - 1]->get_fit_edge();
+
+            // an unfit point is never reached by a search; it only has to end the run.
+            if (eptr && prev_eptr ? is_edge_change( eptr, prev_eptr ) : eptr != prev_eptr)
+            {
+                run_starts.push_back( i );
+            }
+        }
+
+        if (traj[i]->is_critical())
+        {
+            critical_points.push_back( i );
+        }
+    }
+}
+
+PrivacyIntervalFinder::Event PrivacyIntervalFinder::next_event( trajectory::Index pos, trajectory::Index& position ) const
+{
+    auto ci_it = std::lower_bound( critical_points.begin(), critical_points.end(), pos );
+    auto run_it = std::upper_bound( run_starts.begin(), run_starts.end(), pos );
+    trajectory::Index ci = ci_it == critical_points.end() ? n_points : *ci_it;
+    trajectory::Index change = run_it == run_starts.end() ? n_points : *run_it;
+
+    // a point is checked for a critical interval before its edge.
+    if (ci < n_points && ci <= change)
+    {
+        position = ci;
+
+        return Event::kCritical;
+    }
+
+    position = change;
+
+    return change < n_points ? Event::kEdgeChange : Event::kNone;
+}
+
+PrivacyIntervalFinder::Event PrivacyIntervalFinder::previous_event( trajectory::Index pos, trajectory::Index& position ) const
+{
+    auto ci_it = std::upper_bound( critical_points.begin(), critical_points.end(), pos );
+    auto run_it = std::upper_bound( run_starts.begin(), run_starts.end(), pos );
+    Event event = Event::kNone;
+
+    // the events at the highest position come first; at one point the critical interval is checked first, then the
+    // privacy interval and then the edge.
+    if (ci_it != critical_points.begin())
+    {
+        position = *std::prev( ci_it );
+        event = Event::kCritical;
+    }
+
+    if (last_pi_end <= pos && (event == Event::kNone || last_pi_end > position))
+    {
+        position = last_pi_end;
+        event = Event::kPrivacyEnd;
+    }
+
+    // the point before the run of pos is on another edge.
+    trajectory::Index run_start = *std::prev( run_it );
+
+    if (run_start > 0 && (event == Event::kNone || run_start - 1 > position))
+    {
+        position = run_start - 1;
+        event = Event::kEdgeChange;
+    }
+
+    return event;
+}
+
 const trajectory::Interval::PtrList& PrivacyIntervalFinder::find_intervals( trajectory::Trajectory& traj ) 
 {
+    index_trajectory( traj );
+
     for (curr_tp_it = traj.begin(); curr_tp_it != traj.end(); ++curr_tp_it) 
     {
         update_intervals( curr_tp_it, traj );
@@ -114,9 +300,7 @@ void PrivacyIntervalFinder::find_interval( const TrajectoryIterator start, const
 {
     trajectory::Point::Ptr tp = *start;
     init_priv_point = tp;
-    rand_min_md = (md_rand * static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) + min_md;
-    rand_min_dd = (dd_rand * static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) + min_dd;
-    rand_min_out_degree = static_cast <uint32_t> ((out_degree_rand * static_cast <float> (rand()) / static_cast <float> (RAND_MAX))) + min_out_degree;
+    draw_thresholds();
 
     // Reset the distance state, out degree state, and start index state.
     md = 0.0;
@@ -126,58 +310,59 @@ void PrivacyIntervalFinder::find_interval( const TrajectoryIterator start, const
     trajectory::Index interval_end = interval_start;
     geo::EdgeCPtr eptr = tp->get_fit_edge();
     TrajectoryIterator edge_start = start;
-    TrajectoryIterator last;
+    trajectory::Index pos = start - traj_begin;
+    trajectory::Index position;
+    Event event;
 
-    for (auto tp_it = start; tp_it != end; ++tp_it)
+    // Only the critical points and the edge changes can end the interval; jump from one to the next.
+    while ((event = next_event( pos, position )) != Event::kNone)
     {
+        TrajectoryIterator tp_it = traj_begin + position;
         tp = *tp_it;
-        last = tp_it;
 
         // Set the end of the interval to the current trip point.
         interval_end = tp->get_index();
 
-        if (tp->get_critical_interval()) 
+        if (event == Event::kCritical) 
         {
             // The trip point ran into another crtiical interval.
             // Everything up to this point is a privacy interval.
             last_pi_end = interval_end;
             curr_tp_it += (interval_end - interval_start) - 1; 
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_start, interval_end, "forward:ci" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_start, interval_end, "forward:ci" ) );
 		
           	return;
         }
 
-        geo::EdgeCPtr tp_eptr = tp->get_fit_edge();
-
-        if (is_edge_change(tp_eptr, eptr)) 
+        // The edge changed.
+        // Handle the change by looking at the current and previous edges.
+        if (handle_edge_change( edge_start, tp_it, eptr ))
         {
-            // The edge changed.
-            // Handle the change by looking at the current and previous edges.
-            if (handle_edge_change( edge_start, tp_it, eptr ))
-            {
-                return;
-            }
-        
-            // Update the local edge state.
-            edge_start = tp_it;
-            eptr = tp_eptr;
+            return;
         }
+    
+        // Update the local edge state.
+        edge_start = tp_it;
+        eptr = tp->get_fit_edge();
+        pos = position;
     }
 
     // There are no more trip points.
     // Check if the distance metric has been met on the current edge.
+    TrajectoryIterator last = std::prev( end );
+    interval_end = (*last)->get_index();
     trajectory::Index edge_end = find_interval_end( edge_start, last );
 
     if (edge_end != interval_end) 
     {
         last_pi_end = edge_end;
         curr_tp_it += (edge_end - interval_start) - 1; 
-        interval_list.push_back( std::make_shared<trajectory::Interval>( interval_start, edge_end, "forward:max_md" ) );
+        interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_start, edge_end, "forward:max_md" ) );
     }
     else 
     {
         curr_tp_it += (interval_end - interval_start) - 1; 
-        interval_list.push_back( std::make_shared<trajectory::Interval>( interval_start, interval_end, "forward:end" ) );
+        interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_start, interval_end, "forward:end" ) );
     }
 }
 
@@ -208,7 +393,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const TrajectoryIterator prev, c
             interval_end = find_interval_end( prev, curr );
             last_pi_end = interval_end;
             curr_tp_it += (interval_end - interval_start) - 1;
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_start, interval_end, "forward:max_dist" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_start, interval_end, "forward:max_dist" ) );
 
             return true;
         }
@@ -242,7 +427,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const TrajectoryIterator prev, c
             // the edge, the interval end must be the current trip point.
             last_pi_end = curr_tp->get_index();
             curr_tp_it += (last_pi_end - interval_start) - 1;
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_start, last_pi_end, "forward:min" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_start, last_pi_end, "forward:min" ) );
 
             return true;
         }
@@ -254,7 +439,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const TrajectoryIterator prev, c
             interval_end = find_interval_end( prev, curr );
             last_pi_end = interval_end;
             curr_tp_it += (last_pi_end - interval_start) - 1;
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_start, interval_end, "forward:max_dist" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_start, interval_end, "forward:max_dist" ) );
         
             return true;
         }
@@ -264,7 +449,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const TrajectoryIterator prev, c
             // Set the interval.
             last_pi_end = curr_tp->get_index();
             curr_tp_it += (last_pi_end - interval_start) - 1;
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_start, last_pi_end, "forward:max_out_degree" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_start, last_pi_end, "forward:max_out_degree" ) );
  
             return true;
         }
@@ -279,25 +464,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const TrajectoryIterator prev, c
 
 trajectory::Index PrivacyIntervalFinder::find_interval_end( const TrajectoryIterator start, const TrajectoryIterator end ) 
 {
-    double edge_distance;
-    double direct_distance;
-    trajectory::Point::Ptr curr_tp;
-
-    trajectory::Point::Ptr tp = *start;
-
-    for (auto tp_it = std::next( start, 1 ); tp_it != end; ++tp_it)
-    {
-        curr_tp = *(tp_it);
-        edge_distance = tp->distance_to( *curr_tp );
-        direct_distance = init_priv_point->distance_to( *curr_tp );
-        
-        if (md + edge_distance > max_md || direct_distance > max_dd) 
-        {
-            return curr_tp->get_index();
-        }
-    }
-    
-    return (*end)->get_index();
+    return scan_interval_end( start, end, *init_priv_point, md, max_md, max_dd );
 }
 
 /******************************Backward PI Routines****************************/
@@ -306,9 +473,7 @@ void PrivacyIntervalFinder::find_interval( const RevTrajectoryIterator start, co
 {
     trajectory::Point::Ptr tp = *start;
     init_priv_point = tp;
-    rand_min_md = (md_rand * static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) + min_md;
-    rand_min_dd = (dd_rand * static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) + min_dd;
-    rand_min_out_degree = static_cast <uint32_t> ((out_degree_rand * static_cast <float> (rand()) / static_cast <float> (RAND_MAX))) + min_out_degree;
+    draw_thresholds();
 
     // Reset the distance state, out degree state, and start index state.
     md = 0.0;
@@ -318,62 +483,64 @@ void PrivacyIntervalFinder::find_interval( const RevTrajectoryIterator start, co
     trajectory::Index interval_end = interval_start;
     geo::EdgeCPtr eptr = tp->get_fit_edge();
     RevTrajectoryIterator edge_start = start;
-    RevTrajectoryIterator last;
+    trajectory::Index pos = (start.base() - traj_begin) - 1;
+    trajectory::Index position;
+    Event event;
 
-    for (auto tp_it = start; tp_it != end; ++tp_it)
+    // Only the critical points, the previous privacy interval and the edge changes can end the interval; jump from one
+    // to the next.
+    while ((event = previous_event( pos, position )) != Event::kNone)
     {
+        RevTrajectoryIterator tp_it{ traj_begin + position + 1 };
         tp = *tp_it;
-        last = tp_it;
 
         // Set the end of the interval to the current trip point.
         interval_end = tp->get_index();
 
-        if (tp->get_critical_interval()) 
+        if (event == Event::kCritical) 
         {
             // The trip point ran into another crtiical interval.
             // Everything up to this point is a privacy interval.
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:ci" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:ci" ) );
             
             return;
         }
 
-        if (tp->get_index() == last_pi_end)
+        if (event == Event::kPrivacyEnd)
         {
             // The trip point ran into another privacy interval.
             // Everything up to this point is a privacy interval.
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:pi" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:pi" ) );
 
             return;
         }
     
-        geo::EdgeCPtr tp_eptr = tp->get_fit_edge();
-
-        if (is_edge_change(tp_eptr, eptr)) 
+        // The edge changed.
+        // Handle the change by looking at the current and previous edges.
+        if (handle_edge_change( edge_start, tp_it, eptr ))
         {
-            // The edge changed.
-            // Handle the change by looking at the current and previous edges.
-            if (handle_edge_change( edge_start, tp_it, eptr ))
-            {
-                return;
-            }
-        
-            // Update the local edge state.
-            edge_start = tp_it;
-            eptr = tp_eptr;
+            return;
         }
+    
+        // Update the local edge state.
+        edge_start = tp_it;
+        eptr = tp->get_fit_edge();
+        pos = position;
     }
 
     // There are no more trip points.
     // Check if the distance metrics have been met on the current edge.
+    RevTrajectoryIterator last = std::prev( end );
+    interval_end = (*last)->get_index();
     trajectory::Index edge_end = find_interval_end( edge_start, last );
     
     if (interval_end != edge_end)
     {
-        interval_list.push_back( std::make_shared<trajectory::Interval>( edge_end, interval_start + 1, "backward:max_md" ) );
+        interval_list.push_back( memory::make_shared<trajectory::Interval>( edge_end, interval_start + 1, "backward:max_md" ) );
     }
     else
     {
-        interval_list.push_back( std::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:end" ) );
+        interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:end" ) );
     }
 }
 
@@ -402,7 +569,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const RevTrajectoryIterator prev
             // Find the interval end within the edge and add the 
             // interval to the list.
             interval_end = find_interval_end( prev, curr );
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:max_dist" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:max_dist" ) );
 
             return true;
         }
@@ -435,7 +602,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const RevTrajectoryIterator prev
             // Because the out degree metric can only be met after traversing
             // the edge, the interval end must be the current trip point.
             interval_end = curr_tp->get_index();
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:min" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:min" ) );
 
             return true;
         }
@@ -445,7 +612,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const RevTrajectoryIterator prev
             // Find the interval within the edge and add the interval
             // to the list.
             interval_end = find_interval_end( prev, curr );
-            interval_list.push_back( std::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:max_md" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( interval_end, interval_start + 1, "backward:max_md" ) );
         
             return true;
         }
@@ -453,7 +620,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const RevTrajectoryIterator prev
         {
             // The max out degree metric was met by the traversal.
             // Set the interval.
-            interval_list.push_back( std::make_shared<trajectory::Interval>( curr_tp->get_index(), interval_start + 1, "backward:max_out_degree" ) );
+            interval_list.push_back( memory::make_shared<trajectory::Interval>( curr_tp->get_index(), interval_start + 1, "backward:max_out_degree" ) );
  
             return true;
         }
@@ -468,25 +635,7 @@ bool PrivacyIntervalFinder::handle_edge_change( const RevTrajectoryIterator prev
 
 trajectory::Index PrivacyIntervalFinder::find_interval_end( const RevTrajectoryIterator start, const RevTrajectoryIterator end )
 {
-    double edge_distance;
-    double direct_distance;
-    trajectory::Point::Ptr curr_tp;
-
-    trajectory::Point::Ptr tp = *start;
-
-    for (auto tp_it = std::next( start, 1 ); tp_it != end; ++tp_it)
-    {
-        curr_tp = *(tp_it);
-        edge_distance = tp->distance_to( *curr_tp );
-        direct_distance = init_priv_point->distance_to( *curr_tp );
-        
-        if (md + edge_distance > max_md || direct_distance > max_dd) 
-        {
-            return curr_tp->get_index();
-        }
-    }
-    
-    return (*end)->get_index();
+    return scan_interval_end( start, end, *init_priv_point, md, max_md, max_dd );
 }
 
 /***************************Privacy Interval Marker****************************/
@@ -580,7 +729,7 @@ void PrivacyIntervalMarker::merge_intervals( const std::initializer_list<traject
             // This interval starts after the saved interval.
             // Add the saved interval to the list and update the 
             // saved interval state.
-            intervals.push_back( std::make_shared<trajectory::Interval>( start, end, aux_set_ptr, n_merged ) );
+            intervals.push_back( memory::make_shared<trajectory::Interval>( start, end, aux_set_ptr, n_merged ) );
             n_merged++;
 
             start = next_start;
@@ -591,7 +740,7 @@ void PrivacyIntervalMarker::merge_intervals( const std::initializer_list<traject
     
     // The intevals were exhausted.
     // Add the removing saved interval to the list.
-    intervals.push_back( std::make_shared<trajectory::Interval>( start, end, aux_set_ptr, n_merged ) );
+    intervals.push_back( memory::make_shared<trajectory::Interval>( start, end, aux_set_ptr, n_merged ) );
 }
 
 void PrivacyIntervalMarker::set_next_interval()
@@ -613,16 +762,38 @@ void PrivacyIntervalMarker::mark_trajectory( trajectory::Trajectory& traj )
     }
 }
 
+void PrivacyIntervalMarker::mark_trajectory( trajectory::Columns& cols ) 
+{
+    for (trajectory::Index i = 0; i < cols.size(); ++i) {
+        trajectory::IntervalCPtr interval = containing_interval( cols.indexes()[i] );
+
+        if (interval) {
+            // Set the interval as private for the trip point.
+            cols.set_private( i );
+        }
+    }
+}
+
 void PrivacyIntervalMarker::mark_trip_point( trajectory::Point::Ptr& tp ) 
+{
+    trajectory::IntervalCPtr interval = containing_interval( tp->get_index() );
+
+    if (interval) {
+        // Set the interval as private for the trip point.
+        tp->set_private();
+    }
+}
+
+trajectory::IntervalCPtr PrivacyIntervalMarker::containing_interval( trajectory::Index index ) 
 {
     if (!iptr) 
     {
         // There are no more intervals.
         // Nothing can be done for this trip point.
-        return;
+        return nullptr;
     }
     
-    while (iptr->is_before( tp->get_index() ))
+    while (iptr->is_before( index ))
     {
         // The trip point is after the end of the interval.
         // Find the next interval that contains the trip point.
@@ -632,32 +803,73 @@ void PrivacyIntervalMarker::mark_trip_point( trajectory::Point::Ptr& tp )
         {
             // There are no more intervals.
             // Nothing can be done for this trip point.
-            return;
+            return nullptr;
         }
     }
         
     // The trip point is before or within the interval.
     // Check if it is within.
-    if (iptr->contains( tp->get_index() )) 
+    if (iptr->contains( index )) 
     {
         // The trip point is within the interval.
-        // Set the interval as private for the trip point.
-        tp->set_private();
-
-        return;
+        return iptr;
     }
 
     // The trip point is before the interval.
     // Check the next trip point.
+    return nullptr;
 }
 
 /****************************DeIdentifier**************************************/
 const trajectory::Trajectory& DeIdentifier::de_identify( const trajectory::Trajectory& traj )
 {
+    instrument::NullCounter point_counter;
+
+    return remove_points( traj, point_counter );
+}
+
+const trajectory::Trajectory& DeIdentifier::de_identify( const trajectory::Trajectory& traj, instrument::PointCounter& point_counter )
+{
+    return remove_points( traj, point_counter );
+}
+
+const trajectory::Columns& DeIdentifier::de_identify( const trajectory::Columns& cols )
+{
+    instrument::NullCounter point_counter;
+
+    return remove_points( cols, point_counter );
+}
+
+const trajectory::Columns& DeIdentifier::de_identify( const trajectory::Columns& cols, instrument::PointCounter& point_counter )
+{
+    return remove_points( cols, point_counter );
+}
+
+uint64_t DeIdentifier::de_identify( const trajectory::Trajectory& traj, trajectory::PointSink& sink )
+{
+    instrument::NullCounter point_counter;
+
+    return de_identify( traj, sink, point_counter );
+}
+
+template <typename Counter>
+const trajectory::Trajectory& DeIdentifier::remove_points( const trajectory::Trajectory& traj, Counter& point_counter )
+{
+    new_traj.reserve( traj.size() );
+
     for (auto& tp : traj)
     {
-        if (tp->is_critical() || tp->is_private())
+        if (tp->is_critical())
         {
+            point_counter.n_ci_points++;
+ 
+            continue;
+        }
+
+        if (tp->is_private())
+        {
+            point_counter.n_pi_points++;
+
             continue;
         }
 
@@ -667,26 +879,60 @@ const trajectory::Trajectory& DeIdentifier::de_identify( const trajectory::Traje
     return new_traj;
 }
 
-const trajectory::Trajectory& DeIdentifier::de_identify( const trajectory::Trajectory& traj, instrument::PointCounter& point_counter )
+template <typename Counter>
+const trajectory::Columns& DeIdentifier::remove_points( const trajectory::Columns& cols, Counter& point_counter )
 {
+    new_cols.reserve( cols.size() );
+
+    for (trajectory::Index i = 0; i < cols.size(); ++i)
+    {
+        if (cols.is_critical( i ))
+        {
+            point_counter.n_ci_points++;
+
+            continue;
+        }
+
+        if (cols.is_private( i ))
+        {
+            point_counter.n_pi_points++;
+
+            continue;
+        }
+
+        new_cols.push_back( cols, i );
+    }
+
+    return new_cols;
+}
+
+template <typename Counter>
+uint64_t DeIdentifier::de_identify( const trajectory::Trajectory& traj, trajectory::PointSink& sink, Counter& point_counter )
+{
+    uint64_t n_written = 0;
+
     for (auto& tp : traj)
     {
         if (tp->is_critical())
         {
-            point_counter.n_ci_points++;           
- 
+            point_counter.n_ci_points++;
+
             continue;
         }
 
         if (tp->is_private())
         {
-            point_counter.n_pi_points++;           
+            point_counter.n_pi_points++;
 
             continue;
         }
 
-        new_traj.push_back(tp);
+        sink.write_point( *tp );
+        ++n_written;
     }
 
-    return new_traj;
+    return n_written;
 }
+
+template uint64_t DeIdentifier::de_identify( const trajectory::Trajectory&, trajectory::PointSink&, instrument::PointCounter& );
+template uint64_t DeIdentifier::de_identify( const trajectory::Trajectory&, trajectory::PointSink&, instrument::NullCounter& );
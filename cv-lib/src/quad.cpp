@@ -20,8 +20,14 @@
 #include "quad.hpp"
 #include "utilities.hpp"
 
-geo::Vertex::IdToPtrMap Quad::elementmap{};
-geo::Entity::PtrList Quad::empty_element_list{};
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+
+const geo::Entity::PtrList Quad::empty_element_list{};
 
 Quad::Quad( const geo::Point& swpoint, const geo::Point& nepoint, int level, const std::string& position )
     : geo::Bounds{ swpoint, nepoint }, 
@@ -150,6 +156,80 @@ bool Quad::insert( Quad::Ptr& quadptr, geo::Entity::CPtr entity_ptr )
     return true;
 }
 
+std::size_t Quad::bulk_insert( Quad::Ptr& quadptr, const geo::Entity::PtrList& entities, unsigned n_threads )
+{
+    if (quadptr->haschildren() || !quadptr->element_list_.empty()) {
+        throw std::invalid_argument("Quad bulk insertion requires an empty quad.");
+    }
+
+    Entity::PtrList touching;
+
+    for (auto& entity_ptr : entities) {
+        if (entity_ptr->touches(quadptr->fuzzybounds_)) {
+            touching.push_back(entity_ptr);
+        }
+    }
+
+    std::size_t n_inserted = touching.size();
+    quadptr->build(std::move(touching), std::max(n_threads, 1u));
+
+    return n_inserted;
+}
+
+void Quad::build( geo::Entity::PtrList entities, unsigned n_threads )
+{
+    // Incremental insertion splits a leaf as soon as it holds more than MAX_ELEMENTS, and every entity that reaches
+    // a quad passes through it in insertion order, so a quad is split exactly when this list is too long.
+    if (entities.size() <= static_cast<std::size_t>(MAX_ELEMENTS) || !split()) {
+        element_list_ = std::move(entities);
+
+        return;
+    }
+
+    std::vector<Entity::PtrList> child_entities(children_.size());
+
+    for (auto& entity_ptr : entities) {
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            if (entity_ptr->touches(children_[i]->fuzzybounds_)) {
+                child_entities[i].push_back(entity_ptr);
+            }
+        }
+    }
+
+    entities.clear();
+    entities.shrink_to_fit();
+
+    if (n_threads < 2) {
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            children_[i]->build(std::move(child_entities[i]), 1);
+        }
+
+        return;
+    }
+
+    // The subtrees share nothing; split the thread budget among them and let each thread take the next unbuilt one.
+    unsigned n_children = static_cast<unsigned>(children_.size());
+    unsigned child_threads = std::max(1u, n_threads / n_children);
+    std::atomic<unsigned> next_child{ 0 };
+    std::vector<std::thread> threads;
+
+    auto build_children = [&]() {
+        for (unsigned i = next_child++; i < n_children; i = next_child++) {
+            children_[i]->build(std::move(child_entities[i]), child_threads);
+        }
+    };
+
+    for (unsigned i = 1; i < std::min(n_threads, n_children); ++i) {
+        threads.emplace_back(build_children);
+    }
+
+    build_children();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
 std::ostream& operator<<( std::ostream& os, const Quad& quad )
 {
     return os << "Quad: {" << quad.sw << ", " << quad.ne << "} element count: " << quad.element_list_.size() << " level: " << quad.level_ << " children: " << quad.children_.size() << " fuzzy: {" << quad.fuzzybounds_.sw << ", " << quad.fuzzybounds_.ne << ", " << quad.fuzzybounds_.height() << ", " << quad.fuzzybounds_.width() << "}";
@@ -265,3 +345,101 @@ geo::Entity::PtrList Quad::retrieve_all_entities( Quad::Ptr& quadptr )
     return ret;
 }
 
+
+FlatQuad::CPtr Quad::freeze() const
+{
+    return std::make_shared<const FlatQuad>( *this );
+}
+
+FlatQuad::FlatQuad( const Quad& quad )
+{
+    std::queue<const Quad*> quadqueue;
+    quadqueue.push( &quad );
+
+    sw_lat_.push_back( quad.sw.lat );
+    sw_lon_.push_back( quad.sw.lon );
+    ne_lat_.push_back( quad.ne.lat );
+    ne_lon_.push_back( quad.ne.lon );
+
+    // Nodes are numbered as they are queued, so a node's children get consecutive indices and nodes are dequeued in
+    // index order.
+    while (!quadqueue.empty()) {
+        const Quad* currquad = quadqueue.front();
+        quadqueue.pop();
+
+        child_begin_.push_back( static_cast<uint32_t>( sw_lat_.size() ) );
+        child_count_.push_back( static_cast<uint8_t>( currquad->children_.size() ) );
+        element_begin_.push_back( static_cast<uint32_t>( elements_.size() ) );
+
+        for (auto& child : currquad->children_) {
+            quadqueue.push( child.get() );
+            sw_lat_.push_back( child->sw.lat );
+            sw_lon_.push_back( child->sw.lon );
+            ne_lat_.push_back( child->ne.lat );
+            ne_lon_.push_back( child->ne.lon );
+        }
+
+        elements_.insert( elements_.end(), currquad->element_list_.begin(), currquad->element_list_.end() );
+
+        if (elements_.size() > std::numeric_limits<uint32_t>::max()) {
+            throw std::out_of_range("Too many quad elements to compile.");
+        }
+
+        element_end_.push_back( static_cast<uint32_t>( elements_.size() ) );
+    }
+}
+
+bool FlatQuad::contains( uint32_t node, const Point& pt ) const
+{
+    return sw_lat_[node] <= pt.lat && pt.lat <= ne_lat_[node] && sw_lon_[node] <= pt.lon && pt.lon <= ne_lon_[node];
+}
+
+FlatQuad::EntityRange FlatQuad::retrieve_elements( const Point& pt ) const
+{
+    if (!contains( 0, pt )) {
+        return EntityRange{ elements_.end(), elements_.end() };
+    }
+
+    uint32_t node = 0;
+
+    while (child_count_[node] > 0) {
+        uint32_t first = child_begin_[node];
+        uint32_t last = first + child_count_[node];
+        uint32_t next = node;
+
+        for (uint32_t child = first; child < last; ++child) {
+            if (contains( child, pt )) {
+                next = child;
+                break;                   // stop at the first child; retrieval quads are disjoint.
+            }
+        }
+
+        if (next == node) {
+            // numerical edge case; no child contains the point.
+            return EntityRange{ elements_.end(), elements_.end() };
+        }
+
+        node = next;
+    }
+
+    return EntityRange{ elements_.begin() + element_begin_[node], elements_.begin() + element_end_[node] };
+}
+
+std::size_t FlatQuad::node_count() const
+{
+    return sw_lat_.size();
+}
+
+std::size_t FlatQuad::element_count() const
+{
+    return elements_.size();
+}
+
+geo::Bounds FlatQuad::bounds() const
+{
+    if (sw_lat_.empty()) {
+        return geo::Bounds{};
+    }
+
+    return geo::Bounds{ geo::Point{ sw_lat_[0], sw_lon_[0] }, geo::Point{ ne_lat_[0], ne_lon_[0] } };
+}
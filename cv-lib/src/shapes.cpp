@@ -22,6 +22,7 @@
 #include <iomanip>
 
 #include "shapes.hpp"
+#include "compression.hpp"
 #include "osm.hpp"
 #include "utilities.hpp"
 
@@ -372,7 +373,7 @@ void CSVInputFactory::make_grid(const StrVector& line_parts) {
 
 void CSVInputFactory::make_shapes() {
     std::string line;
-    std::ifstream file(file_path_);
+    compression::InputFile file(file_path_);
 
     if (file.fail()) {
         throw std::invalid_argument("Could not open shape file: " + file_path_);
@@ -384,6 +385,11 @@ void CSVInputFactory::make_shapes() {
     }
 
     while (std::getline(file, line)) {
+        // the file is read as bytes, so drop the carriage return of a Windows line ending.
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
         try {
             StrVector parts = string_utilities::split(line, ',');
 
@@ -413,6 +419,11 @@ void CSVInputFactory::make_shapes() {
     }
 
     file.close();
+
+    // the road network is complete; the edges hold the out-degree of their ends for the intersection count.
+    for (auto& item : vertex_map_) {
+        item.second->record_outdegree( item.second->outdegree() );
+    }
 }
 
 const std::vector<geo::Circle::CPtr>& CSVInputFactory::get_circles() const {
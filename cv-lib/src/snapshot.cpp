@@ -0,0 +1,297 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "snapshot.hpp"
+
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+    // Fixed-width records; the static_asserts keep the on-disk layout stable across compilers.
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t n_vertices;
+        uint64_t n_edges;
+        uint64_t n_nodes;
+        uint64_t n_elements;
+    };
+
+    struct VertexRecord {
+        uint64_t uid;
+        double lat;
+        double lon;
+    };
+
+    struct EdgeRecord {
+        uint64_t uid;
+        uint32_t v1;
+        uint32_t v2;
+        uint32_t way_type;
+        uint32_t explicit_edge;
+    };
+
+    static_assert(sizeof(Header) == 40, "unexpected snapshot header size");
+    static_assert(sizeof(VertexRecord) == 24, "unexpected snapshot vertex record size");
+    static_assert(sizeof(EdgeRecord) == 24, "unexpected snapshot edge record size");
+
+    const char kPadding[8] = { 0 };
+
+    template <typename T>
+    void write_array( std::ostream& os, const std::vector<T>& values )
+    {
+        std::size_t n_bytes = values.size() * sizeof(T);
+        os.write( reinterpret_cast<const char*>(values.data()), n_bytes );
+
+        // keep the next section aligned.
+        os.write( kPadding, (8 - n_bytes % 8) % 8 );
+    }
+
+    template <typename T>
+    void read_array( std::istream& is, std::vector<T>& values, uint64_t n )
+    {
+        values.resize( n );
+        std::size_t n_bytes = n * sizeof(T);
+        is.read( reinterpret_cast<char*>(values.data()), n_bytes );
+        is.ignore( (8 - n_bytes % 8) % 8 );
+
+        if (!is) {
+            throw std::invalid_argument("Truncated map snapshot.");
+        }
+    }
+}
+
+namespace snapshot {
+
+    MapWriter::MapWriter( const std::vector<geo::EdgeCPtr>& edges, const FlatQuad& quad ) :
+        edges_{ edges },
+        quad_{ quad }
+    {}
+
+    void MapWriter::write( std::ostream& os ) const
+    {
+        if (edges_.size() > std::numeric_limits<uint32_t>::max()) {
+            throw std::invalid_argument("Too many edges for a map snapshot.");
+        }
+
+        std::vector<VertexRecord> vertices;
+        std::vector<uint32_t> outdegrees;
+        std::vector<EdgeRecord> edges;
+        std::unordered_map<const geo::Vertex*, uint32_t> vertex_index;
+        std::unordered_map<const geo::Entity*, uint32_t> edge_index;
+
+        edges.reserve( edges_.size() );
+
+        // vertices are shared by edges; each is written once.
+        for (auto& eptr : edges_) {
+            uint32_t v[2];
+            const geo::Vertex* vptrs[2] = { eptr->v1.get(), eptr->v2.get() };
+
+            for (int i = 0; i < 2; ++i) {
+                auto item = vertex_index.find( vptrs[i] );
+
+                if (item == vertex_index.end()) {
+                    v[i] = static_cast<uint32_t>( vertices.size() );
+                    vertex_index.emplace( vptrs[i], v[i] );
+                    vertices.push_back( VertexRecord{ vptrs[i]->uid, vptrs[i]->lat, vptrs[i]->lon } );
+                    outdegrees.push_back( eptr->end_outdegree( i ) );
+                } else {
+                    v[i] = item->second;
+                }
+            }
+
+            edge_index.emplace( static_cast<const geo::Entity*>(eptr.get()), static_cast<uint32_t>( edges.size() ) );
+            edges.push_back( EdgeRecord{ eptr->get_uid(), v[0], v[1], static_cast<uint32_t>( eptr->get_way_type_index() ), eptr->is_explicit() ? 1u : 0u } );
+        }
+
+        std::vector<uint32_t> elements;
+        elements.reserve( quad_.elements_.size() );
+
+        for (auto& entity_ptr : quad_.elements_) {
+            auto item = edge_index.find( entity_ptr.get() );
+
+            if (item == edge_index.end()) {
+                throw std::invalid_argument("Map snapshot quad contains an entity that is not a network edge.");
+            }
+
+            elements.push_back( item->second );
+        }
+
+        Header header{ MAGIC, VERSION, vertices.size(), edges.size(), quad_.node_count(), elements.size() };
+        os.write( reinterpret_cast<const char*>(&header), sizeof(header) );
+
+        write_array( os, vertices );
+        write_array( os, outdegrees );
+        write_array( os, edges );
+        write_array( os, quad_.sw_lat_ );
+        write_array( os, quad_.sw_lon_ );
+        write_array( os, quad_.ne_lat_ );
+        write_array( os, quad_.ne_lon_ );
+        write_array( os, quad_.child_begin_ );
+        write_array( os, quad_.child_count_ );
+        write_array( os, quad_.element_begin_ );
+        write_array( os, quad_.element_end_ );
+        write_array( os, elements );
+
+        if (!os) {
+            throw std::invalid_argument("Could not write map snapshot.");
+        }
+    }
+
+    void MapWriter::write( const std::string& file_path ) const
+    {
+        std::ofstream os( file_path, std::ios::binary | std::ios::trunc );
+
+        if (os.fail()) {
+            throw std::invalid_argument("Could not open map snapshot file: " + file_path);
+        }
+
+        write( os );
+        os.close();
+    }
+
+    bool MapReader::is_snapshot( const std::string& file_path )
+    {
+        std::ifstream is( file_path, std::ios::binary );
+        uint32_t magic = 0;
+
+        is.read( reinterpret_cast<char*>(&magic), sizeof(magic) );
+
+        return is && magic == MAGIC;
+    }
+
+    MapReader::MapReader( std::istream& is )
+    {
+        read( is );
+    }
+
+    MapReader::MapReader( const std::string& file_path )
+    {
+        std::ifstream is( file_path, std::ios::binary );
+
+        if (is.fail()) {
+            throw std::invalid_argument("Could not open map snapshot file: " + file_path);
+        }
+
+        read( is );
+    }
+
+    const std::vector<geo::EdgeCPtr>& MapReader::get_edges() const
+    {
+        return edges_;
+    }
+
+    const FlatQuad::CPtr& MapReader::get_quad() const
+    {
+        return quad_;
+    }
+
+    void MapReader::read( std::istream& is )
+    {
+        Header header;
+        is.read( reinterpret_cast<char*>(&header), sizeof(header) );
+
+        if (!is || header.magic != MAGIC) {
+            throw std::invalid_argument("Not a map snapshot (or wrong byte order).");
+        }
+
+        if (header.version < MIN_VERSION || header.version > VERSION) {
+            throw std::invalid_argument("Unsupported map snapshot version: " + std::to_string(header.version));
+        }
+
+        if (header.n_nodes == 0) {
+            throw std::invalid_argument("Corrupt map snapshot: no quad nodes.");
+        }
+
+        std::vector<VertexRecord> vertex_records;
+        std::vector<uint32_t> outdegrees;
+        std::vector<EdgeRecord> edge_records;
+        std::vector<uint32_t> elements;
+
+        read_array( is, vertex_records, header.n_vertices );
+
+        if (header.version >= 2) {
+            read_array( is, outdegrees, header.n_vertices );
+        }
+
+        read_array( is, edge_records, header.n_edges );
+
+        std::shared_ptr<FlatQuad> quad{ new FlatQuad() };
+
+        read_array( is, quad->sw_lat_, header.n_nodes );
+        read_array( is, quad->sw_lon_, header.n_nodes );
+        read_array( is, quad->ne_lat_, header.n_nodes );
+        read_array( is, quad->ne_lon_, header.n_nodes );
+        read_array( is, quad->child_begin_, header.n_nodes );
+        read_array( is, quad->child_count_, header.n_nodes );
+        read_array( is, quad->element_begin_, header.n_nodes );
+        read_array( is, quad->element_end_, header.n_nodes );
+        read_array( is, elements, header.n_elements );
+
+        std::vector<geo::Vertex::Ptr> vertices;
+        vertices.reserve( vertex_records.size() );
+
+        for (auto& record : vertex_records) {
+            vertices.push_back( std::make_shared<geo::Vertex>( record.lat, record.lon, record.uid ) );
+        }
+
+        edges_.clear();
+        edges_.reserve( edge_records.size() );
+
+        for (auto& record : edge_records) {
+            if (record.v1 >= vertices.size() || record.v2 >= vertices.size() || record.way_type > static_cast<uint32_t>(osm::Highway::OTHER)) {
+                throw std::invalid_argument("Corrupt map snapshot: bad edge record.");
+            }
+
+            geo::EdgePtr edge_ptr = std::make_shared<geo::Edge>( vertices[record.v1], vertices[record.v2], static_cast<osm::Highway>(record.way_type), record.uid, record.explicit_edge != 0 );
+            vertices[record.v1]->add_edge( edge_ptr );
+            vertices[record.v2]->add_edge( edge_ptr );
+            edges_.push_back( edge_ptr );
+        }
+
+        // an older snapshot only has the edges to count.
+        for (std::size_t i = 0; i < vertices.size(); ++i) {
+            vertices[i]->record_outdegree( outdegrees.empty() ? vertices[i]->outdegree() : outdegrees[i] );
+        }
+
+        // the quad structure must be consistent or retrievals could read out of bounds.
+        for (uint64_t node = 0; node < header.n_nodes; ++node) {
+            if (static_cast<uint64_t>(quad->child_begin_[node]) + quad->child_count_[node] > header.n_nodes ||
+                quad->element_begin_[node] > quad->element_end_[node] ||
+                quad->element_end_[node] > header.n_elements) {
+                throw std::invalid_argument("Corrupt map snapshot: bad quad node.");
+            }
+        }
+
+        quad->elements_.reserve( elements.size() );
+
+        for (auto index : elements) {
+            if (index >= edges_.size()) {
+                throw std::invalid_argument("Corrupt map snapshot: bad quad element.");
+            }
+
+            quad->elements_.push_back( edges_[index] );
+        }
+
+        quad_ = quad;
+    }
+}
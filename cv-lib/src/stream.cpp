@@ -0,0 +1,402 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "stream.hpp"
+#include "arena.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+
+namespace {
+    bool left_before( const trajectory::IntervalCPtr& a, const trajectory::IntervalCPtr& b )
+    {
+        return a->left() < b->left();
+    }
+}
+
+struct StreamDeIdentifier::Trip
+{
+    Trip( const Settings& settings, const MapFitterFactory& make_fitter, std::unique_ptr<trajectory::PointSink> sink ) :
+        sink{ std::move( sink ) },
+        head{},
+        corrected{ false },
+        mf{ make_fitter() },
+        imf{ settings.n_heading_groups, settings.min_edge_trip_points, false },
+        ic{},
+        tad{ settings.ta_max_q_size, settings.ta_area_width, settings.ta_max_speed, settings.ta_heading_delta, false },
+        stop{ settings.stop_max_time, settings.stop_min_distance, settings.stop_max_speed },
+        n_turn_arounds{ 0 },
+        n_stops{ 0 },
+        critical{},
+        window{},
+        route{},
+        first{ 0 },
+        next{ 0 },
+        route_end{ 0.0 },
+        last{},
+        engine{},
+        last_time{ 0 }
+    {}
+
+    std::unique_ptr<trajectory::PointSink> sink;
+    trajectory::Trajectory head;                        ///< the first points waiting for the error corrector.
+    bool corrected;                                     ///< the head has been corrected and analyzed.
+    MapFitter mf;
+    ImplicitMapFitter imf;
+    IntersectionCounter ic;
+    Detector::TurnAround tad;
+    Detector::Stop stop;
+    std::size_t n_turn_arounds;                         ///< the detector intervals already collected.
+    std::size_t n_stops;
+    trajectory::Interval::PtrList critical;             ///< the critical intervals not released yet, sorted by left end.
+    std::deque<trajectory::Point::Ptr> window;          ///< the analyzed points not released yet.
+    std::deque<double> route;                           ///< the route distance from the trip start to each window point.
+    trajectory::Index first;                            ///< the index of the first window point.
+    trajectory::Index next;                             ///< the index of the next analyzed point.
+    double route_end;                                   ///< the route distance to the last analyzed point.
+    trajectory::Point::Ptr last;                        ///< the last analyzed point.
+    PrivacyIntervalFinder::RandomEngine engine;
+    uint64_t last_time;                                 ///< the time of the last point received.
+};
+
+StreamDeIdentifier::StreamDeIdentifier( const Settings& settings, const MapFitterFactory& make_fitter, trajectory::PointSinkFactory& sink_factory, bool strip_cr ) :
+    settings_( settings ),
+    make_fitter_( make_fitter ),
+    sink_factory_( sink_factory ),
+    strip_cr_{ strip_cr },
+    ec_{ settings.ec_sample_size },
+    trips_{},
+    n_written_{ 0 },
+    n_suppressed_{ 0 }
+{
+    if (settings.max_window == 0) {
+        throw std::invalid_argument("The stream window must hold at least one point.");
+    }
+}
+
+StreamDeIdentifier::~StreamDeIdentifier()
+{}
+
+double StreamDeIdentifier::quiet_distance() const
+{
+    // a privacy interval ends before either maximum distance is traveled from its critical interval.
+    return std::max( settings_.max_manhattan_distance, settings_.max_direct_distance );
+}
+
+std::size_t StreamDeIdentifier::push( const std::string& uid, const trajectory::Point::Ptr& tp )
+{
+    auto found = trips_.find( uid );
+
+    if (found == trips_.end()) {
+        std::unique_ptr<Trip> trip_ptr{ new Trip{ settings_, make_fitter_, sink_factory_.open_trajectory( uid, strip_cr_ ) } };
+        trip_ptr->engine.seed( PrivacyIntervalFinder::trip_seed( settings_.rand_seed, uid ) );
+        trip_ptr->critical.push_back( memory::make_shared<trajectory::Interval>( 0, 1, "start_pt" ) );
+        found = trips_.emplace( uid, std::move( trip_ptr ) ).first;
+    }
+
+    Trip& trip = *found->second;
+    trip.last_time = tp->get_time();
+
+    if (trip.corrected) {
+        analyze( trip, tp );
+    } else {
+        trip.head.push_back( tp );
+
+        if (trip.head.size() < settings_.ec_sample_size) {
+            return 0;
+        }
+
+        ec_.correct_error( trip.head, uid );
+
+        for (auto& head_tp : trip.head) {
+            analyze( trip, head_tp );
+        }
+
+        trip.head.clear();
+        trip.corrected = true;
+    }
+
+    std::size_t n_released = 0;
+    trajectory::Index end = settled_end( trip );
+
+    if (end > trip.first) {
+        n_released += release( trip, end - trip.first, false );
+    }
+
+    if (trip.window.size() > settings_.max_window) {
+        std::size_t n_dropped = trip.window.size() / 2;
+        drop( trip, n_dropped );
+        n_released += n_dropped;
+    }
+
+    return n_released;
+}
+
+void StreamDeIdentifier::analyze( Trip& trip, const trajectory::Point::Ptr& tp )
+{
+    tp->set_index( trip.next++ );
+
+    // the same point-local stages as PointPipeline.
+    trip.mf.fit( *tp );
+    trip.imf.fit( *tp );
+    trip.ic.count_intersections( *tp );
+    trip.tad.update_turn_around_state( tp );
+    trip.stop.update_stop_state( tp );
+
+    if (trip.last) {
+        trip.route_end += geo::Location::distance( *trip.last, *tp );
+    }
+
+    trip.last = tp;
+    trip.window.push_back( tp );
+    trip.route.push_back( trip.route_end );
+    collect_intervals( trip );
+}
+
+void StreamDeIdentifier::collect_intervals( Trip& trip )
+{
+    const trajectory::Interval::PtrList& turn_arounds = trip.tad.get_turn_arounds();
+    const trajectory::Interval::PtrList& stops = trip.stop.get_stops();
+
+    if (turn_arounds.size() == trip.n_turn_arounds && stops.size() == trip.n_stops) {
+        return;
+    }
+
+    trip.critical.insert( trip.critical.end(), turn_arounds.begin() + trip.n_turn_arounds, turn_arounds.end() );
+    trip.critical.insert( trip.critical.end(), stops.begin() + trip.n_stops, stops.end() );
+    trip.n_turn_arounds = turn_arounds.size();
+    trip.n_stops = stops.size();
+
+    std::stable_sort( trip.critical.begin(), trip.critical.end(), left_before );
+}
+
+trajectory::Index StreamDeIdentifier::cut_before( const Trip& trip, trajectory::Index index ) const
+{
+    // the window points at least the quiet distance along the route before index.
+    index = std::max( index, trip.first );
+    double route = index < trip.next ? trip.route[index - trip.first] : trip.route_end;
+    auto end = trip.route.begin() + (index - trip.first);
+
+    return trip.first + (std::upper_bound( trip.route.begin(), end, route - quiet_distance() ) - trip.route.begin());
+}
+
+trajectory::Index StreamDeIdentifier::settled_end( const Trip& trip ) const
+{
+    // no critical interval found later can start before open.
+    trajectory::Index open = std::min( trip.tad.open_index( trip.next ), trip.stop.open_index( trip.next ) );
+    trajectory::Index end = cut_before( trip, open );
+    double quiet = quiet_distance();
+    bool settled = false;
+
+    while (end > trip.first && !settled) {
+        settled = true;
+        double end_route = trip.route[end - 1 - trip.first];
+
+        for (auto& iptr : trip.critical) {
+            trajectory::Index left = std::max( iptr->left(), trip.first );
+            bool far;
+
+            if (left >= end) {
+                // its backward privacy interval must not reach the segment.
+                far = left >= trip.next || trip.route[left - trip.first] - end_route >= quiet;
+            } else {
+                // it is released with the segment; its forward privacy interval must end within the segment.
+                far = iptr->right() < end && end_route - trip.route[iptr->right() - trip.first] >= quiet;
+            }
+
+            if (!far) {
+                end = cut_before( trip, left );
+                settled = false;
+                break;
+            }
+        }
+    }
+
+    return end;
+}
+
+void StreamDeIdentifier::drop( Trip& trip, std::size_t n )
+{
+    trip.window.erase( trip.window.begin(), trip.window.begin() + n );
+    trip.route.erase( trip.route.begin(), trip.route.begin() + n );
+    trip.first += n;
+    n_suppressed_ += n;
+
+    trajectory::Index first = trip.first;
+
+    trip.critical.erase( std::remove_if( trip.critical.begin(), trip.critical.end(), [first]( const trajectory::IntervalCPtr& iptr ) {
+        return iptr->right() <= first;
+    }), trip.critical.end() );
+
+    // the points after the gap are protected like the start of the trip.
+    trip.critical.push_back( memory::make_shared<trajectory::Interval>( first, first + 1, "stream_gap" ) );
+    std::stable_sort( trip.critical.begin(), trip.critical.end(), left_before );
+}
+
+std::size_t StreamDeIdentifier::release( Trip& trip, std::size_t n, bool trip_end )
+{
+    trajectory::Index end = trip.first + n;
+    trajectory::Trajectory segment{ trip.window.begin(), trip.window.begin() + n };
+    trajectory::Interval::PtrList critical;
+    auto it = trip.critical.begin();
+
+    // the segment is de-identified as a trajectory of its own.
+    for (; it != trip.critical.end() && (*it)->left() < end; ++it) {
+        trajectory::Index left = std::max( (*it)->left(), trip.first ) - trip.first;
+        trajectory::Index right = std::min( (*it)->right(), end ) - trip.first;
+        critical.push_back( memory::make_shared<trajectory::Interval>( left, right, (*it)->get_aux_str() ) );
+    }
+
+    trip.critical.erase( trip.critical.begin(), it );
+
+    if (trip_end) {
+        critical.push_back( memory::make_shared<trajectory::Interval>( n - 1, n, "end_pt" ) );
+    }
+
+    for (trajectory::Index i = 0; i < n; ++i) {
+        segment[i]->set_index( i );
+    }
+
+    IntervalMarker im( { critical } );
+    im.mark_trajectory( segment );
+
+    PrivacyIntervalFinder pif( settings_.min_direct_distance,
+                               settings_.min_manhattan_distance,
+                               settings_.min_out_degree,
+                               settings_.max_direct_distance,
+                               settings_.max_manhattan_distance,
+                               settings_.max_out_degree,
+                               settings_.rand_direct_distance,
+                               settings_.rand_manhattan_distance,
+                               settings_.rand_out_degree,
+                               &trip.engine );
+
+    PrivacyIntervalMarker pim( { pif.find_intervals( segment ) } );
+    pim.mark_trajectory( segment );
+
+    DeIdentifier di;
+    uint64_t n_kept = di.de_identify( segment, *trip.sink );
+    n_written_ += n_kept;
+    n_suppressed_ += n - n_kept;
+
+    trip.window.erase( trip.window.begin(), trip.window.begin() + n );
+    trip.route.erase( trip.route.begin(), trip.route.begin() + n );
+    trip.first = end;
+
+    return n;
+}
+
+std::size_t StreamDeIdentifier::end_trip( const std::string& uid, Trip& trip )
+{
+    if (!trip.corrected) {
+        ec_.correct_error( trip.head, uid );
+
+        for (auto& head_tp : trip.head) {
+            analyze( trip, head_tp );
+        }
+
+        trip.head.clear();
+        trip.corrected = true;
+    }
+
+    // a partial stop is ignored as in the batch detector; the trip end covers it.
+    trip.stop.finish_stops();
+    collect_intervals( trip );
+
+    std::size_t n_released = trip.window.size();
+
+    if (n_released > 0) {
+        release( trip, n_released, true );
+    }
+
+    trip.sink->close();
+
+    return n_released;
+}
+
+std::size_t StreamDeIdentifier::flush( const std::string& uid )
+{
+    auto found = trips_.find( uid );
+
+    if (found == trips_.end()) {
+        return 0;
+    }
+
+    std::size_t n_released = end_trip( uid, *found->second );
+    trips_.erase( found );
+
+    return n_released;
+}
+
+std::size_t StreamDeIdentifier::flush_idle( uint64_t time, uint64_t idle_time )
+{
+    std::size_t n_ended = 0;
+
+    for (auto it = trips_.begin(); it != trips_.end(); ) {
+        if (time > it->second->last_time && time - it->second->last_time > idle_time) {
+            end_trip( it->first, *it->second );
+            it = trips_.erase( it );
+            ++n_ended;
+        } else {
+            ++it;
+        }
+    }
+
+    return n_ended;
+}
+
+std::size_t StreamDeIdentifier::flush_all()
+{
+    std::size_t n_ended = trips_.size();
+
+    for (auto& entry : trips_) {
+        end_trip( entry.first, *entry.second );
+    }
+
+    trips_.clear();
+
+    return n_ended;
+}
+
+std::size_t StreamDeIdentifier::n_trips() const
+{
+    return trips_.size();
+}
+
+std::size_t StreamDeIdentifier::held_points() const
+{
+    std::size_t n_held = 0;
+
+    for (auto& entry : trips_) {
+        n_held += entry.second->head.size() + entry.second->window.size();
+    }
+
+    return n_held;
+}
+
+uint64_t StreamDeIdentifier::written_points() const
+{
+    return n_written_;
+}
+
+uint64_t StreamDeIdentifier::suppressed_points() const
+{
+    return n_suppressed_;
+}
@@ -0,0 +1,439 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "tiles.hpp"
+#include "arena.hpp"
+#include "snapshot.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace tiles {
+
+    // Tile
+
+    Tile::Tile( const geo::Bounds& bounds, const std::string& file_path, std::size_t n_indexed, double fit_width_scaling, double fit_extension ) :
+        bounds_{ bounds },
+        size_{ 0 }
+    {
+        snapshot::MapReader reader( file_path );
+        edges_ = reader.get_edges();
+        quad_ = reader.get_quad();
+
+        if (n_indexed > edges_.size()) {
+            throw std::invalid_argument("Corrupt map tile: more indexed edges than edges: " + file_path);
+        }
+
+        for (std::size_t i = 0; i < n_indexed; ++i) {
+            vertices_.emplace( edges_[i]->v1->uid, edges_[i]->v1 );
+            vertices_.emplace( edges_[i]->v2->uid, edges_[i]->v2 );
+        }
+
+        area_cache_ = std::make_shared<const EdgeAreaCache>( edges_, fit_width_scaling, fit_extension );
+
+        std::ifstream is( file_path, std::ios::binary | std::ios::ate );
+        size_ = static_cast<std::size_t>( is.tellg() );
+    }
+
+    Tile::~Tile()
+    {
+        for (auto& eptr : edges_) {
+            eptr->v1->clear_edges();
+            eptr->v2->clear_edges();
+        }
+    }
+
+    const geo::Bounds& Tile::bounds() const
+    {
+        return bounds_;
+    }
+
+    const FlatQuad::CPtr& Tile::quad() const
+    {
+        return quad_;
+    }
+
+    const EdgeAreaCache::CPtr& Tile::area_cache() const
+    {
+        return area_cache_;
+    }
+
+    const std::vector<geo::EdgeCPtr>& Tile::edges() const
+    {
+        return edges_;
+    }
+
+    geo::Vertex::Ptr Tile::find_vertex( uint64_t uid ) const
+    {
+        auto it = vertices_.find( uid );
+
+        return it == vertices_.end() ? nullptr : it->second;
+    }
+
+    std::size_t Tile::size() const
+    {
+        return size_;
+    }
+
+    // write_tiles
+
+    namespace {
+        /**
+         * Return the grid cell holding a coordinate, clamped to [0, n).
+         */
+        std::size_t cell( double value, double origin, double tile_degrees, std::size_t n )
+        {
+            double index = std::floor( (value - origin) / tile_degrees );
+
+            if (index < 0.0) {
+                return 0;
+            }
+
+            return std::min( static_cast<std::size_t>( index ), n - 1 );
+        }
+
+        std::string tile_file_name( std::size_t row, std::size_t col )
+        {
+            return "tile_" + std::to_string( row ) + "_" + std::to_string( col ) + ".snap";
+        }
+    }
+
+    std::size_t write_tiles( const std::vector<geo::EdgeCPtr>& edges, const geo::Point& sw, const geo::Point& ne, double tile_degrees, double halo_degrees, const std::string& dir_path )
+    {
+        if (!(tile_degrees > 0.0) || !(ne.lat > sw.lat) || !(ne.lon > sw.lon)) {
+            throw std::invalid_argument("Map tiles need a positive tile size and region.");
+        }
+
+        std::size_t n_rows = static_cast<std::size_t>( std::ceil( (ne.lat - sw.lat) / tile_degrees ) );
+        std::size_t n_cols = static_cast<std::size_t>( std::ceil( (ne.lon - sw.lon) / tile_degrees ) );
+        double halo = std::max( halo_degrees, tile_degrees / Quad::REDUCTION_FACTOR );
+
+        // the edges that touch each tile with its halo, in input order.
+        std::vector<std::vector<geo::EdgeCPtr>> tile_edges( n_rows * n_cols );
+
+        for (auto& eptr : edges) {
+            double min_lat = std::min( eptr->v1->lat, eptr->v2->lat ) - halo;
+            double max_lat = std::max( eptr->v1->lat, eptr->v2->lat ) + halo;
+            double min_lon = std::min( eptr->v1->lon, eptr->v2->lon ) - halo;
+            double max_lon = std::max( eptr->v1->lon, eptr->v2->lon ) + halo;
+
+            if (max_lat < sw.lat || min_lat > ne.lat || max_lon < sw.lon || min_lon > ne.lon) {
+                continue;
+            }
+
+            std::size_t row_end = cell( max_lat, sw.lat, tile_degrees, n_rows );
+            std::size_t col_end = cell( max_lon, sw.lon, tile_degrees, n_cols );
+
+            for (std::size_t row = cell( min_lat, sw.lat, tile_degrees, n_rows ); row <= row_end; ++row) {
+                for (std::size_t col = cell( min_lon, sw.lon, tile_degrees, n_cols ); col <= col_end; ++col) {
+                    geo::Point tile_sw{ sw.lat + row * tile_degrees - halo, sw.lon + col * tile_degrees - halo };
+                    geo::Point tile_ne{ sw.lat + (row + 1) * tile_degrees + halo, sw.lon + (col + 1) * tile_degrees + halo };
+
+                    if (geo::Bounds{ tile_sw, tile_ne }.contains_or_intersects( *eptr )) {
+                        tile_edges[row * n_cols + col].push_back( eptr );
+                    }
+                }
+            }
+        }
+
+        std::string manifest_path = dir_path + "/" + kManifestName;
+        std::ofstream manifest( manifest_path, std::ios::trunc );
+
+        if (manifest.fail()) {
+            throw std::invalid_argument("Could not open map tile manifest: " + manifest_path);
+        }
+
+        manifest << std::setprecision( std::numeric_limits<double>::max_digits10 );
+        manifest << kManifestVersion << '\n';
+        manifest << "sw:" << sw.lat << ',' << sw.lon << '\n';
+        manifest << "ne:" << ne.lat << ',' << ne.lon << '\n';
+        manifest << "tile_degrees:" << tile_degrees << '\n';
+        manifest << "rows:" << n_rows << '\n';
+        manifest << "cols:" << n_cols << '\n';
+
+        std::size_t n_tiles = 0;
+
+        for (std::size_t index = 0; index < tile_edges.size(); ++index) {
+            std::vector<geo::EdgeCPtr>& indexed = tile_edges[index];
+
+            if (indexed.empty()) {
+                continue;
+            }
+
+            std::size_t row = index / n_cols;
+            std::size_t col = index % n_cols;
+
+            // the neighbors complete the incident edges of the indexed edges' vertices; sorted to keep tiles stable.
+            std::unordered_set<uint64_t> in_tile;
+            std::vector<geo::EdgeCPtr> neighbors;
+
+            for (auto& eptr : indexed) {
+                in_tile.insert( eptr->get_uid() );
+            }
+
+            for (auto& eptr : indexed) {
+                for (const geo::Vertex* vptr : { eptr->v1.get(), eptr->v2.get() }) {
+                    for (auto& incident : vptr->get_incident_edges()) {
+                        if (in_tile.insert( incident->get_uid() ).second) {
+                            neighbors.push_back( incident );
+                        }
+                    }
+                }
+            }
+
+            std::sort( neighbors.begin(), neighbors.end(), []( const geo::EdgeCPtr& a, const geo::EdgeCPtr& b ) {
+                return a->get_uid() < b->get_uid();
+            });
+
+            geo::Point tile_sw{ sw.lat + row * tile_degrees, sw.lon + col * tile_degrees };
+            geo::Point tile_ne{ sw.lat + (row + 1) * tile_degrees, sw.lon + (col + 1) * tile_degrees };
+            Quad::Ptr quad_ptr = std::make_shared<Quad>( tile_sw, tile_ne );
+            Quad::bulk_insert( quad_ptr, geo::Entity::PtrList{ indexed.begin(), indexed.end() } );
+
+            std::size_t n_indexed = indexed.size();
+            indexed.insert( indexed.end(), neighbors.begin(), neighbors.end() );
+
+            std::string file_name = tile_file_name( row, col );
+            snapshot::MapWriter( indexed, *quad_ptr->freeze() ).write( dir_path + "/" + file_name );
+            manifest << "tile:" << row << ',' << col << ',' << file_name << ',' << n_indexed << '\n';
+
+            // release the tile's edge list as soon as it is written.
+            std::vector<geo::EdgeCPtr>().swap( indexed );
+            ++n_tiles;
+        }
+
+        manifest.close();
+
+        if (manifest.fail()) {
+            throw std::invalid_argument("Could not write map tile manifest: " + manifest_path);
+        }
+
+        return n_tiles;
+    }
+
+    // TiledMap
+
+    namespace {
+        /**
+         * Read a "key:value" line and return the value split at the commas.
+         */
+        StrVector read_values( std::istream& is, const std::string& key )
+        {
+            std::string line;
+
+            if (!std::getline( is, line ) || line.compare( 0, key.size() + 1, key + ":" ) != 0) {
+                throw std::invalid_argument("Corrupt map tile manifest: expected " + key);
+            }
+
+            return string_utilities::split( line.substr( key.size() + 1 ), ',' );
+        }
+    }
+
+    bool TiledMap::is_tiled( const std::string& path )
+    {
+        std::ifstream is( path + "/" + kManifestName );
+        std::string line;
+
+        return std::getline( is, line ) && line == kManifestVersion;
+    }
+
+    TiledMap::TiledMap( const std::string& dir_path, std::size_t memory_budget, double fit_width_scaling, double fit_extension ) :
+        dir_path_{ dir_path },
+        memory_budget_{ memory_budget },
+        fit_width_scaling_{ fit_width_scaling },
+        fit_extension_{ fit_extension },
+        resident_size_{ 0 },
+        n_loads_{ 0 }
+    {
+        std::string manifest_path = dir_path + "/" + kManifestName;
+        std::ifstream is( manifest_path );
+        std::string line;
+
+        if (is.fail()) {
+            throw std::invalid_argument("Could not open map tile manifest: " + manifest_path);
+        }
+
+        if (!std::getline( is, line ) || line != kManifestVersion) {
+            throw std::invalid_argument("Not a map tile manifest: " + manifest_path);
+        }
+
+        try {
+            StrVector values = read_values( is, "sw" );
+            sw_.lat = std::stod( values.at( 0 ) );
+            sw_.lon = std::stod( values.at( 1 ) );
+            read_values( is, "ne" );
+            tile_degrees_ = std::stod( read_values( is, "tile_degrees" ).at( 0 ) );
+            n_rows_ = std::stoul( read_values( is, "rows" ).at( 0 ) );
+            n_cols_ = std::stoul( read_values( is, "cols" ).at( 0 ) );
+
+            if (!(tile_degrees_ > 0.0)) {
+                throw std::invalid_argument("Corrupt map tile manifest: bad tile size.");
+            }
+
+            entries_.resize( n_rows_ * n_cols_, Entry{ "", 0 } );
+
+            while (std::getline( is, line )) {
+                if (line.empty()) {
+                    continue;
+                }
+
+                if (line.compare( 0, 5, "tile:" ) != 0) {
+                    throw std::invalid_argument("Corrupt map tile manifest: " + line);
+                }
+
+                values = string_utilities::split( line.substr( 5 ), ',' );
+                std::size_t row = std::stoul( values.at( 0 ) );
+                std::size_t col = std::stoul( values.at( 1 ) );
+
+                if (row >= n_rows_ || col >= n_cols_ || values.at( 2 ).empty()) {
+                    throw std::invalid_argument("Corrupt map tile manifest: " + line);
+                }
+
+                entries_[row * n_cols_ + col] = Entry{ values.at( 2 ), std::stoul( values.at( 3 ) ) };
+            }
+        } catch (std::invalid_argument&) {
+            throw;
+        } catch (std::exception&) {
+            throw std::invalid_argument("Corrupt map tile manifest: " + manifest_path);
+        }
+    }
+
+    geo::Bounds TiledMap::tile_bounds( std::size_t row, std::size_t col ) const
+    {
+        return geo::Bounds{ geo::Point{ sw_.lat + row * tile_degrees_, sw_.lon + col * tile_degrees_ }, geo::Point{ sw_.lat + (row + 1) * tile_degrees_, sw_.lon + (col + 1) * tile_degrees_ } };
+    }
+
+    geo::Bounds TiledMap::bounds() const
+    {
+        return geo::Bounds{ sw_, geo::Point{ sw_.lat + n_rows_ * tile_degrees_, sw_.lon + n_cols_ * tile_degrees_ } };
+    }
+
+    Tile::CPtr TiledMap::tile( const geo::Point& pt ) const
+    {
+        double row_offset = std::floor( (pt.lat - sw_.lat) / tile_degrees_ );
+        double col_offset = std::floor( (pt.lon - sw_.lon) / tile_degrees_ );
+
+        if (!(row_offset >= 0.0 && row_offset < n_rows_ && col_offset >= 0.0 && col_offset < n_cols_)) {
+            return nullptr;
+        }
+
+        std::size_t row = static_cast<std::size_t>( row_offset );
+        std::size_t col = static_cast<std::size_t>( col_offset );
+        std::size_t index = row * n_cols_ + col;
+        const Entry& entry = entries_[index];
+
+        if (entry.file_name.empty()) {
+            return nullptr;
+        }
+
+        std::promise<Tile::CPtr> promise;
+        TileFuture future;
+
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            auto it = resident_.find( index );
+
+            if (it != resident_.end()) {
+                lru_.splice( lru_.begin(), lru_, it->second.lru_it );
+
+                // another thread may still be loading it.
+                future = it->second.tile;
+            } else {
+                lru_.push_front( index );
+                resident_.emplace( index, Resident{ promise.get_future().share(), lru_.begin(), 0 } );
+                ++n_loads_;
+            }
+        }
+
+        if (future.valid()) {
+            return future.get();
+        }
+
+        // this thread loads the tile; the others asking for it wait on the future.
+        Tile::CPtr tile_ptr;
+
+        try {
+            // the tile is cached and shared by all threads, so its areas must not come from this thread's arena.
+            memory::Arena::Scope heap_scope( nullptr );
+            tile_ptr = std::make_shared<const Tile>( tile_bounds( row, col ), dir_path_ + "/" + entry.file_name, entry.n_indexed, fit_width_scaling_, fit_extension_ );
+        } catch (std::exception&) {
+            {
+                std::lock_guard<std::mutex> lock( mutex_ );
+                auto it = resident_.find( index );
+
+                if (it != resident_.end() && it->second.size == 0) {
+                    lru_.erase( it->second.lru_it );
+                    resident_.erase( it );
+                }
+            }
+
+            promise.set_exception( std::current_exception() );
+            throw;
+        }
+
+        promise.set_value( tile_ptr );
+        admit( index, tile_ptr->size() );
+
+        return tile_ptr;
+    }
+
+    void TiledMap::admit( std::size_t index, std::size_t size ) const
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        auto it = resident_.find( index );
+
+        if (it != resident_.end() && it->second.size == 0) {
+            it->second.size = size;
+            resident_size_ += size;
+        }
+
+        // evicted tiles stay alive for the fitters still using them.
+        while (resident_size_ > memory_budget_ && lru_.size() > 1 && lru_.back() != index) {
+            auto victim = resident_.find( lru_.back() );
+            resident_size_ -= victim->second.size;
+            resident_.erase( victim );
+            lru_.pop_back();
+        }
+    }
+
+    bool TiledMap::matches( double fit_width_scaling, double fit_extension ) const
+    {
+        return fit_width_scaling_ == fit_width_scaling && fit_extension_ == fit_extension;
+    }
+
+    uint64_t TiledMap::load_count() const
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+
+        return n_loads_;
+    }
+
+    std::size_t TiledMap::resident_size() const
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+
+        return resident_size_;
+    }
+}
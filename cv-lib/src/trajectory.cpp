@@ -28,18 +28,38 @@
 
 namespace trajectory {
 
+    namespace {
+        /**
+         * Copy a record into a shared buffer.
+         */
+        std::shared_ptr<const char> copy_record( const std::string& data )
+        {
+            if (data.empty()) {
+                return nullptr;
+            }
+
+            std::shared_ptr<const std::string> copy = std::make_shared<const std::string>( data );
+
+            return std::shared_ptr<const char>( copy, copy->data() );
+        }
+    }
+
     Point::Point( const std::string& data, uint64_t time, double lat, double lon, double heading, double speed, uint64_t index ) :
+        Point::Point{ copy_record( data ), data.size(), time, lat, lon, heading, speed, index }
+    {}
+
+    Point::Point( const std::shared_ptr<const char>& data_ref, std::size_t data_size, uint64_t time, double lat, double lon, double heading, double speed, uint64_t index ) :
         geo::Location{ lat, lon, index }, 
-        data{ data },
-        heading{ heading },
-        speed{ speed },
+        data_ref{ data_ref },
         time{ time },
-        index{ index },
+        heading{ static_cast<float>(heading) },
+        speed{ static_cast<float>(speed) },
+        index{ static_cast<uint32_t>(index) },
+        data_size{ static_cast<uint32_t>(data_size) },
         fitedge{nullptr},
         critical_interval{ nullptr },
-        _private{ false },
-        is_hmm_map_match_{ false },
-        outdegree{ 0 }
+        outdegree{ 0 },
+        _private{ 0 }
     {}
 
     Point::Point() :
@@ -47,9 +67,24 @@ namespace trajectory {
     {
     }
 
-    const std::string& Point::get_data() const
+    std::string Point::get_data() const
     {
-        return data;
+        if (data_ref) {
+            return std::string( data_ref.get(), data_size );
+        }
+
+        return std::string{};
+    }
+
+    string_utilities::CharSpan Point::get_data_span() const
+    {
+        static const char kNoData[] = "";
+
+        if (data_ref) {
+            return string_utilities::CharSpan{ data_ref.get(), data_ref.get() + data_size };
+        }
+
+        return string_utilities::CharSpan{ kNoData, kNoData };
     }
 
     double Point::get_speed() const
@@ -128,17 +163,17 @@ namespace trajectory {
         return fitedge != nullptr;
     }
 
-    geo::EdgeCPtr Point::get_fit_edge()
+    const geo::EdgeCPtr& Point::get_fit_edge() const
     {
         return fitedge;
     }
 
-    IntervalCPtr Point::get_critical_interval() const 
+    const IntervalCPtr& Point::get_critical_interval() const 
     {
         return critical_interval;
     }
 
-    void Point::set_critical_interval( IntervalCPtr iptr ) 
+    void Point::set_critical_interval( const IntervalCPtr& iptr ) 
     {
         critical_interval = iptr;
     }
@@ -155,7 +190,7 @@ namespace trajectory {
 
     void Point::set_private() 
     {
-        _private = true;
+        _private = 1;
     }
 
     void Point::set_index(uint64_t i) {
@@ -164,7 +199,7 @@ namespace trajectory {
 
     bool Point::is_private() const
     {
-        return _private;
+        return _private != 0;
     }
 
     bool Point::is_critical() const
@@ -288,4 +323,24 @@ namespace trajectory {
 
         return os << "id = " << interval._id << " [" << interval._left << ", " << interval._right << " ) types: { " << aux_types << " }";
     }
+
+    StreamPointSink::StreamPointSink( std::ostream& os, bool strip_cr ) :
+        os_( os ),
+        strip_cr_( strip_cr )
+    {}
+
+    void StreamPointSink::write_point( const Point& tp )
+    {
+        write_record( tp.get_data_span() );
+    }
+
+    void StreamPointSink::write_record( string_utilities::CharSpan record )
+    {
+        if (strip_cr_ && record.size() > 0 && *(record.last - 1) == '\r') {
+            --record.last;
+        }
+
+        os_.write( record.first, record.size() );
+        os_ << '\n';
+    }
 }
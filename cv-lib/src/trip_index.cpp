@@ -0,0 +1,446 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "trip_index.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace trip_index {
+
+    // TripRange
+
+    TripRange::TripRange() :
+        TripRange("", 0, 0)
+        {}
+
+    TripRange::TripRange(const std::string& uid, uint64_t begin, uint64_t end) :
+        uid(uid),
+        begin(begin),
+        end(end),
+        n_records(0),
+        min_lat(std::numeric_limits<double>::infinity()),
+        min_lon(std::numeric_limits<double>::infinity()),
+        max_lat(-std::numeric_limits<double>::infinity()),
+        max_lon(-std::numeric_limits<double>::infinity())
+        {}
+
+    void TripRange::include(double lat, double lon) {
+        min_lat = std::min(min_lat, lat);
+        min_lon = std::min(min_lon, lon);
+        max_lat = std::max(max_lat, lat);
+        max_lon = std::max(max_lon, lon);
+    }
+
+    bool TripRange::has_bounds() const {
+        return min_lat <= max_lat;
+    }
+
+    // UIDExtractor
+
+    namespace {
+        /**
+         * Split a header line into its field names; a trailing carriage return belongs to the last field name.
+         */
+        StrVector header_fields(const std::string& header, char delimiter) {
+            StrVector parts = string_utilities::split(header, delimiter);
+
+            if (!parts.empty() && !parts.back().empty() && parts.back().back() == '\r') {
+                parts.back().pop_back();
+            }
+
+            return parts;
+        }
+
+        /**
+         * Remove a trailing carriage return from a record.
+         */
+        string_utilities::CharSpan strip_cr(const string_utilities::CharSpan& record) {
+            if (record.last != record.first && *(record.last - 1) == '\r') {
+                return string_utilities::CharSpan{ record.first, record.last - 1 };
+            }
+
+            return record;
+        }
+    }
+
+    UIDExtractor::UIDExtractor(const std::string& header, const std::string& uid_fields, char delimiter) :
+        n_fields_(0),
+        delimiter_(delimiter)
+    {
+        StrVector uid_parts = string_utilities::split(uid_fields, delimiter);
+        StrVector parts = header_fields(header, delimiter);
+        std::size_t part_index = 0;
+
+        for (auto& field : uid_parts) {
+            // search the remaining parts.
+            while (part_index < parts.size() && parts[part_index] != field) {
+                ++part_index;
+            }
+
+            if (part_index == parts.size()) {
+                throw std::invalid_argument("Could not find header field: " + field);
+            }
+
+            indices_.push_back(part_index);
+            n_fields_ = part_index + 1;
+        }
+    }
+
+    std::string UIDExtractor::uid(const string_utilities::CharSpan& record) const {
+        std::vector<string_utilities::CharSpan> fields(n_fields_);
+        string_utilities::CharSpan line = strip_cr(record);
+        std::size_t n_found = string_utilities::split(line.first, line.last, delimiter_, fields.data(), n_fields_);
+        std::string ret;
+
+        for (std::size_t i = 0; i < indices_.size(); ++i) {
+            if (i > 0) {
+                ret += '_';
+            }
+
+            if (indices_[i] < n_found) {
+                ret.append(fields[indices_[i]].first, fields[indices_[i]].last);
+            }
+        }
+
+        return ret;
+    }
+
+    // LocationExtractor
+
+    LocationExtractor::LocationExtractor(const std::string& header, const std::string& lat_field, const std::string& lon_field, char delimiter) :
+        delimiter_(delimiter)
+    {
+        StrVector parts = header_fields(header, delimiter);
+        StrVector::iterator lat_it = std::find(parts.begin(), parts.end(), lat_field);
+        StrVector::iterator lon_it = std::find(parts.begin(), parts.end(), lon_field);
+
+        if (lat_it == parts.end()) {
+            throw std::invalid_argument("Could not find header field: " + lat_field);
+        }
+
+        if (lon_it == parts.end()) {
+            throw std::invalid_argument("Could not find header field: " + lon_field);
+        }
+
+        lat_index_ = static_cast<std::size_t>(lat_it - parts.begin());
+        lon_index_ = static_cast<std::size_t>(lon_it - parts.begin());
+    }
+
+    bool LocationExtractor::location(const string_utilities::CharSpan& record, double& lat, double& lon) const {
+        std::size_t n_fields = std::max(lat_index_, lon_index_) + 1;
+        std::vector<string_utilities::CharSpan> fields(n_fields);
+        string_utilities::CharSpan line = strip_cr(record);
+
+        if (string_utilities::split(line.first, line.last, delimiter_, fields.data(), n_fields) < n_fields) {
+            return false;
+        }
+
+        try {
+            lat = string_utilities::to_double(fields[lat_index_]);
+            lon = string_utilities::to_double(fields[lon_index_]);
+        } catch (std::exception&) {
+            return false;
+        }
+
+        return true;
+    }
+
+    // index_trips
+
+    namespace {
+        /**
+         * Scan the lines that start in [first, last); data + end bounds the last line.
+         */
+        void scan_chunk(const char* data, std::size_t first, std::size_t last, std::size_t end, const UIDExtractor& extractor, const LocationExtractor* locator, TripRangeList& trips) {
+            std::size_t pos = first;
+            double lat;
+            double lon;
+
+            while (pos < last) {
+                const char* eol = std::find(data + pos, data + end, '\n');
+                std::size_t next = eol == data + end ? end : static_cast<std::size_t>(eol - data) + 1;
+                string_utilities::CharSpan line{ data + pos, eol };
+
+                if (line.size() == 0 || (line.size() == 1 && *line.first == '\r')) {
+                    if (!trips.empty()) {
+                        trips.back().end = next;
+                    }
+
+                    pos = next;
+                    continue;
+                }
+
+                std::string uid = extractor.uid(line);
+
+                if (!trips.empty() && trips.back().uid == uid) {
+                    trips.back().end = next;
+                } else {
+                    trips.push_back(TripRange{ uid, pos, next });
+                }
+
+                ++trips.back().n_records;
+
+                if (locator && locator->location(line, lat, lon)) {
+                    trips.back().include(lat, lon);
+                }
+
+                pos = next;
+            }
+        }
+
+        /**
+         * Move a chunk boundary to the start of the next line.
+         */
+        std::size_t line_start(const char* data, std::size_t pos, std::size_t begin, std::size_t size) {
+            if (pos <= begin) {
+                return begin;
+            }
+
+            if (data[pos - 1] == '\n') {
+                return pos;
+            }
+
+            const char* eol = std::find(data + pos, data + size, '\n');
+
+            return eol == data + size ? size : static_cast<std::size_t>(eol - data) + 1;
+        }
+
+        TripRangeList index_chunks(const char* data, std::size_t size, std::size_t begin, const UIDExtractor& extractor, const LocationExtractor* locator, unsigned n_threads, std::size_t min_chunk_size) {
+            if (begin >= size) {
+                return TripRangeList{};
+            }
+
+            std::size_t n_bytes = size - begin;
+            std::size_t n_chunks = std::max<std::size_t>(1, std::min<std::size_t>(n_threads, n_bytes / std::max<std::size_t>(min_chunk_size, 1)));
+            std::vector<std::size_t> bounds(n_chunks + 1);
+
+            for (std::size_t i = 0; i <= n_chunks; ++i) {
+                bounds[i] = line_start(data, begin + n_bytes / n_chunks * i, begin, size);
+            }
+
+            bounds[n_chunks] = size;
+
+            std::vector<TripRangeList> chunk_trips(n_chunks);
+            std::vector<std::thread> threads;
+
+            for (std::size_t i = 1; i < n_chunks; ++i) {
+                threads.emplace_back(scan_chunk, data, bounds[i], bounds[i + 1], size, std::cref(extractor), locator, std::ref(chunk_trips[i]));
+            }
+
+            scan_chunk(data, bounds[0], bounds[1], size, extractor, locator, chunk_trips[0]);
+
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            // join the runs that continue across the chunk edges.
+            TripRangeList trips = std::move(chunk_trips[0]);
+
+            for (std::size_t i = 1; i < n_chunks; ++i) {
+                // the empty lines that start a chunk belong to the trip before it.
+                if (!trips.empty()) {
+                    trips.back().end = chunk_trips[i].empty() ? bounds[i + 1] : chunk_trips[i].front().begin;
+                }
+
+                for (auto& trip : chunk_trips[i]) {
+                    if (!trips.empty() && trips.back().uid == trip.uid) {
+                        TripRange& prev = trips.back();
+                        prev.end = trip.end;
+                        prev.n_records += trip.n_records;
+
+                        if (trip.has_bounds()) {
+                            prev.include(trip.min_lat, trip.min_lon);
+                            prev.include(trip.max_lat, trip.max_lon);
+                        }
+                    } else {
+                        trips.push_back(std::move(trip));
+                    }
+                }
+            }
+
+            return trips;
+        }
+    }
+
+    TripRangeList index_trips(const char* data, std::size_t size, std::size_t begin, const UIDExtractor& extractor, unsigned n_threads, std::size_t min_chunk_size) {
+        return index_chunks(data, size, begin, extractor, nullptr, n_threads, min_chunk_size);
+    }
+
+    TripRangeList index_trips(const char* data, std::size_t size, std::size_t begin, const UIDExtractor& extractor, const LocationExtractor& locator, unsigned n_threads, std::size_t min_chunk_size) {
+        return index_chunks(data, size, begin, extractor, &locator, n_threads, min_chunk_size);
+    }
+
+    // index files
+
+    namespace {
+        const std::string kIndexVersion = "# cvdi trip index 1";
+        const std::string kIndexHeader = "uid,begin,end,records,min_lat,min_lon,max_lat,max_lon";
+
+        /**
+         * Get the size and modification time (seconds) of a file.
+         */
+        bool source_stamp(const std::string& source_path, uint64_t& size, int64_t& mtime) {
+            struct stat st;
+
+            if (::stat(source_path.c_str(), &st) != 0) {
+                return false;
+            }
+
+            size = static_cast<uint64_t>(st.st_size);
+            mtime = static_cast<int64_t>(st.st_mtime);
+
+            return true;
+        }
+
+        /**
+         * Read a "key:value" line and return the value.
+         */
+        bool read_value(std::istream& is, const std::string& key, std::string& value) {
+            std::string line;
+
+            if (!std::getline(is, line) || line.compare(0, key.size() + 1, key + ":") != 0) {
+                return false;
+            }
+
+            value = line.substr(key.size() + 1);
+
+            return true;
+        }
+    }
+
+    std::string index_path(const std::string& source_path) {
+        return source_path + kIndexSuffix;
+    }
+
+    bool read_index(const std::string& source_path, const std::string& uid_fields, TripRangeList& trips) {
+        uint64_t size;
+        int64_t mtime;
+        std::ifstream is(index_path(source_path));
+        std::string line;
+        std::string value;
+
+        if (is.fail() || !source_stamp(source_path, size, mtime)) {
+            return false;
+        }
+
+        if (!std::getline(is, line) || line != kIndexVersion) {
+            return false;
+        }
+
+        try {
+            if (!read_value(is, "source_size", value) || std::stoull(value) != size) {
+                return false;
+            }
+
+            if (!read_value(is, "source_mtime", value) || std::stoll(value) != mtime) {
+                return false;
+            }
+
+            if (!read_value(is, "uid_fields", value) || value != uid_fields) {
+                return false;
+            }
+
+            if (!std::getline(is, line) || line != kIndexHeader) {
+                return false;
+            }
+
+            TripRangeList saved;
+
+            while (std::getline(is, line)) {
+                StrVector fields = string_utilities::split(line, ',');
+
+                if (fields.size() != 8) {
+                    return false;
+                }
+
+                TripRange trip{ fields[0], std::stoull(fields[1]), std::stoull(fields[2]) };
+                trip.n_records = std::stoull(fields[3]);
+                trip.min_lat = std::stod(fields[4]);
+                trip.min_lon = std::stod(fields[5]);
+                trip.max_lat = std::stod(fields[6]);
+                trip.max_lon = std::stod(fields[7]);
+
+                if (trip.begin > trip.end || trip.end > size) {
+                    return false;
+                }
+
+                saved.push_back(std::move(trip));
+            }
+
+            trips = std::move(saved);
+        } catch (std::exception&) {
+            return false;
+        }
+
+        return true;
+    }
+
+    void write_index(const std::string& source_path, const std::string& uid_fields, const TripRangeList& trips) {
+        uint64_t size;
+        int64_t mtime;
+
+        if (!source_stamp(source_path, size, mtime)) {
+            throw std::invalid_argument("Could not examine indexed file: " + source_path);
+        }
+
+        std::string path = index_path(source_path);
+        std::string tmp_path = path + ".tmp";
+        std::ofstream os(tmp_path, std::ofstream::trunc);
+
+        if (os.fail()) {
+            throw std::invalid_argument("Could not open trip index file: " + tmp_path);
+        }
+
+        os << std::setprecision(std::numeric_limits<double>::max_digits10);
+        os << kIndexVersion << '\n';
+        os << "source_size:" << size << '\n';
+        os << "source_mtime:" << mtime << '\n';
+        os << "uid_fields:" << uid_fields << '\n';
+        os << kIndexHeader << '\n';
+
+        for (auto& trip : trips) {
+            os << trip.uid << ',' << trip.begin << ',' << trip.end << ',' << trip.n_records << ',';
+            os << trip.min_lat << ',' << trip.min_lon << ',' << trip.max_lat << ',' << trip.max_lon << '\n';
+        }
+
+        os.close();
+
+        if (os.fail()) {
+            std::remove(tmp_path.c_str());
+            throw std::invalid_argument("Could not write trip index file: " + tmp_path);
+        }
+
+        // rename does not replace an existing file everywhere.
+        std::remove(path.c_str());
+
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+            throw std::invalid_argument("Could not write trip index file: " + path);
+        }
+    }
+}
@@ -19,7 +19,11 @@
  *******************************************************************************/
 #include "utilities.hpp"
 
+#include <cerrno>
 #include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
 
 const std::string string_utilities::DELIMITERS = " \f\n\r\t\v";
 
@@ -58,6 +62,150 @@ StrPair string_utilities::split_attribute( const std::string& s, char delim) {
     return r;
 }
 
+std::size_t string_utilities::split(const char* first, const char* last, char delim, CharSpan* fields, std::size_t max_fields)
+{
+    std::size_t n = 0;
+    const char* start = first;
+
+    for (const char* c = first; c != last; ++c) {
+        if (*c == delim) {
+            if (n < max_fields) {
+                fields[n] = CharSpan{ start, c };
+            }
+
+            ++n;
+            start = c + 1;
+        }
+    }
+
+    // like getline, a trailing delimiter does not start another field.
+    if (start != last) {
+        if (n < max_fields) {
+            fields[n] = CharSpan{ start, last };
+        }
+
+        ++n;
+    }
+
+    return n;
+}
+
+namespace {
+
+    inline bool is_space(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    inline bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // Powers of ten that are exactly representable as doubles.
+    const double kExactPowersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const uint64_t kMaxExactMantissa = uint64_t(1) << 53;
+}
+
+double string_utilities::to_double(const CharSpan& span)
+{
+    const char* c = span.first;
+
+    while (c != span.last && is_space(*c)) ++c;
+
+    bool negative = false;
+
+    if (c != span.last && (*c == '-' || *c == '+')) {
+        negative = *c == '-';
+        ++c;
+    }
+
+    uint64_t mantissa = 0;
+    int n_digits = 0;
+    int n_fraction_digits = 0;
+    bool exact = true;
+
+    for (; c != span.last && is_digit(*c); ++c, ++n_digits) {
+        mantissa = mantissa * 10 + (*c - '0');
+        exact = exact && mantissa <= kMaxExactMantissa;
+    }
+
+    if (c != span.last && *c == '.') {
+        for (++c; c != span.last && is_digit(*c); ++c, ++n_digits, ++n_fraction_digits) {
+            mantissa = mantissa * 10 + (*c - '0');
+            exact = exact && mantissa <= kMaxExactMantissa;
+        }
+    }
+
+    // Both the mantissa and the power of ten are exact doubles so the single division is correctly rounded, i.e.,
+    // the same value strtod produces. Exponents, hex, inf/nan, trailing characters, and long numbers use strtod.
+    if (exact && c == span.last && n_digits > 0 && n_fraction_digits <= 22) {
+        double value = static_cast<double>(mantissa) / kExactPowersOfTen[n_fraction_digits];
+        return negative ? -value : value;
+    }
+
+    std::string s = span.str();
+    char* end = nullptr;
+    errno = 0;
+    double value = std::strtod(s.c_str(), &end);
+
+    if (end == s.c_str()) {
+        throw std::invalid_argument("to_double: no conversion: " + s);
+    }
+
+    if (errno == ERANGE) {
+        throw std::out_of_range("to_double: value out of range: " + s);
+    }
+
+    return value;
+}
+
+uint64_t string_utilities::to_uint64(const CharSpan& span)
+{
+    const char* c = span.first;
+
+    while (c != span.last && is_space(*c)) ++c;
+
+    uint64_t value = 0;
+    const char* digits = c;
+    bool exact = true;
+
+    for (; c != span.last && is_digit(*c); ++c) {
+        uint64_t digit = static_cast<uint64_t>(*c - '0');
+
+        if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+            exact = false;
+            break;
+        }
+
+        value = value * 10 + digit;
+    }
+
+    if (exact && c == span.last && c != digits) {
+        return value;
+    }
+
+    // signs, overflow, and trailing characters get the strtoull treatment.
+    std::string s = span.str();
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long result = std::strtoull(s.c_str(), &end, 10);
+
+    if (end == s.c_str()) {
+        throw std::invalid_argument("to_uint64: no conversion: " + s);
+    }
+
+    if (errno == ERANGE) {
+        throw std::out_of_range("to_uint64: value out of range: " + s);
+    }
+
+    return static_cast<uint64_t>(result);
+}
+
 bool double_utilities::are_equal(double a, double b, double epsilon) {
     return std::fabs(a - b) < epsilon;
 }